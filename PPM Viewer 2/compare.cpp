@@ -0,0 +1,517 @@
+#include "compare.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+// Row bands compared in parallel hold at least this many samples, so small images
+// don't pay for threads they can't keep busy
+constexpr size_t kCompareBandSamples = 1 << 18;
+// SSIM windows are 8x8 with a stride of 4: each is assembled from 2x2 blocks of 4x4
+constexpr int kSsimBlock = 4;
+// SSIM stabilizers for samples scaled to [0, 1]: (0.01 L)^2 and (0.03 L)^2
+constexpr double kSsimC1 = 0.0001;
+constexpr double kSsimC2 = 0.0009;
+
+// Error sums over a band of rows (sample units)
+struct ErrorSums {
+    double absSum = 0;
+    double sqSum = 0;
+    double maxError = 0;
+    uint64_t differing = 0;
+};
+
+// SSIM sums over a band of windows (all channels)
+struct SsimSums {
+    double sum = 0;
+    uint64_t windows = 0;
+};
+
+// 1. ERROR KERNELS
+// Helper: |a - b|, sum, sum of squares and max of one row of 8-bit samples. The
+// squares are summed in 32-bit lanes and moved to 64 bits before they could wrap.
+static void ErrorRow8(const uint8_t* a, const uint8_t* b, size_t n, ErrorSums& s) {
+    uint64_t absSum = 0, sqSum = 0;
+    uint32_t maxError = 0;
+    size_t i = 0;
+#ifdef PPM_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sad = zero, sq = zero, mx = zero;
+    auto flush = [&] {
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sq);
+        sqSum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        sq = zero;
+    };
+    // Each lane gains at most 4 * 255^2 per step
+    size_t steps = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        mx = _mm_max_epu8(mx, d);
+        sad = _mm_add_epi64(sad, _mm_sad_epu8(d, zero));
+        const __m128i lo = _mm_unpacklo_epi8(d, zero);
+        const __m128i hi = _mm_unpackhi_epi8(d, zero);
+        sq = _mm_add_epi32(sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+        if (++steps == 4096) {
+            flush();
+            steps = 0;
+        }
+    }
+    flush();
+    alignas(16) uint64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), sad);
+    absSum = sums[0] + sums[1];
+    alignas(16) uint8_t maxes[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxes), mx);
+    maxError = *std::max_element(maxes, maxes + 16);
+#endif
+    for (; i < n; ++i) {
+        const uint32_t d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        absSum += d;
+        sqSum += d * d;
+        maxError = std::max(maxError, d);
+    }
+    s.absSum += static_cast<double>(absSum);
+    s.sqSum += static_cast<double>(sqSum);
+    s.maxError = std::max(s.maxError, static_cast<double>(maxError));
+}
+
+// Helper: same for 16-bit samples. SSE2 has no unsigned 16-bit max, so the
+// differences are biased into signed range for it; squares are widened to 64 bits.
+static void ErrorRow16(const uint16_t* a, const uint16_t* b, size_t n, ErrorSums& s) {
+    uint64_t absSum = 0, sqSum = 0;
+    uint32_t maxError = 0;
+    size_t i = 0;
+#ifdef PPM_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    __m128i sum = zero, sq = zero, mx = bias;
+    auto flush = [&] {
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sum);
+        absSum += static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        sum = zero;
+    };
+    // Each lane of `sum` gains at most 2 * 65535 per step
+    size_t steps = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        const __m128i d = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+        mx = _mm_max_epi16(mx, _mm_xor_si128(d, bias));
+        sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_unpacklo_epi16(d, zero), _mm_unpackhi_epi16(d, zero)));
+        // d * d as 32-bit products, then 64-bit lanes
+        const __m128i lo = _mm_mullo_epi16(d, d);
+        const __m128i hi = _mm_mulhi_epu16(d, d);
+        const __m128i p0 = _mm_unpacklo_epi16(lo, hi);
+        const __m128i p1 = _mm_unpackhi_epi16(lo, hi);
+        sq = _mm_add_epi64(sq, _mm_add_epi64(_mm_add_epi64(_mm_unpacklo_epi32(p0, zero), _mm_unpackhi_epi32(p0, zero)),
+                                             _mm_add_epi64(_mm_unpacklo_epi32(p1, zero), _mm_unpackhi_epi32(p1, zero))));
+        if (++steps == 16384) {
+            flush();
+            steps = 0;
+        }
+    }
+    flush();
+    alignas(16) uint64_t sums[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(sums), sq);
+    sqSum = sums[0] + sums[1];
+    alignas(16) uint16_t maxes[8];
+    _mm_store_si128(reinterpret_cast<__m128i*>(maxes), _mm_xor_si128(mx, bias));
+    maxError = *std::max_element(maxes, maxes + 8);
+#endif
+    for (; i < n; ++i) {
+        const uint32_t d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        absSum += d;
+        sqSum += static_cast<uint64_t>(d) * d;
+        maxError = std::max(maxError, d);
+    }
+    s.absSum += static_cast<double>(absSum);
+    s.sqSum += static_cast<double>(sqSum);
+    s.maxError = std::max(s.maxError, static_cast<double>(maxError));
+}
+
+// Helper: |a - b| of one float sample. A NaN on either side is an infinite error,
+// unless both samples are the same bits.
+static float FloatError(float a, float b) {
+    if (std::memcmp(&a, &b, sizeof(float)) == 0) return 0.0f;
+    const float d = std::fabs(a - b);
+    return d == d ? d : std::numeric_limits<float>::infinity();
+}
+
+// Helper: same for float samples; a row is summed in float, then added in double
+static void ErrorRowF(const float* a, const float* b, size_t n, ErrorSums& s) {
+    float absSum = 0, sqSum = 0, maxError = 0;
+    size_t i = 0;
+#ifdef PPM_SSE2
+    const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 sum = _mm_setzero_ps(), sq = _mm_setzero_ps(), mx = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 va = _mm_loadu_ps(a + i);
+        const __m128 vb = _mm_loadu_ps(b + i);
+        __m128 d = _mm_and_ps(_mm_sub_ps(va, vb), magnitude);
+        const __m128 nan = _mm_cmpunord_ps(d, d);
+        d = _mm_or_ps(_mm_andnot_ps(nan, d), _mm_and_ps(nan, inf));
+        const __m128i same = _mm_cmpeq_epi32(_mm_castps_si128(va), _mm_castps_si128(vb));
+        d = _mm_andnot_ps(_mm_castsi128_ps(same), d);
+        mx = _mm_max_ps(mx, d);
+        sum = _mm_add_ps(sum, d);
+        sq = _mm_add_ps(sq, _mm_mul_ps(d, d));
+    }
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, sum);
+    absSum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_store_ps(lanes, sq);
+    sqSum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_store_ps(lanes, mx);
+    maxError = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < n; ++i) {
+        const float d = FloatError(a[i], b[i]);
+        absSum += d;
+        sqSum += d * d;
+        maxError = std::max(maxError, d);
+    }
+    s.absSum += absSum;
+    s.sqSum += sqSum;
+    s.maxError = std::max(s.maxError, static_cast<double>(maxError));
+}
+
+// Helper: error sums of rows [y0, y1), flagging the rows that differ in rowDiffers.
+// Pixels are only told apart in those, which in a regression run are few.
+static void ErrorBand(const Image& a, const Image& b, int y0, int y1, ErrorSums& s, std::vector<uint8_t>& rowDiffers) {
+    const size_t pixelBytes = static_cast<size_t>(a.channels) * a.BytesPerSample();
+    const size_t rowSamples = static_cast<size_t>(a.width) * a.channels;
+    const size_t rowBytes = a.width * pixelBytes;
+    for (int y = y0; y < y1; ++y) {
+        const size_t first = static_cast<size_t>(y) * rowSamples;
+        ErrorSums row;
+        if (a.isFloat) ErrorRowF(a.SamplesF() + first, b.SamplesF() + first, rowSamples, row);
+        else if (a.BytesPerSample() == 2) ErrorRow16(a.Samples16() + first, b.Samples16() + first, rowSamples, row);
+        else ErrorRow8(a.Data() + first, b.Data() + first, rowSamples, row);
+        s.absSum += row.absSum;
+        s.sqSum += row.sqSum;
+        s.maxError = std::max(s.maxError, row.maxError);
+        if (row.maxError == 0) continue;
+        rowDiffers[y] = 1;
+        const uint8_t* pa = a.Data() + y * rowBytes;
+        const uint8_t* pb = b.Data() + y * rowBytes;
+        for (int x = 0; x < a.width; ++x, pa += pixelBytes, pb += pixelBytes) {
+            if (std::memcmp(pa, pb, pixelBytes) != 0) ++s.differing;
+        }
+    }
+}
+
+// 2. SSIM
+// Sums of one 4x4 block (one channel), samples scaled to [0, 1]
+struct BlockSums {
+    float a = 0, b = 0, aa = 0, bb = 0, ab = 0;
+};
+
+// Per-sample column sums over the rows of a block row, and the blocks made of them
+struct BlockRowScratch {
+    std::vector<float> rowA, rowB;
+    std::vector<float> a, b, aa, bb, ab;
+    explicit BlockRowScratch(size_t rowSamples)
+        : rowA(rowSamples), rowB(rowSamples), a(rowSamples), b(rowSamples), aa(rowSamples), bb(rowSamples), ab(rowSamples) {}
+};
+
+// Helper: row y of img scaled to [0, 1] (float samples as they are)
+static void ScaledRow(const Image& img, int y, float* out) {
+    const size_t n = static_cast<size_t>(img.width) * img.channels;
+    const size_t first = static_cast<size_t>(y) * n;
+    if (img.isFloat) {
+        std::memcpy(out, img.SamplesF() + first, n * sizeof(float));
+        return;
+    }
+    const float scale = 1.0f / img.maxVal;
+    if (img.BytesPerSample() == 2) {
+        const uint16_t* in = img.Samples16() + first;
+        for (size_t i = 0; i < n; ++i) out[i] = in[i] * scale;
+    } else {
+        const uint8_t* in = img.Data() + first;
+        size_t i = 0;
+#ifdef PPM_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 vscale = _mm_set1_ps(scale);
+        for (; i + 16 <= n; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+            const __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), vscale));
+            _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), vscale));
+            _mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), vscale));
+            _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), vscale));
+        }
+#endif
+        for (; i < n; ++i) out[i] = in[i] * scale;
+    }
+}
+
+// Helper: add a scaled row of each image to the per-sample sums
+static void AccumulateRow(const float* ra, const float* rb, BlockRowScratch& t) {
+    const size_t n = t.rowA.size();
+    float* sa = t.a.data();
+    float* sb = t.b.data();
+    float* saa = t.aa.data();
+    float* sbb = t.bb.data();
+    float* sab = t.ab.data();
+    size_t i = 0;
+#ifdef PPM_SSE2
+    for (; i + 4 <= n; i += 4) {
+        const __m128 va = _mm_loadu_ps(ra + i), vb = _mm_loadu_ps(rb + i);
+        _mm_storeu_ps(sa + i, _mm_add_ps(_mm_loadu_ps(sa + i), va));
+        _mm_storeu_ps(sb + i, _mm_add_ps(_mm_loadu_ps(sb + i), vb));
+        _mm_storeu_ps(saa + i, _mm_add_ps(_mm_loadu_ps(saa + i), _mm_mul_ps(va, va)));
+        _mm_storeu_ps(sbb + i, _mm_add_ps(_mm_loadu_ps(sbb + i), _mm_mul_ps(vb, vb)));
+        _mm_storeu_ps(sab + i, _mm_add_ps(_mm_loadu_ps(sab + i), _mm_mul_ps(va, vb)));
+    }
+#endif
+    for (; i < n; ++i) {
+        sa[i] += ra[i];
+        sb[i] += rb[i];
+        saa[i] += ra[i] * ra[i];
+        sbb[i] += rb[i] * rb[i];
+        sab[i] += ra[i] * rb[i];
+    }
+}
+
+// Helper: SSIM of one window from its sums over n samples
+static double SsimWindow(double a, double b, double aa, double bb, double ab, double n) {
+    const double ma = a / n, mb = b / n;
+    const double va = aa / n - ma * ma, vb = bb / n - mb * mb, cov = ab / n - ma * mb;
+    return ((2 * ma * mb + kSsimC1) * (2 * cov + kSsimC2)) / ((ma * ma + mb * mb + kSsimC1) * (va + vb + kSsimC2));
+}
+
+// Helper: 4x4 block sums of block row `by` (blocks x channels). The rows are summed
+// per sample first, then folded into blocks.
+static void BlockRow(const Image& a, const Image& b, int by, BlockRowScratch& t, std::vector<BlockSums>& blocks) {
+    std::fill(t.a.begin(), t.a.end(), 0.0f);
+    std::fill(t.b.begin(), t.b.end(), 0.0f);
+    std::fill(t.aa.begin(), t.aa.end(), 0.0f);
+    std::fill(t.bb.begin(), t.bb.end(), 0.0f);
+    std::fill(t.ab.begin(), t.ab.end(), 0.0f);
+    for (int y = by * kSsimBlock; y < (by + 1) * kSsimBlock; ++y) {
+        ScaledRow(a, y, t.rowA.data());
+        ScaledRow(b, y, t.rowB.data());
+        AccumulateRow(t.rowA.data(), t.rowB.data(), t);
+    }
+    const int ch = a.channels;
+    const size_t blockCount = static_cast<size_t>(a.width / kSsimBlock) * ch;
+    for (size_t i = 0; i < blockCount; ++i) {
+        // Block i is channel i % ch of pixels 4 * (i / ch) .. + 3
+        const size_t first = (i / ch) * kSsimBlock * ch + i % ch;
+        BlockSums s;
+        for (int k = 0; k < kSsimBlock; ++k) {
+            const size_t j = first + static_cast<size_t>(k) * ch;
+            s.a += t.a[j];
+            s.b += t.b[j];
+            s.aa += t.aa[j];
+            s.bb += t.bb[j];
+            s.ab += t.ab[j];
+        }
+        blocks[i] = s;
+    }
+}
+
+// Helper: SSIM sums of the windows whose top block row is in [by0, by1). A window
+// over rows that are identical in a and b is exactly 1 and isn't computed.
+static void SsimBand(const Image& a, const Image& b, const std::vector<uint8_t>& rowDiffers, int by0, int by1, SsimSums& s) {
+    const int ch = a.channels;
+    const int blocksX = a.width / kSsimBlock;
+    const int blocksY = a.height / kSsimBlock;
+    const uint64_t perRow = static_cast<uint64_t>(blocksX - 1) * ch;
+    BlockRowScratch scratch(static_cast<size_t>(a.width) * ch);
+    std::vector<BlockSums> above(static_cast<size_t>(blocksX) * ch), below(above.size());
+    int aboveRow = -1; // block row held in `above`
+    for (int by = by0; by < by1 && by + 1 < blocksY; ++by) {
+        const auto rows = rowDiffers.begin() + by * kSsimBlock;
+        s.windows += perRow;
+        if (std::find(rows, rows + 2 * kSsimBlock, 1) == rows + 2 * kSsimBlock) {
+            s.sum += static_cast<double>(perRow);
+            continue;
+        }
+        if (aboveRow != by) BlockRow(a, b, by, scratch, above);
+        BlockRow(a, b, by + 1, scratch, below);
+        for (int bx = 0; bx + 1 < blocksX; ++bx) {
+            for (int c = 0; c < ch; ++c) {
+                const size_t i = static_cast<size_t>(bx) * ch + c, j = i + ch;
+                const BlockSums &p = above[i], &q = above[j], &r = below[i], &u = below[j];
+                s.sum += SsimWindow(double(p.a) + q.a + r.a + u.a, double(p.b) + q.b + r.b + u.b,
+                                    double(p.aa) + q.aa + r.aa + u.aa, double(p.bb) + q.bb + r.bb + u.bb,
+                                    double(p.ab) + q.ab + r.ab + u.ab, 4.0 * kSsimBlock * kSsimBlock);
+            }
+        }
+        std::swap(above, below);
+        aboveRow = by + 1;
+    }
+}
+
+// Helper: images too small for one 8x8 window are a single window per channel
+static double SsimWhole(const Image& a, const Image& b) {
+    const int ch = a.channels;
+    const size_t rowSamples = static_cast<size_t>(a.width) * ch;
+    std::vector<float> rowA(rowSamples), rowB(rowSamples);
+    std::vector<double> sums(static_cast<size_t>(ch) * 5);
+    for (int y = 0; y < a.height; ++y) {
+        ScaledRow(a, y, rowA.data());
+        ScaledRow(b, y, rowB.data());
+        for (size_t i = 0; i < rowSamples; ++i) {
+            double* s = &sums[(i % ch) * 5];
+            s[0] += rowA[i];
+            s[1] += rowB[i];
+            s[2] += double(rowA[i]) * rowA[i];
+            s[3] += double(rowB[i]) * rowB[i];
+            s[4] += double(rowA[i]) * rowB[i];
+        }
+    }
+    double total = 0;
+    for (int c = 0; c < ch; ++c) {
+        const double* s = &sums[static_cast<size_t>(c) * 5];
+        total += SsimWindow(s[0], s[1], s[2], s[3], s[4], static_cast<double>(a.width) * a.height);
+    }
+    return total / ch;
+}
+
+// 3. PUBLIC API
+// Helper: img's rows in kSsimBlock units, and how many of those make a band worth a
+// thread (kCompareBandSamples)
+static int BlockRows(const Image& img) {
+    return (img.height + kSsimBlock - 1) / kSsimBlock;
+}
+
+static int MinBandBlocks(const Image& img) {
+    const size_t blockSamples = static_cast<size_t>(img.width) * img.channels * kSsimBlock;
+    return static_cast<int>((kCompareBandSamples + blockSamples - 1) / blockSamples);
+}
+
+// Helper: number of bands ForEachBand cuts img's rows into
+static int BandCount(const Image& img, unsigned threads) {
+    return ParallelBandCount(BlockRows(img), threads, MinBandBlocks(img));
+}
+
+// Helper: run fn(band, y0, y1) over BandCount() bands of img's rows, each a multiple
+// of kSsimBlock rows (the last takes the rest); the first runs on this thread
+static void ForEachBand(const Image& img, unsigned threads, const std::function<void(int, int, int)>& fn) {
+    ParallelBands(BlockRows(img), threads, MinBandBlocks(img), [&](int band, int b0, int b1) {
+        fn(band, b0 * kSsimBlock, std::min(img.height, b1 * kSsimBlock));
+    });
+}
+
+// Helper: a and b have the same size and sample layout (prints otherwise)
+static bool Comparable(const Image& a, const Image& b) {
+    if (!a.HasSamples() || !b.HasSamples()) {
+        std::cerr << "Error: Nothing to compare." << std::endl;
+        return false;
+    }
+    if (a.width != b.width || a.height != b.height || a.channels != b.channels) {
+        std::cerr << "Error: Images differ in size: " << a.width << "x" << a.height << "x" << a.channels << " vs "
+                  << b.width << "x" << b.height << "x" << b.channels << std::endl;
+        return false;
+    }
+    if (a.isFloat != b.isFloat || (!a.isFloat && a.maxVal != b.maxVal)) {
+        std::cerr << "Error: Images differ in sample format (maxval " << (a.isFloat ? 0 : a.maxVal) << " vs "
+                  << (b.isFloat ? 0 : b.maxVal) << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CompareImages(const Image& a, const Image& b, CompareStats& stats, const CompareOptions& options) {
+    stats = CompareStats{};
+    if (!Comparable(a, b)) return false;
+
+    // 1. Errors, noting which rows differ
+    const int bands = BandCount(a, options.threads);
+    std::vector<ErrorSums> errors(bands);
+    std::vector<uint8_t> rowDiffers(a.height);
+    ForEachBand(a, options.threads, [&](int band, int y0, int y1) { ErrorBand(a, b, y0, y1, errors[band], rowDiffers); });
+    ErrorSums total;
+    for (const ErrorSums& e : errors) {
+        total.absSum += e.absSum;
+        total.sqSum += e.sqSum;
+        total.maxError = std::max(total.maxError, e.maxError);
+        total.differing += e.differing;
+    }
+
+    // 2. SSIM, only where rows differ (windows span the bands' edges, so this is a
+    // second pass over the finished row flags)
+    const bool windowed = a.width >= 2 * kSsimBlock && a.height >= 2 * kSsimBlock;
+    SsimSums windows;
+    if (options.ssim && windowed && total.maxError > 0) {
+        const int blocksY = a.height / kSsimBlock;
+        std::vector<SsimSums> ssim(bands);
+        ForEachBand(a, options.threads, [&](int band, int y0, int y1) {
+            SsimBand(a, b, rowDiffers, y0 / kSsimBlock, std::min(blocksY, (y1 + kSsimBlock - 1) / kSsimBlock), ssim[band]);
+        });
+        for (const SsimSums& s : ssim) {
+            windows.sum += s.sum;
+            windows.windows += s.windows;
+        }
+    }
+
+    // 3. Metrics
+    const double n = static_cast<double>(a.SampleCount());
+    const double peak = a.isFloat ? 1.0 : a.maxVal;
+    stats.maxError = total.maxError;
+    stats.meanError = total.absSum / n;
+    stats.mse = total.sqSum / n;
+    stats.psnr = stats.mse > 0 ? 10.0 * std::log10(peak * peak / stats.mse) : std::numeric_limits<double>::infinity();
+    stats.differing = total.differing;
+    if (!options.ssim || total.maxError == 0) stats.ssim = 1.0;
+    else stats.ssim = windowed ? windows.sum / std::max<uint64_t>(1, windows.windows) : SsimWhole(a, b);
+    return true;
+}
+
+// Helper: heatmap ramp, black (no difference) through blue, red and yellow to white
+static void HeatColor(double t, uint8_t* rgb) {
+    static const double stops[5][3] = { { 0, 0, 0 }, { 0, 0, 255 }, { 255, 0, 0 }, { 255, 255, 0 }, { 255, 255, 255 } };
+    t = std::clamp(t, 0.0, 1.0) * 4.0;
+    const int i = std::min(3, static_cast<int>(t));
+    const double f = t - i;
+    for (int c = 0; c < 3; ++c) rgb[c] = static_cast<uint8_t>(std::lround(stops[i][c] + (stops[i + 1][c] - stops[i][c]) * f));
+}
+
+Image DiffHeatmap(const Image& a, const Image& b, double scale, unsigned threads) {
+    Image heat;
+    if (!Comparable(a, b)) return heat;
+    heat.width = a.width;
+    heat.height = a.height;
+    heat.channels = 3;
+    heat.maxVal = 255;
+    heat.samples.resize(static_cast<size_t>(a.width) * a.height * 3);
+
+    // Any difference at all is at least dark blue, so single-step errors still show
+    constexpr int kLevels = 256, kFloor = 24;
+    uint8_t ramp[kLevels][3];
+    for (int i = 0; i < kLevels; ++i) HeatColor(static_cast<double>(i) / (kLevels - 1), ramp[i]);
+    const double toLevel = scale > 0 ? (kLevels - 1 - kFloor) / scale : 0.0;
+
+    const int ch = a.channels;
+    ForEachBand(a, threads, [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const size_t first = static_cast<size_t>(y) * a.width * ch;
+            uint8_t* out = &heat.samples[static_cast<size_t>(y) * a.width * 3];
+            for (int x = 0; x < a.width; ++x, out += 3) {
+                double d = 0;
+                for (int c = 0; c < ch; ++c) {
+                    const size_t i = first + static_cast<size_t>(x) * ch + c;
+                    if (a.isFloat) d = std::max(d, static_cast<double>(FloatError(a.SamplesF()[i], b.SamplesF()[i])));
+                    else if (a.BytesPerSample() == 2) d = std::max(d, std::fabs(double(a.Samples16()[i]) - b.Samples16()[i]));
+                    else d = std::max(d, std::fabs(double(a.Data()[i]) - b.Data()[i]));
+                }
+                const int level = d > 0 ? static_cast<int>(std::min<double>(kLevels - 1, kFloor + d * toLevel + 0.5)) : 0;
+                std::memcpy(out, ramp[level], 3);
+            }
+        }
+    });
+    return heat;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstdint>
+
+// Difference metrics of two images of the same size and format (e.g. a render
+// against its reference). Errors are in sample units: 0..maxVal for integer
+// images, nominal [0, 1] for float ones. Every channel counts, alpha included.
+struct CompareStats {
+    double maxError = 0;    // largest absolute sample difference
+    double meanError = 0;   // mean absolute sample difference
+    double mse = 0;         // mean squared sample difference
+    double psnr = 0;        // dB against maxVal (1 for float); infinite when identical
+    double ssim = 1;        // mean SSIM over 8x8 windows (stride 4), averaged over channels
+    uint64_t differing = 0; // pixels with at least one differing sample
+};
+
+struct CompareOptions {
+    bool ssim = true;     // SSIM reads the images a second time
+    unsigned threads = 0; // row bands compared in parallel; 0 = one per hardware thread
+};
+
+// Compare a (the reference) with b. Prints and returns false unless both have the
+// same size, channel count and sample format.
+bool CompareImages(const Image& a, const Image& b, CompareStats& stats, const CompareOptions& options = CompareOptions{});
+
+// Per-pixel difference as an 8-bit RGB heatmap: the largest channel difference of
+// each pixel through a black-blue-red-yellow-white ramp, white at `scale` (sample
+// units) and above. Identical pixels are black. Empty unless a and b compare.
+Image DiffHeatmap(const Image& a, const Image& b, double scale, unsigned threads = 0);
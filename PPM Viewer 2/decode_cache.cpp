@@ -0,0 +1,242 @@
+#include "decode_cache.h"
+#include "image_cache.h"
+#include "tiled.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+constexpr char kEntryMagic[8] = { 'P', 'P', 'M', 'D', 'C', 'A', 'C', 'H' };
+constexpr uint32_t kEntryVersion = 1;
+// Raster offset alignment: whole pages, so the mapped samples are suitably aligned
+constexpr uint64_t kRasterAlign = 4096;
+constexpr uint64_t kDefaultBudget = 2ull << 30;
+
+// Entry layout: EntryHeader, source path (UTF-8), tuple type, padding, raster
+struct EntryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // 1 = alpha, 2 = float
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t maxVal;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t rasterOffset;
+    uint64_t rasterBytes;
+    uint32_t pathBytes;
+    uint32_t tupleTypeBytes;
+};
+
+static std::mutex g_dirMutex;
+static std::string g_dir;
+static std::atomic<uint64_t> g_budget{kDefaultBudget};
+
+// 1. HELPERS
+// Helper: one entry file per source path (FNV-1a of the path)
+static fs::path EntryPath(const std::string& dir, const std::string& filepath) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : filepath) h = (h ^ c) * 1099511628211ull;
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.pdc", static_cast<unsigned long long>(h));
+    return Utf8Path(dir) / name;
+}
+
+// Helper: write an entry for img under the source stamp taken before it was decoded
+static bool StoreEntry(const std::string& dir, const std::string& filepath, const FileStamp& stamp, const Image& img) {
+    EntryHeader header = {};
+    std::memcpy(header.magic, kEntryMagic, sizeof(kEntryMagic));
+    header.version = kEntryVersion;
+    header.flags = (img.alpha ? 1u : 0u) | (img.isFloat ? 2u : 0u);
+    header.width = img.width;
+    header.height = img.height;
+    header.channels = img.channels;
+    header.maxVal = img.maxVal;
+    header.sourceSize = stamp.size;
+    header.sourceMtime = stamp.mtime;
+    header.pathBytes = static_cast<uint32_t>(filepath.size());
+    header.tupleTypeBytes = static_cast<uint32_t>(img.tupleType.size());
+    const uint64_t used = sizeof(EntryHeader) + header.pathBytes + header.tupleTypeBytes;
+    header.rasterOffset = (used + kRasterAlign - 1) / kRasterAlign * kRasterAlign;
+    header.rasterBytes = static_cast<uint64_t>(img.SampleCount()) * img.BytesPerSample();
+
+    // Written under a temporary name and renamed into place, so a reader never maps a
+    // half-written entry
+    static std::atomic<uint32_t> counter{0};
+    const fs::path target = EntryPath(dir, filepath);
+    fs::path temp = target;
+    temp += ".tmp" + std::to_string(counter++);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Error: Could not create decode cache entry in " << dir << std::endl;
+            return false;
+        }
+        const std::vector<char> padding(static_cast<size_t>(header.rasterOffset - used), 0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(filepath.data(), filepath.size());
+        out.write(img.tupleType.data(), img.tupleType.size());
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char*>(img.Data()), static_cast<std::streamsize>(header.rasterBytes));
+        out.close();
+        if (out.fail()) {
+            std::cerr << "Error: Failed while writing decode cache entry for " << filepath << std::endl;
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        // Typically the old entry is still mapped (Windows won't replace it); try next time
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Helper: delete the oldest entries (by mtime, i.e. when they were stored) until
+// the directory fits the budget. Entries that can't be removed are skipped.
+static void PruneEntries(const std::string& dir, uint64_t budget) {
+    struct Entry {
+        fs::path path;
+        fs::file_time_type mtime;
+        uint64_t bytes;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code ec;
+    for (const auto& item : fs::directory_iterator(Utf8Path(dir), ec)) {
+        std::error_code itemEc;
+        if (item.path().extension() != ".pdc" || !item.is_regular_file(itemEc)) continue;
+        const uint64_t bytes = item.file_size(itemEc);
+        if (itemEc) continue;
+        const fs::file_time_type mtime = item.last_write_time(itemEc);
+        if (itemEc) continue;
+        entries.push_back({ item.path(), mtime, bytes });
+        total += bytes;
+    }
+    if (ec || total <= budget) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+    for (const Entry& entry : entries) {
+        if (total <= budget) break;
+        if (fs::remove(entry.path, ec)) total -= entry.bytes;
+    }
+}
+
+// 2. PUBLIC API
+void SetDecodeCacheDir(const std::string& directory) {
+    if (!directory.empty()) {
+        std::error_code ec;
+        fs::create_directories(Utf8Path(directory), ec);
+        if (ec) {
+            std::cerr << "Error: Could not create decode cache directory: " << directory << std::endl;
+            return;
+        }
+    }
+    std::lock_guard<std::mutex> lock(g_dirMutex);
+    g_dir = directory;
+}
+
+std::string DecodeCacheDir() {
+    std::lock_guard<std::mutex> lock(g_dirMutex);
+    return g_dir;
+}
+
+void SetDecodeCacheBudget(uint64_t budgetBytes) {
+    g_budget = budgetBytes;
+}
+
+uint64_t DecodeCacheBudget() {
+    return g_budget;
+}
+
+std::string DefaultDecodeCacheDir() {
+    std::error_code ec;
+    const fs::path temp = fs::temp_directory_path(ec);
+    if (ec) return {};
+    return PathUtf8(temp / "ppmviewer-decode-cache");
+}
+
+bool LookupDecodeCache(const std::string& filepath, Image& img) {
+    const std::string dir = DecodeCacheDir();
+    FileStamp stamp;
+    if (dir.empty() || !GetFileStamp(filepath, stamp)) return false;
+
+    uint64_t size = 0;
+    std::shared_ptr<const uint8_t> base = MapFileReadOnly(PathUtf8(EntryPath(dir, filepath)), size);
+    if (!base || size < sizeof(EntryHeader)) return false;
+    EntryHeader header;
+    std::memcpy(&header, base.get(), sizeof(header));
+    if (std::memcmp(header.magic, kEntryMagic, sizeof(kEntryMagic)) != 0 || header.version != kEntryVersion) return false;
+    // Stale: the source changed since it was cached
+    if (header.sourceSize != stamp.size || header.sourceMtime != stamp.mtime) return false;
+    const char* names = reinterpret_cast<const char*>(base.get()) + sizeof(EntryHeader);
+    if (sizeof(EntryHeader) + static_cast<uint64_t>(header.pathBytes) + header.tupleTypeBytes > size) return false;
+    // A different path that hashed to the same name
+    if (filepath.compare(0, std::string::npos, names, header.pathBytes) != 0) return false;
+
+    Image entry;
+    entry.width = header.width;
+    entry.height = header.height;
+    entry.channels = header.channels;
+    entry.maxVal = header.maxVal;
+    entry.alpha = (header.flags & 1) != 0;
+    entry.isFloat = (header.flags & 2) != 0;
+    entry.tupleType.assign(names + header.pathBytes, header.tupleTypeBytes);
+    if (entry.width <= 0 || entry.height <= 0 || entry.channels < 1 || entry.channels > 4 || entry.maxVal < 1 || entry.maxVal > 65535) return false;
+    const uint64_t expected = static_cast<uint64_t>(entry.SampleCount()) * entry.BytesPerSample();
+    if (header.rasterBytes != expected || header.rasterOffset % kRasterAlign != 0 || header.rasterOffset + expected > size) return false;
+
+    // Points into the mapping and shares its lifetime
+    entry.mapped = std::shared_ptr<const uint8_t>(base, base.get() + header.rasterOffset);
+    img = std::move(entry);
+    return true;
+}
+
+bool StoreDecodeCache(const std::string& filepath, const Image& img) {
+    const std::string dir = DecodeCacheDir();
+    FileStamp stamp;
+    if (dir.empty() || !img.HasSamples() || !GetFileStamp(filepath, stamp)) return false;
+    if (!StoreEntry(dir, filepath, stamp, img)) return false;
+    PruneEntries(dir, g_budget);
+    return true;
+}
+
+std::shared_ptr<const Image> DecodeWithDiskCache(const std::string& filepath) {
+    auto img = std::make_shared<Image>();
+    if (IsTiledFile(filepath)) {
+        TiledReader tiled;
+        if (!tiled.Open(filepath) || !tiled.ReadLevel(0, *img)) return nullptr;
+        return img;
+    }
+    const std::string dir = DecodeCacheDir();
+    if (!dir.empty() && LookupDecodeCache(filepath, *img)) return img;
+
+    FileStamp before;
+    const bool stamped = !dir.empty() && GetFileStamp(filepath, before);
+    std::unique_ptr<std::istream> in = OpenPnmInput(filepath);
+    if (!in) return nullptr;
+    PnmReader reader(*in);
+    PnmHeader header;
+    if (!ReadPnmHeader(reader, header) || !ReadPnmRaster(reader, header, *img)) return nullptr;
+
+    // Only text and compressed files are worth caching, and only if the file didn't
+    // change while it was read
+    FileStamp after;
+    const bool slow = header.IsAscii() || FileCompression(filepath) != Compression::None;
+    if (stamped && slow && GetFileStamp(filepath, after) && after == before && StoreEntry(dir, filepath, before, *img)) PruneEntries(dir, g_budget);
+    return img;
+}
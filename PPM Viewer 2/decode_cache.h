@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// On-disk cache of decoded rasters for the text formats (P1-P3), which are slow to
+// parse, and for gzip/zstd compressed files, which are slow to decompress. An entry
+// holds a small header (source path, size and mtime, image shape) followed by the
+// raster in Image's native layout at a page-aligned offset, so a re-open maps the
+// file and points Image::mapped at it instead of parsing again.
+// Entries live in one directory, one file per source path; a source that changed
+// simply overwrites its entry. After every store the directory is trimmed to a byte
+// budget (2 GiB by default), the entries written longest ago going first; one still
+// mapped somewhere (Windows won't delete it) is left for a later store. Uncompressed
+// binary formats and tiled containers (tiled.h) are not cached: reading them already
+// costs no more than reading the cache entry would.
+//
+// Off until a directory is set. Entries are local to the machine (host byte order).
+
+// Enable the cache in `directory` (created if missing); an empty string disables it
+void SetDecodeCacheDir(const std::string& directory);
+std::string DecodeCacheDir();
+// A per-user default under the system temp directory
+std::string DefaultDecodeCacheDir();
+// Total size the entries may take on disk; lowering it trims on the next store
+void SetDecodeCacheBudget(uint64_t budgetBytes);
+uint64_t DecodeCacheBudget();
+
+// Map the cached raster for filepath into img if the cache holds a current entry
+bool LookupDecodeCache(const std::string& filepath, Image& img);
+// Write img (decoded from filepath) to the cache; failures only print
+bool StoreDecodeCache(const std::string& filepath, const Image& img);
+
+// Decode filepath, going through the cache when it is enabled: a hit maps the
+// stored raster, a miss on a text format or a compressed file decodes and stores it.
+// Tiled containers are decoded directly, their tiles in parallel. Null on failure.
+std::shared_ptr<const Image> DecodeWithDiskCache(const std::string& filepath);
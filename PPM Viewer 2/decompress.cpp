@@ -0,0 +1,1404 @@
+#include "decompress.h"
+#include "thread_pool.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Compressed input is read this much at a time
+constexpr size_t kSourceChunk = 1 << 17;
+// Serial decoding hands out this much output per refill
+constexpr size_t kOutputChunk = 1 << 18;
+// Zstd frames up to this size (declared in their header) may go to a worker
+constexpr uint64_t kParallelFrameBytes = 32ull << 20;
+// Larger zstd windows are refused (zstd itself needs --memory past 128 MB)
+constexpr uint64_t kMaxZstdWindow = 1ull << 31;
+// Largest zstd block, compressed or not
+constexpr size_t kZstdMaxBlock = 1 << 17;
+
+static std::atomic<unsigned> g_decompressThreads{ 0 };
+
+// 1. CHECKSUMS
+// Helper: little-endian loads
+static inline uint32_t Load16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t Load32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+static inline uint64_t Load64(const uint8_t* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+
+// Helper: index of the highest set bit (v > 0)
+static inline int HighBit(uint32_t v) {
+    int n = 0;
+    while (v >>= 1) ++n;
+    return n;
+}
+
+// Helper: CRC-32 (gzip) continued over n more bytes, eight bytes per step
+static uint32_t Crc32(uint32_t crc, const uint8_t* p, size_t n) {
+    static const auto tables = [] {
+        std::vector<std::array<uint32_t, 256>> t(8);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[0][i] = c;
+        }
+        for (int k = 1; k < 8; ++k) {
+            for (int i = 0; i < 256; ++i) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+        }
+        return t;
+    }();
+    const auto& t = tables;
+    crc = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        const uint32_t one = Load32(p) ^ crc, two = Load32(p + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+            ^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+    }
+    for (; n > 0; --n, ++p) crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// XXH64 with seed 0 over data that arrives in pieces (zstd content checksums)
+class Xxh64 {
+public:
+    void Update(const uint8_t* p, size_t n) {
+        if (n == 0) return;
+        total_ += n;
+        if (buffered_ + n < 32) {
+            std::memcpy(buffer_ + buffered_, p, n);
+            buffered_ += n;
+            return;
+        }
+        if (buffered_) {
+            const size_t fill = 32 - buffered_;
+            std::memcpy(buffer_ + buffered_, p, fill);
+            Stripe(buffer_);
+            p += fill;
+            n -= fill;
+            buffered_ = 0;
+        }
+        for (; n >= 32; n -= 32, p += 32) Stripe(p);
+        std::memcpy(buffer_, p, n);
+        buffered_ = n;
+    }
+
+    uint64_t Digest() const {
+        uint64_t h;
+        if (total_ >= 32) {
+            h = Rotl(v_[0], 1) + Rotl(v_[1], 7) + Rotl(v_[2], 12) + Rotl(v_[3], 18);
+            for (uint64_t v : v_) h = (h ^ Round(0, v)) * kP1 + kP4;
+        } else {
+            h = kP5;
+        }
+        h += total_;
+        const uint8_t* p = buffer_;
+        size_t n = buffered_;
+        for (; n >= 8; n -= 8, p += 8) h = Rotl(h ^ Round(0, Load64(p)), 27) * kP1 + kP4;
+        if (n >= 4) {
+            h = Rotl(h ^ (static_cast<uint64_t>(Load32(p)) * kP1), 23) * kP2 + kP3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n > 0; --n, ++p) h = Rotl(h ^ (*p * kP5), 11) * kP1;
+        h ^= h >> 33;
+        h *= kP2;
+        h ^= h >> 29;
+        h *= kP3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr uint64_t kP1 = 11400714785074694791ull, kP2 = 14029467366897019727ull, kP3 = 1609587929392839161ull;
+    static constexpr uint64_t kP4 = 9650029242287828579ull, kP5 = 2870177450012600261ull;
+    static uint64_t Rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+    static uint64_t Round(uint64_t acc, uint64_t input) { return Rotl(acc + input * kP2, 31) * kP1; }
+    void Stripe(const uint8_t* p) {
+        for (int i = 0; i < 4; ++i) v_[i] = Round(v_[i], Load64(p + 8 * i));
+    }
+
+    uint64_t v_[4] = { kP1 + kP2, kP2, 0, 0 - kP1 };
+    uint8_t buffer_[32] = {};
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+};
+
+// 2. INPUT AND OUTPUT
+// Compressed bytes, either pulled from a stream in chunks or all in memory. The
+// last few bytes consumed stay in the buffer so inflate can hand back what its bit
+// reader fetched past the end of a member.
+class SourceBuffer {
+public:
+    static constexpr size_t kKeepBack = 8;
+
+    explicit SourceBuffer(std::istream* in) : in_(in), storage_(kSourceChunk + kKeepBack) { data_ = storage_.data(); }
+    SourceBuffer(const uint8_t* data, size_t size) : data_(data), end_(size) {}
+
+    int Get() { return (pos_ < end_ || Fill(1)) ? data_[pos_++] : EOF; }
+    // n more bytes, or false (having consumed what there was) at the end
+    bool Read(uint8_t* dst, size_t n) {
+        while (n > 0) {
+            if (pos_ == end_ && !Fill(1)) return false;
+            const size_t take = std::min(n, end_ - pos_);
+            std::memcpy(dst, data_ + pos_, take);
+            pos_ += take;
+            dst += take;
+            n -= take;
+        }
+        return true;
+    }
+    bool Skip(uint64_t n) {
+        while (n > 0) {
+            if (pos_ == end_ && !Fill(1)) return false;
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(n, end_ - pos_));
+            pos_ += take;
+            n -= take;
+        }
+        return true;
+    }
+    // The next n bytes without consuming them (n <= kSourceChunk), or null if fewer are left
+    const uint8_t* Peek(size_t n) { return (end_ - pos_ >= n || Fill(n)) ? data_ + pos_ : nullptr; }
+    // Up to n bytes without consuming them; `avail` receives how many there are
+    const uint8_t* PeekUpTo(size_t n, size_t& avail) {
+        Peek(n);
+        avail = std::min(n, end_ - pos_);
+        return data_ + pos_;
+    }
+    size_t Available() const { return end_ - pos_; }
+    bool AtEnd() { return pos_ == end_ && !Fill(1); }
+    void Unget(size_t n) { pos_ -= std::min(n, pos_); }
+
+private:
+    // At least `need` unread bytes, keeping kKeepBack consumed ones in front
+    bool Fill(size_t need) {
+        if (!in_) return end_ - pos_ >= need;
+        const size_t keep = std::min(pos_, kKeepBack);
+        std::memmove(storage_.data(), storage_.data() + pos_ - keep, end_ - pos_ + keep);
+        end_ = end_ - pos_ + keep;
+        pos_ = keep;
+        while (end_ - pos_ < need && in_->good()) {
+            in_->read(reinterpret_cast<char*>(storage_.data() + end_), static_cast<std::streamsize>(storage_.size() - end_));
+            end_ += static_cast<size_t>(in_->gcount());
+        }
+        return end_ - pos_ >= need;
+    }
+
+    std::istream* in_ = nullptr;
+    std::vector<uint8_t> storage_;
+    const uint8_t* data_ = nullptr;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+// Decompressed bytes: a vector used up to `size`, grown ahead of the writes
+struct OutBuffer {
+    std::vector<uint8_t> data;
+    size_t size = 0;
+
+    // Room for n more bytes at data.data() + size
+    uint8_t* Reserve(size_t n) {
+        if (size + n > data.size()) data.resize(std::max(data.size() * 2, size + n + 65536));
+        return data.data() + size;
+    }
+    // Append n bytes from `from` (which may be null when n is 0: nothing is copied)
+    void Append(const uint8_t* from, size_t n) {
+        if (n == 0) return;
+        std::memcpy(Reserve(n), from, n);
+        size += n;
+    }
+    // Append length bytes copied from distance bytes back (the copy may overlap itself)
+    void CopyMatch(size_t distance, size_t length) {
+        uint8_t* out = Reserve(length);
+        const uint8_t* from = out - distance;
+        if (distance >= length) {
+            std::memcpy(out, from, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) out[i] = from[i];
+        }
+        size += length;
+    }
+};
+
+// Helper: prints why the data can't be decoded; always false
+static bool Corrupt(Compression kind, const char* why) {
+    std::cerr << "Error: Corrupt " << CompressionName(kind) << " data (" << why << ")." << std::endl;
+    return false;
+}
+
+// 3. GZIP (DEFLATE)
+// LSB-first bit reader over a SourceBuffer. Past the end it reads zeros and counts
+// them, so running off a truncated stream is caught without a check per bit.
+struct BitInput {
+    SourceBuffer* src = nullptr;
+    uint64_t bits = 0;
+    int count = 0;
+    int fake = 0; // zero bytes appended past the end of the input
+
+    void Need(int n) {
+        if (count >= n) return;
+        while (count <= 56) {
+            int c = src->Get();
+            if (c == EOF) {
+                c = 0;
+                ++fake;
+            }
+            bits |= static_cast<uint64_t>(c) << count;
+            count += 8;
+        }
+    }
+    uint32_t Bits(int n) {
+        Need(n);
+        const uint32_t v = static_cast<uint32_t>(bits & ((1ull << n) - 1));
+        bits >>= n;
+        count -= n;
+        return v;
+    }
+    void Drop(int n) {
+        bits >>= n;
+        count -= n;
+    }
+    // More zero bytes consumed than the buffer can hold: the input ended early
+    bool Overrun() const { return fake > 8; }
+    // Back to the byte boundary, returning whole bytes not used to the source;
+    // false if any bit consumed was past the end
+    bool Align() {
+        Drop(count & 7);
+        const int whole = count / 8;
+        if (fake > whole) return false;
+        src->Unget(static_cast<size_t>(whole - fake));
+        bits = 0;
+        count = fake = 0;
+        return true;
+    }
+};
+
+// Canonical Huffman code: a lookup table for codes of up to kFastBits bits, and
+// per-length counts with the symbols in code order for the longer ones
+struct InflateCode {
+    static constexpr int kFastBits = 9;
+    uint16_t fast[1 << kFastBits]; // (symbol << 4) | length; 0 = longer code
+    uint16_t count[16];
+    uint16_t symbols[288];
+};
+
+// Helper: code for n symbol lengths; false if over-subscribed (incomplete codes
+// are accepted, and only fail if a missing code turns up)
+static bool BuildInflateCode(const uint8_t* lengths, int n, InflateCode& code) {
+    std::fill(std::begin(code.count), std::end(code.count), 0);
+    for (int i = 0; i < n; ++i) ++code.count[lengths[i]];
+    code.count[0] = 0;
+    int left = 1;
+    for (int len = 1; len <= 15; ++len) {
+        left = (left << 1) - code.count[len];
+        if (left < 0) return false;
+    }
+    uint16_t offset[16] = {}, next[16] = {};
+    for (int len = 1; len < 15; ++len) offset[len + 1] = offset[len] + code.count[len];
+    uint32_t c = 0;
+    for (int len = 1; len <= 15; ++len) {
+        c = (c + code.count[len - 1]) << 1;
+        next[len] = static_cast<uint16_t>(c);
+    }
+    std::fill(std::begin(code.fast), std::end(code.fast), 0);
+    for (int sym = 0; sym < n; ++sym) {
+        const int len = lengths[sym];
+        if (len == 0) continue;
+        code.symbols[offset[len]++] = static_cast<uint16_t>(sym);
+        const uint32_t value = next[len]++;
+        if (len > InflateCode::kFastBits) continue;
+        // Codes are sent MSB first into an LSB-first stream: index by the reversed code
+        uint32_t reversed = 0;
+        for (int b = 0; b < len; ++b) reversed |= ((value >> b) & 1) << (len - 1 - b);
+        for (uint32_t i = reversed; i < (1u << InflateCode::kFastBits); i += 1u << len) {
+            code.fast[i] = static_cast<uint16_t>((sym << 4) | len);
+        }
+    }
+    return true;
+}
+
+// Helper: next symbol, or -1 for a code that isn't in the table
+static int DecodeSymbol(BitInput& in, const InflateCode& code) {
+    in.Need(InflateCode::kFastBits);
+    const uint16_t e = code.fast[in.bits & ((1u << InflateCode::kFastBits) - 1)];
+    if (e) {
+        in.Drop(e & 15);
+        return e >> 4;
+    }
+    int value = 0, first = 0, index = 0;
+    for (int len = 1; len <= 15; ++len) {
+        value |= static_cast<int>(in.Bits(1));
+        const int count = code.count[len];
+        if (value - count < first) return code.symbols[index + (value - first)];
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
+    }
+    return -1;
+}
+
+// Decoding position within one deflate stream
+struct Inflater {
+    enum class State { BlockHeader, Stored, Codes, Done };
+    State state = State::BlockHeader;
+    bool last = false;
+    uint32_t storedLeft = 0;
+    BitInput in;
+    InflateCode literals;
+    InflateCode distances;
+};
+
+// Helper: the next block header and, for Huffman blocks, its codes
+static bool InflateBlockHeader(Inflater& z) {
+    BitInput& in = z.in;
+    z.last = in.Bits(1) != 0;
+    const uint32_t type = in.Bits(2);
+    if (type == 0) {
+        in.Drop(in.count & 7);
+        const uint32_t len = in.Bits(16), nlen = in.Bits(16);
+        if (len != (~nlen & 0xFFFF)) return Corrupt(Compression::Gzip, "stored block length");
+        z.storedLeft = len;
+        z.state = Inflater::State::Stored;
+        return !in.Overrun() || Corrupt(Compression::Gzip, "truncated");
+    }
+    uint8_t lengths[320];
+    if (type == 1) {
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        std::fill(lengths + 288, lengths + 318, 5);
+        BuildInflateCode(lengths, 288, z.literals);
+        BuildInflateCode(lengths + 288, 30, z.distances);
+        z.state = Inflater::State::Codes;
+        return true;
+    }
+    if (type != 2) return Corrupt(Compression::Gzip, "block type");
+
+    static const uint8_t kOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    const int nlen = static_cast<int>(in.Bits(5)) + 257, ndist = static_cast<int>(in.Bits(5)) + 1, ncode = static_cast<int>(in.Bits(4)) + 4;
+    if (nlen > 286 || ndist > 30) return Corrupt(Compression::Gzip, "code counts");
+    uint8_t codeLengths[19] = {};
+    for (int i = 0; i < ncode; ++i) codeLengths[kOrder[i]] = static_cast<uint8_t>(in.Bits(3));
+    InflateCode lengthCode;
+    if (!BuildInflateCode(codeLengths, 19, lengthCode)) return Corrupt(Compression::Gzip, "code length code");
+    for (int i = 0; i < nlen + ndist;) {
+        const int sym = DecodeSymbol(in, lengthCode);
+        if (sym < 0 || in.Overrun()) return Corrupt(Compression::Gzip, "code lengths");
+        if (sym < 16) {
+            lengths[i++] = static_cast<uint8_t>(sym);
+            continue;
+        }
+        uint8_t value = 0;
+        int repeat;
+        if (sym == 16) {
+            if (i == 0) return Corrupt(Compression::Gzip, "repeat with no previous length");
+            value = lengths[i - 1];
+            repeat = 3 + static_cast<int>(in.Bits(2));
+        } else if (sym == 17) {
+            repeat = 3 + static_cast<int>(in.Bits(3));
+        } else {
+            repeat = 11 + static_cast<int>(in.Bits(7));
+        }
+        if (i + repeat > nlen + ndist) return Corrupt(Compression::Gzip, "code lengths overflow");
+        std::fill(lengths + i, lengths + i + repeat, value);
+        i += repeat;
+    }
+    if (lengths[256] == 0) return Corrupt(Compression::Gzip, "no end-of-block code");
+    if (!BuildInflateCode(lengths, nlen, z.literals) || !BuildInflateCode(lengths + nlen, ndist, z.distances)) {
+        return Corrupt(Compression::Gzip, "over-subscribed code");
+    }
+    z.state = Inflater::State::Codes;
+    return true;
+}
+
+// Helper: inflate until out.size reaches target or the stream ends; distances may
+// reach back to out.data[base]
+static bool Inflate(Inflater& z, OutBuffer& out, size_t base, size_t target) {
+    static const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                            513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    BitInput& in = z.in;
+    while (out.size < target && z.state != Inflater::State::Done) {
+        if (z.state == Inflater::State::BlockHeader) {
+            if (!InflateBlockHeader(z)) return false;
+        } else if (z.state == Inflater::State::Stored) {
+            // Whole bytes still in the bit buffer first, then straight from the source
+            while (z.storedLeft > 0 && in.count / 8 > in.fake) {
+                *out.Reserve(1) = static_cast<uint8_t>(in.Bits(8));
+                ++out.size;
+                --z.storedLeft;
+            }
+            if (z.storedLeft > 0) {
+                if (in.fake) return Corrupt(Compression::Gzip, "truncated");
+                const size_t n = std::min<size_t>(z.storedLeft, std::max<size_t>(target - out.size, 1));
+                if (!in.src->Read(out.Reserve(n), n)) return Corrupt(Compression::Gzip, "truncated");
+                out.size += n;
+                z.storedLeft -= static_cast<uint32_t>(n);
+            }
+            if (z.storedLeft == 0) z.state = z.last ? Inflater::State::Done : Inflater::State::BlockHeader;
+        } else {
+            while (out.size < target) {
+                const int sym = DecodeSymbol(in, z.literals);
+                if (sym < 256) {
+                    if (sym < 0) return Corrupt(Compression::Gzip, "invalid literal/length code");
+                    *out.Reserve(1) = static_cast<uint8_t>(sym);
+                    ++out.size;
+                    continue;
+                }
+                if (sym == 256) {
+                    z.state = z.last ? Inflater::State::Done : Inflater::State::BlockHeader;
+                    break;
+                }
+                if (sym > 285) return Corrupt(Compression::Gzip, "invalid length code");
+                const size_t length = kLengthBase[sym - 257] + in.Bits(kLengthExtra[sym - 257]);
+                const int d = DecodeSymbol(in, z.distances);
+                if (d < 0 || d > 29) return Corrupt(Compression::Gzip, "invalid distance code");
+                const size_t distance = kDistBase[d] + in.Bits(kDistExtra[d]);
+                if (distance > out.size - base) return Corrupt(Compression::Gzip, "distance too far back");
+                out.CopyMatch(distance, length);
+                if (in.Overrun()) return Corrupt(Compression::Gzip, "truncated");
+            }
+        }
+        if (in.Overrun()) return Corrupt(Compression::Gzip, "truncated");
+    }
+    return true;
+}
+
+// One gzip member being decoded
+struct GzipMember {
+    Inflater inflater;
+    uint32_t crc = 0;
+    uint64_t size = 0;
+    size_t base = 0; // where its output starts in the OutBuffer
+    bool done = false;
+};
+
+// Helper: gzip member header; `bgzfSize` receives the member's total size from a
+// BGZF "BC" extra field (0 if there is none)
+static bool ParseGzipHeader(const uint8_t* p, size_t avail, size_t& headerBytes, uint32_t& bgzfSize) {
+    bgzfSize = 0;
+    if (avail < 10 || p[0] != 0x1F || p[1] != 0x8B || p[2] != 8 || (p[3] & 0xE0)) return false;
+    const uint8_t flags = p[3];
+    size_t at = 10;
+    if (flags & 4) {
+        if (avail < at + 2) return false;
+        const size_t xlen = Load16(p + at);
+        at += 2;
+        if (avail < at + xlen) return false;
+        for (size_t f = at; f + 4 <= at + xlen;) {
+            const size_t len = Load16(p + f + 2);
+            if (p[f] == 'B' && p[f + 1] == 'C' && len == 2 && f + 6 <= at + xlen) bgzfSize = Load16(p + f + 4) + 1;
+            f += 4 + len;
+        }
+        at += xlen;
+    }
+    for (uint8_t flag : { uint8_t(8), uint8_t(16) }) {
+        if (!(flags & flag)) continue;
+        while (at < avail && p[at] != 0) ++at;
+        if (at++ >= avail) return false;
+    }
+    if (flags & 2) at += 2;
+    if (at > avail) return false;
+    headerBytes = at;
+    return true;
+}
+
+// Helper: read a member header and start decoding it, appending at out.size
+static bool GzipBegin(SourceBuffer& src, GzipMember& m, const OutBuffer& out) {
+    // Names and comments may be long: look further until the header fits
+    size_t headerBytes = 0;
+    uint32_t bgzfSize = 0;
+    for (size_t look = 64;; look *= 2) {
+        size_t avail = 0;
+        const uint8_t* p = src.PeekUpTo(look, avail);
+        if (ParseGzipHeader(p, avail, headerBytes, bgzfSize)) break;
+        if (avail < look || look >= kSourceChunk) return Corrupt(Compression::Gzip, "member header");
+    }
+    src.Skip(headerBytes);
+    m = GzipMember{};
+    m.inflater.in.src = &src;
+    m.base = out.size;
+    return true;
+}
+
+// Helper: decode the member until out.size reaches target; at its end the trailer
+// (CRC-32 and length) is checked
+static bool GzipProduce(GzipMember& m, OutBuffer& out, size_t target) {
+    const size_t before = out.size;
+    if (!Inflate(m.inflater, out, m.base, target)) return false;
+    m.crc = Crc32(m.crc, out.data.data() + before, out.size - before);
+    m.size += out.size - before;
+    if (m.inflater.state != Inflater::State::Done) return true;
+    uint8_t trailer[8];
+    if (!m.inflater.in.Align() || !m.inflater.in.src->Read(trailer, 8)) return Corrupt(Compression::Gzip, "truncated");
+    if (Load32(trailer) != m.crc) return Corrupt(Compression::Gzip, "CRC mismatch");
+    if (Load32(trailer + 4) != static_cast<uint32_t>(m.size)) return Corrupt(Compression::Gzip, "length mismatch");
+    m.done = true;
+    return true;
+}
+
+// 4. ZSTANDARD (RFC 8878)
+struct FseCell {
+    uint16_t base;  // next state, before the bits read are added
+    uint8_t symbol;
+    uint8_t bits;
+};
+
+struct FseTable {
+    int accuracy = 0;
+    std::vector<FseCell> cells;
+};
+
+struct HufCell {
+    uint8_t symbol;
+    uint8_t bits;
+};
+
+struct HufTable {
+    int maxBits = 0;
+    std::vector<HufCell> cells;
+};
+
+// Backward bitstream: written forwards, read from the last bit (after the final
+// byte's marker bit) towards the first. Past the start it reads zeros and `pos`
+// goes negative, which decoders check for.
+struct BackwardBits {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int64_t pos = 0; // bits left to read
+
+    bool Init(const uint8_t* p, size_t n) {
+        if (n == 0 || p[n - 1] == 0) return false;
+        data = p;
+        size = n;
+        pos = static_cast<int64_t>(n - 1) * 8 + HighBit(p[n - 1]);
+        return true;
+    }
+    // The next n (<= 32) bits, most significant first
+    uint32_t Peek(int n) const {
+        if (n == 0) return 0;
+        const int64_t start = pos - n;
+        if (start >= 0) {
+            const size_t byte = static_cast<size_t>(start >> 3);
+            uint64_t w;
+            if (byte + 8 <= size) {
+                w = Load64(data + byte);
+            } else {
+                w = 0;
+                for (size_t i = byte; i < size; ++i) w |= static_cast<uint64_t>(data[i]) << (8 * (i - byte));
+            }
+            return static_cast<uint32_t>((w >> (start & 7)) & ((1ull << n) - 1));
+        }
+        if (pos <= 0) return 0;
+        uint64_t w = 0;
+        for (size_t i = 0; i < size && i < 8; ++i) w |= static_cast<uint64_t>(data[i]) << (8 * i);
+        return static_cast<uint32_t>((w & ((1ull << pos) - 1)) << (-start));
+    }
+    uint32_t Read(int n) {
+        const uint32_t v = Peek(n);
+        pos -= n;
+        return v;
+    }
+};
+
+// Helper: FSE decoding table from normalized counts (-1: "less than one", one cell
+// at the top of the table)
+static bool BuildFse(const int16_t* counts, int symbols, int accuracy, FseTable& table) {
+    const uint32_t size = 1u << accuracy;
+    table.accuracy = accuracy;
+    table.cells.assign(size, FseCell{ 0, 0, 0 });
+    uint32_t high = size - 1;
+    uint16_t next[256];
+    for (int s = 0; s < symbols; ++s) {
+        if (counts[s] == -1) {
+            table.cells[high--].symbol = static_cast<uint8_t>(s);
+            next[s] = 1;
+        } else {
+            next[s] = static_cast<uint16_t>(std::max<int16_t>(counts[s], 0));
+        }
+    }
+    const uint32_t step = (size >> 1) + (size >> 3) + 3, mask = size - 1;
+    uint32_t position = 0;
+    for (int s = 0; s < symbols; ++s) {
+        for (int i = 0; i < counts[s]; ++i) {
+            table.cells[position].symbol = static_cast<uint8_t>(s);
+            do position = (position + step) & mask; while (position > high);
+        }
+    }
+    if (position != 0) return false;
+    for (uint32_t u = 0; u < size; ++u) {
+        FseCell& cell = table.cells[u];
+        const uint32_t x = next[cell.symbol]++;
+        if (x == 0) return false;
+        cell.bits = static_cast<uint8_t>(accuracy - HighBit(x));
+        cell.base = static_cast<uint16_t>((x << cell.bits) - size);
+    }
+    return true;
+}
+
+// Helper: FSE table description (normalized counts) at p; bytes used, 0 if invalid
+static size_t ReadFseTable(const uint8_t* p, size_t n, int maxSymbol, int maxAccuracy, FseTable& table) {
+    uint64_t bitPos = 0;
+    auto peek = [&](int bits) {
+        const size_t byte = static_cast<size_t>(bitPos >> 3);
+        uint32_t w = 0;
+        for (size_t i = 0; i < 4 && byte + i < n; ++i) w |= static_cast<uint32_t>(p[byte + i]) << (8 * i);
+        return static_cast<int>((w >> (bitPos & 7)) & ((1u << bits) - 1));
+    };
+    const int accuracy = peek(4) + 5;
+    bitPos += 4;
+    if (accuracy > maxAccuracy) return 0;
+    int16_t counts[256] = {};
+    int remaining = (1 << accuracy) + 1, threshold = 1 << accuracy, bits = accuracy + 1, symbol = 0;
+    bool previous0 = false;
+    while (remaining > 1 && symbol <= maxSymbol) {
+        if (previous0) {
+            int n0 = symbol;
+            while (peek(2) == 3) {
+                n0 += 3;
+                bitPos += 2;
+            }
+            n0 += peek(2);
+            bitPos += 2;
+            if (n0 > maxSymbol) return 0;
+            while (symbol < n0) counts[symbol++] = 0;
+        }
+        const int max = (2 * threshold - 1) - remaining;
+        int count;
+        const int v = peek(bits);
+        if ((v & (threshold - 1)) < max) {
+            count = v & (threshold - 1);
+            bitPos += bits - 1;
+        } else {
+            count = v & (2 * threshold - 1);
+            if (count >= threshold) count -= max;
+            bitPos += bits;
+        }
+        --count;
+        remaining -= count < 0 ? -count : count;
+        if (remaining < 1) return 0;
+        counts[symbol++] = static_cast<int16_t>(count);
+        previous0 = count == 0;
+        while (remaining < threshold) {
+            --bits;
+            threshold >>= 1;
+        }
+        if (bitPos > static_cast<uint64_t>(n) * 8) return 0;
+    }
+    if (remaining != 1 || bitPos > static_cast<uint64_t>(n) * 8) return 0;
+    if (!BuildFse(counts, symbol, accuracy, table)) return 0;
+    return static_cast<size_t>((bitPos + 7) / 8);
+}
+
+// Helper: Huffman literal table description at p; bytes used, 0 if invalid
+static size_t ReadHuffmanTable(const uint8_t* p, size_t n, HufTable& table) {
+    if (n == 0) return 0;
+    uint8_t weights[256] = {};
+    int count = 0;
+    size_t used;
+    const uint8_t header = p[0];
+    if (header >= 128) {
+        // Direct: four bits per weight
+        count = header - 127;
+        used = 1 + (count + 1) / 2;
+        if (used > n) return 0;
+        for (int i = 0; i < count; ++i) weights[i] = (i & 1) ? p[1 + i / 2] & 15 : p[1 + i / 2] >> 4;
+    } else {
+        // FSE compressed, two interleaved states, until the bitstream runs out
+        used = 1 + header;
+        if (used > n || header == 0) return 0;
+        FseTable fse;
+        const size_t description = ReadFseTable(p + 1, header, 12, 6, fse);
+        BackwardBits in;
+        if (description == 0 || !in.Init(p + 1 + description, header - description)) return 0;
+        uint32_t state[2] = { in.Read(fse.accuracy), in.Read(fse.accuracy) };
+        for (int which = 0;; which ^= 1) {
+            if (count > 254) return 0;
+            const FseCell& cell = fse.cells[state[which]];
+            weights[count++] = cell.symbol;
+            state[which] = cell.base + in.Read(cell.bits);
+            if (in.pos < 0) {
+                weights[count++] = fse.cells[state[which ^ 1]].symbol;
+                break;
+            }
+        }
+    }
+    // The last symbol's weight is implied: it completes the total to a power of two
+    uint32_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        if (weights[i] > 12) return 0;
+        if (weights[i]) total += 1u << (weights[i] - 1);
+    }
+    if (total == 0) return 0;
+    const int maxBits = HighBit(total) + 1;
+    const uint32_t rest = (1u << maxBits) - total;
+    if (maxBits > 12 || (rest & (rest - 1)) != 0 || count >= 256) return 0;
+    weights[count++] = static_cast<uint8_t>(HighBit(rest) + 1);
+
+    // Cells by weight (lightest first), then symbol
+    uint32_t start[14] = {};
+    for (int i = 0; i < count; ++i) if (weights[i]) start[weights[i]] += 1u << (weights[i] - 1);
+    uint32_t position = 0;
+    for (int w = 1; w <= 13; ++w) {
+        const uint32_t cells = start[w];
+        start[w] = position;
+        position += cells;
+    }
+    table.maxBits = maxBits;
+    table.cells.assign(1u << maxBits, HufCell{ 0, 0 });
+    for (int s = 0; s < count; ++s) {
+        const int w = weights[s];
+        if (!w) continue;
+        const uint32_t cells = 1u << (w - 1);
+        for (uint32_t i = 0; i < cells; ++i) table.cells[start[w] + i] = HufCell{ static_cast<uint8_t>(s), static_cast<uint8_t>(maxBits + 1 - w) };
+        start[w] += cells;
+    }
+    return used;
+}
+
+// Helper: one Huffman-coded literal stream, which must be used up exactly
+static bool DecodeHuffmanStream(const uint8_t* p, size_t n, const HufTable& table, uint8_t* out, size_t count) {
+    BackwardBits in;
+    if (!in.Init(p, n)) return false;
+    for (size_t i = 0; i < count; ++i) {
+        const HufCell cell = table.cells[in.Peek(table.maxBits)];
+        out[i] = cell.symbol;
+        in.pos -= cell.bits;
+    }
+    return in.pos == 0;
+}
+
+// Helper: the predefined sequence tables
+static const FseTable& DefaultTable(int which) {
+    static const std::array<FseTable, 3> tables = [] {
+        static const int16_t kLiteralLengths[36] = { 4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
+                                                     2, 3, 2, 1, 1, 1, 1, 1, -1, -1, -1, -1 };
+        static const int16_t kOffsets[29] = { 1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1 };
+        static const int16_t kMatchLengths[53] = { 1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, -1 };
+        std::array<FseTable, 3> t;
+        BuildFse(kLiteralLengths, 36, 6, t[0]);
+        BuildFse(kOffsets, 29, 5, t[1]);
+        BuildFse(kMatchLengths, 53, 6, t[2]);
+        return t;
+    }();
+    return tables[which];
+}
+
+// One zstd frame being decoded, with the state its blocks share
+struct ZstdFrame {
+    uint64_t windowSize = 0;
+    uint64_t contentSize = 0;
+    bool hasContentSize = false;
+    bool checksum = false;
+    bool done = false;
+    uint64_t produced = 0;
+    size_t base = 0; // where its output starts in the OutBuffer
+    uint32_t rep[3] = { 1, 4, 8 };
+    HufTable huffman;
+    FseTable tables[3]; // literal lengths, offsets, match lengths
+    bool haveTable[3] = {};
+    Xxh64 hash;
+    std::vector<uint8_t> block;
+    std::vector<uint8_t> literals;
+};
+
+// Helper: frame header at p (magic included); bytes it takes, or 0 if more are
+// needed or it is invalid (`valid` tells which)
+static size_t ParseZstdHeader(const uint8_t* p, size_t avail, ZstdFrame& f, bool& valid) {
+    valid = false;
+    if (avail < 5) return 0;
+    if (Load32(p) != 0xFD2FB528u) return 0;
+    const uint8_t descriptor = p[4];
+    const int fcsFlag = descriptor >> 6;
+    const bool singleSegment = (descriptor & 0x20) != 0;
+    if (descriptor & 0x08) return 0;
+    static const int kDictBytes[4] = { 0, 1, 2, 4 };
+    const int dictBytes = kDictBytes[descriptor & 3];
+    const int fcsBytes = fcsFlag == 0 ? (singleSegment ? 1 : 0) : (1 << fcsFlag);
+    const size_t size = 5 + (singleSegment ? 0 : 1) + dictBytes + fcsBytes;
+    valid = true;
+    if (avail < size) return 0;
+
+    size_t at = 5;
+    if (!singleSegment) {
+        const int exponent = p[at] >> 3, mantissa = p[at] & 7;
+        const uint64_t windowBase = 1ull << (10 + exponent);
+        f.windowSize = windowBase + (windowBase / 8) * mantissa;
+        ++at;
+    }
+    uint32_t dictionary = 0;
+    for (int i = 0; i < dictBytes; ++i) dictionary |= static_cast<uint32_t>(p[at + i]) << (8 * i);
+    at += dictBytes;
+    f.hasContentSize = fcsBytes > 0;
+    f.contentSize = 0;
+    for (int i = 0; i < fcsBytes; ++i) f.contentSize |= static_cast<uint64_t>(p[at + i]) << (8 * i);
+    if (fcsBytes == 2) f.contentSize += 256;
+    if (singleSegment) f.windowSize = f.contentSize;
+    f.checksum = (descriptor & 0x04) != 0;
+    if (dictionary != 0 || f.windowSize > kMaxZstdWindow) {
+        valid = false;
+        return 0;
+    }
+    return size;
+}
+
+// Helper: skip skippable frames; true if a regular frame (or the end) is next
+static bool SkipZstdSkippable(SourceBuffer& src) {
+    for (;;) {
+        const uint8_t* p = src.Peek(8);
+        if (!p || (Load32(p) & 0xFFFFFFF0u) != 0x184D2A50u) return true;
+        const uint32_t size = Load32(p + 4);
+        if (!src.Skip(8) || !src.Skip(size)) return Corrupt(Compression::Zstd, "truncated skippable frame");
+    }
+}
+
+// Helper: read a frame header and start decoding it, appending at out.size
+static bool ZstdBegin(SourceBuffer& src, ZstdFrame& f, const OutBuffer& out) {
+    f.done = false;
+    f.produced = 0;
+    f.base = out.size;
+    f.rep[0] = 1;
+    f.rep[1] = 4;
+    f.rep[2] = 8;
+    f.huffman.cells.clear();
+    f.haveTable[0] = f.haveTable[1] = f.haveTable[2] = false;
+    f.hash = Xxh64{};
+    bool valid = false;
+    size_t avail = 0;
+    const uint8_t* p = src.PeekUpTo(18, avail);
+    const size_t size = ParseZstdHeader(p, avail, f, valid);
+    if (size == 0) return Corrupt(Compression::Zstd, valid ? "truncated frame header" : "unsupported frame (dictionary, window or magic)");
+    return src.Skip(size);
+}
+
+// Helper: literals section of a compressed block; `end` receives where it stops
+static bool ZstdLiterals(const uint8_t* p, size_t n, ZstdFrame& f, const uint8_t*& literals, size_t& count, size_t& end) {
+    const int type = p[0] & 3, format = (p[0] >> 2) & 3;
+    if (type < 2) {
+        size_t header;
+        if (format == 0 || format == 2) {
+            header = 1;
+            count = p[0] >> 3;
+        } else if (format == 1) {
+            header = 2;
+            if (n < 2) return false;
+            count = (p[0] >> 4) + (p[1] << 4);
+        } else {
+            header = 3;
+            if (n < 3) return false;
+            count = (p[0] >> 4) + (p[1] << 4) + (static_cast<size_t>(p[2]) << 12);
+        }
+        if (count > kZstdMaxBlock) return false;
+        if (type == 0) {
+            if (header + count > n) return false;
+            literals = p + header;
+            end = header + count;
+        } else {
+            if (header + 1 > n) return false;
+            f.literals.assign(count, p[header]);
+            literals = f.literals.data();
+            end = header + 1;
+        }
+        return true;
+    }
+
+    static const size_t kHeader[4] = { 3, 3, 4, 5 };
+    const size_t header = kHeader[format];
+    if (n < header) return false;
+    uint64_t h = 0;
+    for (size_t i = 0; i < header; ++i) h |= static_cast<uint64_t>(p[i]) << (8 * i);
+    const int sizeBits = format < 2 ? 10 : (format == 2 ? 14 : 18);
+    count = static_cast<size_t>((h >> 4) & ((1u << sizeBits) - 1));
+    const size_t compressed = static_cast<size_t>((h >> (4 + sizeBits)) & ((1u << sizeBits) - 1));
+    if (count > kZstdMaxBlock || header + compressed > n) return false;
+    const uint8_t* q = p + header;
+    size_t left = compressed;
+    if (type == 2) {
+        const size_t used = ReadHuffmanTable(q, left, f.huffman);
+        if (used == 0) return false;
+        q += used;
+        left -= used;
+    } else if (f.huffman.cells.empty()) {
+        return false;
+    }
+    f.literals.resize(count);
+    if (format == 0) {
+        if (!DecodeHuffmanStream(q, left, f.huffman, f.literals.data(), count)) return false;
+    } else {
+        // Four streams after a jump table of the first three sizes
+        if (left < 6) return false;
+        const size_t sizes[3] = { Load16(q), Load16(q + 2), Load16(q + 4) };
+        if (6 + sizes[0] + sizes[1] + sizes[2] > left) return false;
+        const size_t segment = (count + 3) / 4;
+        if (count < 3 * segment) return false;
+        const uint8_t* stream = q + 6;
+        size_t remaining = left - 6;
+        for (int i = 0; i < 4; ++i) {
+            const size_t bytes = i < 3 ? sizes[i] : remaining;
+            const size_t symbols = i < 3 ? segment : count - 3 * segment;
+            if (!DecodeHuffmanStream(stream, bytes, f.huffman, f.literals.data() + i * segment, symbols)) return false;
+            stream += bytes;
+            remaining -= bytes;
+        }
+    }
+    literals = f.literals.data();
+    end = header + compressed;
+    return true;
+}
+
+// Helper: a compressed block's literals and sequences, executed into out
+static bool ZstdCompressedBlock(const uint8_t* p, size_t n, ZstdFrame& f, OutBuffer& out) {
+    static const uint32_t kLiteralLengthBase[36] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 18, 20, 22, 24, 28,
+                                                     32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536 };
+    static const uint8_t kLiteralLengthBits[36] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+                                                    3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    static const uint32_t kMatchLengthBase[53] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+                                                   27, 28, 29, 30, 31, 32, 33, 34, 35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515,
+                                                   1027, 2051, 4099, 8195, 16387, 32771, 65539 };
+    static const uint8_t kMatchLengthBits[53] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                  0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    if (n == 0) return Corrupt(Compression::Zstd, "empty block");
+    const uint8_t* literals = nullptr;
+    size_t literalCount = 0, at = 0;
+    if (!ZstdLiterals(p, n, f, literals, literalCount, at)) return Corrupt(Compression::Zstd, "literals");
+
+    // Sequences section header
+    if (at >= n) return Corrupt(Compression::Zstd, "missing sequences");
+    size_t sequences = p[at];
+    if (sequences == 0) {
+        ++at;
+    } else if (sequences < 128) {
+        ++at;
+    } else if (sequences < 255) {
+        if (at + 2 > n) return Corrupt(Compression::Zstd, "sequences header");
+        sequences = ((sequences - 128) << 8) + p[at + 1];
+        at += 2;
+    } else {
+        if (at + 3 > n) return Corrupt(Compression::Zstd, "sequences header");
+        sequences = p[at + 1] + (static_cast<size_t>(p[at + 2]) << 8) + 0x7F00;
+        at += 3;
+    }
+    const size_t blockStart = out.size;
+    if (sequences == 0) {
+        if (at != n) return Corrupt(Compression::Zstd, "data after literals");
+        out.Append(literals, literalCount);
+        return true;
+    }
+    if (at >= n) return Corrupt(Compression::Zstd, "sequences header");
+    const uint8_t modes = p[at++];
+    if (modes & 3) return Corrupt(Compression::Zstd, "reserved bits");
+    static const int kMaxSymbol[3] = { 35, 31, 52 }, kMaxAccuracy[3] = { 9, 8, 9 };
+    for (int t = 0; t < 3; ++t) {
+        const int mode = (modes >> (6 - 2 * t)) & 3;
+        if (mode == 0) {
+            f.tables[t] = DefaultTable(t);
+        } else if (mode == 1) {
+            if (at >= n || p[at] > kMaxSymbol[t]) return Corrupt(Compression::Zstd, "RLE table");
+            f.tables[t].accuracy = 0;
+            f.tables[t].cells.assign(1, FseCell{ 0, p[at++], 0 });
+        } else if (mode == 2) {
+            const size_t used = ReadFseTable(p + at, n - at, kMaxSymbol[t], kMaxAccuracy[t], f.tables[t]);
+            if (used == 0) return Corrupt(Compression::Zstd, "FSE table");
+            at += used;
+        } else if (!f.haveTable[t]) {
+            return Corrupt(Compression::Zstd, "repeated table with no previous one");
+        }
+        f.haveTable[t] = true;
+    }
+
+    BackwardBits in;
+    if (!in.Init(p + at, n - at)) return Corrupt(Compression::Zstd, "sequences bitstream");
+    const FseTable& llTable = f.tables[0];
+    const FseTable& ofTable = f.tables[1];
+    const FseTable& mlTable = f.tables[2];
+    uint32_t ll = in.Read(llTable.accuracy), of = in.Read(ofTable.accuracy), ml = in.Read(mlTable.accuracy);
+    size_t literalPos = 0;
+    for (size_t s = 0; s < sequences; ++s) {
+        const FseCell& llCell = llTable.cells[ll];
+        const FseCell& ofCell = ofTable.cells[of];
+        const FseCell& mlCell = mlTable.cells[ml];
+        const uint32_t offsetValue = (1u << ofCell.symbol) + in.Read(ofCell.symbol);
+        const size_t matchLength = kMatchLengthBase[mlCell.symbol] + in.Read(kMatchLengthBits[mlCell.symbol]);
+        const size_t literalLength = kLiteralLengthBase[llCell.symbol] + in.Read(kLiteralLengthBits[llCell.symbol]);
+        if (s + 1 < sequences) {
+            ll = llCell.base + in.Read(llCell.bits);
+            ml = mlCell.base + in.Read(mlCell.bits);
+            of = ofCell.base + in.Read(ofCell.bits);
+        }
+        if (in.pos < 0) return Corrupt(Compression::Zstd, "sequences overrun");
+
+        // Offsets 1-3 repeat recent ones (shifted by one after no literals)
+        size_t offset;
+        if (offsetValue > 3) {
+            offset = offsetValue - 3;
+            f.rep[2] = f.rep[1];
+            f.rep[1] = f.rep[0];
+            f.rep[0] = static_cast<uint32_t>(offset);
+        } else {
+            const uint32_t index = offsetValue - 1 + (literalLength == 0 ? 1 : 0);
+            if (index == 0) {
+                offset = f.rep[0];
+            } else {
+                offset = index == 3 ? f.rep[0] - 1 : f.rep[index];
+                if (index != 1) f.rep[2] = f.rep[1];
+                f.rep[1] = f.rep[0];
+                f.rep[0] = static_cast<uint32_t>(offset);
+            }
+        }
+
+        if (literalLength > literalCount - literalPos) return Corrupt(Compression::Zstd, "literal length");
+        out.Append(literals + literalPos, literalLength);
+        literalPos += literalLength;
+        if (offset == 0 || offset > out.size - f.base || offset > f.windowSize) return Corrupt(Compression::Zstd, "offset too far back");
+        out.CopyMatch(offset, matchLength);
+        if (out.size - blockStart > kZstdMaxBlock) return Corrupt(Compression::Zstd, "block too large");
+    }
+    if (in.pos != 0) return Corrupt(Compression::Zstd, "sequences bitstream not used up");
+    const size_t rest = literalCount - literalPos;
+    out.Append(literals + literalPos, rest);
+    if (out.size - blockStart > kZstdMaxBlock) return Corrupt(Compression::Zstd, "block too large");
+    return true;
+}
+
+// Helper: decode the frame's blocks until out.size reaches target; after the last
+// one the content size and checksum are checked
+static bool ZstdProduce(SourceBuffer& src, ZstdFrame& f, OutBuffer& out, size_t target) {
+    while (!f.done && out.size < target) {
+        uint8_t header[3];
+        if (!src.Read(header, 3)) return Corrupt(Compression::Zstd, "truncated");
+        const uint32_t h = header[0] | (header[1] << 8) | (header[2] << 16);
+        const bool last = h & 1;
+        const int type = (h >> 1) & 3;
+        const size_t size = h >> 3;
+        const size_t before = out.size;
+        if (type == 3 || size > kZstdMaxBlock || (type != 1 && size > f.windowSize && f.windowSize < kZstdMaxBlock)) {
+            return Corrupt(Compression::Zstd, "block header");
+        }
+        if (type == 0) {
+            if (!src.Read(out.Reserve(size), size)) return Corrupt(Compression::Zstd, "truncated");
+            out.size += size;
+        } else if (type == 1) {
+            const int c = src.Get();
+            if (c == EOF) return Corrupt(Compression::Zstd, "truncated");
+            if (size > 0) std::memset(out.Reserve(size), c, size);
+            out.size += size;
+        } else {
+            f.block.resize(size);
+            if (!src.Read(f.block.data(), size)) return Corrupt(Compression::Zstd, "truncated");
+            if (!ZstdCompressedBlock(f.block.data(), size, f, out)) return false;
+        }
+        f.produced += out.size - before;
+        if (f.checksum) f.hash.Update(out.data.data() + before, out.size - before);
+        if (f.hasContentSize && f.produced > f.contentSize) return Corrupt(Compression::Zstd, "more data than the frame declares");
+        if (!last) continue;
+
+        f.done = true;
+        if (f.hasContentSize && f.produced != f.contentSize) return Corrupt(Compression::Zstd, "less data than the frame declares");
+        if (f.checksum) {
+            uint8_t sum[4];
+            if (!src.Read(sum, 4)) return Corrupt(Compression::Zstd, "truncated");
+            if (Load32(sum) != static_cast<uint32_t>(f.hash.Digest())) return Corrupt(Compression::Zstd, "checksum mismatch");
+        }
+    }
+    return true;
+}
+
+// 5. STREAMING AND PARALLEL FRAMES
+// A frame (or BGZF member) read whole and decoded on a worker
+struct FrameJob {
+    std::vector<uint8_t> input;
+    OutBuffer output;
+    bool ok = false;
+    bool done = false;
+};
+
+// Helper: decode a complete member/frame held in memory; it must use all of it
+static bool DecodeFrame(Compression kind, const std::vector<uint8_t>& input, OutBuffer& out) {
+    SourceBuffer src(input.data(), input.size());
+    if (kind == Compression::Gzip) {
+        GzipMember m;
+        if (!GzipBegin(src, m, out)) return false;
+        while (!m.done) {
+            if (!GzipProduce(m, out, SIZE_MAX)) return false;
+        }
+    } else {
+        ZstdFrame f;
+        if (!ZstdBegin(src, f, out) || !ZstdProduce(src, f, out, SIZE_MAX)) return false;
+    }
+    return src.AtEnd() || Corrupt(kind, "frame size");
+}
+
+class DecompressBuffer : public std::streambuf {
+public:
+    DecompressBuffer(Compression kind, std::unique_ptr<std::istream> source)
+        : kind_(kind), source_(std::move(source)), src_(source_.get()) { Init(); }
+    DecompressBuffer(Compression kind, std::string data)
+        : kind_(kind), data_(std::move(data)), src_(reinterpret_cast<const uint8_t*>(data_.data()), data_.size()) { Init(); }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        return Refill() ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+        std::streamsize done = 0;
+        while (done < n) {
+            if (gptr() == egptr() && !Refill()) break;
+            const std::streamsize take = std::min<std::streamsize>(n - done, egptr() - gptr());
+            std::memcpy(s + done, gptr(), static_cast<size_t>(take));
+            gbump(static_cast<int>(take));
+            done += take;
+        }
+        return done;
+    }
+
+private:
+    void Init() {
+        const unsigned threads = DecompressThreads();
+        maxQueued_ = threads > 1 ? 2 * static_cast<size_t>(threads) : 0;
+        if (maxQueued_) pool_ = std::make_unique<ThreadPool>(threads);
+    }
+
+    // Make more output current: the next finished parallel frame or the next chunk
+    // of the frame decoded here; false at the end or on an error
+    bool Refill() {
+        serving_.reset();
+        while (!ended_) {
+            if (!queue_.empty()) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    ready_.wait(lock, [&] { return queue_.front()->done; });
+                }
+                serving_ = std::move(queue_.front());
+                queue_.pop_front();
+                if (!serving_->ok) return Stop();
+                Enqueue();
+                if (serving_->output.size == 0) continue;
+                char* base = reinterpret_cast<char*>(serving_->output.data.data());
+                setg(base, base, base + serving_->output.size);
+                return true;
+            }
+            if (broken_) return Stop();
+            if (serial_) {
+                Trim();
+                const size_t before = out_.size;
+                const bool ok = kind_ == Compression::Gzip ? GzipProduce(gzip_, out_, before + kOutputChunk)
+                                                           : ZstdProduce(src_, zstd_, out_, before + kOutputChunk);
+                if (!ok) return Stop();
+                serial_ = kind_ == Compression::Gzip ? !gzip_.done : !zstd_.done;
+                if (out_.size > before) {
+                    char* base = reinterpret_cast<char*>(out_.data.data());
+                    setg(base, base + before, base + out_.size);
+                    return true;
+                }
+                continue;
+            }
+            if (!StartNext()) return Stop();
+        }
+        return false;
+    }
+
+    bool Stop() {
+        ended_ = true;
+        setg(nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    // Drop output already handed out, keeping the window the current frame may copy from
+    void Trim() {
+        const size_t window = kind_ == Compression::Gzip ? 32768 : static_cast<size_t>(zstd_.windowSize);
+        if (out_.size <= window + std::max<size_t>(window, 1 << 20)) return;
+        const size_t drop = out_.size - window;
+        std::memmove(out_.data.data(), out_.data.data() + drop, window);
+        out_.size = window;
+        gzip_.base = gzip_.base > drop ? gzip_.base - drop : 0;
+        zstd_.base = zstd_.base > drop ? zstd_.base - drop : 0;
+    }
+
+    // Helper: whether the next member/frame can go to a worker: a BGZF member, or a
+    // zstd frame declaring at most kParallelFrameBytes
+    bool NextIsParallel() {
+        if (!maxQueued_) return false;
+        size_t avail = 0;
+        if (kind_ == Compression::Gzip) {
+            const uint8_t* p = src_.PeekUpTo(18, avail);
+            size_t headerBytes = 0;
+            uint32_t bgzfSize = 0;
+            return ParseGzipHeader(p, avail, headerBytes, bgzfSize) && bgzfSize != 0;
+        }
+        if (!SkipZstdSkippable(src_)) return false;
+        ZstdFrame f;
+        bool valid = false;
+        const uint8_t* p = src_.PeekUpTo(18, avail);
+        return ParseZstdHeader(p, avail, f, valid) && f.hasContentSize && f.contentSize <= kParallelFrameBytes;
+    }
+
+    // Helper: read the next member/frame whole (NextIsParallel() said it may) and
+    // hand it to a worker
+    bool QueueFrame() {
+        auto job = std::make_shared<FrameJob>();
+        size_t avail = 0;
+        const uint8_t* p = src_.PeekUpTo(18, avail);
+        if (kind_ == Compression::Gzip) {
+            size_t headerBytes = 0;
+            uint32_t bgzfSize = 0;
+            ParseGzipHeader(p, avail, headerBytes, bgzfSize);
+            job->input.resize(bgzfSize);
+            if (!src_.Read(job->input.data(), bgzfSize)) return Corrupt(kind_, "truncated");
+        } else {
+            // Walk the block headers to find where the frame ends
+            ZstdFrame f;
+            bool valid = false;
+            const size_t header = ParseZstdHeader(p, avail, f, valid);
+            job->input.assign(p, p + header);
+            src_.Skip(header);
+            for (bool last = false; !last;) {
+                uint8_t b[3];
+                if (!src_.Read(b, 3)) return Corrupt(kind_, "truncated");
+                const uint32_t h = b[0] | (b[1] << 8) | (b[2] << 16);
+                last = h & 1;
+                const size_t size = ((h >> 1) & 3) == 1 ? 1 : h >> 3;
+                if (size > kZstdMaxBlock || job->input.size() > 2 * kParallelFrameBytes) return Corrupt(kind_, "block header");
+                job->input.insert(job->input.end(), b, b + 3);
+                const size_t at = job->input.size();
+                job->input.resize(at + size);
+                if (!src_.Read(job->input.data() + at, size)) return Corrupt(kind_, "truncated");
+            }
+            if (f.checksum) {
+                uint8_t sum[4];
+                if (!src_.Read(sum, 4)) return Corrupt(kind_, "truncated");
+                job->input.insert(job->input.end(), sum, sum + 4);
+            }
+        }
+        queue_.push_back(job);
+        pool_->Submit([this, job, kind = kind_] {
+            const bool ok = DecodeFrame(kind, job->input, job->output);
+            std::vector<uint8_t>().swap(job->input);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                job->ok = ok;
+                job->done = true;
+            }
+            ready_.notify_all();
+        });
+        return true;
+    }
+
+    // Keep the workers busy with the frames that follow, as long as they qualify
+    void Enqueue() {
+        while (!broken_ && queue_.size() < maxQueued_ && !src_.AtEnd() && NextIsParallel()) {
+            if (!QueueFrame()) broken_ = true;
+        }
+    }
+
+    // Start the next member/frame: on workers when it qualifies, otherwise here
+    bool StartNext() {
+        out_.size = 0;
+        if (kind_ == Compression::Zstd && !SkipZstdSkippable(src_)) return false;
+        if (src_.AtEnd()) {
+            ended_ = true;
+            return true;
+        }
+        if (kind_ == Compression::Gzip) {
+            // Anything but another member after one (such as zero padding) is ignored
+            const uint8_t* p = src_.Peek(2);
+            if (!p || p[0] != 0x1F || p[1] != 0x8B) {
+                ended_ = true;
+                return true;
+            }
+        }
+        if (NextIsParallel()) {
+            if (!QueueFrame()) return false;
+            Enqueue();
+            return true;
+        }
+        serial_ = true;
+        return kind_ == Compression::Gzip ? GzipBegin(src_, gzip_, out_) : ZstdBegin(src_, zstd_, out_);
+    }
+
+    Compression kind_;
+    std::unique_ptr<std::istream> source_;
+    std::string data_;
+    SourceBuffer src_;
+    OutBuffer out_;          // output of the member/frame decoded on this thread
+    GzipMember gzip_;
+    ZstdFrame zstd_;
+    bool serial_ = false;    // a member/frame is being decoded on this thread
+    bool ended_ = false;
+    bool broken_ = false;    // reading ahead for the workers failed: stop once they are served
+    size_t maxQueued_ = 0;   // frames in flight on workers; 0 = no workers
+    std::deque<std::shared_ptr<FrameJob>> queue_;
+    std::shared_ptr<FrameJob> serving_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::unique_ptr<ThreadPool> pool_; // last: finishes its jobs before the rest goes
+};
+
+// Owns the buffer it reads from
+class DecompressStream : public std::istream {
+public:
+    template <typename Source>
+    DecompressStream(Compression kind, Source source) : std::istream(nullptr), buffer_(kind, std::move(source)) { rdbuf(&buffer_); }
+
+private:
+    DecompressBuffer buffer_;
+};
+
+// 6. PUBLIC API
+Compression DetectCompression(const uint8_t* head, size_t size) {
+    if (size >= 3 && head[0] == 0x1F && head[1] == 0x8B && head[2] == 8) return Compression::Gzip;
+    if (size >= 4 && Load32(head) == 0xFD2FB528u) return Compression::Zstd;
+    // A zstd file may start with skippable frames
+    if (size >= 4 && (Load32(head) & 0xFFFFFFF0u) == 0x184D2A50u) return Compression::Zstd;
+    return Compression::None;
+}
+
+Compression FileCompression(const std::string& filepath) {
+    std::ifstream file(Utf8Path(filepath), std::ios::binary);
+    uint8_t head[4] = {};
+    file.read(reinterpret_cast<char*>(head), sizeof(head));
+    return DetectCompression(head, static_cast<size_t>(file.gcount()));
+}
+
+const char* CompressionName(Compression kind) {
+    switch (kind) {
+    case Compression::Gzip: return "gzip";
+    case Compression::Zstd: return "zstd";
+    default: return "none";
+    }
+}
+
+bool IsCompressedExtension(const std::string& ext) {
+    std::string lower = ext;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return lower == ".gz" || lower == ".zst";
+}
+
+void SetDecompressThreads(unsigned threads) { g_decompressThreads = threads; }
+
+unsigned DecompressThreads() {
+    const unsigned threads = g_decompressThreads;
+    return threads ? threads : ThreadPool::DefaultThreads();
+}
+
+std::unique_ptr<std::istream> OpenDecompressor(std::unique_ptr<std::istream> source, Compression kind) {
+    return std::make_unique<DecompressStream>(kind, std::move(source));
+}
+
+std::unique_ptr<std::istream> OpenDecompressor(std::string data, Compression kind) {
+    return std::make_unique<DecompressStream>(kind, std::move(data));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+
+// Compressed containers a Netpbm file may come in (.ppm.gz, .ppm.zst), recognized
+// by their first bytes rather than by name
+enum class Compression { None, Gzip, Zstd };
+
+Compression DetectCompression(const uint8_t* head, size_t size);
+// Of a file on disk (reads its first bytes); None if it can't be read
+Compression FileCompression(const std::string& filepath);
+const char* CompressionName(Compression kind);
+// ".gz" or ".zst" in any case: what follows a Netpbm extension on compressed files
+bool IsCompressedExtension(const std::string& ext);
+
+// Process-wide: threads that decode independent frames of one file in parallel
+// (gzip members with a BGZF size field, zstd frames of up to 32 MB that declare
+// their size, such as those pzstd writes). 0 = one per hardware thread, 1 = none.
+// Everything else (an ordinary single-stream .gz or .zst) is decoded serially.
+void SetDecompressThreads(unsigned threads);
+unsigned DecompressThreads();
+
+// A stream that decompresses `source` as it is read: only the compressed input
+// buffer, the format's window (32 KB for gzip, the frame's window for zstd) and
+// the frames in flight are held, never the whole decompressed file. Corrupt or
+// truncated data prints an error and ends the stream early. Not seekable.
+std::unique_ptr<std::istream> OpenDecompressor(std::unique_ptr<std::istream> source, Compression kind);
+// Same for a compressed file already read into memory (the buffer is moved, not copied)
+std::unique_ptr<std::istream> OpenDecompressor(std::string data, Compression kind);
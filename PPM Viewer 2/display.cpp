@@ -0,0 +1,340 @@
+#include "display.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Helper: levels on a display value in [0, 1] (see ToneSettings)
+static double ApplyLevels(double v, const ToneSettings& tone) {
+    const double range = std::max(1e-6, static_cast<double>(tone.white) - tone.black);
+    v = std::clamp((v - tone.black) / range, 0.0, 1.0);
+    if (tone.midGamma != 1.0f) v = std::pow(v, 1.0 / std::max(0.01f, tone.midGamma));
+    return v;
+}
+
+// Native samples -> BGRX, one tile at a time. For integer images the LUT folds the
+// maxVal scaling ((v * 255) / maxVal, clamped), exposure and levels into a single
+// lookup per sample. It covers the whole storage range so out-of-range samples in
+// binary rasters cannot index past it. Float images are exposed and tone mapped in
+// SIMD, then gamma encoded and leveled through a LUT indexed by the quantized
+// [0, 1] result. Either way a new setting only rebuilds the LUT (at most 65536
+// entries) and reconverts the tiles on screen; the samples are never touched.
+// Alpha goes through alphaLut instead, which only scales: the tone controls change
+// how bright a pixel is, never how opaque.
+void BuildDisplayTransform(const Image& img, const ToneSettings& tone, DisplayTransform& xf) {
+    const bool leveled = tone.black != 0.0f || tone.white != 1.0f || tone.midGamma != 1.0f;
+    xf.identity = false;
+    xf.alphaLut.clear();
+    if (img.isFloat) {
+        xf.exposureScale = std::exp2(tone.exposure);
+        xf.reinhard = tone.reinhard;
+        xf.lut.resize(kFloatLutSize);
+        const double invGamma = 1.0 / std::max(0.01f, tone.gamma);
+        for (int i = 0; i < kFloatLutSize; ++i) {
+            double v = std::pow(static_cast<double>(i) / (kFloatLutSize - 1), invGamma);
+            if (leveled) v = ApplyLevels(v, tone);
+            xf.lut[i] = static_cast<uint8_t>(std::lround(v * 255.0));
+        }
+        if (img.alpha) {
+            xf.alphaLut.resize(kFloatLutSize);
+            for (int i = 0; i < kFloatLutSize; ++i) {
+                xf.alphaLut[i] = static_cast<uint8_t>(std::lround(static_cast<double>(i) * 255.0 / (kFloatLutSize - 1)));
+            }
+        }
+        return;
+    }
+    xf.exposureScale = 1.0f;
+    xf.reinhard = false;
+    const size_t entries = img.BytesPerSample() == 2 ? 65536 : 256;
+    std::vector<uint8_t> scaled(entries);
+    for (size_t v = 0; v < entries; ++v) {
+        scaled[v] = static_cast<uint8_t>(std::min<int>(255, (static_cast<int>(v) * 255) / img.maxVal));
+    }
+    if (img.alpha) xf.alphaLut = scaled;
+    if (!leveled && tone.exposure == 0.0f) {
+        xf.lut = std::move(scaled);
+        xf.identity = (img.BytesPerSample() == 1 && img.maxVal == 255);
+        return;
+    }
+    xf.lut.resize(entries);
+    const double scale = std::exp2(static_cast<double>(tone.exposure)) / img.maxVal;
+    for (size_t v = 0; v < xf.lut.size(); ++v) {
+        const double n = ApplyLevels(std::min(1.0, static_cast<double>(v) * scale), tone);
+        xf.lut[v] = static_cast<uint8_t>(std::lround(n * 255.0));
+    }
+}
+
+void DisplayCache::Reset(const Image& img) {
+    tiles.clear();
+    transform = DisplayTransform{};
+    tilesX = tilesY = 0;
+    if (img.width <= 0 || img.height <= 0 || !img.HasSamples()) return;
+    tilesX = (ViewWidth(img) + kDisplayTileSize - 1) / kDisplayTileSize;
+    tilesY = (ViewHeight(img) + kDisplayTileSize - 1) / kDisplayTileSize;
+    tiles.resize(static_cast<size_t>(tilesX) * tilesY);
+    BuildDisplayTransform(img, tone, transform);
+}
+
+void DisplayCache::SetTone(const Image& img, const ToneSettings& settings) {
+    tone = settings;
+    if (tiles.empty()) return;
+    BuildDisplayTransform(img, tone, transform);
+    for (auto& tile : tiles) {
+        tile.clear();
+        tile.shrink_to_fit();
+    }
+}
+
+void DisplayCache::SetOrientation(const Image& img, Orientation o) {
+    orientation = o;
+    if (!tiles.empty()) Reset(img);
+}
+
+// Helper: float samples -> exposure -> [Reinhard] -> clamp [0, 1] -> gamma LUT.
+// NaN maps to 0 and +inf to 1 (max/min return their second operand on NaN).
+static void ToneMapRow(const float* in, uint8_t* out, size_t n, const DisplayTransform& xf) {
+    const float top = static_cast<float>(xf.lut.size() - 1);
+    size_t i = 0;
+#ifdef PPM_SSE2
+    const __m128 scale = _mm_set1_ps(xf.exposureScale);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 topv = _mm_set1_ps(top);
+    const __m128 half = _mm_set1_ps(0.5f);
+    alignas(16) int32_t idx[4];
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), zero);
+        if (xf.reinhard) v = _mm_div_ps(v, _mm_add_ps(v, one));
+        v = _mm_min_ps(v, one);
+        _mm_store_si128(reinterpret_cast<__m128i*>(idx), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, topv), half)));
+        out[i + 0] = xf.lut[idx[0]];
+        out[i + 1] = xf.lut[idx[1]];
+        out[i + 2] = xf.lut[idx[2]];
+        out[i + 3] = xf.lut[idx[3]];
+    }
+#endif
+    for (; i < n; ++i) {
+        float v = in[i] * xf.exposureScale;
+        v = (v > 0.0f) ? v : 0.0f;
+        if (xf.reinhard) v = v / (v + 1.0f);
+        v = (v < 1.0f) ? v : 1.0f;
+        out[i] = xf.lut[static_cast<int32_t>(v * top + 0.5f)];
+    }
+}
+
+// Helper: redo the alpha samples (every ch-th, the last of each pixel) of a row
+// ToneMapRow mapped, clamped to [0, 1] but not exposed or tone mapped
+static void MapAlphaRow(const float* in, uint8_t* out, size_t n, int ch, const DisplayTransform& xf) {
+    const float top = static_cast<float>(xf.alphaLut.size() - 1);
+    for (size_t i = ch - 1; i < n; i += ch) {
+        float v = in[i];
+        v = (v > 0.0f) ? v : 0.0f;
+        v = (v < 1.0f) ? v : 1.0f;
+        out[i] = xf.alphaLut[static_cast<int32_t>(v * top + 0.5f)];
+    }
+}
+
+#ifdef PPM_SSSE3
+// Helper: PackToBGRX's bulk, four pixels per shuffle; returns the pixels done. The
+// 16-byte loads must stay inside the row, so the last pixels are left to the caller.
+PPM_TARGET_SSSE3 static int PackToBGRXSSSE3(const uint8_t* in, int ch, uint32_t* out, int w) {
+    const __m128i order = (ch == 3) ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+                                    : _mm_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+    int x = 0;
+    for (; (static_cast<size_t>(x) * ch + 16) <= static_cast<size_t>(w) * ch; x += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + static_cast<size_t>(x) * ch));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_shuffle_epi8(v, order));
+    }
+    return x;
+}
+#endif
+
+// Helper: gray bytes -> BGRX (g, g, g, 0)
+static void ExpandGrayToBGRX(const uint8_t* in, uint32_t* out, int w) {
+    int x = 0;
+#ifdef PPM_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= w; x += 16) {
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+        const __m128i gg = _mm_unpacklo_epi8(g, g);       // g g (pixels 0-7)
+        const __m128i g0 = _mm_unpacklo_epi8(g, zero);    // g 0 (pixels 0-7)
+        const __m128i gg2 = _mm_unpackhi_epi8(g, g);      // g g (pixels 8-15)
+        const __m128i g02 = _mm_unpackhi_epi8(g, zero);   // g 0 (pixels 8-15)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_unpacklo_epi16(gg, g0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 4), _mm_unpackhi_epi16(gg, g0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 8), _mm_unpacklo_epi16(gg2, g02));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 12), _mm_unpackhi_epi16(gg2, g02));
+    }
+#endif
+    for (; x < w; ++x) out[x] = static_cast<uint32_t>(in[x]) * 0x010101u;
+}
+
+// Helper: 3 or 4 channel 8-bit pixels -> BGRX (r, g, b; a 4th channel is dropped)
+static void PackToBGRX(const uint8_t* in, int ch, uint32_t* out, int w) {
+    int x = 0;
+#ifdef PPM_SSSE3
+    if (CpuHasSSSE3()) x = PackToBGRXSSSE3(in, ch, out, w);
+#endif
+    for (in += static_cast<size_t>(x) * ch; x < w; ++x, in += ch) {
+        out[x] = (static_cast<uint32_t>(in[0]) << 16) | (static_cast<uint32_t>(in[1]) << 8) | in[2];
+    }
+}
+
+// Helper: checkerboard shown through transparent pixels (image coordinates, 8px squares)
+static inline int CheckerAt(int x, int y) {
+    return (((x >> 3) ^ (y >> 3)) & 1) ? 0x66 : 0x99;
+}
+
+// Helper: blend one 8-bit channel over the checkerboard ("over", straight alpha)
+static inline uint32_t Over(uint32_t c, uint32_t a, uint32_t bg) {
+    return (c * a + bg * (255 - a) + 127) / 255;
+}
+
+void ConvertToBGRX(const Image& img, const DisplayTransform& xf, int x0, int y0, int w, int h, uint32_t* dst, int dstStride) {
+    const std::vector<uint8_t>& lut = xf.lut;
+    const int ch = img.channels;
+    // Integer samples index the LUT as stored, never clamped to maxVal, so the LUT
+    // must cover the whole storage range. One built for another image (or an
+    // identity one for a wider format) would be read past its end: draw black instead.
+    const size_t storage = img.BytesPerSample() == 2 ? 65536 : 256;
+    const size_t alphaEntries = img.alpha ? (img.isFloat ? static_cast<size_t>(kFloatLutSize) : storage) : 0;
+    if ((!img.isFloat && (xf.identity ? img.BytesPerSample() != 1 : lut.size() < storage)) ||
+        xf.alphaLut.size() < alphaEntries) {
+        for (int y = 0; y < h; ++y) std::fill_n(dst + static_cast<size_t>(y) * dstStride, w, 0u);
+        return;
+    }
+    // Map each row through the LUT into 8-bit samples first, unless it is the
+    // identity and the samples can be used in place. (A plain table lookup per
+    // sample beats a pshufb-based 256-entry lookup, which takes 16 shuffles per 16
+    // samples.) Alpha is then redone through alphaLut; with the identity both are.
+    const std::vector<uint8_t>& alphaLut = xf.alphaLut;
+    const bool identity = xf.identity;
+    std::vector<uint8_t> mapped(identity ? 0 : static_cast<size_t>(w) * ch);
+    for (int y = 0; y < h; ++y) {
+        const size_t first = (static_cast<size_t>(y0 + y) * img.width + x0) * ch;
+        uint32_t* out = dst + static_cast<size_t>(y) * dstStride;
+        const uint8_t* row;
+        if (identity) {
+            row = img.Data() + first;
+        } else if (img.isFloat) {
+            ToneMapRow(img.SamplesF() + first, mapped.data(), mapped.size(), xf);
+            if (img.alpha) MapAlphaRow(img.SamplesF() + first, mapped.data(), mapped.size(), ch, xf);
+            row = mapped.data();
+        } else if (img.BytesPerSample() == 2) {
+            const uint16_t* in = img.Samples16() + first;
+            for (size_t i = 0; i < mapped.size(); ++i) mapped[i] = lut[in[i]];
+            if (img.alpha) {
+                for (size_t i = ch - 1; i < mapped.size(); i += ch) mapped[i] = alphaLut[in[i]];
+            }
+            row = mapped.data();
+        } else {
+            const uint8_t* in = img.Data() + first;
+            for (size_t i = 0; i < mapped.size(); ++i) mapped[i] = lut[in[i]];
+            if (img.alpha) {
+                for (size_t i = ch - 1; i < mapped.size(); i += ch) mapped[i] = alphaLut[in[i]];
+            }
+            row = mapped.data();
+        }
+
+        if (!img.alpha) {
+            if (ch < 3) {
+                if (ch == 1) {
+                    ExpandGrayToBGRX(row, out, w);
+                } else {
+                    for (int x = 0; x < w; ++x) out[x] = static_cast<uint32_t>(row[x * ch]) * 0x010101u;
+                }
+            } else {
+                PackToBGRX(row, ch, out, w);
+            }
+        } else {
+            // Composite over the checkerboard; alpha is the last channel
+            const uint8_t* in = row;
+            for (int x = 0; x < w; ++x, in += ch) {
+                const uint32_t a = in[ch - 1];
+                const uint32_t bg = static_cast<uint32_t>(CheckerAt(x0 + x, y0 + y));
+                uint32_t r, g, b;
+                if (ch == 2) { r = g = b = Over(in[0], a, bg); }
+                else { r = Over(in[0], a, bg); g = Over(in[1], a, bg); b = Over(in[2], a, bg); }
+                out[x] = (r << 16) | (g << 8) | b;
+            }
+        }
+    }
+}
+
+const uint32_t* DisplayCache::GetTile(const Image& img, int tx, int ty, int& tileW, int& tileH) {
+    if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY) return nullptr;
+    const int viewW = ViewWidth(img);
+    const int viewH = ViewHeight(img);
+    const int x0 = tx * kDisplayTileSize;
+    const int y0 = ty * kDisplayTileSize;
+    tileW = std::min(kDisplayTileSize, viewW - x0);
+    tileH = std::min(kDisplayTileSize, viewH - y0);
+    std::vector<uint32_t>& tile = tiles[static_cast<size_t>(ty) * tilesX + tx];
+    if (tile.empty()) {
+        tile.resize(static_cast<size_t>(tileW) * tileH);
+        if (orientation == Orientation::Identity) {
+            ConvertToBGRX(img, transform, x0, y0, tileW, tileH, tile.data(), tileW);
+        } else {
+            // The source block the tile shows, converted as it is and then oriented
+            int sx = x0, sy = y0, sw = tileW, sh = tileH;
+            OrientRect(Inverse(orientation), viewW, viewH, sx, sy, sw, sh);
+            scratch.resize(static_cast<size_t>(sw) * sh);
+            ConvertToBGRX(img, transform, sx, sy, sw, sh, scratch.data(), sw);
+            OrientPixels(reinterpret_cast<const uint8_t*>(scratch.data()), static_cast<size_t>(sw) * 4, sw, sh, 4,
+                         orientation, reinterpret_cast<uint8_t*>(tile.data()), static_cast<size_t>(tileW) * 4);
+        }
+    }
+    return tile.data();
+}
+
+// Changes are found per source block (kDisplayTileSize square, compared row by row)
+// and each changed block drops the view tiles it lands on; without an orientation
+// the two grids are the same.
+void DisplayCache::Update(const Image& previous, const Image& img, const std::vector<RowRange>& changed,
+                          std::vector<std::pair<int, int>>& dirty) {
+    dirty.clear();
+    if (tiles.empty()) return;
+    const size_t pixelBytes = static_cast<size_t>(img.channels) * img.BytesPerSample();
+    const size_t rowBytes = img.width * pixelBytes;
+    const int blocksX = (img.width + kDisplayTileSize - 1) / kDisplayTileSize;
+    std::vector<bool> dropped(tiles.size(), false);
+    for (const RowRange& range : changed) {
+        for (int by = range.begin / kDisplayTileSize; by <= (range.end - 1) / kDisplayTileSize && by * kDisplayTileSize < img.height; ++by) {
+            const int y0 = std::max(range.begin, by * kDisplayTileSize);
+            const int y1 = std::min(range.end, (by + 1) * kDisplayTileSize);
+            for (int bx = 0; bx < blocksX; ++bx) {
+                // View tiles under this block
+                int vx = bx * kDisplayTileSize, vy = by * kDisplayTileSize;
+                int vw = std::min(kDisplayTileSize, img.width - vx), vh = std::min(kDisplayTileSize, img.height - vy);
+                OrientRect(orientation, img.width, img.height, vx, vy, vw, vh);
+                const int tx0 = vx / kDisplayTileSize, tx1 = (vx + vw - 1) / kDisplayTileSize;
+                const int ty0 = vy / kDisplayTileSize, ty1 = (vy + vh - 1) / kDisplayTileSize;
+                bool pending = false;
+                for (int ty = ty0; ty <= ty1; ++ty) {
+                    for (int tx = tx0; tx <= tx1; ++tx) pending |= !dropped[static_cast<size_t>(ty) * tilesX + tx];
+                }
+                if (!pending) continue;
+
+                const size_t x0 = static_cast<size_t>(bx) * kDisplayTileSize * pixelBytes;
+                const size_t span = std::min<size_t>(kDisplayTileSize, img.width - bx * kDisplayTileSize) * pixelBytes;
+                bool differs = false;
+                for (int y = y0; y < y1 && !differs; ++y) {
+                    const size_t offset = static_cast<size_t>(y) * rowBytes + x0;
+                    differs = std::memcmp(previous.Data() + offset, img.Data() + offset, span) != 0;
+                }
+                if (!differs) continue;
+                for (int ty = ty0; ty <= ty1; ++ty) {
+                    for (int tx = tx0; tx <= tx1; ++tx) {
+                        const size_t t = static_cast<size_t>(ty) * tilesX + tx;
+                        if (dropped[t]) continue;
+                        dropped[t] = true;
+                        tiles[t].clear();
+                        tiles[t].shrink_to_fit();
+                        dirty.emplace_back(tx, ty);
+                    }
+                }
+            }
+        }
+    }
+}
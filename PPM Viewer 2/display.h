@@ -0,0 +1,78 @@
+#pragma once
+
+#include "ppm.h"
+#include "transform.h"
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+// Display buffer: the renderer wants BGRX (32bpp top-down DIB). Instead of converting
+// the whole image up front, tiles are converted from the native samples the first
+// time they are painted, so tiles that never become visible never cost memory or time.
+constexpr int kDisplayTileSize = 256;
+
+// Entries of the gamma LUT used for float images (indexed by the tone-mapped value in [0, 1])
+constexpr int kFloatLutSize = 16384;
+
+// User-facing display adjustments. Exposure applies to every image (float samples
+// before tone mapping, integer ones to the sample scaled to [0, 1]); gamma and
+// reinhard encode float images for display. Levels then remap the display value
+// in [0, 1]: black and white points stretch [black, white] to [0, 1], and midGamma
+// brightens (> 1) or darkens (< 1) the midtones in between. All of it is folded
+// into DisplayTransform's LUT, so the samples are never touched. Only the color
+// channels are adjusted; alpha is shown as stored.
+struct ToneSettings {
+    float exposure = 0.0f; // stops
+    float gamma = 2.2f;
+    bool reinhard = true;  // v / (1 + v) before gamma, otherwise clip at 1
+    float black = 0.0f;
+    float white = 1.0f;
+    float midGamma = 1.0f;
+};
+
+// Sample -> 8-bit display value mapping, rebuilt whenever the image or the tone
+// settings change
+struct DisplayTransform {
+    std::vector<uint8_t> lut;   // integer images: indexed by sample (256 or 65536 entries);
+                                // float images: by the tone-mapped value (kFloatLutSize entries)
+    std::vector<uint8_t> alphaLut; // images with alpha: the alpha channel, scaled to 8 bits but
+                                   // never exposed or leveled (same indexing as lut)
+    float exposureScale = 1.0f; // float images: 2^exposure
+    bool reinhard = false;      // float images
+    bool identity = false;      // 8-bit LUT that maps every sample to itself: skipped
+};
+
+void BuildDisplayTransform(const Image& img, const ToneSettings& tone, DisplayTransform& xf);
+
+// Tiles are laid out over the image as shown, i.e. after `orientation`: a rotated or
+// flipped view costs nothing up front, each tile is oriented as it is converted.
+struct DisplayCache {
+    int tilesX = 0;
+    int tilesY = 0;
+    ToneSettings tone;
+    Orientation orientation = Orientation::Identity; // kept across Reset
+    DisplayTransform transform;
+    std::vector<std::vector<uint32_t>> tiles; // BGRX, empty until first requested
+    std::vector<uint32_t> scratch;            // unoriented tile, when orientation is not identity
+
+    void Reset(const Image& img);
+    // Apply new tone settings; already converted tiles are dropped and redone on demand
+    void SetTone(const Image& img, const ToneSettings& settings);
+    // Show img in orientation o; the tiles are laid out anew and redone on demand
+    void SetOrientation(const Image& img, Orientation o);
+    // Size of img as shown
+    int ViewWidth(const Image& img) const { return SwapsAxes(orientation) ? img.height : img.width; }
+    int ViewHeight(const Image& img) const { return SwapsAxes(orientation) ? img.width : img.height; }
+    // (tx, ty) is in view tiles
+    const uint32_t* GetTile(const Image& img, int tx, int ty, int& tileW, int& tileH);
+    // img replaced `previous` (same size and format), differing only within the
+    // `changed` rows: drop just the tiles whose samples differ and return them (tx,
+    // ty) in `dirty`, so only those are converted and repainted again
+    void Update(const Image& previous, const Image& img, const std::vector<RowRange>& changed,
+                std::vector<std::pair<int, int>>& dirty);
+};
+
+// Convert a w x h region at (x0, y0) of img into BGRX through xf; images with
+// alpha are composited over a checkerboard
+void ConvertToBGRX(const Image& img, const DisplayTransform& xf, int x0, int y0, int w, int h, uint32_t* dst, int dstStride);
@@ -0,0 +1,168 @@
+#include "file_watch.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// Helper: milliseconds left of the quiet period (a poll/wait timeout)
+static int QuietLeft(Clock::time_point lastEvent, int quietMs) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - lastEvent).count();
+    return static_cast<int>(std::max<long long>(0, quietMs - elapsed));
+}
+
+bool FileWatcher::Start(const std::string& filepath, std::function<void()> onChange, int quietMs) {
+    Stop();
+    const fs::path p = Utf8Path(filepath);
+    fs::path dir = p.parent_path();
+    if (dir.empty()) dir = ".";
+
+#ifdef _WIN32
+    directory_ = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                             nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (directory_ == INVALID_HANDLE_VALUE) {
+        directory_ = nullptr;
+        std::cerr << "Error: Could not watch directory of " << filepath << std::endl;
+        return false;
+    }
+    stopEvent_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#else
+    inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // Rewrites in place (close after write, attribute/size changes) and replacement by rename
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_MOVED_TO;
+    if (inotify_ < 0 || inotify_add_watch(inotify_, dir.c_str(), mask) < 0 || pipe(stopPipe_) != 0) {
+        std::cerr << "Error: Could not watch directory of " << filepath << std::endl;
+        if (inotify_ >= 0) close(inotify_);
+        inotify_ = -1;
+        return false;
+    }
+#endif
+
+    file_ = filepath;
+    // Changes before the watch started don't count
+    FileStamp stamp;
+    GetFileStamp(filepath, stamp);
+    thread_ = std::thread([this, onChange = std::move(onChange), quietMs, stamp] { Run(onChange, quietMs, stamp); });
+    return true;
+}
+
+void FileWatcher::Stop() {
+    if (!thread_.joinable()) return;
+#ifdef _WIN32
+    SetEvent(stopEvent_);
+    thread_.join();
+    CloseHandle(stopEvent_);
+    CloseHandle(directory_);
+    stopEvent_ = directory_ = nullptr;
+#else
+    const char wake = 1;
+    if (write(stopPipe_[1], &wake, 1) != 1) std::cerr << "Error: Could not stop file watcher." << std::endl;
+    thread_.join();
+    close(inotify_);
+    close(stopPipe_[0]);
+    close(stopPipe_[1]);
+    inotify_ = stopPipe_[0] = stopPipe_[1] = -1;
+#endif
+    file_.clear();
+}
+
+void FileWatcher::Run(std::function<void()> onChange, int quietMs, FileStamp last) {
+    const fs::path name = Utf8Path(file_).filename();
+    bool pending = false;
+    Clock::time_point lastEvent;
+
+    // After the quiet period: report only if the file really is different (a
+    // write of identical size and mtime, or a touch of another file, is not)
+    auto settle = [&]() {
+        pending = false;
+        FileStamp stamp;
+        if (!GetFileStamp(file_, stamp) || stamp == last) return;
+        last = stamp;
+        onChange();
+    };
+
+#ifdef _WIN32
+    const std::wstring target = name.wstring();
+    alignas(DWORD) char buffer[16384];
+    OVERLAPPED ov = {};
+    ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_FILE_NAME;
+    bool reading = ReadDirectoryChangesW(directory_, buffer, sizeof(buffer), FALSE, filter, nullptr, &ov, nullptr) != 0;
+    HANDLE handles[2] = { stopEvent_, ov.hEvent };
+    while (reading) {
+        const DWORD wait = WaitForMultipleObjects(2, handles, FALSE, pending ? static_cast<DWORD>(QuietLeft(lastEvent, quietMs)) : INFINITE);
+        if (wait == WAIT_OBJECT_0) break;
+        if (wait == WAIT_TIMEOUT) {
+            settle();
+            continue;
+        }
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(directory_, &ov, &bytes, FALSE)) break;
+        if (bytes == 0) {
+            // Buffer overflow: the names are lost, so assume our file was among them
+            pending = true;
+            lastEvent = Clock::now();
+        }
+        for (DWORD offset = 0; bytes > 0;) {
+            const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer + offset);
+            const int length = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+            if (CompareStringOrdinal(info->FileName, length, target.c_str(), static_cast<int>(target.size()), TRUE) == CSTR_EQUAL) {
+                pending = true;
+                lastEvent = Clock::now();
+            }
+            if (info->NextEntryOffset == 0) break;
+            offset += info->NextEntryOffset;
+        }
+        ResetEvent(ov.hEvent);
+        reading = ReadDirectoryChangesW(directory_, buffer, sizeof(buffer), FALSE, filter, nullptr, &ov, nullptr) != 0;
+    }
+    // The read still in flight must finish before buffer and ov go away
+    if (reading) {
+        DWORD bytes = 0;
+        CancelIoEx(directory_, &ov);
+        GetOverlappedResult(directory_, &ov, &bytes, TRUE);
+    }
+    CloseHandle(ov.hEvent);
+#else
+    const std::string target = name.string();
+    alignas(inotify_event) char buffer[16384];
+    pollfd fds[2] = { { stopPipe_[0], POLLIN, 0 }, { inotify_, POLLIN, 0 } };
+    for (;;) {
+        const int ready = poll(fds, 2, pending ? QuietLeft(lastEvent, quietMs) : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents) break;
+        if (ready == 0) {
+            settle();
+            continue;
+        }
+        ssize_t bytes;
+        while ((bytes = read(inotify_, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < bytes;) {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                if (event->mask & IN_Q_OVERFLOW || (event->len && target == event->name)) {
+                    pending = true;
+                    lastEvent = Clock::now();
+                }
+                offset += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "image_cache.h"
+
+#include <functional>
+#include <string>
+#include <thread>
+
+// Watches one file for rewrites, e.g. a renderer overwriting its output over and
+// over. The file's directory is watched (inotify on Linux, ReadDirectoryChangesW on
+// Windows), so files replaced by rename are caught too. Writes are debounced:
+// onChange runs once no event has arrived for `quietMs` and the file's size/mtime
+// differ from the last time it ran, so a file being written in several chunks is
+// reported once, after the last chunk.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    ~FileWatcher() { Stop(); }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Watch filepath (UTF-8), replacing any previous watch. onChange is called on
+    // the watcher's own thread. False (after printing) if the directory can't be watched.
+    bool Start(const std::string& filepath, std::function<void()> onChange, int quietMs = 250);
+    // Returns promptly: the watcher thread only ever blocks waiting for events
+    void Stop();
+
+    bool Active() const { return thread_.joinable(); }
+    const std::string& File() const { return file_; }
+
+private:
+    void Run(std::function<void()> onChange, int quietMs, FileStamp last);
+
+    std::string file_;
+    std::thread thread_;
+#ifdef _WIN32
+    void* directory_ = nullptr; // HANDLE of the watched directory
+    void* stopEvent_ = nullptr; // HANDLE, signaled by Stop()
+#else
+    int inotify_ = -1;
+    int stopPipe_[2] = { -1, -1 }; // Stop() writes to [1]
+#endif
+};
@@ -0,0 +1,166 @@
+#include "image_cache.h"
+#include "decode_cache.h"
+#include "utf8_path.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+bool GetFileStamp(const std::string& filepath, FileStamp& stamp) {
+    std::error_code ec;
+    const fs::path p = Utf8Path(filepath);
+    if (!fs::is_regular_file(p, ec)) return false;
+    const uintmax_t size = fs::file_size(p, ec);
+    if (ec) return false;
+    const fs::file_time_type mtime = fs::last_write_time(p, ec);
+    if (ec) return false;
+    stamp.size = size;
+    stamp.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return true;
+}
+
+std::shared_ptr<const uint8_t> MapFileReadOnly(const std::string& filepath, uint64_t& size) {
+    size = 0;
+    const fs::path p = Utf8Path(filepath);
+#ifdef _WIN32
+    HANDLE file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER fileSize = {};
+    void* view = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && static_cast<uint64_t>(fileSize.QuadPart) <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+    }
+    CloseHandle(file);
+    if (!view) return nullptr;
+    size = static_cast<uint64_t>(fileSize.QuadPart);
+    return std::shared_ptr<const uint8_t>(static_cast<const uint8_t*>(view),
+                                          [](const uint8_t* v) { UnmapViewOfFile(v); });
+#else
+    const int fd = open(p.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st = {};
+    void* view = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return nullptr;
+    const size_t length = static_cast<size_t>(st.st_size);
+    size = length;
+    return std::shared_ptr<const uint8_t>(static_cast<const uint8_t*>(view),
+                                          [length](const uint8_t* v) { munmap(const_cast<uint8_t*>(v), length); });
+#endif
+}
+
+std::shared_ptr<const Image> ImageCache::FindLocked(const std::string& filepath, const FileStamp& stamp) {
+    auto it = index_.find(filepath);
+    if (it == index_.end()) return nullptr;
+    if (!(it->second->stamp == stamp)) {
+        // The file changed since it was decoded
+        bytes_ -= it->second->bytes;
+        lru_.erase(it->second);
+        index_.erase(it);
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->image;
+}
+
+void ImageCache::EvictLocked() {
+    while (bytes_ > budget_ && !lru_.empty()) {
+        bytes_ -= lru_.back().bytes;
+        index_.erase(lru_.back().path);
+        lru_.pop_back();
+        ++evictions_;
+    }
+}
+
+std::shared_ptr<const Image> ImageCache::Load(const std::string& filepath) {
+    FileStamp stamp;
+    const bool stamped = GetFileStamp(filepath, stamp);
+    if (stamped) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (auto img = FindLocked(filepath, stamp)) {
+            ++hits_;
+            return img;
+        }
+        ++misses_;
+    }
+
+    std::shared_ptr<const Image> img = DecodeWithDiskCache(filepath);
+    if (!img) return nullptr;
+    // Without a stamp (e.g. stdin) there is nothing to validate a later hit against
+    if (!stamped) return img;
+
+    Entry entry;
+    entry.path = filepath;
+    entry.stamp = stamp;
+    // Rasters mapped from the decode cache are backed by the OS page cache, not the heap
+    entry.bytes = sizeof(Image) + img->samples.capacity() + img->tupleType.capacity();
+    entry.image = img;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Larger than the whole budget: hand it out, don't flush everything else for it
+    if (entry.bytes > budget_) return img;
+    // Another thread may have decoded the same file meanwhile; the newer copy wins
+    auto it = index_.find(filepath);
+    if (it != index_.end()) {
+        bytes_ -= it->second->bytes;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    bytes_ += entry.bytes;
+    lru_.push_front(std::move(entry));
+    index_[filepath] = lru_.begin();
+    EvictLocked();
+    return img;
+}
+
+std::shared_ptr<const Image> ImageCache::Find(const std::string& filepath) {
+    FileStamp stamp;
+    if (!GetFileStamp(filepath, stamp)) return nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return FindLocked(filepath, stamp);
+}
+
+void ImageCache::SetBudget(size_t budgetBytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = budgetBytes;
+    EvictLocked();
+}
+
+void ImageCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+ImageCacheStats ImageCache::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ImageCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.evictions = evictions_;
+    stats.bytes = bytes_;
+    stats.entries = lru_.size();
+    stats.budget = budget_;
+    return stats;
+}
+
+ImageCache& SharedImageCache() {
+    static ImageCache cache(size_t(1) << 30);
+    return cache;
+}
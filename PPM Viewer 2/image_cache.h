@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// File identity used to validate cached data: size and last write time
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    bool operator==(const FileStamp& o) const { return size == o.size && mtime == o.mtime; }
+};
+// False if the file can't be stat'ed (missing, or not a regular file such as "-")
+bool GetFileStamp(const std::string& filepath, FileStamp& stamp);
+// Map a whole file read-only; the mapping goes away with the last pointer copy. Null
+// if the file can't be opened or is empty.
+std::shared_ptr<const uint8_t> MapFileReadOnly(const std::string& filepath, uint64_t& size);
+
+struct ImageCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;    // includes entries found stale (file changed on disk)
+    uint64_t evictions = 0;
+    size_t bytes = 0;       // decoded bytes currently held
+    size_t entries = 0;
+    size_t budget = 0;
+};
+
+// Decoded images kept in memory, least recently used first out once the byte budget
+// is exceeded. Entries are keyed by (path, file size, mtime): the key is checked
+// against the file on every lookup, so a file rewritten on disk is decoded again.
+// Images are handed out as shared_ptr, so evicting one never invalidates a caller's
+// copy. Thread-safe; decoding happens outside the lock.
+class ImageCache {
+public:
+    explicit ImageCache(size_t budgetBytes) : budget_(budgetBytes) {}
+
+    // Decoded first image of filepath (cached or decoded now); null if it fails to decode
+    std::shared_ptr<const Image> Load(const std::string& filepath);
+    // Cached image only; null on a miss (does not touch the hit/miss counters)
+    std::shared_ptr<const Image> Find(const std::string& filepath);
+
+    // Shrinking the budget evicts immediately
+    void SetBudget(size_t budgetBytes);
+    void Clear();
+    ImageCacheStats Stats() const;
+
+private:
+    struct Entry {
+        std::string path;
+        FileStamp stamp;
+        std::shared_ptr<const Image> image;
+        size_t bytes = 0;
+    };
+
+    // Lookup under the lock; moves a fresh entry to the front, drops a stale one
+    std::shared_ptr<const Image> FindLocked(const std::string& filepath, const FileStamp& stamp);
+    void EvictLocked();
+
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t budget_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0, misses_ = 0, evictions_ = 0;
+    mutable std::mutex mutex_;
+};
+
+// The cache shared by everything in the process (1 GiB unless SetBudget says otherwise)
+ImageCache& SharedImageCache();
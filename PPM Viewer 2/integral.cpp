@@ -0,0 +1,156 @@
+#include "integral.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Row bands built in parallel hold at least this many samples
+constexpr size_t kIntegralBandSamples = 1 << 20;
+
+// 1. BUILDING THE TABLES
+// Helper: sample as accumulated (non-finite floats count as 0)
+static inline uint64_t Accumulate(uint8_t v) { return v; }
+static inline uint64_t Accumulate(uint16_t v) { return v; }
+static inline double Accumulate(float v) { return std::isfinite(v) ? v : 0.0; }
+
+// Helper: tables of rows [y0, y1) as if the image started at y0. Table row y + 1
+// is table row y plus the running sums of image row y.
+template <typename Sample, typename Acc>
+static void BuildBand(const Sample* samples, int width, int channels, int y0, int y1, Acc* sums, Acc* squares) {
+    const size_t stride = static_cast<size_t>(width + 1) * channels;
+    for (int y = y0; y < y1; ++y) {
+        const Sample* in = samples + static_cast<size_t>(y) * width * channels;
+        Acc* sum = sums + static_cast<size_t>(y + 1) * stride;
+        Acc* square = squares + static_cast<size_t>(y + 1) * stride;
+        const Acc* sumAbove = (y == y0) ? nullptr : sum - stride;
+        const Acc* squareAbove = (y == y0) ? nullptr : square - stride;
+        for (int c = 0; c < channels; ++c) sum[c] = square[c] = 0;
+        Acc rowSum[4] = {}, rowSquare[4] = {};
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) {
+                const Acc v = Accumulate(in[static_cast<size_t>(x) * channels + c]);
+                rowSum[c] += v;
+                rowSquare[c] += v * v;
+                const size_t i = static_cast<size_t>(x + 1) * channels + c;
+                sum[i] = rowSum[c] + (sumAbove ? sumAbove[i] : 0);
+                square[i] = rowSquare[c] + (squareAbove ? squareAbove[i] : 0);
+            }
+        }
+    }
+}
+
+// Helper: bands are built independently, then each band's rows get the totals of
+// all rows above it added (the last row of the band before, once that is final)
+template <typename Sample, typename Acc>
+static void BuildTables(const Sample* samples, int width, int height, int channels, unsigned threads,
+                        std::unique_ptr<Acc[]>& sums, std::unique_ptr<Acc[]>& squares, size_t& allocated) {
+    const size_t stride = static_cast<size_t>(width + 1) * channels;
+    const size_t size = stride * (height + 1);
+    if (!sums || allocated != size) {
+        sums.reset();
+        squares.reset();
+        sums.reset(new Acc[size]);
+        squares.reset(new Acc[size]);
+        allocated = size;
+    }
+    std::fill(sums.get(), sums.get() + stride, Acc(0));
+    std::fill(squares.get(), squares.get() + stride, Acc(0));
+
+    const size_t rowSamples = static_cast<size_t>(width) * channels;
+    const int minRows = static_cast<int>((kIntegralBandSamples + rowSamples - 1) / rowSamples);
+    const int bands = ParallelBandCount(height, threads, minRows);
+    std::vector<int> bounds(bands + 1);
+    ParallelBands(height, threads, minRows, [&](int i, int y0, int y1) {
+        bounds[i] = y0;
+        bounds[i + 1] = y1;
+        BuildBand(samples, width, channels, y0, y1, sums.get(), squares.get());
+    });
+    if (bands == 1) return;
+
+    // The last row of every band first (one row per band, in order), then the rest
+    for (int i = 1; i < bands; ++i) {
+        const size_t carry = static_cast<size_t>(bounds[i]) * stride;
+        const size_t last = static_cast<size_t>(bounds[i + 1]) * stride;
+        for (size_t j = 0; j < stride; ++j) {
+            sums[last + j] += sums[carry + j];
+            squares[last + j] += squares[carry + j];
+        }
+    }
+    ParallelBands(height, threads, minRows, [&](int i, int y0, int y1) {
+        if (i == 0) return;
+        const size_t carry = static_cast<size_t>(y0) * stride;
+        for (int y = y0 + 1; y < y1; ++y) {
+            const size_t row = static_cast<size_t>(y) * stride;
+            for (size_t j = 0; j < stride; ++j) {
+                sums[row + j] += sums[carry + j];
+                squares[row + j] += squares[carry + j];
+            }
+        }
+    });
+}
+
+bool IntegralImage::Build(const Image& img, unsigned threads) {
+    if (!img.HasSamples() || img.width <= 0 || img.height <= 0 || img.channels < 1 || img.channels > 4) {
+        Clear();
+        return false;
+    }
+    // Tables of the other sample kind are not reused
+    if (img.isFloat != isFloat_) Clear();
+    width_ = img.width;
+    height_ = img.height;
+    channels_ = img.channels;
+    isFloat_ = img.isFloat;
+    if (img.isFloat) {
+        BuildTables(reinterpret_cast<const float*>(img.Data()), width_, height_, channels_, threads, fsums_, fsquares_, allocated_);
+    } else if (img.BytesPerSample() == 2) {
+        BuildTables(img.Samples16(), width_, height_, channels_, threads, sums_, squares_, allocated_);
+    } else {
+        BuildTables(img.Data(), width_, height_, channels_, threads, sums_, squares_, allocated_);
+    }
+    return true;
+}
+
+void IntegralImage::Clear() {
+    width_ = height_ = channels_ = 0;
+    isFloat_ = false;
+    allocated_ = 0;
+    sums_.reset();
+    squares_.reset();
+    fsums_.reset();
+    fsquares_.reset();
+}
+
+// 2. QUERIES
+// Helper: sum over the rectangle from its four corners. Unsigned sums wrap, but the
+// result is exact as the true value fits.
+template <typename Acc>
+static Acc Corners(const std::unique_ptr<Acc[]>& table, size_t stride, int channels, int x0, int y0, int x1, int y1, int c) {
+    auto at = [&](int x, int y) { return table[static_cast<size_t>(y) * stride + static_cast<size_t>(x) * channels + c]; };
+    return at(x1, y1) - at(x0, y1) - at(x1, y0) + at(x0, y0);
+}
+
+bool IntegralImage::Query(int x, int y, int w, int h, RegionStats& stats) const {
+    stats = RegionStats{};
+    const int x0 = std::clamp(x, 0, width_), x1 = std::clamp(x + std::max(w, 0), 0, width_);
+    const int y0 = std::clamp(y, 0, height_), y1 = std::clamp(y + std::max(h, 0), 0, height_);
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    const size_t stride = static_cast<size_t>(width_ + 1) * channels_;
+    stats.channels = channels_;
+    stats.pixels = static_cast<uint64_t>(x1 - x0) * (y1 - y0);
+    const double n = static_cast<double>(stats.pixels);
+    for (int c = 0; c < channels_; ++c) {
+        double sum, square;
+        if (isFloat_) {
+            sum = Corners(fsums_, stride, channels_, x0, y0, x1, y1, c);
+            square = Corners(fsquares_, stride, channels_, x0, y0, x1, y1, c);
+        } else {
+            sum = static_cast<double>(Corners(sums_, stride, channels_, x0, y0, x1, y1, c));
+            square = static_cast<double>(Corners(squares_, stride, channels_, x0, y0, x1, y1, c));
+        }
+        stats.mean[c] = sum / n;
+        stats.variance[c] = std::max(0.0, square / n - stats.mean[c] * stats.mean[c]);
+    }
+    return true;
+}
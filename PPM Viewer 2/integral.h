@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstdint>
+#include <memory>
+
+// Mean and spread of each channel over a rectangle, in sample units (0..maxVal for
+// integer images, nominal [0, 1] for float ones)
+struct RegionStats {
+    int channels = 0;
+    uint64_t pixels = 0;
+    double mean[4] = {};
+    double variance[4] = {}; // population variance
+};
+
+// Summed-area tables of an image: per channel, the sum and the sum of squares of
+// all samples above and to the left of every pixel corner. Once built, any
+// rectangle's mean and variance take four lookups per table, however large it is.
+// Integer images accumulate exactly in 64 bits (squares of 16-bit samples included,
+// up to 2^32 pixels), float ones in double with non-finite samples counted as 0.
+// At 16 bytes per sample the tables are several times the image, so they are only
+// built where region statistics are actually asked for; rebuilding them for an
+// image of the same size and format (the next frame) reuses their memory.
+class IntegralImage {
+public:
+    // Row bands go to `threads` threads; 0 = one per hardware thread
+    bool Build(const Image& img, unsigned threads = 0);
+    void Clear();
+    bool Empty() const { return width_ == 0; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+
+    // Statistics of the w x h rectangle at (x, y), clipped to the image; false when
+    // nothing of it is left
+    bool Query(int x, int y, int w, int h, RegionStats& stats) const;
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int channels_ = 0;
+    bool isFloat_ = false;
+    size_t allocated_ = 0; // entries of each table
+    // (width + 1) x (height + 1) corners, channels interleaved; row and column 0 are zero.
+    // Not value-initialized: the build writes every entry, from the threads that use it.
+    std::unique_ptr<uint64_t[]> sums_, squares_; // integer images
+    std::unique_ptr<double[]> fsums_, fsquares_; // float images
+};
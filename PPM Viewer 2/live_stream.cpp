@@ -0,0 +1,296 @@
+#include "live_stream.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <istream>
+#include <streambuf>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Helper: streambuf handing out whatever one read of the source returns instead of
+// waiting for the full request, so PnmReader only blocks for the bytes a frame
+// still needs (the end of a frame is not held back until the next one arrives)
+class PipeBuf : public std::streambuf {
+public:
+    explicit PipeBuf(std::function<size_t(char*, size_t)> readSome) : readSome_(std::move(readSome)) {}
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        const size_t got = readSome_(buffer_, sizeof(buffer_));
+        if (got == 0) return traits_type::eof();
+        setg(buffer_, buffer_, buffer_ + got);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+        // Buffered bytes first; otherwise a single read straight into the destination
+        const std::streamsize buffered = std::min<std::streamsize>(n, egptr() - gptr());
+        if (buffered > 0) {
+            std::memcpy(s, gptr(), static_cast<size_t>(buffered));
+            gbump(static_cast<int>(buffered));
+            return buffered;
+        }
+        return n > 0 ? static_cast<std::streamsize>(readSome_(s, static_cast<size_t>(n))) : 0;
+    }
+
+private:
+    std::function<size_t(char*, size_t)> readSome_;
+    char buffer_[4096];
+};
+
+// Prefix of shared memory sources
+constexpr const char* kShmPrefix = "shm:";
+
+bool IsLiveSource(const std::string& path) {
+    if (path == "-" || path.rfind(kShmPrefix, 0) == 0) return true;
+#ifdef _WIN32
+    return path.size() > 9 && _strnicmp(path.c_str(), "\\\\.\\pipe\\", 9) == 0;
+#else
+    std::error_code ec;
+    return fs::is_fifo(Utf8Path(path), ec);
+#endif
+}
+
+LiveStream::LiveStream(size_t ringSize) {
+    // One shown, one waiting, one being decoded
+    ring_.resize(std::max<size_t>(ringSize, 3));
+    for (auto& buffer : ring_) buffer = std::make_shared<Image>();
+}
+
+bool LiveStream::Start(const std::string& source, std::function<void()> onFrame) {
+    Stop();
+    if (source.rfind(kShmPrefix, 0) == 0) {
+        shm_ = std::make_unique<ShmFrameReader>();
+        if (!shm_->Open(source.substr(std::strlen(kShmPrefix)))) {
+            shm_.reset();
+            return false;
+        }
+    }
+#ifdef _WIN32
+    if (shm_) {
+        input_ = nullptr;
+        ownsInput_ = false;
+    } else if (source == "-") {
+        input_ = GetStdHandle(STD_INPUT_HANDLE);
+        ownsInput_ = false;
+    } else {
+        input_ = CreateFileW(Utf8Path(source).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        ownsInput_ = true;
+    }
+    if (!shm_ && (input_ == INVALID_HANDLE_VALUE || input_ == nullptr)) {
+        input_ = nullptr;
+        std::cerr << "Error: Could not open stream: " << source << std::endl;
+        return false;
+    }
+    stopping_ = false;
+#else
+    // Non-blocking open: a FIFO would otherwise wait here for its writer. Reads only
+    // follow a poll(), so stdin is read as it is, without changing its flags.
+    ownsInput_ = !shm_ && source != "-";
+    input_ = shm_ ? -1 : (ownsInput_ ? open(Utf8Path(source).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC) : 0);
+    if ((!shm_ && input_ < 0) || pipe(stopPipe_) != 0) {
+        std::cerr << "Error: Could not open stream: " << source << std::endl;
+        if (ownsInput_ && input_ >= 0) close(input_);
+        input_ = -1;
+        shm_.reset();
+        return false;
+    }
+#endif
+
+    source_ = source;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.reset();
+        readyFrame_ = received_ = dropped_ = 0;
+        ended_ = false;
+    }
+    finished_ = false;
+    thread_ = std::thread([this, onFrame = std::move(onFrame)] { Run(onFrame); });
+    return true;
+}
+
+void LiveStream::Stop() {
+    if (!thread_.joinable()) return;
+#ifdef _WIN32
+    stopping_ = true;
+    // Only a read already in progress is cancelled: repeat until the reader has left
+    while (!finished_) {
+        CancelSynchronousIo(thread_.native_handle());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    thread_.join();
+    if (ownsInput_) CloseHandle(input_);
+    input_ = nullptr;
+    ownsInput_ = false;
+#else
+    const char wake = 1;
+    if (write(stopPipe_[1], &wake, 1) != 1) std::cerr << "Error: Could not stop stream reader." << std::endl;
+    thread_.join();
+    if (ownsInput_) close(input_);
+    close(stopPipe_[0]);
+    close(stopPipe_[1]);
+    input_ = stopPipe_[0] = stopPipe_[1] = -1;
+    ownsInput_ = false;
+#endif
+    // Frames already handed out keep the ring mapped
+    shm_.reset();
+    source_.clear();
+}
+
+bool LiveStream::StopRequested() {
+#ifdef _WIN32
+    return stopping_;
+#else
+    pollfd fd = { stopPipe_[0], POLLIN, 0 };
+    return poll(&fd, 1, 0) > 0;
+#endif
+}
+
+size_t LiveStream::ReadSome(char* dst, size_t count) {
+#ifdef _WIN32
+    if (stopping_) return 0;
+    DWORD got = 0;
+    const DWORD want = static_cast<DWORD>(std::min<size_t>(count, 1u << 30));
+    // Fails once the writer closes the pipe, or when Stop() cancels the read
+    if (!ReadFile(input_, dst, want, &got, nullptr)) return 0;
+    return got;
+#else
+    pollfd fds[2] = { { stopPipe_[0], POLLIN, 0 }, { input_, POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        if (fds[0].revents) return 0;
+        const ssize_t got = read(input_, dst, count);
+        if (got >= 0) return static_cast<size_t>(got);
+        if (errno != EAGAIN && errno != EINTR) return 0;
+    }
+#endif
+}
+
+std::shared_ptr<Image> LiveStream::FreeBuffer() {
+    for (const auto& buffer : ring_) {
+        // Copies only come from ready_ (under the lock), so a count of one stays one
+        if (buffer != ready_ && buffer.use_count() == 1) {
+            // Pairs with the release of the consumer's last copy
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+void LiveStream::Run(std::function<void()> onFrame) {
+    if (shm_) ReadShm(onFrame);
+    else ReadPipe(onFrame);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ended_ = true;
+    }
+    onFrame();
+    finished_ = true;
+}
+
+void LiveStream::Publish(std::shared_ptr<const Image> img, uint64_t frame, const std::function<void()>& onFrame) {
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // The waiting frame was not taken in time: the newer one replaces it
+        if (ready_) ++dropped_;
+        else notify = true;
+        ready_ = std::move(img);
+        readyFrame_ = frame;
+    }
+    if (notify) onFrame();
+}
+
+void LiveStream::ReadPipe(const std::function<void()>& onFrame) {
+    PipeBuf buf([this](char* dst, size_t count) { return ReadSome(dst, count); });
+    std::istream in(&buf);
+    PnmReader reader(in);
+    uint64_t frame = 0;
+
+    // Frames may be separated by whitespace; end of data is a clean end of stream
+    while (reader.SkipSpace()) {
+        PnmHeader header;
+        if (!ReadPnmHeader(reader, header)) break;
+        ++frame;
+        std::shared_ptr<Image> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            received_ = frame;
+            buffer = FreeBuffer();
+            if (!buffer) ++dropped_;
+        }
+        if (!buffer) {
+            // Every buffer is on screen or waiting: this frame is never shown
+            if (!SkipPnmRaster(reader, header)) break;
+            continue;
+        }
+        if (!ReadPnmRaster(reader, header, *buffer)) break;
+        Publish(std::move(buffer), frame, onFrame);
+    }
+}
+
+void LiveStream::ReadShm(const std::function<void()>& onFrame) {
+    uint64_t seen = 0;
+    // Wakes up now and then without a frame to notice Stop()
+    while (!StopRequested()) {
+        if (!shm_->Wait(50)) continue;
+        // Checked first: the producer publishes its last frame before it closes
+        const bool closed = shm_->Closed();
+        uint64_t frame = 0;
+        std::shared_ptr<const Image> img = shm_->Latest(&frame);
+        if (!img) {
+            if (closed) break;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Frame numbers are the producer's: a gap is frames replaced before they
+            // were looked at, or dropped by the producer for lack of a free slot.
+            // Frames sent before this reader attached were never missed by it.
+            if (seen) dropped_ += frame - seen - 1;
+            received_ = frame;
+        }
+        seen = frame;
+        Publish(std::move(img), frame, onFrame);
+    }
+}
+
+std::shared_ptr<const Image> LiveStream::Take(uint64_t* frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (frame) *frame = readyFrame_;
+    return std::move(ready_);
+}
+
+bool LiveStream::Ended() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ended_;
+}
+
+uint64_t LiveStream::Received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return received_;
+}
+
+uint64_t LiveStream::Dropped() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ppm.h"
+#include "shm_frames.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// True for inputs that are read as a live stream rather than opened as a file:
+// "-" (stdin), named pipes (FIFOs, or \\.\pipe\ names on Windows) and "shm:NAME"
+// (a shared memory frame ring, see ShmFrameWriter)
+bool IsLiveSource(const std::string& path);
+
+// A continuous stream of concatenated Netpbm frames (e.g. `renderer | viewer -`),
+// decoded on a reader thread into a small ring of reused frame buffers. Only the
+// newest complete frame waits for the consumer: one it didn't take in time is
+// dropped for the next, and while every buffer is still held the incoming frame's
+// raster is skipped. A slow consumer thus never stalls the producer, and memory
+// stays at `ringSize` frames.
+//
+// A "shm:NAME" source skips all of that: its frames already sit in shared memory
+// in Image's layout and are handed on as they are, newest first, without a copy.
+class LiveStream {
+public:
+    explicit LiveStream(size_t ringSize = 3);
+    ~LiveStream() { Stop(); }
+
+    LiveStream(const LiveStream&) = delete;
+    LiveStream& operator=(const LiveStream&) = delete;
+
+    // Read source ("-" for stdin, "shm:NAME", or a pipe/file path, UTF-8), replacing
+    // any previous stream. onFrame is called on the reader thread when a frame
+    // becomes ready while none was waiting, and once more when the stream ends.
+    // False (after printing) if the source can't be opened.
+    bool Start(const std::string& source, std::function<void()> onFrame);
+    // Returns promptly, also while the reader is blocked waiting for data
+    void Stop();
+
+    // Newest frame not taken yet, or null; frame (optional) receives its 1-based
+    // position in the stream. The buffer is reused once every copy is released.
+    std::shared_ptr<const Image> Take(uint64_t* frame = nullptr);
+
+    bool Active() const { return thread_.joinable(); }
+    const std::string& Source() const { return source_; }
+    // The producer closed the stream (or sent something that isn't a frame)
+    bool Ended();
+    // Frames that arrived, and those never shown (replaced while waiting, or skipped)
+    uint64_t Received();
+    uint64_t Dropped();
+
+private:
+    void Run(std::function<void()> onFrame);
+    // Decode frames from input_ / hand on frames from shm_ until the stream ends
+    void ReadPipe(const std::function<void()>& onFrame);
+    void ReadShm(const std::function<void()>& onFrame);
+    // Make img the waiting frame (replacing one not taken in time)
+    void Publish(std::shared_ptr<const Image> img, uint64_t frame, const std::function<void()>& onFrame);
+    bool StopRequested();
+    // Whatever one read returns (blocking until there is something); 0 at the end
+    // of the stream or once Stop() was called
+    size_t ReadSome(char* dst, size_t count);
+    // A buffer nobody else holds (lock held), or null
+    std::shared_ptr<Image> FreeBuffer();
+
+    std::string source_;
+    std::vector<std::shared_ptr<Image>> ring_;
+    std::unique_ptr<ShmFrameReader> shm_; // "shm:" sources only
+    std::shared_ptr<const Image> ready_;  // newest complete frame, not yet taken
+    uint64_t readyFrame_ = 0;
+    uint64_t received_ = 0, dropped_ = 0;
+    bool ended_ = false;
+    std::mutex mutex_;
+    std::thread thread_;
+    std::atomic<bool> finished_{false}; // Run() returned
+#ifdef _WIN32
+    void* input_ = nullptr; // HANDLE read from; stdin's is not closed
+    bool ownsInput_ = false;
+    std::atomic<bool> stopping_{false};
+#else
+    int input_ = -1;
+    bool ownsInput_ = false;
+    int stopPipe_[2] = { -1, -1 }; // Stop() writes to [1]
+#endif
+};
@@ -1,32 +1,153 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
-#include <sstream>
 #include <cstdint>
 #include <algorithm>
+#include <memory>
+#include <climits>
+#include <cwchar>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
 #include <windows.h>
+#include <windowsx.h> // GET_X_LPARAM / GET_Y_LPARAM
 #include <commdlg.h> // For GetOpenFileName and OPENFILENAME
 
+#include "ppm.h"
+#include "display.h"
+#include "sequence.h"
+#include "image_cache.h"
+#include "decode_cache.h"
+#include "thumbnails.h"
+#include "file_watch.h"
+#include "live_stream.h"
+#include "compare.h"
+#include "thread_pool.h"
+#include "transform.h"
+#include "integral.h"
+#include "tiled.h"
+
 // Forward-declare CommandLineToArgvW to avoid pulling in shellapi.h here
 extern "C" __declspec(dllimport) LPWSTR* __stdcall CommandLineToArgvW(LPCWSTR lpCmdLine, int* pNumArgs);
 
 // Menu command IDs
 constexpr int ID_FILE_OPEN = 9001;
+constexpr int ID_FILE_SAVE_AS = 9002;
+constexpr int ID_FILE_BROWSE = 9003;
+constexpr int ID_VIEW_EXPOSURE_UP = 9101;
+constexpr int ID_VIEW_EXPOSURE_DOWN = 9102;
+constexpr int ID_VIEW_REINHARD = 9103;
+constexpr int ID_VIEW_WATCH = 9104;
+constexpr int ID_VIEW_COMPARE_WITH = 9105;
+constexpr int ID_VIEW_COMPARE = 9106;
+constexpr int ID_VIEW_STATS = 9107;
+constexpr int ID_VIEW_BLACK_UP = 9108;
+constexpr int ID_VIEW_BLACK_DOWN = 9109;
+constexpr int ID_VIEW_WHITE_UP = 9110;
+constexpr int ID_VIEW_WHITE_DOWN = 9111;
+constexpr int ID_VIEW_MIDTONES_UP = 9112;
+constexpr int ID_VIEW_MIDTONES_DOWN = 9113;
+constexpr int ID_VIEW_LEVELS_RESET = 9114;
+constexpr int ID_VIEW_ROTATE_CW = 9115;
+constexpr int ID_VIEW_ROTATE_CCW = 9116;
+constexpr int ID_VIEW_FLIP_H = 9117;
+constexpr int ID_VIEW_FLIP_V = 9118;
+constexpr int ID_VIEW_CLEAR_REGION = 9119;
+constexpr int ID_FRAME_NEXT = 9201;
+constexpr int ID_FRAME_PREV = 9202;
+constexpr int ID_FRAME_FIRST = 9203;
+constexpr int ID_FRAME_LAST = 9204;
+constexpr int ID_SEQ_NEXT = 9301;
+constexpr int ID_SEQ_PREV = 9302;
+
+// Posted by thumbnail workers: wParam = index of the finished cell
+constexpr UINT WM_APP_THUMB_READY = WM_APP + 1;
+// Posted by the file watcher when the shown file was rewritten
+constexpr UINT WM_APP_FILE_CHANGED = WM_APP + 2;
+// Posted by the reload thread when g_reloaded holds a fresh decode
+constexpr UINT WM_APP_RELOADED = WM_APP + 3;
+// Posted by the live stream reader when a frame is waiting (or the stream ended)
+constexpr UINT WM_APP_LIVE_FRAME = WM_APP + 4;
+
+// Browse grid layout: a thumbnail with padding around it and its file name below
+constexpr int kGridPad = 8;
+constexpr int kGridLabel = 18;
+constexpr int kGridCellW = kThumbnailSize + 2 * kGridPad;
+constexpr int kGridCellH = kThumbnailSize + 2 * kGridPad + kGridLabel;
 
 // 1. DATA STRUCTURES
 struct Pixel {
     uint8_t b, g, r, a; // Windows expects Blue-Green-Red-Alpha order usually
 };
 
-struct Image {
-    int width = 0;
-    int height = 0;
-    std::vector<uint32_t> pixels; // Raw memory buffer (The Framebuffer)
-};
-
-// Global image variable so the Window Procedure can access it
-static Image g_image;
+// Global image variable so the Window Procedure can access it (shared with the
+// sequence prefetcher's cache, so showing a prefetched frame doesn't copy it)
+static std::shared_ptr<const Image> g_image = std::make_shared<Image>();
+static DisplayCache g_display;
+// The file g_image came from, kept open so multi-image files can be stepped through
+static PnmStream g_frames;
+// The other Netpbm files of that directory, decoded ahead of time for next/previous file
+static FramePrefetcher g_sequence;
+static size_t g_sequenceIndex = 0;
+// Browse mode: a scrollable grid of thumbnails of the sequence's files. The loader
+// (and its worker threads) is created the first time the grid is shown.
+static std::unique_ptr<ThumbnailLoader> g_thumbs;
+static bool g_browsing = false;
+static int g_gridScroll = 0; // pixels scrolled down
+// Watch mode: the shown file is decoded again on a background thread whenever it is
+// rewritten, and the result swapped into g_image on the UI thread
+static FileWatcher g_watcher;
+static bool g_watching = false;
+static ThreadPool g_reloadPool(1);
+static std::mutex g_reloadMutex;
+static std::shared_ptr<const Image> g_reloaded;     // guarded by g_reloadMutex
+static std::shared_ptr<const Image> g_reloadedFrom; // the image it was diffed against (guarded)
+static std::vector<RowRange> g_reloadedRows;        // rows that differ from it (guarded)
+static std::string g_reloadedPath;                  // guarded by g_reloadMutex
+static bool g_reloadBusy = false, g_reloadAgain = false;
+// Reload thread only: band hashes of the last reload and the image they describe
+static PnmBandHashes g_reloadHashes;
+static std::shared_ptr<const Image> g_hashedImage;
+// Live mode: frames piped in ("-", a named pipe or a "shm:NAME" ring) are shown as they arrive; the
+// newest frame wins and older ones are dropped when painting can't keep up
+static LiveStream g_live;
+static uint64_t g_liveFrame = 0; // stream position of the frame on screen
+// Compare mode: whatever is on screen is diffed against a reference image, and
+// shown as a heatmap of the differences, as the reference, or as itself
+enum class CompareView { Off, Heatmap, Reference };
+static CompareView g_compareView = CompareView::Off;
+static std::shared_ptr<const Image> g_reference;
+static std::string g_referencePath;
+// The image g_heatmap/g_compareStats describe; not held, so a live frame's buffer goes back to the ring
+static std::weak_ptr<const Image> g_compared;
+static std::shared_ptr<const Image> g_heatmap; // null when it doesn't compare with the reference
+static CompareStats g_compareStats;
+static DisplayCache g_compareDisplay;          // tiles of the heatmap or the reference
+// Statistics panel: histograms and per-channel figures of g_image in the top left
+// corner. While it is shown the decoders gather them as they go (SetCollectStats).
+static bool g_showStats = false;
+static std::weak_ptr<const Image> g_statsOf;       // image g_stats was counted for
+static std::shared_ptr<const ImageStats> g_stats;  // for images decoded without them
+
+// Statistics panel layout: one histogram for all channels, a line of text per channel
+constexpr int kStatsMargin = 8;
+constexpr int kStatsPad = 6;
+constexpr int kStatsHistH = 80;
+constexpr int kStatsLineH = 16;
+constexpr int kStatsW = ImageStats::kBins + 2 * kStatsPad + 160;
+
+// Region measurement: a rectangle dragged over the image (client coordinates, so as
+// shown) and the mean and standard deviation of g_image under it, looked up in
+// summed-area tables built the first time a region is measured on an image
+static bool g_regionShown = false;
+static bool g_dragging = false;
+static POINT g_dragFrom = {}, g_dragTo = {};
+static IntegralImage g_integral;
+static std::weak_ptr<const Image> g_integralOf; // image g_integral was built for
+
+// Region label layout: below the rectangle, a line for its size and one per channel
+constexpr int kRegionLabelW = 280;
+constexpr int kRegionGap = 4;
 
 // Helper: adjust window size so client area matches image size
 static void SetWindowClientSize(HWND hwnd, int clientWidth, int clientHeight) {
@@ -40,6 +161,11 @@ static void SetWindowClientSize(HWND hwnd, int clientWidth, int clientHeight) {
     SetWindowPos(hwnd, NULL, 0, 0, winW, winH, SWP_NOMOVE | SWP_NOZORDER);
 }
 
+// Helper: fit the client area to g_image as shown (rotated by 90 degrees it is the other way up)
+static void FitWindow(HWND hwnd) {
+    SetWindowClientSize(hwnd, g_display.ViewWidth(*g_image), g_display.ViewHeight(*g_image));
+}
+
 // Helper: convert wide string to UTF-8
 static std::string WideToUtf8(const std::wstring& w) {
     if (w.empty()) return {};
@@ -52,357 +178,755 @@ static std::string WideToUtf8(const std::wstring& w) {
     return s;
 }
 
-// 2. PARSING THE PPM (P3 FORMAT)
-// This converts the text "255 0 0" into binary color data in RAM.
-Image LoadPPM(const std::string& filepath) {
+// Helper: convert UTF-8 to wide string
+static std::wstring Utf8ToWide(const std::string& s) {
+    if (s.empty()) return {};
+    int size = ::MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+    if (size <= 0) return {};
+    std::wstring w;
+    w.resize(size);
+    ::MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &w[0], size);
+    if (!w.empty() && w.back() == L'\0') w.pop_back();
+    return w;
+}
+
+// Helper: the image painted: g_image, or in compare mode its heatmap or the reference
+// (g_image again when the two don't compare)
+static const Image& ShownImage() {
+    if (g_compareView == CompareView::Off || !g_heatmap) return *g_image;
+    return g_compareView == CompareView::Heatmap ? *g_heatmap : *g_reference;
+}
+
+static DisplayCache& ShownDisplay() {
+    return &ShownImage() == g_image.get() ? g_display : g_compareDisplay;
+}
+
+// Helper: start over the tiles of the heatmap or reference after switching views
+static void ResetCompareDisplay() {
+    g_compareDisplay.tone = g_display.tone;
+    g_compareDisplay.orientation = g_display.orientation;
+    g_compareDisplay.Reset(ShownImage());
+}
+
+// Helper: diff g_image against the reference unless that was done already. The
+// heatmap is scaled to the largest difference, so any difference shows.
+static void RefreshCompare() {
+    if (!g_reference || g_compareView == CompareView::Off || g_compared.lock() == g_image) return;
+    g_compared = g_image;
+    g_heatmap.reset();
+    if (CompareImages(*g_reference, *g_image, g_compareStats)) {
+        g_heatmap = std::make_shared<Image>(DiffHeatmap(*g_reference, *g_image, g_compareStats.maxError));
+        std::cout << "Compared with " << g_referencePath << ": max error " << g_compareStats.maxError << ", PSNR "
+                  << g_compareStats.psnr << " dB, SSIM " << g_compareStats.ssim << ", " << g_compareStats.differing
+                  << " pixels differ" << std::endl;
+    }
+    ResetCompareDisplay();
+}
+
+// Helper: apply new float tone settings and repaint
+static void ApplyTone(HWND hwnd, const ToneSettings& tone) {
+    g_display.SetTone(*g_image, tone);
+    g_compareDisplay.SetTone(ShownImage(), tone);
+    CheckMenuItem(GetMenu(hwnd), ID_VIEW_REINHARD, MF_BYCOMMAND | (tone.reinhard ? MF_CHECKED : MF_UNCHECKED));
+    std::cout << "Exposure " << tone.exposure << " EV, gamma " << tone.gamma
+              << (tone.reinhard ? ", Reinhard" : ", clip") << ", levels " << tone.black << "-" << tone.white
+              << " midtones " << tone.midGamma << std::endl;
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: open a (possibly multi-image) file and decode its first frame into g_image
+static bool OpenFrames(const std::string& path) {
+    // Files come from the cache; the stream only steps over frame 0 so that later
+    // frames can be reached
+    std::shared_ptr<const Image> img = SharedImageCache().Load(path);
+    if (!img) return false;
+    // A tiled container holds a single image: there are no frames to step through
+    if (IsTiledFile(path)) g_frames = PnmStream();
+    else if (!g_frames.Open(path) || !g_frames.Skip()) return false;
+    g_live.Stop(); // an opened file replaces a live stream
+    g_image = std::move(img);
+    // Single-image files are the common case: find out now so the title can say so
+    if (g_frames.Seekable()) g_frames.AtEnd();
+    g_display.Reset(*g_image);
+
+    // Neighbouring files become the sequence; the prefetcher starts on them right away
+    size_t index = 0;
+    std::vector<std::string> files = ListSequence(path, index);
+    g_sequence.SetFiles(std::move(files), index, g_image);
+    g_sequenceIndex = index;
+    return true;
+}
+
+// Helper: sequence navigation closes g_frames; reopen the current file when its
+// frames are stepped through (frame 0 is already on screen)
+static bool EnsureFrames() {
+    if (g_frames.IsOpen()) return true;
+    if (g_sequenceIndex >= g_sequence.Size()) return false;
+    const std::string& file = g_sequence.File(g_sequenceIndex);
+    return !IsTiledFile(file) && g_frames.Open(file) && g_frames.Skip();
+}
+
+// Helper: in compare mode, the title says what is shown and how far it is off
+static void AppendCompareTitle(std::wstring& title) {
+    if (g_compareView == CompareView::Off || !g_reference) return;
+    RefreshCompare();
+    if (!g_heatmap) {
+        title += L" - does not compare with the reference";
+        return;
+    }
+    wchar_t text[128];
+    swprintf(text, 128, L" - %ls: max error %g, PSNR %.2f dB, SSIM %.5f",
+             g_compareView == CompareView::Heatmap ? L"difference" : L"reference",
+             g_compareStats.maxError, g_compareStats.psnr, g_compareStats.ssim);
+    title += text;
+}
+
+// Helper: window title with the frame position for multi-image files
+static void UpdateTitle(HWND hwnd) {
+    std::wstring title = L"My C++ PPM Viewer";
+    if (g_browsing) {
+        title += L" - browsing " + std::to_wstring(g_thumbs->Size()) + L" files";
+        SetWindowTextW(hwnd, title.c_str());
+        return;
+    }
+    if (g_live.Active()) {
+        title += L" - live frame " + std::to_wstring(g_liveFrame);
+        const uint64_t dropped = g_live.Dropped();
+        if (dropped) title += L" (" + std::to_wstring(dropped) + L" dropped)";
+        if (g_live.Ended()) title += L" - ended";
+        AppendCompareTitle(title);
+        SetWindowTextW(hwnd, title.c_str());
+        return;
+    }
+    const size_t current = g_frames.Position();
+    if (g_frames.IsOpen() && (current > 1 || g_frames.IndexedCount() > 1 || !g_frames.IndexComplete())) {
+        title += L" - frame " + std::to_wstring(current);
+        if (g_frames.IndexComplete()) title += L"/" + std::to_wstring(g_frames.IndexedCount());
+    }
+    if (g_sequence.Size() > 1 && g_sequenceIndex < g_sequence.Size()) {
+        std::string name = g_sequence.File(g_sequenceIndex);
+        const size_t slash = name.find_last_of("/\\");
+        if (slash != std::string::npos) name.erase(0, slash + 1);
+        title += L" - " + Utf8ToWide(name) + L" [" + std::to_wstring(g_sequenceIndex + 1) + L"/" + std::to_wstring(g_sequence.Size()) + L"]";
+    }
+    AppendCompareTitle(title);
+    SetWindowTextW(hwnd, title.c_str());
+}
+
+// Helper: the file on screen ("" for stdin or the startup gradient)
+static std::string CurrentFile() {
+    return g_sequenceIndex < g_sequence.Size() ? g_sequence.File(g_sequenceIndex) : std::string();
+}
+
+// Helper: point the watcher at the file on screen, or stop it when watch mode is off
+static void UpdateWatch(HWND hwnd) {
+    const std::string file = g_watching ? CurrentFile() : std::string();
+    if (file.empty()) {
+        g_watcher.Stop();
+        return;
+    }
+    if (g_watcher.Active() && g_watcher.File() == file) return;
+    g_watcher.Start(file, [hwnd] { PostMessageW(hwnd, WM_APP_FILE_CHANGED, 0, 0); });
+}
+
+// Helper: decode frame `index` of the open file and show it
+static void ShowFrame(HWND hwnd, size_t index) {
+    if (index != g_frames.Position() && !g_frames.Seek(index)) return;
     Image img;
-    std::ifstream file(filepath, std::ios::binary);
-
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open file: " << filepath << std::endl;
-        return img;
-    }
-
-    // Peek first bytes to detect BOM/encoding
-    unsigned char header[4] = {0,0,0,0};
-    file.read(reinterpret_cast<char*>(header), 4);
-    file.clear();
-    file.seekg(0, std::ios::beg);
-
-    bool useStringParser = false;
-    std::istringstream ss; // will contain UTF-8 text if needed
-    std::string token;
-
-    // Normalizer: strip BOM, UTF-8 NBSP (0xC2 0xA0) and leading ASCII control/space bytes
-    auto normalizeToken = [&](std::string &s) {
-        bool changed = true;
-        while (changed && !s.empty()) {
-            changed = false;
-            // UTF-8 BOM
-            if (s.size() >= 3 && static_cast<unsigned char>(s[0]) == 0xEF
-                && static_cast<unsigned char>(s[1]) == 0xBB
-                && static_cast<unsigned char>(s[2]) == 0xBF) {
-                s.erase(0, 3);
-                changed = true;
-                continue;
-            }
-            // UTF-8 non-breaking space (U+00A0) -> bytes C2 A0
-            if (s.size() >= 2 && static_cast<unsigned char>(s[0]) == 0xC2
-                && static_cast<unsigned char>(s[1]) == 0xA0) {
-                s.erase(0, 2);
-                changed = true;
-                continue;
-            }
-            // ASCII control or space
-            if (static_cast<unsigned char>(s[0]) <= 0x20) {
-                s.erase(0, 1);
-                changed = true;
-                continue;
-            }
-        }
-    };
-
-    // UTF-16 LE BOM
-    if (header[0] == 0xFF && header[1] == 0xFE) {
-        // Read entire file into memory
-        std::vector<char> raw((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        // Convert UTF-16LE bytes (skip BOM) into std::wstring
-        std::wstring w;
-        for (size_t i = 2; i + 1 < raw.size(); i += 2) {
-            wchar_t wc = static_cast<unsigned char>(raw[i]) | (static_cast<unsigned char>(raw[i+1]) << 8);
-            w.push_back(wc);
-        }
-        // Convert wide string to UTF-8
-        if (!w.empty()) {
-            int needed = ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), nullptr, 0, nullptr, nullptr);
-            if (needed > 0) {
-                std::string utf8;
-                utf8.resize(needed);
-                ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), &utf8[0], needed, nullptr, nullptr);
-                // build stringstream
-                ss.str(utf8);
-                useStringParser = true;
-            }
-        }
+    if (!g_frames.Next(img)) {
+        // Ran off the end (or hit a bad frame): stay on the current one
+        UpdateTitle(hwnd);
+        return;
     }
-    // UTF-16 BE BOM
-    else if (header[0] == 0xFE && header[1] == 0xFF) {
-        std::vector<char> raw((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        std::wstring w;
-        for (size_t i = 2; i + 1 < raw.size(); i += 2) {
-            wchar_t wc = (static_cast<unsigned char>(raw[i]) << 8) | static_cast<unsigned char>(raw[i+1]);
-            w.push_back(wc);
-        }
-        if (!w.empty()) {
-            int needed = ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), nullptr, 0, nullptr, nullptr);
-            if (needed > 0) {
-                std::string utf8;
-                utf8.resize(needed);
-                ::WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), &utf8[0], needed, nullptr, nullptr);
-                ss.str(utf8);
-                useStringParser = true;
-            }
-        }
+    const bool resized = (img.width != g_image->width || img.height != g_image->height);
+    g_image = std::make_shared<Image>(std::move(img));
+    g_display.Reset(*g_image);
+    if (resized) FitWindow(hwnd);
+    UpdateTitle(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: show file `index` of the sequence, normally straight from the prefetcher's cache
+static void ShowSequenceFile(HWND hwnd, size_t index) {
+    if (index >= g_sequence.Size() || index == g_sequenceIndex) return;
+    std::shared_ptr<const Image> img = g_sequence.Get(index);
+    if (!img) {
+        std::cerr << "Error: Could not decode " << g_sequence.File(index) << std::endl;
+        return;
     }
-    // UTF-8 BOM detection (optional)
-    else if (header[0] == 0xEF && header[1] == 0xBB && header[2] == 0xBF) {
-        // file is UTF-8 with BOM; skip BOM by reading remaining into string
-        std::string rest;
-        std::getline(file, rest, '\0');
-        // rest currently contains entire file including BOM at start; remove first 3 bytes
-        if (rest.size() >= 3) rest = rest.substr(3);
-        ss.str(rest);
-        useStringParser = true;
-    }
-
-    if (useStringParser) {
-        // Token reader operating on ss (UTF-8 text)
-        auto nextTokenStr = [&](std::string &out) -> bool {
-            out.clear();
-            while (ss >> out) {
-                if (!out.empty() && out[0] == '#') {
-                    std::string rest;
-                    std::getline(ss, rest);
-                    continue;
+    g_sequenceIndex = index;
+    g_frames = PnmStream(); // reopened by EnsureFrames() if its frames are stepped through
+    const bool resized = (img->width != g_image->width || img->height != g_image->height);
+    g_image = std::move(img);
+    g_display.Reset(*g_image);
+    if (resized) FitWindow(hwnd);
+    UpdateTitle(hwnd);
+    UpdateWatch(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: client area covered by the statistics panel
+static RECT StatsRect() {
+    const int channels = std::clamp(g_image->channels, 1, 4);
+    return { kStatsMargin, kStatsMargin, kStatsMargin + kStatsW,
+             kStatsMargin + 2 * kStatsPad + kStatsHistH + 4 + channels * kStatsLineH };
+}
+
+// Helper: statistics of g_image. The decoders fill them in while the panel is shown;
+// anything else (a decode cache hit, a shared memory frame, a file prefetched before
+// the panel was opened) is counted here, once.
+static std::shared_ptr<const ImageStats> CurrentStats() {
+    if (g_image->stats) return g_image->stats;
+    if (g_statsOf.lock() != g_image) {
+        g_statsOf = g_image;
+        g_stats = ComputeImageStats(*g_image);
+    }
+    return g_stats;
+}
+
+// Helper: draw the statistics panel (clipped to the area being repainted, so a
+// partial repaint redraws just the part of the panel over the redrawn tiles)
+static void PaintStats(HDC hdc) {
+    const std::shared_ptr<const ImageStats> stats = CurrentStats();
+    if (!stats) return;
+    const RECT panel = StatsRect();
+    FillRect(hdc, &panel, static_cast<HBRUSH>(GetStockObject(DKGRAY_BRUSH)));
+
+    // Histograms share one plot, each channel added in its own color. The end bins
+    // are left out of the scale: a pile-up of clipped samples would flatten the rest.
+    const bool color = stats->channels >= 3;
+    static const uint32_t kColors[2][4] = { { 0xC0C0C0, 0x606060 }, { 0xC00000, 0x00C000, 0x0000C0, 0x606060 } };
+    uint64_t peak = 1;
+    for (int c = 0; c < stats->channels; ++c) {
+        const auto& h = stats->channel[c].histogram;
+        peak = std::max(peak, *std::max_element(h.begin() + 1, h.end() - 1));
+    }
+    std::vector<uint32_t> plot(static_cast<size_t>(ImageStats::kBins) * kStatsHistH, 0x202020);
+    for (int c = 0; c < stats->channels; ++c) {
+        const uint32_t add = kColors[color][std::min(c, color ? 3 : 1)];
+        for (int x = 0; x < ImageStats::kBins; ++x) {
+            const uint64_t n = stats->channel[c].histogram[x];
+            const int bar = static_cast<int>(std::min<uint64_t>(kStatsHistH, (n * kStatsHistH + peak - 1) / peak));
+            for (int y = kStatsHistH - bar; y < kStatsHistH; ++y) {
+                uint32_t& p = plot[static_cast<size_t>(y) * ImageStats::kBins + x];
+                // Per-byte saturating add
+                uint32_t sum = 0;
+                for (int shift = 0; shift < 24; shift += 8) {
+                    sum |= std::min<uint32_t>(0xFF, ((p >> shift) & 0xFF) + ((add >> shift) & 0xFF)) << shift;
                 }
-                normalizeToken(out);
-                return true;
-            }
-            return false;
-        };
-
-        if (!nextTokenStr(token)) { std::cerr << "Error: Empty or invalid PPM file." << std::endl; return img; }
-        normalizeToken(token);
-        if (token != "P3") { std::cerr << "Error: Not a P3 PPM file (expected 'P3')." << std::endl; return img; }
-
-        std::string wtoken, htoken, mtoken;
-        if (!nextTokenStr(wtoken)) { std::cerr << "Error: Missing width." << std::endl; return img; }
-        if (!nextTokenStr(htoken)) { std::cerr << "Error: Missing height." << std::endl; return img; }
-        if (!nextTokenStr(mtoken)) { std::cerr << "Error: Missing maxVal." << std::endl; return img; }
-
-        normalizeToken(wtoken);
-        normalizeToken(htoken);
-        normalizeToken(mtoken);
-
-        try {
-            img.width = std::stoi(wtoken);
-            img.height = std::stoi(htoken);
-        } catch (...) { std::cerr << "Error: Invalid width/height tokens." << std::endl; return img; }
-        int maxVal = 255;
-        try { maxVal = std::stoi(mtoken); } catch (...) { std::cerr << "Error: Invalid maxVal token." << std::endl; return img; }
-
-        if (img.width <= 0 || img.height <= 0) { std::cerr << "Error: Invalid image dimensions." << std::endl; return img; }
-        const uint64_t pixelCount = static_cast<uint64_t>(img.width) * static_cast<uint64_t>(img.height);
-        if (pixelCount == 0 || pixelCount > 100000000) { std::cerr << "Error: Image too large or invalid." << std::endl; return img; }
-
-        img.pixels.resize(static_cast<size_t>(pixelCount));
-        for (uint64_t i = 0; i < pixelCount; ++i) {
-            std::string sr, sg, sb;
-            if (!nextTokenStr(sr) || !nextTokenStr(sg) || !nextTokenStr(sb)) { std::cerr << "Error: Unexpected end of file while reading pixels." << std::endl; img.pixels.clear(); img.width = img.height = 0; return img; }
-            normalizeToken(sr); normalizeToken(sg); normalizeToken(sb);
-            int r = std::stoi(sr);
-            int g = std::stoi(sg);
-            int b = std::stoi(sb);
-            if (maxVal != 255 && maxVal > 0) {
-                r = (r * 255) / maxVal;
-                g = (g * 255) / maxVal;
-                b = (b * 255) / maxVal;
+                p = sum;
             }
-            r = std::min<int>(255, std::max<int>(0, r));
-            g = std::min<int>(255, std::max<int>(0, g));
-            b = std::min<int>(255, std::max<int>(0, b));
-            uint8_t* ptr = reinterpret_cast<uint8_t*>(&img.pixels[i]);
-            ptr[0] = static_cast<uint8_t>(b);
-            ptr[1] = static_cast<uint8_t>(g);
-            ptr[2] = static_cast<uint8_t>(r);
-            ptr[3] = 0;
         }
+    }
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = ImageStats::kBins;
+    bmi.bmiHeader.biHeight = -kStatsHistH;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    StretchDIBits(hdc, panel.left + kStatsPad, panel.top + kStatsPad, ImageStats::kBins, kStatsHistH,
+                  0, 0, ImageStats::kBins, kStatsHistH, plot.data(), &bmi, DIB_RGB_COLORS, SRCCOPY);
+
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(230, 230, 230));
+    static const wchar_t* kNames[2][4] = { { L"Y", L"A" }, { L"R", L"G", L"B", L"A" } };
+    const double pixels = std::max(1.0, static_cast<double>(g_image->width) * g_image->height);
+    for (int c = 0; c < stats->channels; ++c) {
+        const ImageStats::Channel& ch = stats->channel[c];
+        wchar_t text[160];
+        swprintf(text, 160, L"%ls  min %g  max %g  mean %.6g  clipped %.2f%% low, %.2f%% high",
+                 kNames[color][std::min(c, color ? 3 : 1)], ch.min, ch.max, ch.mean,
+                 100.0 * ch.clippedLow / pixels, 100.0 * ch.clippedHigh / pixels);
+        std::wstring line = text;
+        if (ch.nan) line += L", " + std::to_wstring(ch.nan) + L" NaN";
+        const int top = panel.top + kStatsPad + kStatsHistH + 4 + c * kStatsLineH;
+        RECT row = { panel.left + kStatsPad, top, panel.right - kStatsPad, top + kStatsLineH };
+        DrawTextW(hdc, line.c_str(), static_cast<int>(line.size()), &row, DT_SINGLELINE | DT_VCENTER | DT_END_ELLIPSIS);
+    }
+}
 
-        std::cout << "P3 Image Loaded: " << img.width << "x" << img.height << std::endl;
-        return img;
-    }
-
-    // Otherwise proceed with file-stream based parser (existing P3/P6 support)
-    // Helper to read the next non-comment token from file stream
-    auto nextToken = [&](std::string &out) -> bool {
-        out.clear();
-        // Skip whitespace and comments
-        while (true) {
-            int c = file.peek();
-            if (c == EOF) return false;
-            if (isspace(c)) { file.get(); continue; }
-            if (c == '#') {
-                std::string rest;
-                std::getline(file, rest);
-                continue;
-            }
-            break;
-        }
-        while (true) {
-            int c = file.peek();
-            if (c == EOF) break;
-            if (isspace(c) || c == '#') break;
-            out.push_back(static_cast<char>(file.get()));
-        }
-        return !out.empty();
-    };
+// Helper: the measured region in client coordinates (both corner pixels included),
+// clipped to the image as shown
+static RECT RegionRect() {
+    const int viewW = g_display.ViewWidth(*g_image), viewH = g_display.ViewHeight(*g_image);
+    RECT r = { std::min(g_dragFrom.x, g_dragTo.x), std::min(g_dragFrom.y, g_dragTo.y),
+               std::max(g_dragFrom.x, g_dragTo.x) + 1, std::max(g_dragFrom.y, g_dragTo.y) + 1 };
+    r.left = std::clamp<LONG>(r.left, 0, viewW);
+    r.right = std::clamp<LONG>(r.right, 0, viewW);
+    r.top = std::clamp<LONG>(r.top, 0, viewH);
+    r.bottom = std::clamp<LONG>(r.bottom, 0, viewH);
+    return r;
+}
 
-    // Rewind file to start
-    file.clear(); file.seekg(0, std::ios::beg);
+static RECT RegionLabelRect() {
+    const RECT r = RegionRect();
+    const int lines = 1 + std::clamp(g_image->channels, 1, 4);
+    return { r.left, r.bottom + kRegionGap, r.left + kRegionLabelW, r.bottom + kRegionGap + 2 * kStatsPad + lines * kStatsLineH };
+}
 
-    // Read first token again
-    if (!nextToken(token)) { std::cerr << "Error: Empty or invalid PPM file." << std::endl; return img; }
+// Helper: repaint the region's outline and label (before and after it changes)
+static void InvalidateRegion(HWND hwnd) {
+    RECT outline = RegionRect();
+    outline.right += 1;
+    outline.bottom += 1;
+    const RECT label = RegionLabelRect();
+    InvalidateRect(hwnd, &outline, FALSE);
+    InvalidateRect(hwnd, &label, FALSE);
+}
 
-    normalizeToken(token);
+// Helper: statistics of g_image under the region, and where that is in the image
+// (x, y, w, h in image pixels, before orientation). The tables are built on the
+// first query of each image, in parallel; every query after that is O(1).
+static bool MeasureRegion(int& x, int& y, int& w, int& h, RegionStats& stats) {
+    const RECT r = RegionRect();
+    if (r.left >= r.right || r.top >= r.bottom) return false;
+    if (g_integralOf.lock() != g_image) {
+        g_integral.Build(*g_image);
+        g_integralOf = g_image;
+    }
+    x = r.left;
+    y = r.top;
+    w = r.right - r.left;
+    h = r.bottom - r.top;
+    OrientRect(Inverse(g_display.orientation), g_display.ViewWidth(*g_image), g_display.ViewHeight(*g_image), x, y, w, h);
+    return g_integral.Query(x, y, w, h, stats);
+}
 
-    // Strip UTF-8 BOM if present (already handled by normalizeToken, but keep compatibility)
-    if (token.size() >= 3 && static_cast<unsigned char>(token[0]) == 0xEF 
-        && static_cast<unsigned char>(token[1]) == 0xBB 
-        && static_cast<unsigned char>(token[2]) == 0xBF) {
-        token = token.substr(3);
+// Helper: mean and standard deviation of each channel, e.g. "R 120.5 sd 3.2" (%g)
+static std::string FormatRegion(const RegionStats& stats, int c) {
+    static const char* kNames[2][4] = { { "Y", "A" }, { "R", "G", "B", "A" } };
+    const bool color = stats.channels >= 3;
+    char text[96];
+    snprintf(text, sizeof(text), "%s %.6g sd %.4g", kNames[color][std::min(c, color ? 3 : 1)], stats.mean[c], std::sqrt(stats.variance[c]));
+    return text;
+}
+
+// Helper: outline the region and label it with its statistics
+static void PaintRegion(HDC hdc) {
+    int x = 0, y = 0, w = 0, h = 0;
+    RegionStats stats;
+    if (!MeasureRegion(x, y, w, h, stats)) return;
+    const RECT r = RegionRect();
+    RECT outline = { r.left - 1, r.top - 1, r.right + 1, r.bottom + 1 };
+    FrameRect(hdc, &outline, static_cast<HBRUSH>(GetStockObject(BLACK_BRUSH)));
+    FrameRect(hdc, &r, static_cast<HBRUSH>(GetStockObject(WHITE_BRUSH)));
+
+    const RECT label = RegionLabelRect();
+    FillRect(hdc, &label, static_cast<HBRUSH>(GetStockObject(DKGRAY_BRUSH)));
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(230, 230, 230));
+    std::vector<std::wstring> lines;
+    lines.push_back(std::to_wstring(x) + L"," + std::to_wstring(y) + L"  " + std::to_wstring(w) + L" x " + std::to_wstring(h)
+                    + L"  (" + std::to_wstring(stats.pixels) + L" px)");
+    for (int c = 0; c < stats.channels; ++c) lines.push_back(Utf8ToWide(FormatRegion(stats, c)));
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const int top = label.top + kStatsPad + static_cast<int>(i) * kStatsLineH;
+        RECT row = { label.left + kStatsPad, top, label.right - kStatsPad, top + kStatsLineH };
+        DrawTextW(hdc, lines[i].c_str(), static_cast<int>(lines[i].size()), &row, DT_SINGLELINE | DT_VCENTER | DT_END_ELLIPSIS);
     }
+}
+
+// Helper: stop measuring and free the tables
+static void ClearRegion(HWND hwnd) {
+    if (!g_regionShown) return;
+    InvalidateRegion(hwnd);
+    g_regionShown = g_dragging = false;
+    g_integral.Clear();
+    g_integralOf.reset();
+}
 
-    if (token == "P6") {
-        // Binary PPM
-        std::string wstr, hstr, mstr;
-        if (!nextToken(wstr) || !nextToken(hstr) || !nextToken(mstr)) {
-            std::cerr << "Error: Malformed P6 header." << std::endl;
-            return img;
+// Helper: show everything in orientation o from now on. Nothing is rotated up front:
+// the tiles are oriented as they are converted for painting.
+static void ApplyOrientation(HWND hwnd, Orientation o) {
+    // The region is in client coordinates: it would cover something else now
+    ClearRegion(hwnd);
+    g_display.SetOrientation(*g_image, o);
+    g_compareDisplay.SetOrientation(ShownImage(), o);
+    std::cout << "Orientation: " << OrientationName(o) << std::endl;
+    if (g_browsing) return;
+    FitWindow(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: repaint just the given display tiles (tx, ty), and the statistics panel,
+// which describes the whole image
+static void InvalidateTiles(HWND hwnd, const std::vector<std::pair<int, int>>& tiles) {
+    for (const auto& [tx, ty] : tiles) {
+        RECT tile = { tx * kDisplayTileSize, ty * kDisplayTileSize, (tx + 1) * kDisplayTileSize, (ty + 1) * kDisplayTileSize };
+        InvalidateRect(hwnd, &tile, FALSE);
+    }
+    if (g_showStats && !tiles.empty()) {
+        const RECT panel = StatsRect();
+        InvalidateRect(hwnd, &panel, FALSE);
+    }
+    if (g_regionShown && !tiles.empty()) InvalidateRegion(hwnd);
+}
+
+// Helper: decode the shown file again on the reload thread. One decode at a time:
+// changes arriving meanwhile are folded into a single follow-up decode. Only the
+// row bands that were rewritten are decoded; the rest is copied from g_image.
+static void StartReload(HWND hwnd) {
+    const std::string file = CurrentFile();
+    if (file.empty()) return;
+    if (g_reloadBusy) {
+        g_reloadAgain = true;
+        return;
+    }
+    g_reloadBusy = true;
+    g_reloadPool.Submit([hwnd, file, previous = g_image] {
+        // Hashes taken from another image (a different file, or before the file was
+        // reopened) say nothing about this one
+        if (g_hashedImage != previous) g_reloadHashes = PnmBandHashes{};
+        auto img = std::make_shared<Image>();
+        std::vector<RowRange> changed;
+        bool ok;
+        if (IsTiledFile(file)) {
+            // Tiled containers have no band hashes: all tiles are decoded again (in parallel)
+            TiledReader tiled;
+            ok = tiled.Open(file) && tiled.ReadLevel(0, *img);
+            if (ok) changed.push_back({ 0, img->height });
+        } else {
+            ok = ReloadPnm(file, *previous, g_reloadHashes, *img, changed);
         }
-        normalizeToken(wstr); normalizeToken(hstr); normalizeToken(mstr);
-        try {
-            img.width = std::stoi(wstr);
-            img.height = std::stoi(hstr);
-        } catch (...) {
-            std::cerr << "Error: Invalid width/height in P6 header: '" << wstr << "' '" << hstr << "'" << std::endl;
-            return img;
+        if (ok) {
+            // Nothing changed: the hashes still describe `previous`, which stays on screen
+            g_hashedImage = changed.empty() ? previous : img;
+        } else {
+            g_hashedImage.reset();
+            img.reset();
         }
-        int maxVal = 255;
-        try { maxVal = std::stoi(mstr); } catch (...) { std::cerr << "Error: Invalid maxVal in P6 header: '" << mstr << "'" << std::endl; return img; }
-        if (img.width <= 0 || img.height <= 0) { std::cerr << "Error: Invalid image dimensions." << std::endl; return img; }
-        const uint64_t pixelCount = static_cast<uint64_t>(img.width) * static_cast<uint64_t>(img.height);
-        if (pixelCount == 0 || pixelCount > 100000000) { std::cerr << "Error: Image too large or invalid." << std::endl; return img; }
-
-        // Consume single whitespace separating header from binary
-        int sep = file.get();
-        if (sep == EOF) { std::cerr << "Error: Unexpected EOF before pixel data." << std::endl; return img; }
-        // allocate
-        img.pixels.resize(static_cast<size_t>(pixelCount));
-        // Read binary RGB triples
-        for (uint64_t i = 0; i < pixelCount; ++i) {
-            unsigned char rgb[3];
-            file.read(reinterpret_cast<char*>(rgb), 3);
-            if (!file) { std::cerr << "Error: Unexpected end of file while reading binary pixels." << std::endl; img.pixels.clear(); img.width = img.height = 0; return img; }
-            int r = rgb[0];
-            int g = rgb[1];
-            int b = rgb[2];
-            if (maxVal != 255 && maxVal > 0) {
-                r = (r * 255) / maxVal;
-                g = (g * 255) / maxVal;
-                b = (b * 255) / maxVal;
-            }
-            uint8_t* ptr = reinterpret_cast<uint8_t*>(&img.pixels[i]);
-            ptr[0] = static_cast<uint8_t>(b);
-            ptr[1] = static_cast<uint8_t>(g);
-            ptr[2] = static_cast<uint8_t>(r);
-            ptr[3] = 0;
+        {
+            std::lock_guard<std::mutex> lock(g_reloadMutex);
+            g_reloaded = std::move(img);
+            g_reloadedFrom = previous;
+            g_reloadedRows = std::move(changed);
+            g_reloadedPath = file;
         }
+        PostMessageW(hwnd, WM_APP_RELOADED, 0, 0);
+    });
+}
 
-        std::cout << "P6 Image Loaded: " << img.width << "x" << img.height << std::endl;
-        return img;
-    }
-
-    if (token != "P3") {
-        std::cerr << "Error: Not a P3/P6 PPM file (expected 'P3' or 'P6'). Found: '" << token << "'" << std::endl;
-        return img;
-    }
-
-    // P3 ASCII parsing
-    std::string wtoken, htoken, mtoken;
-    if (!nextToken(wtoken)) { std::cerr << "Error: Missing width." << std::endl; return img; }
-    if (!nextToken(htoken)) { std::cerr << "Error: Missing height." << std::endl; return img; }
-    if (!nextToken(mtoken)) { std::cerr << "Error: Missing maxVal." << std::endl; return img; }
-
-    normalizeToken(wtoken); normalizeToken(htoken); normalizeToken(mtoken);
-
-    try {
-        img.width = std::stoi(wtoken);
-        img.height = std::stoi(htoken);
-    } catch (const std::exception& ex) {
-        std::cerr << "Error: Invalid width/height tokens: '" << wtoken << "' '" << htoken << "' - " << ex.what() << std::endl;
-        // Dump first bytes for diagnostic
-        file.clear(); file.seekg(0, std::ios::beg);
-        std::string headerSample;
-        headerSample.resize(256);
-        file.read(&headerSample[0], 256);
-        std::cerr << "File start (first 256 bytes):\n" << headerSample << std::endl;
-        return img;
-    }
-    int maxVal2;
-    try { maxVal2 = std::stoi(mtoken); } catch (const std::exception& ex) {
-        std::cerr << "Error: Invalid maxVal token: '" << mtoken << "' - " << ex.what() << std::endl;
-        return img;
-    }
-
-    if (img.width <= 0 || img.height <= 0) {
-        std::cerr << "Error: Invalid image dimensions." << std::endl;
-        img.width = img.height = 0;
-        return img;
-    }
-
-    const uint64_t pixelCount2 = static_cast<uint64_t>(img.width) * static_cast<uint64_t>(img.height);
-    if (pixelCount2 == 0 || pixelCount2 > 100000000) {
-        std::cerr << "Error: Image too large or invalid." << std::endl;
-        img.width = img.height = 0;
-        return img;
-    }
-
-    img.pixels.resize(static_cast<size_t>(pixelCount2));
-
-    // Read the RGB triples (tokens)
-    for (uint64_t i = 0; i < pixelCount2; ++i) {
-        std::string sr, sg, sb;
-        if (!nextToken(sr)) { std::cerr << "Error: Unexpected end of file while reading pixels (r)." << std::endl; img.width = img.height = 0; img.pixels.clear(); return img; }
-        if (!nextToken(sg)) { std::cerr << "Error: Unexpected end of file while reading pixels (g)." << std::endl; img.width = img.height = 0; img.pixels.clear(); return img; }
-        if (!nextToken(sb)) { std::cerr << "Error: Unexpected end of file while reading pixels (b)." << std::endl; img.width = img.height = 0; img.pixels.clear(); return img; }
-        int r,g,b;
-        try {
-            r = std::stoi(sr);
-            g = std::stoi(sg);
-            b = std::stoi(sb);
-        } catch (const std::exception& ex) {
-            std::cerr << "Error: Invalid pixel token at index " << i << ": '" << sr << "' '" << sg << "' '" << sb << "' - " << ex.what() << std::endl;
-            // diagnostic dump
-            file.clear(); file.seekg(0, std::ios::beg);
-            std::string headerSample;
-            headerSample.resize(256);
-            file.read(&headerSample[0], 256);
-            std::cerr << "File start (first 256 bytes):\n" << headerSample << std::endl;
-            img.pixels.clear(); img.width = img.height = 0; return img;
-        }
+// Helper: swap a finished reload into g_image (UI thread)
+static void FinishReload(HWND hwnd) {
+    std::shared_ptr<const Image> img, from;
+    std::vector<RowRange> changed;
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(g_reloadMutex);
+        img = std::move(g_reloaded);
+        from = std::move(g_reloadedFrom);
+        changed = std::move(g_reloadedRows);
+        path = std::move(g_reloadedPath);
+    }
+    g_reloadBusy = false;
+    if (g_reloadAgain) {
+        g_reloadAgain = false;
+        StartReload(hwnd);
+    }
+    // A failed decode (e.g. a file caught mid-write) keeps the old image; the
+    // writer's next change triggers another reload
+    if (!img || path != CurrentFile()) return;
+    const bool sameLayout = (from == g_image && img->width == g_image->width && img->height == g_image->height
+                             && img->channels == g_image->channels && img->BytesPerSample() == g_image->BytesPerSample());
+    if (sameLayout && changed.empty()) return;
+
+    g_frames = PnmStream(); // reopened by EnsureFrames() if its frames are stepped through
+    const bool resized = (img->width != g_image->width || img->height != g_image->height);
+    // Diffed against what is on screen: only the tiles that really changed are redone
+    const bool partial = sameLayout && img->maxVal == g_image->maxVal;
+    std::vector<std::pair<int, int>> dirty;
+    if (partial) g_display.Update(*g_image, *img, changed, dirty);
+    else g_display.Reset(*img);
+    g_image = std::move(img);
+    // The prefetcher still holds the old decode of this file
+    g_sequence.Replace(g_sequenceIndex, g_image);
+    int rows = 0;
+    for (const RowRange& r : changed) rows += r.end - r.begin;
+    std::cout << "Reloaded: " << path << " (" << rows << "/" << g_image->height << " rows changed)" << std::endl;
+    if (g_browsing) return; // shown when the grid is left
+    UpdateTitle(hwnd);
+    if (resized) FitWindow(hwnd);
+    if (partial) InvalidateTiles(hwnd, dirty);
+    else InvalidateRect(hwnd, NULL, FALSE);
+}
 
-        if (maxVal2 != 255 && maxVal2 > 0) {
-            r = (r * 255) / maxVal2;
-            g = (g * 255) / maxVal2;
-            b = (b * 255) / maxVal2;
+// Helper: show the frames piped in from `source` as they arrive. A stream has no
+// sequence, frames to step through or file to watch.
+static bool StartLive(HWND hwnd, const std::string& source) {
+    if (!g_live.Start(source, [hwnd] { PostMessageW(hwnd, WM_APP_LIVE_FRAME, 0, 0); })) return false;
+    g_liveFrame = 0;
+    g_frames = PnmStream();
+    g_sequence.SetFiles({}, 0, nullptr);
+    g_sequenceIndex = 0;
+    UpdateWatch(hwnd);
+    UpdateTitle(hwnd);
+    return true;
+}
+
+// Helper: put the newest waiting frame on screen. Its buffer returns to the stream's
+// ring once the previous g_image is released here.
+static void ShowLiveFrame(HWND hwnd) {
+    uint64_t frame = 0;
+    std::shared_ptr<const Image> img = g_live.Take(&frame);
+    if (!img) {
+        // Nothing waiting only after the last frame: it stays on screen
+        if (g_live.Active() && g_live.Ended()) {
+            std::cout << "Stream ended: " << g_live.Received() << " frames, " << g_live.Dropped() << " dropped" << std::endl;
+            if (!g_browsing) UpdateTitle(hwnd);
         }
+        return;
+    }
+    // Consecutive frames mostly share size and format: then only the tiles that
+    // differ are converted and painted again
+    const bool sameLayout = (img->width == g_image->width && img->height == g_image->height && img->channels == g_image->channels
+                             && img->BytesPerSample() == g_image->BytesPerSample() && img->maxVal == g_image->maxVal);
+    std::vector<std::pair<int, int>> dirty;
+    if (sameLayout) g_display.Update(*g_image, *img, { RowRange{ 0, img->height } }, dirty);
+    else g_display.Reset(*img);
+    const bool resized = (img->width != g_image->width || img->height != g_image->height);
+    g_image = std::move(img);
+    g_liveFrame = frame;
+    if (g_browsing) return; // shown when the grid is left
+    UpdateTitle(hwnd);
+    if (resized) FitWindow(hwnd);
+    if (sameLayout) InvalidateTiles(hwnd, dirty);
+    else InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: ask for a destination and save the current frame, oriented as shown. The
+// filter picks the encoding: source samples as P6 or P3, or the displayed (tone
+// mapped) view as P6.
+static void SaveImageAs(HWND hwnd) {
+    if (g_image->width <= 0 || !g_image->HasSamples()) return;
+    OPENFILENAMEW ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    wchar_t szFile[MAX_PATH] = {};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = L"Binary PPM (P6)\0*.ppm\0ASCII PPM (P3)\0*.ppm\0Displayed View (P6)\0*.ppm\0\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrDefExt = L"ppm";
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT | OFN_HIDEREADONLY;
+    if (!GetSaveFileNameW(&ofn)) return;
+
+    const std::string path = WideToUtf8(szFile);
+    // The view is only oriented tile by tile: the file gets the whole image turned once
+    std::shared_ptr<const Image> saved = g_image;
+    if (g_display.orientation != Orientation::Identity) {
+        saved = std::make_shared<Image>(OrientImage(*g_image, g_display.orientation));
+    }
+    bool ok;
+    if (ofn.nFilterIndex == 3) {
+        // Rows are converted straight from the native samples, bypassing the tile cache
+        const Image& img = *saved;
+        ok = SavePPMFromBGRX(path, img.width, img.height, false, [&img](int y, uint32_t* row) {
+            ConvertToBGRX(img, g_display.transform, 0, y, img.width, 1, row, img.width);
+        });
+    } else {
+        SaveOptions options;
+        options.ascii = (ofn.nFilterIndex == 2);
+        ok = SavePPM(*saved, path, options);
+    }
+    if (ok) std::cout << "Saved: " << path << std::endl;
+    else MessageBoxW(hwnd, L"Failed to save the image.", L"Save Error", MB_ICONERROR);
+}
+
+// Helper: grid columns that fit the client area
+static int GridColumns(HWND hwnd) {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    return std::max(1, static_cast<int>(rc.right - rc.left) / kGridCellW);
+}
+
+// Helper: after a resize or scroll, clamp the scroll position, update the scroll
+// bar and tell the loader which cells are on screen
+static void UpdateGrid(HWND hwnd) {
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    const int clientH = std::max(1, static_cast<int>(rc.bottom - rc.top));
+    const int columns = GridColumns(hwnd);
+    const int rows = static_cast<int>((g_thumbs->Size() + columns - 1) / columns);
+    const int contentH = rows * kGridCellH;
+    g_gridScroll = std::max(0, std::min(g_gridScroll, contentH - clientH));
+
+    SCROLLINFO si = {};
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS;
+    si.nMin = 0;
+    si.nMax = std::max(0, contentH - 1);
+    si.nPage = static_cast<UINT>(clientH);
+    si.nPos = g_gridScroll;
+    SetScrollInfo(hwnd, SB_VERT, &si, TRUE);
+
+    if (g_thumbs->Size() == 0) return;
+    const size_t first = static_cast<size_t>(g_gridScroll / kGridCellH) * columns;
+    const size_t last = static_cast<size_t>((g_gridScroll + clientH - 1) / kGridCellH + 1) * columns - 1;
+    g_thumbs->SetVisible(first, std::min(last, g_thumbs->Size() - 1));
+}
+
+static void ScrollGrid(HWND hwnd, int position) {
+    g_gridScroll = position;
+    UpdateGrid(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// Helper: switch to the thumbnail grid of the current file's directory (the
+// working directory when nothing was opened), scrolled to the current file
+static void EnterBrowse(HWND hwnd) {
+    if (!g_thumbs) {
+        g_thumbs = std::make_unique<ThumbnailLoader>(kThumbnailSize, DefaultThumbnailDir());
+        g_thumbs->SetOnReady([hwnd](size_t index) { PostMessageW(hwnd, WM_APP_THUMB_READY, index, 0); });
+    }
+    std::vector<std::string> files;
+    size_t current = 0;
+    if (g_sequence.Size() > 0) {
+        for (size_t i = 0; i < g_sequence.Size(); ++i) files.push_back(g_sequence.File(i));
+        current = g_sequenceIndex;
+    } else {
+        // "./." names no file, so this lists the working directory as is
+        files = ListSequence("./.", current);
+    }
+    g_thumbs->SetFiles(std::move(files));
+    g_browsing = true;
+
+    // Small images make small windows: leave room for a few rows of cells
+    RECT rc;
+    GetClientRect(hwnd, &rc);
+    if (rc.right - rc.left < 3 * kGridCellW || rc.bottom - rc.top < 2 * kGridCellH) {
+        SetWindowClientSize(hwnd, std::max<int>(rc.right - rc.left, 5 * kGridCellW), std::max<int>(rc.bottom - rc.top, 3 * kGridCellH));
+    }
+    ShowScrollBar(hwnd, SB_VERT, TRUE);
+    g_gridScroll = static_cast<int>(current / GridColumns(hwnd)) * kGridCellH;
+    UpdateGrid(hwnd);
+    UpdateTitle(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+static void LeaveBrowse(HWND hwnd) {
+    g_browsing = false;
+    g_thumbs->SetFiles({}); // stops generating and frees the thumbnails
+    ShowScrollBar(hwnd, SB_VERT, FALSE);
+    FitWindow(hwnd);
+    UpdateTitle(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
 
-        r = std::min<int>(255, std::max<int>(0, r));
-        g = std::min<int>(255, std::max<int>(0, g));
-        b = std::min<int>(255, std::max<int>(0, b));
+// Helper: cell under a client point, if any
+static bool GridHitTest(HWND hwnd, int x, int y, size_t& index) {
+    const int columns = GridColumns(hwnd);
+    const int column = x / kGridCellW;
+    if (x < 0 || y < 0 || column >= columns) return false;
+    index = static_cast<size_t>((y + g_gridScroll) / kGridCellH) * columns + column;
+    return index < g_thumbs->Size();
+}
 
-        uint8_t* ptr = reinterpret_cast<uint8_t*>(&img.pixels[i]);
-        ptr[0] = static_cast<uint8_t>(b); // Blue
-        ptr[1] = static_cast<uint8_t>(g); // Green
-        ptr[2] = static_cast<uint8_t>(r); // Red
-        ptr[3] = 0;                        // Padding
+// Helper: draw the cells overlapping the invalidated rectangle
+static void PaintGrid(HWND hwnd, HDC hdc, const RECT& dirty) {
+    HBRUSH background = static_cast<HBRUSH>(GetStockObject(DKGRAY_BRUSH));
+    FillRect(hdc, &dirty, background);
+    SetBkMode(hdc, TRANSPARENT);
+    SetTextColor(hdc, RGB(230, 230, 230));
+
+    const int columns = GridColumns(hwnd);
+    const int row0 = (dirty.top + g_gridScroll) / kGridCellH;
+    const int row1 = (dirty.bottom - 1 + g_gridScroll) / kGridCellH;
+    std::vector<uint32_t> bgrx;
+    for (int row = row0; row <= row1; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            const size_t index = static_cast<size_t>(row) * columns + column;
+            if (index >= g_thumbs->Size()) return;
+            const int cellX = column * kGridCellW;
+            const int cellY = row * kGridCellH - g_gridScroll;
+
+            std::shared_ptr<const Image> thumb = g_thumbs->Get(index);
+            if (thumb) {
+                // Thumbnails are 8-bit RGB: repack as BGRX and center in the cell
+                bgrx.resize(static_cast<size_t>(thumb->width) * thumb->height);
+                const uint8_t* s = thumb->Data();
+                for (uint32_t& p : bgrx) {
+                    p = (static_cast<uint32_t>(s[0]) << 16) | (static_cast<uint32_t>(s[1]) << 8) | s[2];
+                    s += 3;
+                }
+                BITMAPINFO bmi = {};
+                bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+                bmi.bmiHeader.biWidth = thumb->width;
+                bmi.bmiHeader.biHeight = -thumb->height;
+                bmi.bmiHeader.biPlanes = 1;
+                bmi.bmiHeader.biBitCount = 32;
+                bmi.bmiHeader.biCompression = BI_RGB;
+                StretchDIBits(hdc,
+                              cellX + kGridPad + (kThumbnailSize - thumb->width) / 2,
+                              cellY + kGridPad + (kThumbnailSize - thumb->height) / 2,
+                              thumb->width, thumb->height, 0, 0, thumb->width, thumb->height,
+                              bgrx.data(), &bmi, DIB_RGB_COLORS, SRCCOPY);
+            } else {
+                // Not generated yet (or failed): an empty box
+                RECT box = { cellX + kGridPad, cellY + kGridPad, cellX + kGridPad + kThumbnailSize, cellY + kGridPad + kThumbnailSize };
+                FillRect(hdc, &box, static_cast<HBRUSH>(GetStockObject(g_thumbs->Failed(index) ? BLACK_BRUSH : GRAY_BRUSH)));
+            }
+
+            std::string name = g_thumbs->File(index);
+            const size_t slash = name.find_last_of("/\\");
+            if (slash != std::string::npos) name.erase(0, slash + 1);
+            const std::wstring label = Utf8ToWide(name);
+            RECT text = { cellX + 2, cellY + kGridPad + kThumbnailSize, cellX + kGridCellW - 2, cellY + kGridCellH };
+            DrawTextW(hdc, label.c_str(), static_cast<int>(label.size()), &text, DT_CENTER | DT_SINGLELINE | DT_VCENTER | DT_END_ELLIPSIS);
+        }
     }
+}
 
-    std::cout << "P3 Image Loaded: " << img.width << "x" << img.height << std::endl;
-    return img;
+// Helper: open the file of a grid cell and go back to the image view
+static void OpenFromGrid(HWND hwnd, size_t index) {
+    const std::string path = g_thumbs->File(index);
+    if (!OpenFrames(path)) {
+        MessageBoxW(hwnd, L"Failed to load selected Netpbm file.", L"Load Error", MB_ICONERROR);
+        return;
+    }
+    LeaveBrowse(hwnd);
+    UpdateWatch(hwnd);
 }
 
-// 3. THE WINDOW PROCEDURE (The Event Listener)
+// Helper: ask for a Netpbm file to open
+static bool AskOpenPath(HWND hwnd, std::string& path) {
+    OPENFILENAMEW ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    wchar_t szFile[MAX_PATH] = {};
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = L"Netpbm Files (*.ppm;*.pgm;*.pbm;*.pnm;*.pam;*.pfm;*.ppmt;*.gz;*.zst)\0*.ppm;*.pgm;*.pbm;*.pnm;*.pam;*.pfm;*.ppmt;*.gz;*.zst\0All Files\0*.*\0\0";
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
+    if (!GetOpenFileNameW(&ofn)) return false;
+    path = WideToUtf8(szFile);
+    return true;
+}
+
+// Helper: load the image to compare against and switch to its heatmap
+static bool SetReference(const std::string& path) {
+    std::shared_ptr<const Image> img = SharedImageCache().Load(path);
+    if (!img) return false;
+    g_reference = std::move(img);
+    g_referencePath = path;
+    g_compared.reset();
+    g_compareView = CompareView::Heatmap;
+    return true;
+}
+
+// Helper: after the compare view changed, repaint all of it
+static void ShowCompare(HWND hwnd) {
+    CheckMenuItem(GetMenu(hwnd), ID_VIEW_COMPARE, MF_BYCOMMAND | (g_compareView != CompareView::Off ? MF_CHECKED : MF_UNCHECKED));
+    RefreshCompare();
+    ResetCompareDisplay();
+    if (g_browsing) return;
+    UpdateTitle(hwnd);
+    InvalidateRect(hwnd, NULL, FALSE);
+}
+
+// 2. THE WINDOW PROCEDURE (The Event Listener)
 // This function handles messages from the OS (mouse clicks, resize, "paint now")
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
     switch (uMsg) {
@@ -412,59 +936,289 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
     case WM_COMMAND: {
         int wmId = LOWORD(wParam);
+        std::string path;
         if (wmId == ID_FILE_OPEN) {
-            OPENFILENAMEW ofn;
-            ZeroMemory(&ofn, sizeof(ofn));
-            wchar_t szFile[MAX_PATH] = {};
-            ofn.lStructSize = sizeof(ofn);
-            ofn.hwndOwner = hwnd;
-            ofn.lpstrFilter = L"PPM Files (*.ppm)\0*.ppm\0All Files\0*.*\0\0";
-            ofn.lpstrFile = szFile;
-            ofn.nMaxFile = MAX_PATH;
-            ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST | OFN_HIDEREADONLY;
-            if (GetOpenFileNameW(&ofn)) {
-                std::string path = WideToUtf8(szFile);
-                Image img = LoadPPM(path);
-                if (img.width > 0 && img.height > 0) {
-                    g_image = std::move(img);
-
+            if (AskOpenPath(hwnd, path)) {
+                if (OpenFrames(path)) {
                     // Resize window so client area matches image size
-                    SetWindowClientSize(hwnd, g_image.width, g_image.height);
+                    FitWindow(hwnd);
+                    UpdateTitle(hwnd);
+                    UpdateWatch(hwnd);
 
                     InvalidateRect(hwnd, NULL, TRUE);
                     UpdateWindow(hwnd);
                 } else {
-                    MessageBoxW(hwnd, L"Failed to load selected PPM file.", L"Load Error", MB_ICONERROR);
+                    MessageBoxW(hwnd, L"Failed to load selected Netpbm file.", L"Load Error", MB_ICONERROR);
                 }
             }
+        } else if (wmId == ID_FILE_SAVE_AS) {
+            SaveImageAs(hwnd);
+        } else if (wmId == ID_FILE_BROWSE) {
+            if (g_browsing) LeaveBrowse(hwnd);
+            else EnterBrowse(hwnd);
+        } else if (wmId >= ID_VIEW_EXPOSURE_UP && wmId <= ID_VIEW_REINHARD) {
+            ToneSettings tone = g_display.tone;
+            if (wmId == ID_VIEW_EXPOSURE_UP) tone.exposure += 0.5f;
+            else if (wmId == ID_VIEW_EXPOSURE_DOWN) tone.exposure -= 0.5f;
+            else tone.reinhard = !tone.reinhard;
+            ApplyTone(hwnd, tone);
+        } else if (wmId >= ID_VIEW_BLACK_UP && wmId <= ID_VIEW_LEVELS_RESET) {
+            // Levels only rebuild the display LUT, so holding a key down steps
+            // through them at key repeat speed
+            constexpr float kStep = 1.0f / 64, kMinRange = 1.0f / 32;
+            ToneSettings tone = g_display.tone;
+            if (wmId == ID_VIEW_BLACK_UP) tone.black = std::min(tone.black + kStep, tone.white - kMinRange);
+            else if (wmId == ID_VIEW_BLACK_DOWN) tone.black = std::max(tone.black - kStep, 0.0f);
+            else if (wmId == ID_VIEW_WHITE_UP) tone.white = std::min(tone.white + kStep, 1.0f);
+            else if (wmId == ID_VIEW_WHITE_DOWN) tone.white = std::max(tone.white - kStep, tone.black + kMinRange);
+            else if (wmId == ID_VIEW_MIDTONES_UP) tone.midGamma = std::min(tone.midGamma * 1.1f, 10.0f);
+            else if (wmId == ID_VIEW_MIDTONES_DOWN) tone.midGamma = std::max(tone.midGamma / 1.1f, 0.1f);
+            else {
+                const ToneSettings defaults;
+                tone.black = defaults.black;
+                tone.white = defaults.white;
+                tone.midGamma = defaults.midGamma;
+                tone.exposure = defaults.exposure;
+            }
+            ApplyTone(hwnd, tone);
+        } else if (wmId >= ID_VIEW_ROTATE_CW && wmId <= ID_VIEW_FLIP_V) {
+            // Relative to the current orientation, as the image is seen
+            Orientation step = Orientation::FlipV;
+            if (wmId == ID_VIEW_ROTATE_CW) step = Orientation::Rotate90;
+            else if (wmId == ID_VIEW_ROTATE_CCW) step = Orientation::Rotate270;
+            else if (wmId == ID_VIEW_FLIP_H) step = Orientation::FlipH;
+            ApplyOrientation(hwnd, Compose(g_display.orientation, step));
+        } else if (wmId == ID_VIEW_CLEAR_REGION) {
+            ClearRegion(hwnd);
+        } else if (wmId == ID_VIEW_COMPARE_WITH) {
+            if (AskOpenPath(hwnd, path)) {
+                if (SetReference(path)) ShowCompare(hwnd);
+                else MessageBoxW(hwnd, L"Failed to load the reference image.", L"Load Error", MB_ICONERROR);
+            }
+        } else if (wmId == ID_VIEW_COMPARE) {
+            // Difference -> reference -> the image itself; a reference is asked for first
+            if (!g_reference) {
+                SendMessageW(hwnd, WM_COMMAND, ID_VIEW_COMPARE_WITH, 0);
+                return 0;
+            }
+            if (g_compareView == CompareView::Off) g_compareView = CompareView::Heatmap;
+            else if (g_compareView == CompareView::Heatmap) g_compareView = CompareView::Reference;
+            else g_compareView = CompareView::Off;
+            ShowCompare(hwnd);
+        } else if (wmId == ID_VIEW_STATS) {
+            g_showStats = !g_showStats;
+            // Files decoded from now on bring their statistics with them
+            SetCollectStats(g_showStats);
+            CheckMenuItem(GetMenu(hwnd), ID_VIEW_STATS, MF_BYCOMMAND | (g_showStats ? MF_CHECKED : MF_UNCHECKED));
+            if (!g_showStats) g_stats.reset();
+            if (!g_browsing) InvalidateRect(hwnd, NULL, FALSE);
+        } else if (wmId == ID_VIEW_WATCH) {
+            g_watching = !g_watching;
+            CheckMenuItem(GetMenu(hwnd), ID_VIEW_WATCH, MF_BYCOMMAND | (g_watching ? MF_CHECKED : MF_UNCHECKED));
+            UpdateWatch(hwnd);
+            if (g_watcher.Active()) std::cout << "Watching: " << g_watcher.File() << std::endl;
+        } else if (wmId == ID_FRAME_NEXT) {
+            if (EnsureFrames()) ShowFrame(hwnd, g_frames.Position());
+        } else if (wmId == ID_FRAME_PREV) {
+            if (EnsureFrames() && g_frames.Position() >= 2) ShowFrame(hwnd, g_frames.Position() - 2);
+        } else if (wmId == ID_FRAME_FIRST) {
+            if (EnsureFrames()) ShowFrame(hwnd, 0);
+        } else if (wmId == ID_FRAME_LAST) {
+            // Needs the full index; rasters are skipped, not decoded
+            const size_t count = EnsureFrames() ? g_frames.BuildIndex() : 0;
+            if (count > 0) ShowFrame(hwnd, count - 1);
+        } else if (wmId == ID_SEQ_NEXT) {
+            ShowSequenceFile(hwnd, g_sequenceIndex + 1);
+        } else if (wmId == ID_SEQ_PREV) {
+            if (g_sequenceIndex > 0) ShowSequenceFile(hwnd, g_sequenceIndex - 1);
         }
         return 0;
     }
 
+    case WM_KEYDOWN: {
+        if (g_browsing) {
+            // The grid scrolls with the arrow and page keys instead of stepping frames
+            RECT rc;
+            GetClientRect(hwnd, &rc);
+            const int page = std::max(kGridCellH, static_cast<int>(rc.bottom - rc.top) - kGridCellH);
+            if (wParam == VK_ESCAPE || wParam == 'B') LeaveBrowse(hwnd);
+            else if (wParam == VK_DOWN) ScrollGrid(hwnd, g_gridScroll + kGridCellH);
+            else if (wParam == VK_UP) ScrollGrid(hwnd, g_gridScroll - kGridCellH);
+            else if (wParam == VK_NEXT) ScrollGrid(hwnd, g_gridScroll + page);
+            else if (wParam == VK_PRIOR) ScrollGrid(hwnd, g_gridScroll - page);
+            else if (wParam == VK_HOME) ScrollGrid(hwnd, 0);
+            else if (wParam == VK_END) ScrollGrid(hwnd, INT_MAX / 2);
+            return 0;
+        }
+        // Keyboard shortcuts for the View menu
+        if (wParam == VK_ADD || wParam == VK_OEM_PLUS) SendMessageW(hwnd, WM_COMMAND, ID_VIEW_EXPOSURE_UP, 0);
+        else if (wParam == VK_SUBTRACT || wParam == VK_OEM_MINUS) SendMessageW(hwnd, WM_COMMAND, ID_VIEW_EXPOSURE_DOWN, 0);
+        else if (wParam == 'T') SendMessageW(hwnd, WM_COMMAND, ID_VIEW_REINHARD, 0);
+        else if (wParam == 'W') SendMessageW(hwnd, WM_COMMAND, ID_VIEW_WATCH, 0);
+        else if (wParam == 'D') SendMessageW(hwnd, WM_COMMAND, ID_VIEW_COMPARE, 0);
+        else if (wParam == 'H') SendMessageW(hwnd, WM_COMMAND, ID_VIEW_STATS, 0);
+        // [ ] move the black point, Shift+[ ] the white point
+        else if (wParam == VK_OEM_6) SendMessageW(hwnd, WM_COMMAND, (GetKeyState(VK_SHIFT) & 0x8000) ? ID_VIEW_WHITE_UP : ID_VIEW_BLACK_UP, 0);
+        else if (wParam == VK_OEM_4) SendMessageW(hwnd, WM_COMMAND, (GetKeyState(VK_SHIFT) & 0x8000) ? ID_VIEW_WHITE_DOWN : ID_VIEW_BLACK_DOWN, 0);
+        else if (wParam == VK_OEM_PERIOD) SendMessageW(hwnd, WM_COMMAND, ID_VIEW_MIDTONES_UP, 0);
+        else if (wParam == VK_OEM_COMMA) SendMessageW(hwnd, WM_COMMAND, ID_VIEW_MIDTONES_DOWN, 0);
+        else if (wParam == '0') SendMessageW(hwnd, WM_COMMAND, ID_VIEW_LEVELS_RESET, 0);
+        // R rotates clockwise, Shift+R counterclockwise; F flips left-right, Shift+F upside down
+        else if (wParam == 'R') SendMessageW(hwnd, WM_COMMAND, (GetKeyState(VK_SHIFT) & 0x8000) ? ID_VIEW_ROTATE_CCW : ID_VIEW_ROTATE_CW, 0);
+        else if (wParam == 'F') SendMessageW(hwnd, WM_COMMAND, (GetKeyState(VK_SHIFT) & 0x8000) ? ID_VIEW_FLIP_V : ID_VIEW_FLIP_H, 0);
+        else if (wParam == VK_NEXT) SendMessageW(hwnd, WM_COMMAND, ID_FRAME_NEXT, 0);
+        else if (wParam == VK_PRIOR) SendMessageW(hwnd, WM_COMMAND, ID_FRAME_PREV, 0);
+        else if (wParam == VK_HOME) SendMessageW(hwnd, WM_COMMAND, ID_FRAME_FIRST, 0);
+        else if (wParam == VK_END) SendMessageW(hwnd, WM_COMMAND, ID_FRAME_LAST, 0);
+        else if (wParam == VK_RIGHT) SendMessageW(hwnd, WM_COMMAND, ID_SEQ_NEXT, 0);
+        else if (wParam == VK_LEFT) SendMessageW(hwnd, WM_COMMAND, ID_SEQ_PREV, 0);
+        else if (wParam == 'S' && (GetKeyState(VK_CONTROL) & 0x8000)) SendMessageW(hwnd, WM_COMMAND, ID_FILE_SAVE_AS, 0);
+        else if (wParam == 'B') SendMessageW(hwnd, WM_COMMAND, ID_FILE_BROWSE, 0);
+        else if (wParam == VK_ESCAPE) SendMessageW(hwnd, WM_COMMAND, ID_VIEW_CLEAR_REGION, 0);
+        return 0;
+    }
+
+    case WM_MOUSEWHEEL:
+        if (g_browsing) ScrollGrid(hwnd, g_gridScroll - GET_WHEEL_DELTA_WPARAM(wParam) * kGridCellH / WHEEL_DELTA);
+        return 0;
+
+    case WM_VSCROLL: {
+        if (!g_browsing) return 0;
+        SCROLLINFO si = {};
+        si.cbSize = sizeof(si);
+        si.fMask = SIF_ALL;
+        GetScrollInfo(hwnd, SB_VERT, &si);
+        int position = g_gridScroll;
+        switch (LOWORD(wParam)) {
+        case SB_LINEUP: position -= kGridCellH / 2; break;
+        case SB_LINEDOWN: position += kGridCellH / 2; break;
+        case SB_PAGEUP: position -= static_cast<int>(si.nPage); break;
+        case SB_PAGEDOWN: position += static_cast<int>(si.nPage); break;
+        case SB_THUMBTRACK: position = si.nTrackPos; break;
+        case SB_TOP: position = 0; break;
+        case SB_BOTTOM: position = si.nMax; break;
+        }
+        ScrollGrid(hwnd, position);
+        return 0;
+    }
+
+    case WM_LBUTTONDOWN: {
+        size_t index = 0;
+        if (g_browsing) {
+            if (GridHitTest(hwnd, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam), index)) OpenFromGrid(hwnd, index);
+            return 0;
+        }
+        // Start measuring a new region; a click alone measures one pixel
+        if (g_regionShown) InvalidateRegion(hwnd);
+        g_regionShown = g_dragging = true;
+        g_dragFrom = g_dragTo = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+        SetCapture(hwnd);
+        InvalidateRegion(hwnd);
+        return 0;
+    }
+
+    case WM_MOUSEMOVE:
+        if (g_dragging) {
+            InvalidateRegion(hwnd);
+            g_dragTo = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+            InvalidateRegion(hwnd);
+        }
+        return 0;
+
+    case WM_LBUTTONUP: {
+        if (!g_dragging) return 0;
+        g_dragging = false;
+        ReleaseCapture();
+        int x = 0, y = 0, w = 0, h = 0;
+        RegionStats stats;
+        if (MeasureRegion(x, y, w, h, stats)) {
+            std::cout << "Region " << x << "," << y << " " << w << "x" << h << ":";
+            for (int c = 0; c < stats.channels; ++c) std::cout << (c ? ", " : " ") << FormatRegion(stats, c);
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+
+    case WM_RBUTTONDOWN:
+        if (!g_browsing) ClearRegion(hwnd);
+        return 0;
+
+    case WM_SIZE:
+        if (g_browsing) {
+            UpdateGrid(hwnd);
+            InvalidateRect(hwnd, NULL, FALSE);
+        }
+        return 0;
+
+    case WM_APP_FILE_CHANGED:
+        if (g_watching) StartReload(hwnd);
+        return 0;
+
+    case WM_APP_RELOADED:
+        FinishReload(hwnd);
+        return 0;
+
+    case WM_APP_LIVE_FRAME:
+        ShowLiveFrame(hwnd);
+        return 0;
+
+    case WM_APP_THUMB_READY: {
+        // Repaint just that cell if it is (still) on screen
+        if (!g_browsing) return 0;
+        const int columns = GridColumns(hwnd);
+        const int index = static_cast<int>(wParam);
+        const int x = (index % columns) * kGridCellW;
+        const int y = (index / columns) * kGridCellH - g_gridScroll;
+        RECT cell = { x, y, x + kGridCellW, y + kGridCellH };
+        InvalidateRect(hwnd, &cell, FALSE);
+        return 0;
+    }
+
     case WM_PAINT: { // The OS says: "Please draw yourself now"
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hwnd, &ps);
-
-        if (g_image.width > 0 && !g_image.pixels.empty()) {
-            // Define how our pixel buffer is formatted
-            BITMAPINFO bmi = {};
-            bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-            bmi.bmiHeader.biWidth = g_image.width;
-            bmi.bmiHeader.biHeight = -g_image.height; // Negative height tells Windows "Top-Down"
-            bmi.bmiHeader.biPlanes = 1;
-            bmi.bmiHeader.biBitCount = 32; // 32 bits per pixel (B, G, R, Padding)
-            bmi.bmiHeader.biCompression = BI_RGB;
-
-            // Copy our RAM buffer to the Window's Video Memory
-            StretchDIBits(
-                hdc,
-                0, 0, g_image.width, g_image.height, // Destination (Window)
-                0, 0, g_image.width, g_image.height, // Source (RAM)
-                g_image.pixels.data(),               // Pointer to our pixel array
-                &bmi,                                // Info about the array
-                DIB_RGB_COLORS,
-                SRCCOPY
-            );
+        // The image on screen may have changed since it was last compared
+        if (!g_browsing) RefreshCompare();
+
+        if (g_browsing) {
+            PaintGrid(hwnd, hdc, ps.rcPaint);
+        } else if (ShownImage().width > 0 && ShownImage().HasSamples()) {
+            const Image& shown = ShownImage();
+            DisplayCache& display = ShownDisplay();
+            // Only the tiles overlapping the invalidated rectangle are converted/drawn
+            const int tx0 = std::max<int>(0, ps.rcPaint.left / kDisplayTileSize);
+            const int ty0 = std::max<int>(0, ps.rcPaint.top / kDisplayTileSize);
+            const int tx1 = std::min<int>(display.tilesX - 1, (ps.rcPaint.right - 1) / kDisplayTileSize);
+            const int ty1 = std::min<int>(display.tilesY - 1, (ps.rcPaint.bottom - 1) / kDisplayTileSize);
+            for (int ty = ty0; ty <= ty1; ++ty) {
+                for (int tx = tx0; tx <= tx1; ++tx) {
+                    int tileW = 0, tileH = 0;
+                    const uint32_t* tile = display.GetTile(shown, tx, ty, tileW, tileH);
+                    if (!tile) continue;
+
+                    // Define how our pixel buffer is formatted
+                    BITMAPINFO bmi = {};
+                    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+                    bmi.bmiHeader.biWidth = tileW;
+                    bmi.bmiHeader.biHeight = -tileH; // Negative height tells Windows "Top-Down"
+                    bmi.bmiHeader.biPlanes = 1;
+                    bmi.bmiHeader.biBitCount = 32; // 32 bits per pixel (B, G, R, Padding)
+                    bmi.bmiHeader.biCompression = BI_RGB;
+
+                    // Copy the tile to the Window's Video Memory
+                    StretchDIBits(
+                        hdc,
+                        tx * kDisplayTileSize, ty * kDisplayTileSize, tileW, tileH, // Destination (Window)
+                        0, 0, tileW, tileH,                                         // Source (tile)
+                        tile,                                                       // Pointer to the tile's pixels
+                        &bmi,                                                       // Info about the array
+                        DIB_RGB_COLORS,
+                        SRCCOPY
+                    );
+                }
+            }
+            if (g_showStats) PaintStats(hdc);
+            if (g_regionShown) PaintRegion(hdc);
         }
 
         EndPaint(hwnd, &ps);
@@ -474,33 +1228,77 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hwnd, uMsg, wParam, lParam);
 }
 
-// 4. MAIN ENTRY POINT
+// 3. MAIN ENTRY POINT
 int main(int argc, char** argv) {
-    // Optionally load from command line
-    if (argc >= 2) {
-        g_image = LoadPPM(argv[1]);
+    // Optionally load from command line ("-", a named pipe or "shm:NAME" is shown live, as its
+    // frames arrive); --cache-mb N sets the decoded-image cache budget,
+    // --decode-cache [--decode-cache-dir DIR] [--decode-cache-mb N] keeps decoded text
+    // formats on disk for fast re-opens, --watch starts in watch mode, --compare REF
+    // diffs what is shown against REF, --stats opens the statistics panel, --orient O
+    // shows images rotated or flipped (90, 180, 270, fliph, flipv, transpose, transverse)
+    std::string path;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--cache-mb" && i + 1 < argc) {
+            try {
+                SharedImageCache().SetBudget(static_cast<size_t>(std::stoul(argv[++i])) << 20);
+            } catch (...) {
+                std::cerr << "Error: Invalid --cache-mb value: " << argv[i] << std::endl;
+            }
+        } else if (arg == "--decode-cache") {
+            SetDecodeCacheDir(DefaultDecodeCacheDir());
+        } else if (arg == "--decode-cache-dir" && i + 1 < argc) {
+            SetDecodeCacheDir(argv[++i]);
+        } else if (arg == "--decode-cache-mb" && i + 1 < argc) {
+            try {
+                SetDecodeCacheBudget(static_cast<uint64_t>(std::stoull(argv[++i])) << 20);
+            } catch (...) {
+                std::cerr << "Error: Invalid --decode-cache-mb value: " << argv[i] << std::endl;
+            }
+        } else if (arg == "--watch") {
+            g_watching = true;
+        } else if (arg == "--stats") {
+            // Before the first decode, so that one gathers them too
+            g_showStats = true;
+            SetCollectStats(true);
+        } else if (arg == "--orient" && i + 1 < argc) {
+            Orientation o;
+            if (ParseOrientation(argv[++i], o)) g_display.orientation = o;
+            else std::cerr << "Error: Invalid --orient value: " << argv[i] << std::endl;
+        } else if (arg == "--compare" && i + 1 < argc) {
+            if (!SetReference(argv[++i])) std::cerr << "Error: Could not load reference: " << argv[i] << std::endl;
+        } else {
+            path = arg;
+        }
+    }
+    // A stream's frames are posted to the window, so it starts once there is one
+    const bool live = !path.empty() && IsLiveSource(path);
+    if (!path.empty() && !live) {
+        OpenFrames(path);
     }
 
     // If no image loaded, create a dummy gradient
-    if (g_image.width <= 0 || g_image.height <= 0) {
-        g_image.width = 800;
-        g_image.height = 600;
-        g_image.pixels.resize(g_image.width * g_image.height);
-        for (int y = 0; y < g_image.height; ++y) {
-            for (int x = 0; x < g_image.width; ++x) {
-                int r = (x * 255) / g_image.width;
-                int g = (y * 255) / g_image.height;
+    if (g_image->width <= 0 || g_image->height <= 0 || !g_image->HasSamples()) {
+        auto gradient = std::make_shared<Image>();
+        gradient->width = 800;
+        gradient->height = 600;
+        gradient->samples.resize(static_cast<size_t>(gradient->width) * gradient->height * 3);
+        for (int y = 0; y < gradient->height; ++y) {
+            for (int x = 0; x < gradient->width; ++x) {
+                int r = (x * 255) / gradient->width;
+                int g = (y * 255) / gradient->height;
                 int b = 128;
 
-                int index = y * g_image.width + x;
-                uint8_t* ptr = reinterpret_cast<uint8_t*>(&g_image.pixels[index]);
-                ptr[0] = static_cast<uint8_t>(b);
+                int index = y * gradient->width + x;
+                uint8_t* ptr = &gradient->samples[static_cast<size_t>(index) * 3];
+                ptr[0] = static_cast<uint8_t>(r);
                 ptr[1] = static_cast<uint8_t>(g);
-                ptr[2] = static_cast<uint8_t>(r);
-                ptr[3] = 0;
+                ptr[2] = static_cast<uint8_t>(b);
             }
         }
+        g_image = std::move(gradient);
     }
+    g_display.Reset(*g_image);
 
     // B. Register the Window Class
     const wchar_t CLASS_NAME[] = L"PPM Viewer Class";
@@ -517,7 +1315,7 @@ int main(int argc, char** argv) {
     // C. Create the Window
     HWND hwnd = CreateWindowExW(
         0, CLASS_NAME, L"My C++ PPM Viewer", WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, g_image.width + 16, g_image.height + 39, // Approximate window size
+        CW_USEDEFAULT, CW_USEDEFAULT, g_image->width + 16, g_image->height + 39, // Approximate window size
         NULL, NULL, GetModuleHandle(NULL), NULL
     );
 
@@ -526,17 +1324,58 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    // Create a simple File->Open menu and attach it
+    // Create a simple File->Open menu and a View menu (tone mapping, levels) and attach them
     HMENU hMenu = CreateMenu();
     HMENU hFile = CreatePopupMenu();
     AppendMenuW(hFile, MF_STRING, ID_FILE_OPEN, L"&Open...");
+    AppendMenuW(hFile, MF_STRING, ID_FILE_SAVE_AS, L"Save &As...\tCtrl+S");
+    AppendMenuW(hFile, MF_STRING, ID_FILE_BROWSE, L"&Browse Folder\tB");
     AppendMenuW(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hFile), L"&File");
+    HMENU hView = CreatePopupMenu();
+    AppendMenuW(hView, MF_STRING, ID_VIEW_EXPOSURE_UP, L"Exposure &Up\t+");
+    AppendMenuW(hView, MF_STRING, ID_VIEW_EXPOSURE_DOWN, L"Exposure &Down\t-");
+    AppendMenuW(hView, MF_STRING | (g_display.tone.reinhard ? MF_CHECKED : MF_UNCHECKED), ID_VIEW_REINHARD, L"&Reinhard Tone Mapping\tT");
+    HMENU hLevels = CreatePopupMenu();
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_BLACK_UP, L"Raise &Black Point\t]");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_BLACK_DOWN, L"Lower Black Point\t[");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_WHITE_DOWN, L"Lower &White Point\tShift+[");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_WHITE_UP, L"Raise White Point\tShift+]");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_MIDTONES_UP, L"Brighter &Midtones\t.");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_MIDTONES_DOWN, L"Darker Mid&tones\t,");
+    AppendMenuW(hLevels, MF_STRING, ID_VIEW_LEVELS_RESET, L"&Reset Levels and Exposure\t0");
+    AppendMenuW(hView, MF_POPUP, reinterpret_cast<UINT_PTR>(hLevels), L"&Levels");
+    HMENU hOrient = CreatePopupMenu();
+    AppendMenuW(hOrient, MF_STRING, ID_VIEW_ROTATE_CW, L"Rotate &Clockwise\tR");
+    AppendMenuW(hOrient, MF_STRING, ID_VIEW_ROTATE_CCW, L"Rotate C&ounterclockwise\tShift+R");
+    AppendMenuW(hOrient, MF_STRING, ID_VIEW_FLIP_H, L"Flip &Horizontally\tF");
+    AppendMenuW(hOrient, MF_STRING, ID_VIEW_FLIP_V, L"Flip &Vertically\tShift+F");
+    AppendMenuW(hView, MF_POPUP, reinterpret_cast<UINT_PTR>(hOrient), L"R&otate / Flip");
+    AppendMenuW(hView, MF_STRING, ID_VIEW_CLEAR_REGION, L"Clear Measured Re&gion (drag to measure)\tEsc");
+    AppendMenuW(hView, MF_STRING | (g_watching ? MF_CHECKED : MF_UNCHECKED), ID_VIEW_WATCH, L"&Watch File for Changes\tW");
+    AppendMenuW(hView, MF_STRING | (g_showStats ? MF_CHECKED : MF_UNCHECKED), ID_VIEW_STATS, L"&Histogram && Statistics\tH");
+    AppendMenuW(hView, MF_SEPARATOR, 0, nullptr);
+    AppendMenuW(hView, MF_STRING, ID_VIEW_COMPARE_WITH, L"&Compare With...");
+    AppendMenuW(hView, MF_STRING | (g_compareView != CompareView::Off ? MF_CHECKED : MF_UNCHECKED), ID_VIEW_COMPARE, L"Difference / Re&ference\tD");
+    AppendMenuW(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hView), L"&View");
+    HMENU hFrame = CreatePopupMenu();
+    AppendMenuW(hFrame, MF_STRING, ID_FRAME_NEXT, L"&Next Frame\tPgDn");
+    AppendMenuW(hFrame, MF_STRING, ID_FRAME_PREV, L"&Previous Frame\tPgUp");
+    AppendMenuW(hFrame, MF_STRING, ID_FRAME_FIRST, L"&First Frame\tHome");
+    AppendMenuW(hFrame, MF_STRING, ID_FRAME_LAST, L"&Last Frame\tEnd");
+    AppendMenuW(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hFrame), L"F&rame");
+    HMENU hSequence = CreatePopupMenu();
+    AppendMenuW(hSequence, MF_STRING, ID_SEQ_NEXT, L"&Next File\tRight");
+    AppendMenuW(hSequence, MF_STRING, ID_SEQ_PREV, L"&Previous File\tLeft");
+    AppendMenuW(hMenu, MF_POPUP, reinterpret_cast<UINT_PTR>(hSequence), L"&Sequence");
     SetMenu(hwnd, hMenu);
 
     // If an image was loaded from command line, resize window to match it
-    if (g_image.width > 0 && g_image.height > 0) {
-        SetWindowClientSize(hwnd, g_image.width, g_image.height);
+    if (g_image->width > 0 && g_image->height > 0) {
+        FitWindow(hwnd);
     }
+    UpdateTitle(hwnd);
+    UpdateWatch(hwnd);
+    if (live) StartLive(hwnd, path);
 
     ShowWindow(hwnd, SW_SHOW);
 
@@ -546,6 +1385,14 @@ int main(int argc, char** argv) {
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
+    // A reload still running must finish before the caches it uses are destroyed
+    g_live.Stop();
+    g_watcher.Stop();
+    g_reloadPool.WaitIdle();
+
+    const ImageCacheStats cache = SharedImageCache().Stats();
+    std::cout << "Image cache: " << cache.hits << " hits, " << cache.misses << " misses, " << cache.evictions
+              << " evictions, " << (cache.bytes >> 20) << "/" << (cache.budget >> 20) << " MB in " << cache.entries << " images" << std::endl;
 
     return 0;
 }
@@ -0,0 +1,1148 @@
+#include "ppm.h"
+#include "simd.h"
+#include "utf8_path.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+// 1. BUFFERED READER / TOKENIZER
+bool PnmReader::Fill(size_t need) {
+    // Compact the unread tail to the front, then top up from the stream
+    if (pos_ > 0) {
+        std::memmove(buf_.data(), buf_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+    }
+    // Straight from the streambuf: one that returns short reads (a pipe) then only
+    // blocks until `need` bytes are in, not until the whole buffer is full
+    while (end_ < need) {
+        const std::streamsize got = in_.rdbuf()->sgetn(buf_.data() + end_, static_cast<std::streamsize>(buf_.size() - end_));
+        if (got <= 0) break;
+        end_ += static_cast<size_t>(got);
+        consumed_ += static_cast<uint64_t>(got);
+    }
+    return end_ >= need;
+}
+
+size_t PnmReader::Utf8SpaceAt() {
+    const int c = Peek();
+    if (c == 0xC2) {
+        if (end_ - pos_ < 2) Fill(2);
+        if (end_ - pos_ >= 2 && static_cast<unsigned char>(buf_[pos_ + 1]) == 0xA0) return 2;
+    } else if (c == 0xEF) {
+        if (end_ - pos_ < 3) Fill(3);
+        if (end_ - pos_ >= 3 && static_cast<unsigned char>(buf_[pos_ + 1]) == 0xBB
+            && static_cast<unsigned char>(buf_[pos_ + 2]) == 0xBF) return 3;
+    }
+    return 0;
+}
+
+bool PnmReader::SkipSpace() {
+    while (true) {
+        while (pos_ < end_ && static_cast<unsigned char>(buf_[pos_]) <= 0x20) ++pos_;
+        const int c = Peek();
+        if (c == EOF) return false;
+        if (c <= 0x20) continue;
+        if (c == '#') {
+            int d;
+            while ((d = Get()) != EOF && d != '\n' && d != '\r') {}
+            continue;
+        }
+        if (const size_t n = Utf8SpaceAt()) { pos_ += n; continue; }
+        return true;
+    }
+}
+
+bool PnmReader::NextToken(std::string& out) {
+    out.clear();
+    if (!SkipSpace()) return false;
+    while (true) {
+        const int c = Peek();
+        if (c == EOF || c <= 0x20 || c == '#' || Utf8SpaceAt()) break;
+        out.push_back(static_cast<char>(c));
+        ++pos_;
+    }
+    return !out.empty();
+}
+
+bool PnmReader::ReadUInt(uint32_t& value) {
+    if (!SkipSpace()) return false;
+    uint64_t v = 0;
+    size_t digits = 0;
+    while (true) {
+        // Hot loop straight over the buffer; only refill at its end
+        while (pos_ < end_) {
+            const unsigned d = static_cast<unsigned char>(buf_[pos_]) - static_cast<unsigned>('0');
+            if (d > 9) break;
+            v = std::min<uint64_t>(v * 10 + d, 0xFFFFFFFFu);
+            ++digits;
+            ++pos_;
+        }
+        if (pos_ < end_ || !Fill(1)) break;
+    }
+    if (digits == 0) return false;
+    // A sample must be followed by a delimiter ("12abc" is not a number)
+    const int c = Peek();
+    if (c != EOF && c > 0x20 && c != '#' && !Utf8SpaceAt()) return false;
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+bool PnmReader::ReadBit(uint8_t& value) {
+    if (!SkipSpace()) return false;
+    const int c = Get();
+    if (c != '0' && c != '1') return false;
+    value = static_cast<uint8_t>(c - '0');
+    return true;
+}
+
+size_t PnmReader::Read(void* dst, size_t count) {
+    char* out = static_cast<char*>(dst);
+    const size_t buffered = std::min(count, end_ - pos_);
+    std::memcpy(out, buf_.data() + pos_, buffered);
+    pos_ += buffered;
+    size_t done = buffered;
+    // Large remainders bypass the buffer and land directly in the destination
+    while (done < count) {
+        const std::streamsize got = in_.rdbuf()->sgetn(out + done, static_cast<std::streamsize>(count - done));
+        if (got <= 0) break;
+        done += static_cast<size_t>(got);
+        consumed_ += static_cast<uint64_t>(got);
+    }
+    return done;
+}
+
+uint64_t PnmReader::Skip(uint64_t count) {
+    const size_t buffered = static_cast<size_t>(std::min<uint64_t>(count, end_ - pos_));
+    pos_ += buffered;
+    uint64_t done = buffered;
+    if (done == count) return done;
+    // Seekable: jump, but never past the end (a truncated frame must still fail)
+    const std::streampos here = in_.tellg();
+    if (here != std::streampos(-1)) {
+        in_.seekg(0, std::ios::end);
+        const std::streampos last = in_.tellg();
+        const uint64_t avail = (last > here) ? static_cast<uint64_t>(last - here) : 0;
+        const uint64_t jump = std::min<uint64_t>(count - done, avail);
+        in_.seekg(here + static_cast<std::streamoff>(jump));
+        consumed_ += jump;
+        return done + jump;
+    }
+    // Pipes: read and discard
+    while (done < count && Fill(1)) {
+        const size_t n = static_cast<size_t>(std::min<uint64_t>(count - done, end_ - pos_));
+        pos_ += n;
+        done += n;
+    }
+    return done;
+}
+
+bool PnmReader::Seek(uint64_t offset) {
+    in_.clear();
+    in_.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    if (!in_) return false;
+    pos_ = end_ = 0;
+    consumed_ = offset;
+    return true;
+}
+
+// 2. RASTER HELPERS
+
+// Helper: 16-bit samples are big-endian on disk
+static void SwapBigEndian16(uint16_t* s, size_t n) {
+    size_t i = 0;
+#ifdef PPM_SSE2
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(s + i), v);
+    }
+#endif
+    for (; i < n; ++i) s[i] = static_cast<uint16_t>((s[i] << 8) | (s[i] >> 8));
+}
+
+// Helper: expand one packed PBM row (1 = black, MSB first) to one byte per pixel (1 = white)
+static void UnpackBits(const uint8_t* packed, uint8_t* out, int width) {
+    int x = 0;
+#ifdef PPM_SSE2
+    const __m128i mask = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* p = packed + (x >> 3);
+        __m128i v = _mm_cvtsi32_si128(p[0] | (p[1] << 8));
+        v = _mm_unpacklo_epi8(v, v);  // b0 b0 b1 b1
+        v = _mm_unpacklo_epi16(v, v); // b0 x4, b1 x4
+        v = _mm_unpacklo_epi32(v, v); // b0 x8, b1 x8
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, mask), _mm_setzero_si128());
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_and_si128(v, one));
+    }
+#endif
+    for (; x < width; ++x) {
+        out[x] = static_cast<uint8_t>(((packed[x >> 3] >> (7 - (x & 7))) & 1) ^ 1);
+    }
+}
+
+// Process-wide switch, see SetCollectStats
+static std::atomic<bool> g_collectStats{false};
+
+// Decoded bytes per band handed to StatsAccumulator: small enough to still be in L2
+constexpr size_t kStatsBandBytes = 1 << 18;
+
+// Helper: gathers ImageStats over bands of decoded rows. Integer samples only bump
+// a count per value and channel (min, max, mean and clipping all follow from the
+// counts in Finish); float samples are binned and summed as they come.
+class StatsAccumulator {
+public:
+    explicit StatsAccumulator(const Image& img) : channels_(img.channels) {
+        if (img.isFloat) {
+            for (int c = 0; c < channels_; ++c) {
+                min_[c] = std::numeric_limits<float>::infinity();
+                max_[c] = -std::numeric_limits<float>::infinity();
+            }
+        } else {
+            counts_.assign(static_cast<size_t>(channels_) << (8 * img.BytesPerSample()), 0);
+        }
+    }
+
+    // Rows [y0, y1) of img, already decoded
+    void Add(const Image& img, int y0, int y1) {
+        const size_t pixels = static_cast<size_t>(y1 - y0) * img.width;
+        const size_t first = static_cast<size_t>(y0) * img.width * channels_;
+        if (img.isFloat) {
+            AddFloat(img.SamplesF() + first, pixels);
+            return;
+        }
+        // The 32-bit counts could overflow on huge images: move them to wide_ first
+        if (pending_ + pixels > std::numeric_limits<uint32_t>::max()) Flush();
+        pending_ += pixels;
+        if (img.BytesPerSample() == 2) Count(img.Samples16() + first, pixels);
+        else Count(img.Data() + first, pixels);
+    }
+
+    std::shared_ptr<const ImageStats> Finish(const Image& img) {
+        auto stats = std::make_shared<ImageStats>();
+        stats->channels = channels_;
+        const uint64_t pixels = static_cast<uint64_t>(img.width) * img.height;
+        if (img.isFloat) {
+            for (int c = 0; c < channels_; ++c) {
+                ImageStats::Channel& ch = stats->channel[c] = float_[c];
+                const uint64_t finite = pixels - ch.nan;
+                ch.min = finite ? min_[c] : 0;
+                ch.max = finite ? max_[c] : 0;
+                ch.mean = finite ? sum_[c] / static_cast<double>(finite) : 0;
+            }
+            return stats;
+        }
+        Flush();
+        const size_t range = wide_.size() / channels_;
+        const uint32_t maxVal = static_cast<uint32_t>(img.maxVal);
+        for (int c = 0; c < channels_; ++c) {
+            ImageStats::Channel& ch = stats->channel[c];
+            const uint64_t* count = wide_.data() + c * range;
+            bool seen = false;
+            double sum = 0;
+            for (uint32_t v = 0; v < range; ++v) {
+                const uint64_t n = count[v];
+                if (n == 0) continue;
+                if (!seen) ch.min = v;
+                seen = true;
+                ch.max = v;
+                sum += static_cast<double>(v) * static_cast<double>(n);
+                ch.histogram[static_cast<uint64_t>(std::min(v, maxVal)) * ImageStats::kBins / (maxVal + 1)] += n;
+                if (v >= maxVal) ch.clippedHigh += n;
+            }
+            ch.clippedLow = count[0];
+            ch.mean = pixels ? sum / static_cast<double>(pixels) : 0;
+        }
+        return stats;
+    }
+
+private:
+    template <typename T>
+    void Count(const T* s, size_t pixels) {
+        constexpr size_t range = size_t(1) << (8 * sizeof(T));
+        uint32_t* count = counts_.data();
+        switch (channels_) {
+        case 1:
+            for (size_t i = 0; i < pixels; ++i) ++count[s[i]];
+            break;
+        case 3:
+            for (size_t i = 0; i < pixels; ++i, s += 3) {
+                ++count[s[0]];
+                ++count[range + s[1]];
+                ++count[2 * range + s[2]];
+            }
+            break;
+        default:
+            for (size_t i = 0; i < pixels; ++i, s += channels_) {
+                for (int c = 0; c < channels_; ++c) ++count[c * range + s[c]];
+            }
+            break;
+        }
+    }
+
+    void AddFloat(const float* s, size_t pixels) {
+        for (size_t i = 0; i < pixels; ++i, s += channels_) {
+            for (int c = 0; c < channels_; ++c) {
+                const float v = s[c];
+                ImageStats::Channel& ch = float_[c];
+                if (std::isnan(v)) { ++ch.nan; continue; }
+                min_[c] = std::min(min_[c], v);
+                max_[c] = std::max(max_[c], v);
+                sum_[c] += v;
+                if (v <= 0) { ++ch.clippedLow; ++ch.histogram[0]; }
+                else if (v >= 1) { ++ch.clippedHigh; ++ch.histogram[ImageStats::kBins - 1]; }
+                else ++ch.histogram[static_cast<int>(v * ImageStats::kBins)];
+            }
+        }
+    }
+
+    void Flush() {
+        if (wide_.size() != counts_.size()) wide_.assign(counts_.size(), 0);
+        for (size_t i = 0; i < counts_.size(); ++i) wide_[i] += counts_[i];
+        std::fill(counts_.begin(), counts_.end(), 0u);
+        pending_ = 0;
+    }
+
+    int channels_;
+    std::vector<uint32_t> counts_; // integer: per channel, one count per storable value
+    std::vector<uint64_t> wide_;   // counts_ folded in before they could overflow
+    uint64_t pending_ = 0;         // pixels counted in counts_
+    ImageStats::Channel float_[4];
+    float min_[4] = {}, max_[4] = {};
+    double sum_[4] = {};
+};
+
+// Helper: rows per band when gathering statistics, the whole raster otherwise
+static int BandRows(const Image& img, const StatsAccumulator* stats) {
+    if (!stats) return std::max(img.height, 1);
+    const size_t rowBytes = static_cast<size_t>(img.width) * img.channels * img.BytesPerSample();
+    return static_cast<int>(std::clamp<size_t>(kStatsBandBytes / std::max<size_t>(rowBytes, 1), 1, std::max(img.height, 1)));
+}
+
+// first: index of out[0] in the raster, for error messages
+template <typename T>
+static bool ReadAsciiSamples(PnmReader& reader, T* out, size_t count, uint32_t maxVal, size_t first = 0) {
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t v;
+        if (!reader.ReadUInt(v)) {
+            if (reader.Peek() == EOF) std::cerr << "Error: Unexpected end of file while reading pixels." << std::endl;
+            else std::cerr << "Error: Invalid pixel token at sample " << first + i << "." << std::endl;
+            return false;
+        }
+        out[i] = static_cast<T>(std::min(v, maxVal));
+    }
+    return true;
+}
+
+static bool ReadAsciiBits(PnmReader& reader, uint8_t* out, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t bit;
+        if (!reader.ReadBit(bit)) {
+            std::cerr << "Error: Unexpected end of file or invalid bit while reading pixels." << std::endl;
+            return false;
+        }
+        out[i] = bit ^ 1;
+    }
+    return true;
+}
+
+// Helper: P1 (bits) or P2/P3 rasters, handed to stats (if any) a band at a time
+static bool ReadAsciiRaster(PnmReader& reader, Image& img, bool bits, StatsAccumulator* stats) {
+    const int bandRows = BandRows(img, stats);
+    const size_t rowSamples = static_cast<size_t>(img.width) * img.channels;
+    const uint32_t maxVal = static_cast<uint32_t>(img.maxVal);
+    for (int y = 0; y < img.height; y += bandRows) {
+        const int rows = std::min(bandRows, img.height - y);
+        const size_t first = static_cast<size_t>(y) * rowSamples, count = rows * rowSamples;
+        const bool ok = bits ? ReadAsciiBits(reader, img.samples.data() + first, count)
+                      : (img.BytesPerSample() == 2) ? ReadAsciiSamples(reader, img.Samples16() + first, count, maxVal, first)
+                      : ReadAsciiSamples(reader, img.samples.data() + first, count, maxVal, first);
+        if (!ok) return false;
+        if (stats) stats->Add(img, y, y + rows);
+    }
+    return true;
+}
+
+static bool ReadBinarySamples(PnmReader& reader, Image& img, StatsAccumulator* stats) {
+    const int bandRows = BandRows(img, stats);
+    const size_t rowBytes = static_cast<size_t>(img.width) * img.channels * img.BytesPerSample();
+    for (int y = 0; y < img.height; y += bandRows) {
+        const int rows = std::min(bandRows, img.height - y);
+        uint8_t* band = img.samples.data() + static_cast<size_t>(y) * rowBytes;
+        const size_t bytes = rows * rowBytes;
+        if (reader.Read(band, bytes) != bytes) {
+            std::cerr << "Error: Unexpected end of file while reading binary pixels." << std::endl;
+            return false;
+        }
+        if (img.BytesPerSample() == 2) SwapBigEndian16(reinterpret_cast<uint16_t*>(band), bytes / 2);
+        if (stats) stats->Add(img, y, y + rows);
+    }
+    return true;
+}
+
+// Helper: PFM rasters are stored bottom row first, in the byte order given by the
+// sign of the scale (negative = little-endian)
+static bool ReadFloatSamples(PnmReader& reader, Image& img, bool littleEndian, StatsAccumulator* stats) {
+    const size_t rowBytes = static_cast<size_t>(img.width) * img.channels * 4;
+    const uint16_t probe = 1;
+    const bool hostLittle = (*reinterpret_cast<const uint8_t*>(&probe) == 1);
+    for (int y = img.height - 1; y >= 0; --y) {
+        uint8_t* b = img.samples.data() + static_cast<size_t>(y) * rowBytes;
+        if (reader.Read(b, rowBytes) != rowBytes) {
+            std::cerr << "Error: Unexpected end of file while reading float pixels." << std::endl;
+            return false;
+        }
+        if (hostLittle != littleEndian) {
+            for (size_t i = 0; i < rowBytes; i += 4) {
+                std::swap(b[i], b[i + 3]);
+                std::swap(b[i + 1], b[i + 2]);
+            }
+        }
+        if (stats) stats->Add(img, y, y + 1);
+    }
+    return true;
+}
+
+static bool ReadPackedBits(PnmReader& reader, Image& img, StatsAccumulator* stats) {
+    const size_t rowBytes = (static_cast<size_t>(img.width) + 7) / 8;
+    std::vector<uint8_t> row(rowBytes);
+    for (int y = 0; y < img.height; ++y) {
+        if (reader.Read(row.data(), rowBytes) != rowBytes) {
+            std::cerr << "Error: Unexpected end of file while reading binary pixels." << std::endl;
+            return false;
+        }
+        UnpackBits(row.data(), img.samples.data() + static_cast<size_t>(y) * img.width, img.width);
+        if (stats) stats->Add(img, y, y + 1);
+    }
+    return true;
+}
+
+static std::string Utf16ToUtf8(const char* raw, size_t size, bool bigEndian) {
+    std::string out;
+    out.reserve(size / 2);
+    for (size_t i = 2; i + 1 < size; i += 2) {
+        const unsigned char b0 = static_cast<unsigned char>(raw[i]);
+        const unsigned char b1 = static_cast<unsigned char>(raw[i + 1]);
+        uint32_t cp = bigEndian ? ((b0 << 8) | b1) : ((b1 << 8) | b0);
+        // Surrogate pair
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 3 < size) {
+            const unsigned char c0 = static_cast<unsigned char>(raw[i + 2]);
+            const unsigned char c1 = static_cast<unsigned char>(raw[i + 3]);
+            const uint32_t lo = bigEndian ? ((c0 << 8) | c1) : ((c1 << 8) | c0);
+            if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i += 2;
+            }
+        }
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    return out;
+}
+
+// 3. DECODING
+uint64_t PnmHeader::RasterBytes() const {
+    if (magic == "P4") return (static_cast<uint64_t>(width) + 7) / 8 * height;
+    const uint64_t bytesPerSample = isFloat ? 4 : (maxVal > 255 ? 2 : 1);
+    return static_cast<uint64_t>(width) * height * channels * bytesPerSample;
+}
+
+// Helper: PAM header ("WIDTH 640\nHEIGHT 480\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR")
+static bool ReadPamHeader(PnmReader& reader, PnmHeader& header) {
+    std::string key, value;
+    int depth = 0;
+    bool haveW = false, haveH = false, haveD = false, haveM = false;
+    while (true) {
+        if (!reader.NextToken(key)) { std::cerr << "Error: Malformed P7 header (missing ENDHDR)." << std::endl; return false; }
+        if (key == "ENDHDR") break;
+        if (!reader.NextToken(value)) { std::cerr << "Error: Malformed P7 header (no value for " << key << ")." << std::endl; return false; }
+        if (key == "TUPLTYPE") {
+            // Multiple TUPLTYPE lines are concatenated with a space
+            if (!header.tupleType.empty()) header.tupleType += ' ';
+            header.tupleType += value;
+            continue;
+        }
+        int v = 0;
+        try { v = std::stoi(value); } catch (...) {
+            std::cerr << "Error: Invalid " << key << " in P7 header: '" << value << "'" << std::endl;
+            return false;
+        }
+        if (key == "WIDTH") { header.width = v; haveW = true; }
+        else if (key == "HEIGHT") { header.height = v; haveH = true; }
+        else if (key == "DEPTH") { depth = v; haveD = true; }
+        else if (key == "MAXVAL") { header.maxVal = v; haveM = true; }
+        else { std::cerr << "Error: Unknown P7 header field '" << key << "'" << std::endl; return false; }
+    }
+    if (!haveW || !haveH || !haveD || !haveM) { std::cerr << "Error: P7 header needs WIDTH, HEIGHT, DEPTH and MAXVAL." << std::endl; return false; }
+    if (depth < 1 || depth > 4) { std::cerr << "Error: Unsupported P7 DEPTH " << depth << " (expected 1..4)." << std::endl; return false; }
+    header.channels = depth;
+    // Alpha is the last channel of the *_ALPHA tuple types; without a TUPLTYPE,
+    // 2 and 4 channel images are assumed to be gray+alpha / RGB+alpha
+    const std::string suffix = "_ALPHA";
+    if (header.tupleType.empty()) {
+        header.alpha = (depth == 2 || depth == 4);
+    } else {
+        header.alpha = (depth == 2 || depth == 4) && header.tupleType.size() >= suffix.size()
+            && header.tupleType.compare(header.tupleType.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+    return true;
+}
+
+// P1/P4 = PBM (bitonal), P2/P5 = PGM (gray), P3/P6 = PPM (RGB); P1-P3 are ASCII.
+// P7 = PAM (1-4 channels, binary, header of keyword/value lines).
+// PF/Pf = PFM (RGB/gray 32-bit float, "width height scale" header).
+bool ReadPnmHeader(PnmReader& reader, PnmHeader& header) {
+    header = PnmHeader{};
+    std::string& token = header.magic;
+
+    if (!reader.NextToken(token)) { std::cerr << "Error: Empty or invalid PPM file." << std::endl; return false; }
+    if (token.size() != 2 || token[0] != 'P' || ((token[1] < '1' || token[1] > '7') && token[1] != 'F' && token[1] != 'f')) {
+        std::cerr << "Error: Not a Netpbm file (expected 'P1'..'P7', 'PF' or 'Pf'). Found: '" << token << "'" << std::endl;
+        return false;
+    }
+    const char kind = token[1];
+    const bool bitmap = (kind == '1' || kind == '4');
+    header.isFloat = (kind == 'F' || kind == 'f');
+    header.channels = (kind == '3' || kind == '6' || kind == 'F') ? 3 : 1;
+
+    if (kind == '7') {
+        if (!ReadPamHeader(reader, header)) return false;
+    } else {
+        std::string wstr, hstr, mstr;
+        if (!reader.NextToken(wstr) || !reader.NextToken(hstr) || (!bitmap && !reader.NextToken(mstr))) {
+            std::cerr << "Error: Malformed " << token << " header." << std::endl;
+            return false;
+        }
+        try {
+            header.width = std::stoi(wstr);
+            header.height = std::stoi(hstr);
+        } catch (...) {
+            std::cerr << "Error: Invalid width/height in " << token << " header: '" << wstr << "' '" << hstr << "'" << std::endl;
+            return false;
+        }
+        if (header.isFloat) {
+            // The PFM "scale" only carries byte order (its magnitude is informational)
+            float scale = 0.0f;
+            try { scale = std::stof(mstr); } catch (...) {
+                std::cerr << "Error: Invalid scale in " << token << " header: '" << mstr << "'" << std::endl;
+                return false;
+            }
+            header.littleEndian = (scale < 0.0f);
+        } else if (!bitmap) {
+            try { header.maxVal = std::stoi(mstr); } catch (...) {
+                std::cerr << "Error: Invalid maxVal in " << token << " header: '" << mstr << "'" << std::endl;
+                return false;
+            }
+        }
+    }
+    if (header.width <= 0 || header.height <= 0) { std::cerr << "Error: Invalid image dimensions." << std::endl; return false; }
+    const uint64_t pixelCount = static_cast<uint64_t>(header.width) * static_cast<uint64_t>(header.height);
+    if (pixelCount == 0 || pixelCount > 100000000) { std::cerr << "Error: Image too large or invalid." << std::endl; return false; }
+    if (header.maxVal <= 0 || header.maxVal > 65535) {
+        std::cerr << "Error: Unsupported maxVal " << header.maxVal << " (expected 1..65535)." << std::endl;
+        return false;
+    }
+
+    if (!header.IsAscii()) {
+        // Consume single whitespace separating header from binary
+        if (reader.Get() == EOF) { std::cerr << "Error: Unexpected EOF before pixel data." << std::endl; return false; }
+    }
+    return true;
+}
+
+bool ReadPnmRaster(PnmReader& reader, const PnmHeader& header, Image& img) {
+    img.width = header.width;
+    img.height = header.height;
+    img.channels = header.channels;
+    img.maxVal = header.maxVal;
+    img.alpha = header.alpha;
+    img.isFloat = header.isFloat;
+    img.tupleType = header.tupleType;
+    img.samples.resize(img.SampleCount() * img.BytesPerSample());
+
+    img.stats.reset();
+
+    std::unique_ptr<StatsAccumulator> stats;
+    if (g_collectStats) stats = std::make_unique<StatsAccumulator>(img);
+    bool ok;
+    switch (header.magic[1]) {
+    case '1':
+    case '2':
+    case '3': ok = ReadAsciiRaster(reader, img, header.magic[1] == '1', stats.get()); break;
+    case '4': ok = ReadPackedBits(reader, img, stats.get()); break;
+    case 'F':
+    case 'f': ok = ReadFloatSamples(reader, img, header.littleEndian, stats.get()); break;
+    default: ok = ReadBinarySamples(reader, img, stats.get()); break;
+    }
+    if (ok && stats) img.stats = stats->Finish(img);
+    if (!ok) { img.samples.clear(); img.width = img.height = 0; }
+    return ok;
+}
+
+void SetCollectStats(bool on) {
+    g_collectStats = on;
+}
+
+bool CollectStats() {
+    return g_collectStats;
+}
+
+std::shared_ptr<const ImageStats> ComputeImageStats(const Image& img) {
+    if (!img.HasSamples()) return nullptr;
+    StatsAccumulator stats(img);
+    stats.Add(img, 0, img.height);
+    return stats.Finish(img);
+}
+
+bool SkipPnmRaster(PnmReader& reader, const PnmHeader& header) {
+    if (!header.IsAscii()) {
+        if (reader.Skip(header.RasterBytes()) != header.RasterBytes()) {
+            std::cerr << "Error: Unexpected end of file while skipping binary pixels." << std::endl;
+            return false;
+        }
+        return true;
+    }
+    // ASCII rasters have no fixed size: tokenize them without storing anything
+    const uint64_t count = static_cast<uint64_t>(header.width) * header.height * header.channels;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint32_t v;
+        uint8_t bit;
+        if (header.magic == "P1" ? !reader.ReadBit(bit) : !reader.ReadUInt(v)) {
+            std::cerr << "Error: Unexpected end of file or invalid token while skipping pixels." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Helper: one binary (P4-P7, PFM) row as stored in the file -> Image layout. raw
+// and out may be the same buffer except for P4.
+static void DecodeBinaryRow(const PnmHeader& header, int bytesPerSample, const uint8_t* raw, uint8_t* out) {
+    const size_t count = static_cast<size_t>(header.width) * header.channels;
+    const size_t rowBytes = count * bytesPerSample;
+    if (header.magic == "P4") {
+        UnpackBits(raw, out, header.width);
+        return;
+    }
+    if (raw != out) std::memcpy(out, raw, rowBytes);
+    if (header.isFloat) {
+        const uint16_t probe = 1;
+        const bool hostLittle = (*reinterpret_cast<const uint8_t*>(&probe) == 1);
+        if (hostLittle != header.littleEndian) {
+            for (size_t i = 0; i < rowBytes; i += 4) {
+                std::swap(out[i], out[i + 3]);
+                std::swap(out[i + 1], out[i + 2]);
+            }
+        }
+    } else if (bytesPerSample == 2) {
+        SwapBigEndian16(reinterpret_cast<uint16_t*>(out), count);
+    }
+}
+
+// Helper: one raster row in Image layout (PBM as one byte per pixel, native-endian
+// 16-bit and float samples). Rows come in file order, i.e. bottom first for PFM.
+static bool ReadRasterRow(PnmReader& reader, const PnmHeader& header, int bytesPerSample,
+                          std::vector<uint8_t>& row, std::vector<uint8_t>& packed) {
+    const size_t count = static_cast<size_t>(header.width) * header.channels;
+    const size_t rowBytes = count * bytesPerSample;
+    switch (header.magic[1]) {
+    case '1': return ReadAsciiBits(reader, row.data(), count);
+    case '2':
+    case '3':
+        return (bytesPerSample == 2)
+            ? ReadAsciiSamples(reader, reinterpret_cast<uint16_t*>(row.data()), count, static_cast<uint32_t>(header.maxVal))
+            : ReadAsciiSamples(reader, row.data(), count, static_cast<uint32_t>(header.maxVal));
+    case '4':
+        packed.resize((static_cast<size_t>(header.width) + 7) / 8);
+        if (reader.Read(packed.data(), packed.size()) != packed.size()) break;
+        DecodeBinaryRow(header, bytesPerSample, packed.data(), row.data());
+        return true;
+    default:
+        if (reader.Read(row.data(), rowBytes) != rowBytes) break;
+        DecodeBinaryRow(header, bytesPerSample, row.data(), row.data());
+        return true;
+    }
+    std::cerr << "Error: Unexpected end of file while reading binary pixels." << std::endl;
+    return false;
+}
+
+void ThumbnailSize(int width, int height, int maxSize, int& thumbWidth, int& thumbHeight) {
+    if (width <= maxSize && height <= maxSize) {
+        thumbWidth = width;
+        thumbHeight = height;
+    } else if (width >= height) {
+        thumbWidth = maxSize;
+        thumbHeight = static_cast<int>(std::max<int64_t>(1, (static_cast<int64_t>(height) * maxSize + width / 2) / width));
+    } else {
+        thumbHeight = maxSize;
+        thumbWidth = static_cast<int>(std::max<int64_t>(1, (static_cast<int64_t>(width) * maxSize + height / 2) / height));
+    }
+}
+
+bool ReadPnmThumbnail(PnmReader& reader, const PnmHeader& header, int maxSize, Image& thumb) {
+    if (maxSize < 1) { std::cerr << "Error: Invalid thumbnail size " << maxSize << "." << std::endl; return false; }
+    const int width = header.width, height = header.height, channels = header.channels;
+    thumb.channels = channels;
+    thumb.maxVal = header.maxVal;
+    thumb.alpha = header.alpha;
+    thumb.isFloat = header.isFloat;
+    thumb.tupleType = header.tupleType;
+    thumb.mapped.reset();
+    thumb.stats.reset();
+    ThumbnailSize(width, height, maxSize, thumb.width, thumb.height);
+    const int bytesPerSample = thumb.BytesPerSample();
+    thumb.samples.resize(thumb.SampleCount() * bytesPerSample);
+
+    // Box filter: source column x lands in output column x * thumbWidth / width (same
+    // for rows), so every source pixel contributes to exactly one output pixel
+    std::vector<int> column(width);
+    std::vector<uint32_t> columnCount(thumb.width, 0);
+    for (int x = 0; x < width; ++x) {
+        column[x] = static_cast<int>(static_cast<int64_t>(x) * thumb.width / width);
+        ++columnCount[column[x]];
+    }
+
+    // Only one source row and one output row of sums are held at a time
+    std::vector<uint8_t> row(static_cast<size_t>(width) * channels * bytesPerSample), packed;
+    std::vector<double> sum(static_cast<size_t>(thumb.width) * channels, 0.0);
+    uint32_t rowsSummed = 0;
+    int sumRow = -1;
+    auto flush = [&]() {
+        uint8_t* out = thumb.samples.data() + static_cast<size_t>(sumRow) * thumb.width * channels * bytesPerSample;
+        for (int tx = 0; tx < thumb.width; ++tx) {
+            const double count = static_cast<double>(columnCount[tx]) * rowsSummed;
+            for (int c = 0; c < channels; ++c) {
+                const size_t i = static_cast<size_t>(tx) * channels + c;
+                const double v = sum[i] / count;
+                if (bytesPerSample == 4) reinterpret_cast<float*>(out)[i] = static_cast<float>(v);
+                else if (bytesPerSample == 2) reinterpret_cast<uint16_t*>(out)[i] = static_cast<uint16_t>(v + 0.5);
+                else out[i] = static_cast<uint8_t>(v + 0.5);
+            }
+        }
+        std::fill(sum.begin(), sum.end(), 0.0);
+        rowsSummed = 0;
+    };
+
+    for (int i = 0; i < height; ++i) {
+        if (!ReadRasterRow(reader, header, bytesPerSample, row, packed)) {
+            thumb.samples.clear();
+            thumb.width = thumb.height = 0;
+            return false;
+        }
+        const int y = header.isFloat ? height - 1 - i : i;
+        const int ty = static_cast<int>(static_cast<int64_t>(y) * thumb.height / height);
+        if (ty != sumRow && rowsSummed) flush();
+        sumRow = ty;
+        ++rowsSummed;
+        double* acc = sum.data();
+        if (bytesPerSample == 1) {
+            const uint8_t* s = row.data();
+            for (int x = 0; x < width; ++x, s += channels) {
+                double* a = acc + static_cast<size_t>(column[x]) * channels;
+                for (int c = 0; c < channels; ++c) a[c] += s[c];
+            }
+        } else if (bytesPerSample == 2) {
+            const uint16_t* s = reinterpret_cast<const uint16_t*>(row.data());
+            for (int x = 0; x < width; ++x, s += channels) {
+                double* a = acc + static_cast<size_t>(column[x]) * channels;
+                for (int c = 0; c < channels; ++c) a[c] += s[c];
+            }
+        } else {
+            const float* s = reinterpret_cast<const float*>(row.data());
+            for (int x = 0; x < width; ++x, s += channels) {
+                double* a = acc + static_cast<size_t>(column[x]) * channels;
+                for (int c = 0; c < channels; ++c) a[c] += s[c];
+            }
+        }
+    }
+    flush();
+    return true;
+}
+
+Image DecodePnm(std::istream& in) {
+    Image img;
+    PnmReader reader(in);
+    PnmHeader header;
+    if (!ReadPnmHeader(reader, header)) return img;
+    ReadPnmRaster(reader, header, img);
+    return img;
+}
+
+// Helper: a decompressing stream with its first two (decompressed) bytes copied to
+// `head` and put back. Should that fail (a first frame of a single byte), the rest is
+// read into memory behind them.
+static std::unique_ptr<std::istream> PeekDecompressed(std::unique_ptr<std::istream> in, unsigned char head[2]) {
+    head[0] = head[1] = 0;
+    in->read(reinterpret_cast<char*>(head), 2);
+    const std::streamsize got = in->gcount();
+    in->clear();
+    std::streamsize back = 0;
+    while (back < got && in->unget()) ++back;
+    if (*in) return in;
+    in->clear();
+    std::string data(reinterpret_cast<const char*>(head), static_cast<size_t>(got - back));
+    data.append(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>());
+    return std::make_unique<std::istringstream>(std::move(data));
+}
+
+std::unique_ptr<std::istream> OpenPnmInput(const std::string& filepath) {
+    if (filepath == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        // Non-owning: the stream must not delete std::cin
+        return std::unique_ptr<std::istream>(new std::istream(std::cin.rdbuf()));
+    }
+
+    auto file = std::make_unique<std::ifstream>(Utf8Path(filepath), std::ios::binary);
+    if (!file->is_open()) {
+        std::cerr << "Error: Could not open file: " << filepath << std::endl;
+        return nullptr;
+    }
+
+    // Peek first bytes to detect compression and a UTF-16 BOM (UTF-8 BOMs are skipped
+    // by the tokenizer)
+    unsigned char header[4] = {0,0,0,0};
+    file->read(reinterpret_cast<char*>(header), 4);
+    const Compression compression = DetectCompression(header, static_cast<size_t>(file->gcount()));
+    file->clear();
+    file->seekg(0, std::ios::beg);
+
+    // .gz/.zst: decompressed as the tokenizer reads, the BOM being in the decompressed bytes
+    std::unique_ptr<std::istream> in = std::move(file);
+    if (compression != Compression::None) in = PeekDecompressed(OpenDecompressor(std::move(in), compression), header);
+
+    const bool utf16le = (header[0] == 0xFF && header[1] == 0xFE);
+    const bool utf16be = (header[0] == 0xFE && header[1] == 0xFF);
+    if (utf16le || utf16be) {
+        // Text saved as UTF-16: transcode to UTF-8 and parse from memory
+        std::vector<char> raw((std::istreambuf_iterator<char>(*in)), std::istreambuf_iterator<char>());
+        return std::make_unique<std::istringstream>(Utf16ToUtf8(raw.data(), raw.size(), utf16be));
+    }
+    return in;
+}
+
+std::unique_ptr<std::istream> OpenPnmBuffer(std::string data) {
+    const Compression compression = DetectCompression(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    if (compression != Compression::None) {
+        unsigned char head[2];
+        std::unique_ptr<std::istream> in = PeekDecompressed(OpenDecompressor(std::move(data), compression), head);
+        if ((head[0] == 0xFF && head[1] == 0xFE) || (head[0] == 0xFE && head[1] == 0xFF)) {
+            std::vector<char> raw((std::istreambuf_iterator<char>(*in)), std::istreambuf_iterator<char>());
+            return std::make_unique<std::istringstream>(Utf16ToUtf8(raw.data(), raw.size(), head[0] == 0xFE));
+        }
+        return in;
+    }
+    const bool utf16le = (data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0xFF && static_cast<unsigned char>(data[1]) == 0xFE);
+    const bool utf16be = (data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0xFE && static_cast<unsigned char>(data[1]) == 0xFF);
+    if (utf16le || utf16be) data = Utf16ToUtf8(data.data(), data.size(), utf16be);
+    return std::make_unique<std::istringstream>(std::move(data));
+}
+
+Image LoadPPM(const std::string& filepath) {
+    Image img;
+    std::unique_ptr<std::istream> in = OpenPnmInput(filepath);
+    if (!in) return img;
+
+    PnmReader reader(*in);
+    PnmHeader header;
+    if (!ReadPnmHeader(reader, header) || !ReadPnmRaster(reader, header, img)) return img;
+
+    std::cout << header.magic << " Image Loaded: " << img.width << "x" << img.height << std::endl;
+    return img;
+}
+
+Image LoadPPMThumbnail(const std::string& filepath, int maxSize) {
+    Image thumb;
+    std::unique_ptr<std::istream> in = OpenPnmInput(filepath);
+    if (!in) return thumb;
+
+    PnmReader reader(*in);
+    PnmHeader header;
+    if (ReadPnmHeader(reader, header)) ReadPnmThumbnail(reader, header, maxSize, thumb);
+    return thumb;
+}
+
+// Headers are small: this much is read per Fill() while probing
+constexpr size_t kProbeChunk = 4096;
+
+bool ProbePPM(const std::string& filepath, PnmProbe& probe) {
+    probe = PnmProbe{};
+    auto file = std::make_unique<std::ifstream>(Utf8Path(filepath), std::ios::binary | std::ios::ate);
+    if (!file->is_open()) {
+        std::cerr << "Error: Could not open file: " << filepath << std::endl;
+        return false;
+    }
+    probe.fileSize = static_cast<uint64_t>(std::max<std::streamoff>(0, file->tellg()));
+    file->seekg(0, std::ios::beg);
+
+    unsigned char head[4] = {0, 0, 0, 0};
+    file->read(reinterpret_cast<char*>(head), 4);
+    probe.compression = DetectCompression(head, static_cast<size_t>(file->gcount()));
+    file->clear();
+    file->seekg(0, std::ios::beg);
+    // Compressed: the header is read through the decompressor (only its first block
+    // or so gets decoded), and offsets count decompressed bytes
+    std::unique_ptr<std::istream> in = std::move(file);
+    if (probe.compression != Compression::None) in = PeekDecompressed(OpenDecompressor(std::move(in), probe.compression), head);
+    probe.utf16 = (head[0] == 0xFF && head[1] == 0xFE) || (head[0] == 0xFE && head[1] == 0xFF);
+
+    if (!probe.utf16) {
+        PnmReader reader(*in, kProbeChunk);
+        if (!ReadPnmHeader(reader, probe.header)) return false;
+        probe.rasterOffset = reader.Tell();
+        return true;
+    }
+
+    // UTF-16 (necessarily plain text): transcode the start of the file only, then map
+    // the UTF-8 header length back to UTF-16 code units
+    std::vector<char> raw(2 * kProbeChunk);
+    in->read(raw.data(), static_cast<std::streamsize>(raw.size()));
+    raw.resize(static_cast<size_t>(in->gcount()));
+    std::istringstream text(Utf16ToUtf8(raw.data(), raw.size(), head[0] == 0xFE));
+    PnmReader reader(text, kProbeChunk);
+    if (!ReadPnmHeader(reader, probe.header)) return false;
+    const std::string& utf8 = text.str();
+    const size_t headerBytes = std::min<size_t>(static_cast<size_t>(reader.Tell()), utf8.size());
+    probe.rasterOffset = 2; // BOM
+    for (size_t i = 0; i < headerBytes; ++i) {
+        const unsigned char c = static_cast<unsigned char>(utf8[i]);
+        if ((c & 0xC0) != 0x80) probe.rasterOffset += (c >= 0xF0) ? 4 : 2; // surrogate pair or one unit
+    }
+    return true;
+}
+
+// 4. MULTI-IMAGE STREAMS
+bool PnmStream::Open(const std::string& filepath) {
+    reader_.reset();
+    offsets_.clear();
+    position_ = 0;
+    complete_ = false;
+    input_ = OpenPnmInput(filepath);
+    if (!input_) return false;
+    seekable_ = (filepath != "-") && input_->tellg() != std::streampos(-1);
+    reader_ = std::make_unique<PnmReader>(*input_);
+    return true;
+}
+
+bool PnmStream::BeginFrame(PnmHeader& header) {
+    if (!reader_) return false;
+    // Frames may be separated by whitespace; end of data is a clean end of stream
+    if (!reader_->SkipSpace()) {
+        if (position_ == offsets_.size()) complete_ = true;
+        return false;
+    }
+    const uint64_t offset = reader_->Tell();
+    if (!ReadPnmHeader(*reader_, header)) return false;
+    if (position_ == offsets_.size()) offsets_.push_back(offset);
+    return true;
+}
+
+bool PnmStream::AtEnd() {
+    if (!reader_) return true;
+    if (reader_->SkipSpace()) return false;
+    if (position_ == offsets_.size()) complete_ = true;
+    return true;
+}
+
+bool PnmStream::Next(Image& img) {
+    PnmHeader header;
+    if (!BeginFrame(header)) return false;
+    if (!ReadPnmRaster(*reader_, header, img)) return false;
+    ++position_;
+    return true;
+}
+
+bool PnmStream::Skip() {
+    PnmHeader header;
+    if (!BeginFrame(header)) return false;
+    if (!SkipPnmRaster(*reader_, header)) return false;
+    ++position_;
+    return true;
+}
+
+bool PnmStream::Seek(size_t index) {
+    if (!reader_ || !seekable_ || index >= offsets_.size()) return false;
+    if (!reader_->Seek(offsets_[index])) return false;
+    position_ = index;
+    return true;
+}
+
+size_t PnmStream::BuildIndex() {
+    // Indexing a pipe would consume it
+    if (!reader_ || complete_ || !seekable_) return offsets_.size();
+    const size_t resumeAt = position_;
+    // Continue from the last indexed frame (or from here if it was never reached)
+    if (!offsets_.empty() && position_ < offsets_.size()) Seek(offsets_.size() - 1);
+    while (Skip()) {}
+    // Stopping on a malformed frame also ends the index
+    complete_ = true;
+    if (resumeAt < offsets_.size()) Seek(resumeAt);
+    return offsets_.size();
+}
+
+// 5. INCREMENTAL RELOAD
+// Rows per hashed band: fine enough that a render refining a few buckets touches
+// few bands, coarse enough that the hashes stay tiny (270 for an 8K frame)
+constexpr int kReloadBandRows = 16;
+
+// Helper: 64-bit hash of a byte range (four interleaved multiply/rotate lanes over
+// 8-byte words, so it runs near memory speed; not cryptographic)
+static uint64_t HashBytes(const uint8_t* p, size_t n) {
+    constexpr uint64_t k1 = 0x9E3779B185EBCA87ull, k2 = 0xC2B2AE3D27D4EB4Full;
+    auto rotl = [](uint64_t v, int r) { return (v << r) | (v >> (64 - r)); };
+    uint64_t lane[4] = { k1, k2, ~k1, ~k2 };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int l = 0; l < 4; ++l) {
+            uint64_t w;
+            std::memcpy(&w, p + i + 8 * l, 8);
+            lane[l] = rotl(lane[l] + w * k2, 31) * k1;
+        }
+    }
+    uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18) + n;
+    for (; i < n; ++i) h = (h ^ p[i]) * 0x100000001B3ull;
+    h ^= h >> 33;
+    h *= k2;
+    h ^= h >> 29;
+    return h;
+}
+
+// Helper: append rows [begin, end), merging with the previous range when adjacent
+static void AddRows(std::vector<RowRange>& changed, int begin, int end) {
+    if (!changed.empty() && changed.back().end == begin) changed.back().end = end;
+    else changed.push_back({ begin, end });
+}
+
+// Helper: img would be decoded into the same shape and sample layout as `previous`
+static bool SameLayout(const Image& previous, const PnmHeader& header) {
+    return previous.HasSamples() && previous.width == header.width && previous.height == header.height
+        && previous.channels == header.channels && previous.maxVal == header.maxVal
+        && previous.isFloat == header.isFloat && previous.alpha == header.alpha && previous.tupleType == header.tupleType;
+}
+
+// Helper: bands whose decoded samples differ between two images of the same layout
+static void DiffBands(const Image& previous, const Image& img, std::vector<RowRange>& changed) {
+    const size_t rowBytes = static_cast<size_t>(img.width) * img.channels * img.BytesPerSample();
+    for (int y = 0; y < img.height; y += kReloadBandRows) {
+        const int rows = std::min(kReloadBandRows, img.height - y);
+        const size_t offset = static_cast<size_t>(y) * rowBytes;
+        if (std::memcmp(previous.Data() + offset, img.Data() + offset, rows * rowBytes) != 0) AddRows(changed, y, y + rows);
+    }
+}
+
+bool ReloadPnm(const std::string& filepath, const Image& previous, PnmBandHashes& hashes, Image& img, std::vector<RowRange>& changed) {
+    changed.clear();
+    std::unique_ptr<std::istream> in = OpenPnmInput(filepath);
+    if (!in) return false;
+    PnmReader reader(*in);
+    PnmHeader header;
+    if (!ReadPnmHeader(reader, header)) return false;
+    const bool same = SameLayout(previous, header);
+
+    if (header.IsAscii()) {
+        // Text rows have no fixed position or length to hash: decode everything,
+        // then find the changed bands in the decoded samples
+        hashes = PnmBandHashes{};
+        if (!ReadPnmRaster(reader, header, img)) return false;
+        if (same) DiffBands(previous, img, changed);
+        else AddRows(changed, 0, img.height);
+        return true;
+    }
+
+    const int bytesPerSample = header.isFloat ? 4 : (header.maxVal > 255 ? 2 : 1);
+    const size_t fileRowBytes = header.magic == "P4" ? (static_cast<size_t>(header.width) + 7) / 8
+                                                     : static_cast<size_t>(header.width) * header.channels * bytesPerSample;
+    const size_t rowBytes = static_cast<size_t>(header.width) * header.channels * bytesPerSample;
+    const size_t bands = (static_cast<size_t>(header.height) + kReloadBandRows - 1) / kReloadBandRows;
+    // The old hashes only count if they describe `previous`'s raster in this very format
+    const bool usable = same && hashes.bandRows == kReloadBandRows && hashes.hashes.size() == bands
+        && hashes.header.magic == header.magic && hashes.header.littleEndian == header.littleEndian;
+
+    img.width = header.width;
+    img.height = header.height;
+    img.channels = header.channels;
+    img.maxVal = header.maxVal;
+    img.alpha = header.alpha;
+    img.isFloat = header.isFloat;
+    img.tupleType = header.tupleType;
+    img.mapped.reset();
+    img.stats.reset();
+    img.samples.resize(img.SampleCount() * bytesPerSample);
+
+    std::unique_ptr<StatsAccumulator> stats;
+    if (g_collectStats) stats = std::make_unique<StatsAccumulator>(img);
+    std::vector<uint64_t> next(bands);
+    std::vector<uint8_t> raw(fileRowBytes * kReloadBandRows);
+    for (size_t band = 0; band < bands; ++band) {
+        const int fileRow = static_cast<int>(band) * kReloadBandRows;
+        const int rows = std::min(kReloadBandRows, header.height - fileRow);
+        const size_t bytes = fileRowBytes * rows;
+        if (reader.Read(raw.data(), bytes) != bytes) {
+            std::cerr << "Error: Unexpected end of file while reading binary pixels." << std::endl;
+            img.samples.clear();
+            img.width = img.height = 0;
+            hashes = PnmBandHashes{};
+            return false;
+        }
+        next[band] = HashBytes(raw.data(), bytes);
+        const bool unchanged = usable && hashes.hashes[band] == next[band];
+        for (int r = 0; r < rows; ++r) {
+            // PFM stores the bottom row first
+            const int y = header.isFloat ? header.height - 1 - (fileRow + r) : fileRow + r;
+            uint8_t* out = img.samples.data() + static_cast<size_t>(y) * rowBytes;
+            if (unchanged) std::memcpy(out, previous.Data() + static_cast<size_t>(y) * rowBytes, rowBytes);
+            else DecodeBinaryRow(header, bytesPerSample, raw.data() + static_cast<size_t>(r) * fileRowBytes, out);
+        }
+        if (stats) {
+            if (header.isFloat) stats->Add(img, header.height - fileRow - rows, header.height - fileRow);
+            else stats->Add(img, fileRow, fileRow + rows);
+        }
+        if (!unchanged && usable) {
+            if (header.isFloat) changed.push_back({ header.height - fileRow - rows, header.height - fileRow });
+            else AddRows(changed, fileRow, fileRow + rows);
+        }
+    }
+    hashes.header = header;
+    hashes.bandRows = kReloadBandRows;
+    hashes.hashes = std::move(next);
+    if (stats) img.stats = stats->Finish(img);
+
+    if (!usable) {
+        // First reload of this image (or a new layout): no hashes to go by
+        if (same) DiffBands(previous, img, changed);
+        else AddRows(changed, 0, img.height);
+    } else if (header.isFloat) {
+        // Bands were visited bottom up
+        std::sort(changed.begin(), changed.end(), [](const RowRange& a, const RowRange& b) { return a.begin < b.begin; });
+        std::vector<RowRange> merged;
+        for (const RowRange& r : changed) AddRows(merged, r.begin, r.end);
+        changed = std::move(merged);
+    }
+    return true;
+}
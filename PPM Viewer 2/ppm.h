@@ -0,0 +1,265 @@
+#pragma once
+
+#include "decompress.h"
+
+#include <array>
+#include <cstdio>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Per-channel statistics of an image's samples: what exposure checks look at.
+// Integer samples are binned by value * kBins / (maxVal + 1), float samples over
+// [0, 1] with values outside that range in the end bins. Samples of a binary raster
+// above maxVal count as maxVal in the histogram but keep their value in min/max/mean.
+struct ImageStats {
+    static constexpr int kBins = 256;
+    struct Channel {
+        std::array<uint64_t, kBins> histogram{};
+        double min = 0, max = 0, mean = 0; // sample units; NaNs are left out
+        uint64_t clippedLow = 0;  // samples at 0 (float: <= 0)
+        uint64_t clippedHigh = 0; // samples at maxVal or above (float: >= 1)
+        uint64_t nan = 0;         // float only
+    };
+    int channels = 0;
+    Channel channel[4];
+};
+
+// Decoded image in its native sample layout: interleaved samples exactly as stored
+// in the file, one byte per sample when maxVal <= 255, otherwise two (host-endian
+// uint16_t), or four (host-endian float, top row first) for PFM. Nothing here is
+// display-ready; see display.h.
+//
+// channels is 1 for PGM/PBM, 3 for PPM and 1-4 for PAM. Bitonal PBM data is stored
+// as gray with maxVal 1 (0 = black, 1 = white), i.e. the inverse of the bits in the
+// file. When alpha is set the last channel is (straight, not premultiplied) alpha.
+//
+// Samples normally live in `samples`. An image opened from the decode cache (see
+// decode_cache.h) instead points `mapped` at a read-only file mapping and leaves
+// `samples` empty; readers go through Data()/HasSamples() to handle both.
+//
+// `stats` is filled in by the decoder while the raster streams in when
+// SetCollectStats(true) is on, and is null otherwise (ComputeImageStats makes it
+// later). Code that changes samples in place must reset it.
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 3;
+    int maxVal = 255;
+    bool alpha = false;
+    bool isFloat = false;  // PFM: linear float samples, nominal range [0, 1], maxVal unused
+    std::string tupleType; // PAM TUPLTYPE, empty for P1-P6
+    std::vector<uint8_t> samples;
+    std::shared_ptr<const uint8_t> mapped; // keeps the mapping alive
+    std::shared_ptr<const ImageStats> stats;
+
+    int BytesPerSample() const { return isFloat ? 4 : (maxVal > 255 ? 2 : 1); }
+    size_t SampleCount() const { return static_cast<size_t>(width) * height * channels; }
+    bool HasSamples() const { return mapped != nullptr || !samples.empty(); }
+    const uint8_t* Data() const { return mapped ? mapped.get() : samples.data(); }
+    const uint16_t* Samples16() const { return reinterpret_cast<const uint16_t*>(Data()); }
+    uint16_t* Samples16() { return reinterpret_cast<uint16_t*>(samples.data()); }
+    const float* SamplesF() const { return reinterpret_cast<const float*>(Data()); }
+    float* SamplesF() { return reinterpret_cast<float*>(samples.data()); }
+};
+
+// Buffered byte reader shared by every Netpbm decoder: a fast tokenizer for headers
+// and ASCII rasters plus a bulk path for binary rasters. Whitespace includes ASCII
+// control bytes, UTF-8 NBSP (C2 A0) and stray UTF-8 BOMs; '#' starts a comment.
+class PnmReader {
+public:
+    // bufferSize also bounds how far past the current token the stream is read
+    explicit PnmReader(std::istream& in, size_t bufferSize = 1 << 16) : in_(in), buf_(bufferSize) {}
+
+    int Peek() { return (pos_ < end_ || Fill(1)) ? static_cast<unsigned char>(buf_[pos_]) : EOF; }
+    int Get() { return (pos_ < end_ || Fill(1)) ? static_cast<unsigned char>(buf_[pos_++]) : EOF; }
+
+    // Skip whitespace and comments; false at EOF
+    bool SkipSpace();
+    // Next whitespace/comment delimited token; false at EOF
+    bool NextToken(std::string& out);
+    // Next decimal sample (ASCII rasters); false at EOF or on a non-digit token
+    bool ReadUInt(uint32_t& value);
+    // Next single '0'/'1' digit (P1 rasters, which may omit separators)
+    bool ReadBit(uint8_t& value);
+    // Raw bytes (binary rasters); returns the number of bytes actually read
+    size_t Read(void* dst, size_t count);
+    // Discard bytes (seeks when the stream allows it); returns the number skipped
+    uint64_t Skip(uint64_t count);
+
+    // Byte offset of the next unread byte in the underlying stream
+    uint64_t Tell() const { return consumed_ - (end_ - pos_); }
+    // Reposition to an absolute offset (seekable streams only)
+    bool Seek(uint64_t offset);
+
+private:
+    // Make at least `need` unread bytes available in the buffer; false at EOF
+    bool Fill(size_t need);
+    // Length of the multi-byte "whitespace" sequence (NBSP, BOM) at the cursor, or 0
+    size_t Utf8SpaceAt();
+
+    std::istream& in_;
+    std::vector<char> buf_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    uint64_t consumed_ = 0; // bytes pulled from in_ so far
+};
+
+// Everything a Netpbm/PFM header says about the image that follows it
+struct PnmHeader {
+    std::string magic; // "P1".."P7", "PF" or "Pf"
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int maxVal = 1;
+    bool alpha = false;
+    bool isFloat = false;
+    bool littleEndian = false; // PFM byte order
+    std::string tupleType;
+
+    bool IsAscii() const { return magic == "P1" || magic == "P2" || magic == "P3"; }
+    // Size of the raster on disk (binary formats only)
+    uint64_t RasterBytes() const;
+};
+
+// Parse a header, leaving the reader at the first raster byte; prints and returns
+// false on malformed or unsupported headers
+bool ReadPnmHeader(PnmReader& reader, PnmHeader& header);
+// Decode the raster that follows header into img (img.samples keeps its capacity).
+// With SetCollectStats(true) img.stats is gathered band by band as the samples are
+// decoded, while they are still in cache, instead of by a second pass.
+bool ReadPnmRaster(PnmReader& reader, const PnmHeader& header, Image& img);
+// Consume the raster that follows header without storing it
+bool SkipPnmRaster(PnmReader& reader, const PnmHeader& header);
+
+// Process-wide: whether ReadPnmRaster (and so every decoder built on it) gathers
+// Image::stats. Off by default: counting every sample is not free (roughly the cost
+// of decoding a binary raster that is already in memory), it only saves the second
+// trip through memory that ComputeImageStats takes.
+void SetCollectStats(bool on);
+bool CollectStats();
+// Statistics of an already decoded image (one pass over its samples)
+std::shared_ptr<const ImageStats> ComputeImageStats(const Image& img);
+
+// Size of a thumbnail that fits in maxSize x maxSize, keeping the aspect ratio;
+// images that already fit keep their size
+void ThumbnailSize(int width, int height, int maxSize, int& thumbWidth, int& thumbHeight);
+// Decode the raster that follows header straight into a box-filtered thumbnail
+// (same channels/maxVal/format as the source, see ThumbnailSize). Rows are averaged
+// as they stream in, so memory is one source row plus the thumbnail, never the
+// full-resolution image.
+bool ReadPnmThumbnail(PnmReader& reader, const PnmHeader& header, int maxSize, Image& thumb);
+
+// Open a file for decoding; gzip/zstd files are decompressed as they are read, UTF-16
+// text is transcoded to UTF-8 in memory and "-" means stdin. Returns null (after
+// printing) when the file cannot be opened.
+std::unique_ptr<std::istream> OpenPnmInput(const std::string& filepath);
+// Same for a file already read into memory (the buffer is moved, not copied)
+std::unique_ptr<std::istream> OpenPnmBuffer(std::string data);
+
+// Everything ProbePPM learns about a file without touching its raster
+struct PnmProbe {
+    PnmHeader header;          // format (magic), dimensions, channels, maxVal, ...
+    uint64_t rasterOffset = 0; // file offset of the first raster byte (of the first image)
+    uint64_t fileSize = 0;
+    bool utf16 = false;        // UTF-16 text; rasterOffset still counts file bytes
+    Compression compression = Compression::None; // rasterOffset then counts decompressed bytes
+};
+
+// Parse only the header of a file (same BOM/comment handling as LoadPPM), reading a
+// few KB at most for ordinary headers. Prints and returns false on bad headers.
+bool ProbePPM(const std::string& filepath, PnmProbe& probe);
+
+// Decode a P1-P7 Netpbm or PF/Pf PFM image from a file (handles UTF-8/UTF-16 BOMs
+// and gzip/zstd compression)
+Image LoadPPM(const std::string& filepath);
+// Decode a P1-P7 Netpbm or PF/Pf PFM image from an already opened stream
+Image DecodePnm(std::istream& in);
+// Thumbnail of the first image of a file (see ReadPnmThumbnail); empty on failure.
+// Nothing is printed on success, as previews are made in bulk.
+Image LoadPPMThumbnail(const std::string& filepath, int maxSize);
+
+// Hashes of a binary raster in bands of rows (file order), taken by ReloadPnm so the
+// next reload of the same file can tell which bands were rewritten
+struct PnmBandHashes {
+    PnmHeader header;
+    int bandRows = 0;
+    std::vector<uint64_t> hashes;
+};
+
+// Rows [begin, end) of an image
+struct RowRange {
+    int begin = 0;
+    int end = 0;
+};
+
+// Decode the first image of a file that was rewritten in place, given `previous`,
+// its last decode. Binary rasters are read band by band: bands whose bytes hash the
+// same as in `hashes` (which must describe `previous`) are copied from it, the
+// rest are decoded. Text rasters are decoded in full and compared band by band.
+// `changed` receives the rows that differ from `previous` (everything if its size
+// or format differs); `hashes` is updated to describe img.
+bool ReloadPnm(const std::string& filepath, const Image& previous, PnmBandHashes& hashes, Image& img, std::vector<RowRange>& changed);
+
+// Encoding options for SavePPM
+struct SaveOptions {
+    bool ascii = false; // P3 instead of P6
+    int maxVal = 0;     // output maxVal; 0 keeps the image's (255 for float images)
+};
+
+// Encode img as P6 (or P3) PPM. Gray is replicated to RGB, alpha is dropped, float
+// samples are clamped to [0, 1], and samples are rescaled when the output maxVal
+// differs; maxVal > 255 gives 16-bit big-endian output. "-" writes stdout.
+bool SavePPM(const Image& img, const std::string& filepath, const SaveOptions& options = SaveOptions{});
+bool WritePPM(std::ostream& out, const Image& img, const SaveOptions& options = SaveOptions{});
+
+// Supplies row y of a BGRX (0x00RRGGBB) image; may be called from several threads
+using BGRXRowFn = std::function<void(int y, uint32_t* bgrxRow)>;
+// Encode rendered BGRX pixels (e.g. the viewer's displayed view) as 8-bit P6 or P3
+bool SavePPMFromBGRX(const std::string& filepath, int width, int height, bool ascii, const BGRXRowFn& getRow);
+
+// Iterates over the images of a multi-image file or stream (Netpbm allows any
+// number of images back to back). One frame is decoded at a time into a caller
+// owned Image, so memory stays constant however long the stream is. The byte
+// offset of every frame seen is recorded; on seekable inputs Seek() jumps to any
+// indexed frame and BuildIndex() scans the rest of the file (rasters are skipped,
+// not decoded) so the frame count is known.
+class PnmStream {
+public:
+    bool Open(const std::string& filepath);
+
+    // Decode the next frame; false at the end of the stream or on error
+    bool Next(Image& img);
+    // Step over the next frame without decoding its raster
+    bool Skip();
+    // Position before frame `index` (must already be indexed; seekable inputs only)
+    bool Seek(size_t index);
+    // Index every remaining frame; returns the total frame count
+    size_t BuildIndex();
+    // True when no data follows the current frame (blocks on pipes until it knows)
+    bool AtEnd();
+
+    // Index of the frame Next() will return
+    size_t Position() const { return position_; }
+    // Frames indexed so far, and whether that is all of them
+    size_t IndexedCount() const { return offsets_.size(); }
+    bool IndexComplete() const { return complete_; }
+    const std::vector<uint64_t>& Offsets() const { return offsets_; }
+    bool IsOpen() const { return reader_ != nullptr; }
+    bool Seekable() const { return seekable_; }
+
+private:
+    // Skip to the next frame start and record it; false at the end of the stream
+    bool BeginFrame(PnmHeader& header);
+
+    std::unique_ptr<std::istream> input_;
+    std::unique_ptr<PnmReader> reader_;
+    std::vector<uint64_t> offsets_;
+    size_t position_ = 0;
+    bool complete_ = false;
+    bool seekable_ = false;
+};
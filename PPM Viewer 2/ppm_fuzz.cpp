@@ -0,0 +1,815 @@
+#include "ppm_fuzz.h"
+#include "ppm_reference.h"
+#include "decode_cache.h"
+#include "tiled.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Inputs whose header asks for more sample memory than this are skipped: every
+// path would allocate it, only to fail on the missing raster
+constexpr uint64_t kFuzzMaxImageBytes = 64ull << 20;
+// PnmReader buffer sizes tried; 3 is the smallest that can see a whole UTF-8 BOM
+constexpr size_t kFuzzBufferSizes[] = { 3, 4, 5, 7, 16, 64, 4096, 1 << 16 };
+
+// 1. HELPERS
+// Discards everything written to it
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+// Silences std::cerr while alive: the decoders print every input they reject
+class QuietErrors {
+public:
+    QuietErrors() : saved_(std::cerr.rdbuf(&sink_)) {}
+    ~QuietErrors() { std::cerr.rdbuf(saved_); }
+
+private:
+    NullBuffer sink_;
+    std::streambuf* saved_;
+};
+
+// Helper: write `data` as the file at path with a modification time no earlier
+// write had, so caches keyed on size and mtime see every rewrite
+static bool WriteFuzzFile(const fs::path& path, const std::string& data) {
+    static const fs::file_time_type base = fs::file_time_type::clock::now();
+    static int64_t writes = 0;
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out.write(data.data(), static_cast<std::streamsize>(data.size()))) return false;
+    }
+    std::error_code ec;
+    fs::last_write_time(path, base + std::chrono::seconds(++writes), ec);
+    return !ec;
+}
+
+// Helper: "" when img (decoded or not, per ok) matches the reference, otherwise
+// how the path called `what` differs from it
+static std::string Mismatch(const std::string& what, bool refOk, const Image& ref, bool ok, const Image& img) {
+    if (ok != refOk) return what + (ok ? ": decoded an input the reference rejects" : ": rejected an input the reference decodes");
+    if (!ok) return {};
+    std::ostringstream out;
+    out << what << ": ";
+    if (img.width != ref.width || img.height != ref.height || img.channels != ref.channels) {
+        out << img.width << "x" << img.height << "x" << img.channels << ", reference "
+            << ref.width << "x" << ref.height << "x" << ref.channels;
+        return out.str();
+    }
+    if (img.isFloat != ref.isFloat || (!ref.isFloat && img.maxVal != ref.maxVal)) {
+        out << "maxVal " << img.maxVal << (img.isFloat ? " (float)" : "") << ", reference " << ref.maxVal << (ref.isFloat ? " (float)" : "");
+        return out.str();
+    }
+    if (img.alpha != ref.alpha || img.tupleType != ref.tupleType) {
+        out << "alpha " << img.alpha << " \"" << img.tupleType << "\", reference " << ref.alpha << " \"" << ref.tupleType << "\"";
+        return out.str();
+    }
+    const size_t bytesPerSample = ref.BytesPerSample();
+    const size_t bytes = ref.SampleCount() * bytesPerSample;
+    if (!img.HasSamples() || (!img.mapped && img.samples.size() != bytes)) {
+        out << "raster of " << (img.mapped ? 0 : img.samples.size()) << " bytes, reference " << bytes;
+        return out.str();
+    }
+    const uint8_t* a = img.Data();
+    const uint8_t* b = ref.Data();
+    for (size_t i = 0; i < bytes; i += bytesPerSample) {
+        if (std::memcmp(a + i, b + i, bytesPerSample) == 0) continue;
+        uint32_t got = 0, want = 0;
+        std::memcpy(&got, a + i, bytesPerSample);
+        std::memcpy(&want, b + i, bytesPerSample);
+        out << "sample " << i / bytesPerSample << " is 0x" << std::hex << got << ", reference 0x" << want;
+        return out.str();
+    }
+    return {};
+}
+
+// Helper: same for a full-size thumbnail, compared by value (averaging a single
+// sample goes through double, which may turn -0 into 0 and quiet a NaN)
+static std::string ThumbMismatch(bool refOk, const Image& ref, bool ok, const Image& thumb) {
+    if (ok != refOk || !ok) return Mismatch("ReadPnmThumbnail", refOk, ref, ok, thumb);
+    if (!ref.isFloat) return Mismatch("ReadPnmThumbnail", refOk, ref, ok, thumb);
+    if (thumb.width != ref.width || thumb.height != ref.height || thumb.channels != ref.channels || !thumb.isFloat
+        || thumb.samples.size() != ref.samples.size()) {
+        return "ReadPnmThumbnail: float thumbnail has a different size or format";
+    }
+    const float* a = thumb.SamplesF();
+    const float* b = ref.SamplesF();
+    for (size_t i = 0; i < ref.SampleCount(); ++i) {
+        if (a[i] == b[i] || (std::isnan(a[i]) && std::isnan(b[i]))) continue;
+        std::ostringstream out;
+        out << "ReadPnmThumbnail: sample " << i << " is " << a[i] << ", reference " << b[i];
+        return out.str();
+    }
+    return {};
+}
+
+// Helper: statistics gathered while decoding must equal those of a separate pass
+// over the reference image (means of float images up to summation order)
+static std::string StatsMismatch(const std::string& what, const Image& ref, const Image& img) {
+    if (!img.stats) return {};
+    const std::shared_ptr<const ImageStats> want = ComputeImageStats(ref);
+    const ImageStats& got = *img.stats;
+    if (!want || got.channels != want->channels) return what + ": statistics for a different channel count";
+    auto close = [&](double a, double b) {
+        if (a == b || (std::isnan(a) && std::isnan(b))) return true;
+        return ref.isFloat && std::fabs(a - b) <= 1e-9 * std::max(1.0, std::fabs(b));
+    };
+    for (int c = 0; c < got.channels; ++c) {
+        const ImageStats::Channel& g = got.channel[c];
+        const ImageStats::Channel& w = want->channel[c];
+        const char* field = nullptr;
+        if (g.histogram != w.histogram) field = "histogram";
+        else if (g.min != w.min || g.max != w.max) field = "min/max";
+        else if (!close(g.mean, w.mean)) field = "mean";
+        else if (g.clippedLow != w.clippedLow || g.clippedHigh != w.clippedHigh || g.nan != w.nan) field = "clipped/NaN counts";
+        if (field) return what + ": channel " + std::to_string(c) + " statistics differ (" + field + ")";
+    }
+    return {};
+}
+
+// Helper: decode data from memory through a reader with the given buffer size
+static bool DecodeBuffer(const std::string& data, size_t bufferSize, Image& img) {
+    std::unique_ptr<std::istream> in = OpenPnmBuffer(data);
+    PnmReader reader(*in, bufferSize);
+    PnmHeader header;
+    return ReadPnmHeader(reader, header) && ReadPnmRaster(reader, header, img);
+}
+
+// Helper: append v as `bytes` little-endian bytes
+static void PutLittleEndian(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out += static_cast<char>((v >> (8 * i)) & 0xFF);
+}
+
+// Helper: gzip's CRC-32 of size bytes
+static uint32_t Crc32(const char* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= static_cast<unsigned char>(data[i]);
+        for (int k = 0; k < 8; ++k) crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+    }
+    return ~crc;
+}
+
+// Helper: `data` as gzip members of `memberSize` bytes each, made of stored deflate
+// blocks of `blockSize` (no compressor needed, and every boundary still comes up)
+static std::string StoredGzip(const std::string& data, size_t blockSize, size_t memberSize) {
+    std::string out;
+    size_t at = 0;
+    do {
+        const size_t member = std::min(memberSize, data.size() - at);
+        out += std::string("\x1F\x8B\x08\0\0\0\0\0\0\xFF", 10);
+        size_t done = 0;
+        do {
+            const size_t block = std::min(blockSize, member - done);
+            out += static_cast<char>(done + block == member ? 1 : 0);
+            PutLittleEndian(out, block, 2);
+            PutLittleEndian(out, ~block & 0xFFFF, 2);
+            out.append(data, at + done, block);
+            done += block;
+        } while (done < member);
+        PutLittleEndian(out, Crc32(data.data() + at, member), 4);
+        PutLittleEndian(out, member, 4);
+        at += member;
+    } while (at < data.size());
+    return out;
+}
+
+// LSB-first bit writer for deflate; Huffman codes go in most significant bit first
+struct DeflateBits {
+    std::string& out;
+    uint64_t bits = 0;
+    int count = 0;
+
+    void Put(uint32_t value, int n) {
+        bits |= static_cast<uint64_t>(value) << count;
+        for (count += n; count >= 8; count -= 8, bits >>= 8) out += static_cast<char>(bits & 0xFF);
+    }
+    void PutCode(uint32_t code, int n) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < n; ++i) reversed |= ((code >> i) & 1) << (n - 1 - i);
+        Put(reversed, n);
+    }
+    // Fixed Huffman code of a literal/length symbol
+    void PutSymbol(int sym) {
+        if (sym < 144) PutCode(0x30 + sym, 8);
+        else if (sym < 256) PutCode(0x190 + sym - 144, 9);
+        else if (sym < 280) PutCode(sym - 256, 7);
+        else PutCode(0xC0 + sym - 280, 8);
+    }
+    void Flush() {
+        if (count > 0) Put(0, 8 - count);
+    }
+};
+
+// Helper: `data` as one gzip member of fixed Huffman deflate blocks, each coding
+// `blockBytes` of input, with greedy LZ77 matches up to 32 KB back (overlapping
+// ones and ones reaching into earlier blocks included): real back-references for
+// the decoder, still without a compressor library
+static std::string FixedGzip(const std::string& data, size_t blockBytes) {
+    static const uint16_t kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t kDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr size_t kWindow = 32768;
+    auto hash = [&](size_t i) {
+        const auto b = [&](size_t k) { return static_cast<uint32_t>(static_cast<unsigned char>(data[i + k])); };
+        return ((b(0) << 10) ^ (b(1) << 5) ^ b(2)) & 0x7FFF;
+    };
+
+    std::string out("\x1F\x8B\x08\0\0\0\0\0\0\xFF", 10);
+    DeflateBits bits{ out };
+    std::vector<size_t> head(1 << 15, SIZE_MAX);
+    size_t i = 0;
+    do {
+        const size_t end = std::min(data.size(), i + std::max<size_t>(1, blockBytes));
+        bits.Put(end == data.size() ? 1 : 0, 1);
+        bits.Put(1, 2); // fixed Huffman codes
+        while (i < end) {
+            size_t length = 0, distance = 0;
+            if (i + 3 <= data.size()) {
+                const size_t candidate = head[hash(i)];
+                if (candidate != SIZE_MAX && i - candidate <= kWindow) {
+                    const size_t most = std::min<size_t>(258, end - i);
+                    while (length < most && data[candidate + length] == data[i + length]) ++length;
+                    distance = i - candidate;
+                }
+            }
+            if (length < 3) length = 1;
+            for (size_t k = i; k < i + length && k + 3 <= data.size(); ++k) head[hash(k)] = k;
+            if (length == 1) {
+                bits.PutSymbol(static_cast<unsigned char>(data[i]));
+            } else {
+                int code = 28;
+                while (kLengthBase[code] > length) --code;
+                bits.PutSymbol(257 + code);
+                bits.Put(static_cast<uint32_t>(length - kLengthBase[code]), kLengthExtra[code]);
+                int dcode = 29;
+                while (kDistanceBase[dcode] > distance) --dcode;
+                bits.PutCode(dcode, 5);
+                bits.Put(static_cast<uint32_t>(distance - kDistanceBase[dcode]), kDistanceExtra[dcode]);
+            }
+            i += length;
+        }
+        bits.PutSymbol(256);
+    } while (i < data.size());
+    bits.Flush();
+    PutLittleEndian(out, Crc32(data.data(), data.size()), 4);
+    PutLittleEndian(out, data.size(), 4);
+    return out;
+}
+
+// Helper: `data` as zstd frames of `frameSize` bytes, made of raw blocks of
+// `blockSize` (at most 128 KB). Each frame declares its size, so they may be
+// decoded in parallel.
+static std::string RawZstd(const std::string& data, size_t blockSize, size_t frameSize) {
+    std::string out;
+    size_t at = 0;
+    do {
+        const size_t frame = std::min(frameSize, data.size() - at);
+        PutLittleEndian(out, 0xFD2FB528u, 4);
+        out += static_cast<char>(0xA0); // single segment, 4-byte content size
+        PutLittleEndian(out, frame, 4);
+        size_t done = 0;
+        do {
+            const size_t block = std::min(blockSize, frame - done);
+            PutLittleEndian(out, (block << 3) | (done + block == frame ? 1 : 0), 3);
+            out.append(data, at + done, block);
+            done += block;
+        } while (done < frame);
+        at += frame;
+    } while (at < data.size());
+    return out;
+}
+
+// Helper: the w x h pixels of img at (x, y), which must lie inside it
+static Image Crop(const Image& img, int x, int y, int w, int h) {
+    Image crop = img;
+    crop.width = w;
+    crop.height = h;
+    crop.mapped.reset();
+    crop.stats.reset();
+    const size_t pixelBytes = static_cast<size_t>(img.channels) * img.BytesPerSample();
+    crop.samples.resize(static_cast<size_t>(w) * h * pixelBytes);
+    for (int row = 0; row < h; ++row)
+        std::memcpy(crop.samples.data() + row * w * pixelBytes, img.Data() + (static_cast<size_t>(y + row) * img.width + x) * pixelBytes, w * pixelBytes);
+    return crop;
+}
+
+// Helper: rows of `img` that differ from `previous` all lie in `changed`
+static bool ChangedCoversDiff(const Image& previous, const Image& img, const std::vector<RowRange>& changed) {
+    auto listed = [&](int y) {
+        return std::any_of(changed.begin(), changed.end(), [y](const RowRange& r) { return y >= r.begin && y < r.end; });
+    };
+    const bool sameLayout = previous.width == img.width && previous.height == img.height && previous.channels == img.channels
+        && previous.maxVal == img.maxVal && previous.isFloat == img.isFloat;
+    const size_t rowBytes = static_cast<size_t>(img.width) * img.channels * img.BytesPerSample();
+    for (int y = 0; y < img.height; ++y) {
+        const bool differs = !sameLayout
+            || std::memcmp(previous.Data() + y * rowBytes, img.Data() + y * rowBytes, rowBytes) != 0;
+        if (differs && !listed(y)) return false;
+    }
+    return true;
+}
+
+// 2. CHECKS
+// Helper: every path in turn; the first disagreement is returned. `input` is the
+// compressed input data came out of (empty when the input was plain Netpbm).
+static std::string CheckAll(const std::string& data, const std::string& input, const fs::path& dir) {
+    Image ref;
+    size_t refEnd = 0;
+    const bool refOk = DecodePnmReference(data, ref, &refEnd);
+    const bool utf16 = data.size() >= 2 && ((static_cast<unsigned char>(data[0]) == 0xFF && static_cast<unsigned char>(data[1]) == 0xFE)
+                                        || (static_cast<unsigned char>(data[0]) == 0xFE && static_cast<unsigned char>(data[1]) == 0xFF));
+    std::string failure;
+
+    // In memory, with statistics off and then on
+    SetCollectStats(false);
+    for (size_t bufferSize : kFuzzBufferSizes) {
+        Image img;
+        const bool ok = DecodeBuffer(data, bufferSize, img);
+        failure = Mismatch("PnmReader (" + std::to_string(bufferSize) + "-byte buffer)", refOk, ref, ok, img);
+        if (!failure.empty()) return failure;
+    }
+    SetCollectStats(true);
+    {
+        std::unique_ptr<std::istream> in = OpenPnmBuffer(data);
+        Image img = DecodePnm(*in);
+        const bool ok = img.HasSamples() && img.width > 0;
+        failure = Mismatch("DecodePnm with statistics", refOk, ref, ok, img);
+        if (failure.empty() && ok) failure = StatsMismatch("DecodePnm", ref, img);
+        if (!failure.empty()) return failure;
+    }
+    {
+        std::unique_ptr<std::istream> in = OpenPnmBuffer(data);
+        PnmReader reader(*in);
+        PnmHeader header;
+        Image thumb;
+        const bool ok = ReadPnmHeader(reader, header) && ReadPnmThumbnail(reader, header, std::max(header.width, header.height), thumb);
+        failure = ThumbMismatch(refOk, ref, ok, thumb);
+        if (!failure.empty()) return failure;
+    }
+
+    // From a file: the decode cache misses (and stores text formats), then hits
+    const fs::path file = dir / "fuzz.pnm";
+    const std::string filepath = PathUtf8(file);
+    if (!WriteFuzzFile(file, data)) return "could not write " + filepath;
+    for (const char* pass : { "DecodeWithDiskCache (miss)", "DecodeWithDiskCache (hit)" }) {
+        std::shared_ptr<const Image> img = DecodeWithDiskCache(filepath);
+        failure = Mismatch(pass, refOk, ref, img != nullptr, img ? *img : Image{});
+        if (failure.empty() && img) failure = StatsMismatch(pass, ref, *img);
+        if (!failure.empty()) return failure;
+    }
+
+    // Compressed: gzip members of stored and of fixed Huffman blocks, zstd frames of
+    // raw blocks, and the compressed input itself, from memory and through the
+    // cache. One-byte members and frames and tiny blocks (small inputs only) make
+    // the BOM check straddle frames and matches reach across blocks.
+    std::vector<std::string> compressed = {
+        StoredGzip(data, 65535, SIZE_MAX), StoredGzip(data, 5, data.size() <= 4096 ? 1 : 4096),
+        FixedGzip(data, 1 << 16), FixedGzip(data, data.size() <= 4096 ? 9 : 4096),
+        RawZstd(data, 1 << 17, SIZE_MAX), RawZstd(data, 7, data.size() <= 4096 ? 1 : 65536),
+    };
+    if (!input.empty()) compressed.push_back(input);
+    for (const std::string& packed : compressed) {
+        const std::string kind = CompressionName(DetectCompression(reinterpret_cast<const uint8_t*>(packed.data()), packed.size()));
+        std::unique_ptr<std::istream> in = OpenPnmBuffer(packed);
+        Image img = DecodePnm(*in);
+        failure = Mismatch("DecodePnm (" + kind + ")", refOk, ref, img.HasSamples() && img.width > 0, img);
+        if (!failure.empty()) return failure;
+        const fs::path packedFile = dir / ("fuzz.pnm." + kind);
+        if (!WriteFuzzFile(packedFile, packed)) return "could not write " + PathUtf8(packedFile);
+        for (const char* pass : { " (miss)", " (hit)" }) {
+            std::shared_ptr<const Image> cached = DecodeWithDiskCache(PathUtf8(packedFile));
+            failure = Mismatch("DecodeWithDiskCache (" + kind + ")" + pass, refOk, ref, cached != nullptr, cached ? *cached : Image{});
+            if (!failure.empty()) return failure;
+        }
+    }
+
+    // The reference image as a tiled container (small tiles, so that most images span
+    // several): whole through the cache path, one region, and a damaged copy, which
+    // may be rejected but must not be read out of bounds
+    if (refOk) {
+        TiledOptions options;
+        options.tileSize = 16;
+        options.threads = 2;
+        std::string tiled;
+        if (!EncodeTiled(ref, options, tiled)) return "EncodeTiled: rejected the reference image";
+        const fs::path tiledFile = dir / "fuzz.ppmt";
+        if (!WriteFuzzFile(tiledFile, tiled)) return "could not write " + PathUtf8(tiledFile);
+        std::shared_ptr<const Image> img = DecodeWithDiskCache(PathUtf8(tiledFile));
+        failure = Mismatch("DecodeWithDiskCache (tiled)", refOk, ref, img != nullptr, img ? *img : Image{});
+        if (!failure.empty()) return failure;
+
+        const int x = ref.width / 3, y = ref.height / 3, w = ref.width / 2 + 1, h = ref.height / 2 + 1;
+        TiledReader reader;
+        Image region;
+        const bool ok = reader.OpenBuffer(tiled) && reader.ReadRegion(0, x, y, w, h, region, 2);
+        failure = Mismatch("TiledReader::ReadRegion", refOk, Crop(ref, x, y, w, h), ok, region);
+        if (!failure.empty()) return failure;
+
+        for (size_t i = data.size() % 61; i < tiled.size(); i += 1 + tiled.size() / 7) tiled[i] ^= 0x5A;
+        TiledReader damaged;
+        if (damaged.OpenBuffer(std::move(tiled))) {
+            for (int level = 0; level < damaged.Levels(); ++level) {
+                Image any;
+                damaged.ReadLevel(level, any, 2);
+            }
+        }
+    }
+
+    // Incremental reload: a damaged copy first, then the file itself on top of it
+    if (!data.empty()) {
+        std::string sibling = data;
+        for (size_t i = sibling.size() / 2; i < sibling.size(); i += 1 + sibling.size() / 5) sibling[i] ^= 0x5A;
+        Image siblingRef;
+        const bool siblingOk = DecodePnmReference(sibling, siblingRef);
+        if (!WriteFuzzFile(file, sibling)) return "could not write " + filepath;
+        PnmBandHashes hashes;
+        Image previous;
+        std::vector<RowRange> changed;
+        bool ok = ReloadPnm(filepath, Image{}, hashes, previous, changed);
+        failure = Mismatch("ReloadPnm (first load)", siblingOk, siblingRef, ok, previous);
+        if (!failure.empty()) return failure;
+        if (ok) {
+            if (!WriteFuzzFile(file, data)) return "could not write " + filepath;
+            Image img;
+            ok = ReloadPnm(filepath, previous, hashes, img, changed);
+            failure = Mismatch("ReloadPnm (over a damaged copy)", refOk, ref, ok, img);
+            if (failure.empty() && ok) failure = StatsMismatch("ReloadPnm", ref, img);
+            if (failure.empty() && ok && !ChangedCoversDiff(previous, img, changed)) failure = "ReloadPnm: changed rows not all listed";
+            if (!failure.empty()) return failure;
+        }
+    }
+
+    // Two images back to back, decoding or skipping the first. UTF-16 is left out:
+    // the second copy's BOM would be transcoded into the middle of the text.
+    if (!utf16) {
+        const std::string twice = data + data;
+        Image first, second;
+        size_t firstEnd = 0;
+        const bool firstOk = DecodePnmReference(twice, first, &firstEnd);
+        const bool secondOk = firstOk && DecodePnmReference(twice.substr(firstEnd), second);
+        const fs::path streamFile = dir / "fuzz-stream.pnm";
+        if (!WriteFuzzFile(streamFile, twice)) return "could not write " + PathUtf8(streamFile);
+        for (bool skipFirst : { false, true }) {
+            PnmStream stream;
+            if (!stream.Open(PathUtf8(streamFile))) return "PnmStream: could not open " + PathUtf8(streamFile);
+            Image img;
+            const bool ok = skipFirst ? stream.Skip() : stream.Next(img);
+            if (skipFirst) failure = ok != firstOk ? "PnmStream::Skip: first frame accepted differently" : "";
+            else failure = Mismatch("PnmStream (frame 0)", firstOk, first, ok, img);
+            if (failure.empty() && ok) {
+                Image next;
+                const bool nextOk = stream.Next(next);
+                failure = Mismatch(skipFirst ? "PnmStream (frame 1 after Skip)" : "PnmStream (frame 1)", secondOk, second, nextOk, next);
+            }
+            if (!failure.empty()) return failure;
+        }
+    }
+    return {};
+}
+
+std::string CheckDecoders(const std::string& data, const std::string& workDir) {
+    const fs::path dir = Utf8Path(workDir);
+    std::error_code ec;
+    fs::create_directories(dir / "cache", ec);
+    if (ec) return "could not create " + workDir;
+
+    QuietErrors quiet;
+    // The reference only knows Netpbm: a compressed input (a damaged one included) is
+    // checked against whatever its decompressor gets out of it, all of it or what
+    // comes before the damage. Plain inputs are wrapped in compressed ones as well.
+    const Compression kind = DetectCompression(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    std::string plain;
+    if (kind != Compression::None) {
+        std::unique_ptr<std::istream> in = OpenDecompressor(data, kind);
+        std::vector<char> buffer(1 << 16);
+        while (in->read(buffer.data(), buffer.size()) || in->gcount() > 0) {
+            plain.append(buffer.data(), static_cast<size_t>(in->gcount()));
+            if (plain.size() > kFuzzMaxImageBytes) return {};
+        }
+        // Compressed twice: the decoders unwrap one layer only
+        if (DetectCompression(reinterpret_cast<const uint8_t*>(plain.data()), plain.size()) != Compression::None) return {};
+    }
+    const std::string& netpbm = kind != Compression::None ? plain : data;
+
+    // Headers that ask for more memory than the input could ever fill are not worth it
+    {
+        std::unique_ptr<std::istream> in = OpenPnmBuffer(netpbm);
+        PnmReader reader(*in);
+        PnmHeader header;
+        if (ReadPnmHeader(reader, header)) {
+            const uint64_t bytesPerSample = header.isFloat ? 4 : (header.maxVal > 255 ? 2 : 1);
+            if (static_cast<uint64_t>(header.width) * header.height * header.channels * bytesPerSample > kFuzzMaxImageBytes) return {};
+        }
+    }
+
+    const bool savedStats = CollectStats();
+    const std::string savedCacheDir = DecodeCacheDir();
+    SetDecodeCacheDir(PathUtf8(dir / "cache"));
+    const std::string failure = CheckAll(netpbm, kind != Compression::None ? data : std::string(), dir);
+    SetDecodeCacheDir(savedCacheDir);
+    SetCollectStats(savedStats);
+    return failure;
+}
+
+// 3. INPUT GENERATION
+// Helper: random integer in [lo, hi]
+static int64_t Pick(std::mt19937_64& rng, int64_t lo, int64_t hi) {
+    return std::uniform_int_distribution<int64_t>(lo, hi)(rng);
+}
+
+// Helper: true with probability p
+static bool Chance(std::mt19937_64& rng, double p) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < p;
+}
+
+// Helper: whitespace between tokens; usually one blank, sometimes a run of the
+// odd kinds the tokenizer has to know about
+static std::string Separator(std::mt19937_64& rng) {
+    if (!Chance(rng, 0.3)) return Chance(rng, 0.75) ? " " : "\n";
+    static const std::string kOdd[] = {
+        " ", "\n", "\t", "\r\n", "\r", "\v", "\f", "\x01", "\x1F", std::string(1, '\0'),
+        "\xC2\xA0", "\xEF\xBB\xBF", "# comment\n", "# comment\r", "#\n", "#\r\n",
+        "# \xF0\x9F\x98\x80 \xC2\xA0 #\n", "  \t  ",
+    };
+    std::string out;
+    for (int64_t n = Pick(rng, 1, 3); n > 0; --n) out += kOdd[Pick(rng, 0, std::size(kOdd) - 1)];
+    return out;
+}
+
+// Helper: decimal text of v, sometimes zero-padded
+static std::string Number(std::mt19937_64& rng, int64_t v) {
+    std::string text = std::to_string(v);
+    if (v >= 0 && Chance(rng, 0.05)) text.insert(0, static_cast<size_t>(Pick(rng, 1, 4)), '0');
+    return text;
+}
+
+// Helper: a header number: mostly as is, sometimes with trailing junk (which
+// std::stoi stops at) or not a number at all
+static std::string HeaderNumber(std::mt19937_64& rng, int64_t v) {
+    const int64_t kind = Pick(rng, 0, 99);
+    if (kind < 94) return Number(rng, v);
+    if (kind < 96) return Number(rng, v) + "x";
+    if (kind < 98) return "99999999999";
+    return "abc";
+}
+
+// Helper: a maxVal, now and then out of range
+static int64_t MaxVal(std::mt19937_64& rng) {
+    static const int64_t kCommon[] = { 1, 2, 7, 15, 100, 255, 255, 255, 256, 1023, 4095, 65535, 65535 };
+    const int64_t kind = Pick(rng, 0, 99);
+    if (kind < 75) return kCommon[Pick(rng, 0, std::size(kCommon) - 1)];
+    if (kind < 95) return Pick(rng, 1, 65535);
+    static const int64_t kBad[] = { 0, -1, 65536, 100000 };
+    return kBad[Pick(rng, 0, std::size(kBad) - 1)];
+}
+
+// Helper: a text sample for maxVal: mostly in range, sometimes above it (clamped
+// on decode) or too large for 32 bits (saturated)
+static std::string TextSample(std::mt19937_64& rng, int64_t maxVal) {
+    const int64_t kind = Pick(rng, 0, 199);
+    if (kind < 190) return Number(rng, Pick(rng, 0, std::max<int64_t>(maxVal, 0)));
+    if (kind < 198) return Number(rng, Pick(rng, std::max<int64_t>(maxVal, 0) + 1, 70000));
+    return "99999999999999999999";
+}
+
+// Helper: four bytes of a PFM sample in the given byte order
+static void AppendFloat(std::mt19937_64& rng, bool littleEndian, std::string& out) {
+    static const float kSpecial[] = { 0.0f, -0.0f, 1.0f, 0.5f, -2.0f, 1e-42f, 3.4e38f, INFINITY, -INFINITY, NAN };
+    const float v = Chance(rng, 0.2) ? kSpecial[Pick(rng, 0, std::size(kSpecial) - 1)]
+                                     : std::uniform_real_distribution<float>(-0.25f, 1.25f)(rng);
+    uint32_t bits;
+    std::memcpy(&bits, &v, 4);
+    for (int i = 0; i < 4; ++i) out += static_cast<char>(bits >> (littleEndian ? 8 * i : 24 - 8 * i));
+}
+
+// Helper: UTF-8 text (as generated: valid) -> UTF-16 with a BOM
+static std::string Utf16Encode(const std::string& text, bool bigEndian) {
+    std::string out = bigEndian ? "\xFE\xFF" : "\xFF\xFE";
+    auto unit = [&](uint32_t u) {
+        out += static_cast<char>(bigEndian ? u >> 8 : u & 0xFF);
+        out += static_cast<char>(bigEndian ? u & 0xFF : u >> 8);
+    };
+    for (size_t i = 0; i < text.size();) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        const size_t n = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+        uint32_t cp = n == 1 ? c : n == 2 ? c & 0x1F : n == 3 ? c & 0x0F : c & 0x07;
+        for (size_t k = 1; k < n && i + k < text.size(); ++k) cp = (cp << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+        i += n;
+        if (cp >= 0x10000) {
+            unit(0xD800 + ((cp - 0x10000) >> 10));
+            unit(0xDC00 + ((cp - 0x10000) & 0x3FF));
+        } else {
+            unit(cp);
+        }
+    }
+    return out;
+}
+
+// Helper: byte-level damage: truncation, overwrites, insertions, deletions, junk
+static void Mutate(std::mt19937_64& rng, std::string& data) {
+    static const char kInteresting[] = { ' ', '\n', '\r', '#', '0', '9', 'P', '\0', '\xC2', '\xA0', '\xEF', '\xBB', '\xBF', '\xFF', '\xFE' };
+    auto interesting = [&]() {
+        return Chance(rng, 0.5) ? kInteresting[Pick(rng, 0, std::size(kInteresting) - 1)] : static_cast<char>(Pick(rng, 0, 255));
+    };
+    for (int64_t n = Pick(rng, 1, 3); n > 0; --n) {
+        const size_t at = data.empty() ? 0 : static_cast<size_t>(Pick(rng, 0, data.size() - 1));
+        switch (Pick(rng, 0, 5)) {
+        case 0: data.resize(at); break;
+        case 1: if (!data.empty()) data[at] = interesting(); break;
+        case 2: data.insert(at, 1, interesting()); break;
+        case 3: data.erase(at, static_cast<size_t>(Pick(rng, 1, 8))); break;
+        case 4: data += Separator(rng); break;
+        default: data += interesting(); break;
+        }
+    }
+}
+
+std::string MakeFuzzInput(std::mt19937_64& rng) {
+    // Format: mostly P3 and P6
+    static const char* const kMagic[] = { "P1", "P2", "P4", "P5", "P7", "PF", "Pf" };
+    const int64_t kind = Pick(rng, 0, 99);
+    const std::string magic = kind < 35 ? "P3" : kind < 70 ? "P6" : kMagic[Pick(rng, 0, std::size(kMagic) - 1)];
+    const char format = magic[1];
+    const bool text = format >= '1' && format <= '3';
+
+    // Mostly tiny; now and then big enough for several bands and reader refills
+    int64_t width = Pick(rng, 1, 12), height = Pick(rng, 1, 12);
+    const int64_t size = Pick(rng, 0, 99);
+    if (size < 10) {
+        width = Pick(rng, 1, 80);
+        height = Pick(rng, 1, 80);
+    } else if (size < 12) {
+        width = Pick(rng, 200, 600);
+        height = Pick(rng, 100, 300);
+    } else if (size < 13) {
+        width = Pick(rng, -2, 0);
+    }
+    int64_t maxVal = (format == '1' || format == '4') ? 1 : MaxVal(rng);
+    int64_t channels = (format == '3' || format == '6' || format == 'F') ? 3 : 1;
+    const bool littleEndian = Chance(rng, 0.5);
+
+    std::string data;
+    if (Chance(rng, 0.1)) data += "\xEF\xBB\xBF";
+    data += magic;
+    if (format == '7') {
+        channels = Pick(rng, 1, 4);
+        static const char* const kTypes[] = { "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA", "CUSTOM" };
+        std::vector<std::string> lines = { "WIDTH " + HeaderNumber(rng, width), "HEIGHT " + HeaderNumber(rng, height),
+                                           "DEPTH " + HeaderNumber(rng, channels), "MAXVAL " + HeaderNumber(rng, maxVal) };
+        for (int64_t n = Pick(rng, 0, 2); n > 0; --n) lines.push_back(std::string("TUPLTYPE ") + kTypes[Pick(rng, 0, std::size(kTypes) - 1)]);
+        if (Chance(rng, 0.03)) lines.erase(lines.begin() + Pick(rng, 0, 3));
+        if (Chance(rng, 0.03)) lines.push_back("COLOR 1");
+        std::shuffle(lines.begin(), lines.end(), rng);
+        for (const std::string& line : lines) data += Separator(rng) + line;
+        data += Separator(rng) + "ENDHDR";
+    } else {
+        data += Separator(rng) + HeaderNumber(rng, width) + Separator(rng) + HeaderNumber(rng, height);
+        if (format == 'F' || format == 'f') data += Separator(rng) + (littleEndian ? "-1.0" : "1.0");
+        else if (format != '1' && format != '4') data += Separator(rng) + HeaderNumber(rng, maxVal);
+    }
+
+    // Raster: text samples with separators, or the one byte after the header and
+    // the binary samples
+    const uint64_t samples = static_cast<uint64_t>(std::max<int64_t>(width, 0)) * height * channels;
+    if (text) {
+        for (uint64_t i = 0; i < samples; ++i) {
+            if (format == '1') data += (i == 0 || Chance(rng, 0.5)) ? Separator(rng) : std::string();
+            else data += Separator(rng);
+            data += format == '1' ? std::string(1, Chance(rng, 0.5) ? '1' : '0') : TextSample(rng, maxVal);
+        }
+        if (Chance(rng, 0.3)) data += Separator(rng);
+    } else {
+        static const char kAfterHeader[] = { '\n', '\n', '\n', ' ', '\t', '\r', '#', 'x', '\xC2' };
+        data += kAfterHeader[Pick(rng, 0, std::size(kAfterHeader) - 1)];
+        if (format == 'F' || format == 'f') {
+            for (uint64_t i = 0; i < samples; ++i) AppendFloat(rng, littleEndian, data);
+        } else {
+            const uint64_t bytes = format == '4' ? (static_cast<uint64_t>(std::max<int64_t>(width, 0)) + 7) / 8 * height
+                                                 : samples * (maxVal > 255 ? 2 : 1);
+            for (uint64_t i = 0; i < bytes; ++i) data += static_cast<char>(Pick(rng, 0, 255));
+        }
+    }
+
+    if (text && Chance(rng, 0.1)) data = Utf16Encode(data, Chance(rng, 0.5));
+    if (Chance(rng, 0.4)) Mutate(rng, data);
+    return data;
+}
+
+// Compressed members made by the real tools, for the parts of the formats the
+// fuzzer's own encoders (stored and fixed Huffman deflate, raw zstd blocks) don't
+// produce
+// zstd -19 with checksum of a 32x24 P6: Huffman-coded literals, FSE-coded sequences
+static const uint8_t kSeedZstd[] = {
+    0x28, 0xB5, 0x2F, 0xFD, 0x64, 0x14, 0x08, 0x85, 0x08, 0x00, 0x52, 0x46, 0x10, 0x16, 0xC0, 0xA7,
+    0x31, 0xFF, 0xBF, 0xAE, 0xAA, 0x46, 0xDE, 0x62, 0xCE, 0xFD, 0xA7, 0x35, 0x91, 0xF2, 0x13, 0x56,
+    0xAF, 0x34, 0xEF, 0x0E, 0xDB, 0xDC, 0x6D, 0xFA, 0xEA, 0x6E, 0x73, 0x75, 0x7D, 0xD5, 0x75, 0xFD,
+    0xA4, 0xC5, 0x18, 0xB3, 0x6D, 0x75, 0x5F, 0xDD, 0x93, 0x16, 0xB3, 0x93, 0x16, 0x57, 0x0F, 0x80,
+    0xAA, 0xA2, 0x40, 0x45, 0xA0, 0x83, 0x86, 0x42, 0x92, 0x44, 0x39, 0x42, 0x19, 0x47, 0x73, 0xA8,
+    0x11, 0x8B, 0x78, 0xFF, 0x0E, 0x90, 0x8C, 0x8C, 0x04, 0x35, 0xE6, 0x01, 0x92, 0x08, 0x8A, 0x05,
+    0x10, 0x42, 0x10, 0x13, 0x1A, 0xA1, 0x44, 0x04, 0x56, 0x68, 0x84, 0x50, 0x34, 0xA2, 0x15, 0x47,
+    0xB3, 0x07, 0xC2, 0x53, 0xF7, 0xA3, 0x79, 0x5D, 0x35, 0x14, 0xFE, 0x87, 0x6D, 0xFA, 0xB1, 0xC0,
+    0xD5, 0x8F, 0x80, 0xC5, 0x18, 0x51, 0x08, 0x29, 0xD7, 0xA0, 0x6A, 0x54, 0x2D, 0x24, 0x0A, 0xE0,
+    0x9A, 0x8E, 0x6E, 0x50, 0x20, 0x30, 0xE2, 0x19, 0x87, 0x69, 0xE4, 0xD0, 0x14, 0xA8, 0x1E, 0x8A,
+    0x25, 0xA9, 0x36, 0x32, 0x92, 0xD0, 0x00, 0x0E, 0x50, 0xA8, 0x46, 0x20, 0xF1, 0x84, 0x25, 0x49,
+    0x1C, 0xCA, 0x6C, 0x94, 0xDB, 0x15, 0x8C, 0xE2, 0x8C, 0x66, 0x88, 0x48, 0xD4, 0x64, 0xC8, 0xC2,
+    0x7F, 0xAE, 0x77, 0x2B, 0x12, 0x1C, 0x50, 0x51, 0x53, 0x8D, 0x62, 0x1C, 0x11, 0x25, 0x34, 0x75,
+    0x77, 0xB8, 0x04, 0xA0, 0x33, 0x26, 0x41, 0x15, 0x4A, 0x88, 0x68, 0xAD, 0x3C, 0x0A, 0xF5, 0xC7,
+    0x05, 0x86, 0x89, 0x8B, 0xF6, 0x6A, 0x58, 0xE1, 0x94, 0x08, 0x1C, 0x04, 0x0A, 0x3F, 0x21, 0x97,
+    0x9A, 0xC6, 0x77, 0x6B, 0x7A, 0x78, 0x2E, 0x82, 0xE3, 0xE9, 0xC8, 0xB4, 0x4C, 0x0D, 0x44, 0x98,
+    0x1D, 0xBC, 0x20, 0x26, 0xC2, 0x53, 0xBA, 0xAB, 0xDA, 0x78, 0x71, 0x58, 0x49, 0xC1, 0x63, 0x4A,
+    0xD2, 0x1D, 0xE8, 0xA3, 0x12, 0x04, 0x48, 0x3B, 0x58, 0x55, 0x22, 0x41, 0xF9, 0xDF,
+};
+// zstd --fast of a 24x16 P6: raw literals, FSE-coded sequences
+static const uint8_t kSeedZstdFast[] = {
+    0x28, 0xB5, 0x2F, 0xFD, 0x60, 0x94, 0x03, 0xF5, 0x09, 0x00, 0xA4, 0x06, 0x50, 0x36, 0x0A, 0x23,
+    0x20, 0x73, 0x65, 0x65, 0x64, 0x0A, 0x32, 0x34, 0x20, 0x31, 0x36, 0x0A, 0x32, 0x35, 0x35, 0x0A,
+    0x0A, 0x14, 0x1E, 0xC8, 0x28, 0x28, 0x28, 0xC8, 0x80, 0x40, 0x20, 0xFA, 0x00, 0x80, 0x40, 0x20,
+    0x28, 0x28, 0xC8, 0xFA, 0xFA, 0xFA, 0x00, 0x00, 0x00, 0xC8, 0x28, 0x28, 0xC8, 0x28, 0x28, 0x28,
+    0xC8, 0xFA, 0xFA, 0xFA, 0x00, 0x00, 0x00, 0x80, 0x40, 0x20, 0x0A, 0x14, 0x1E, 0x00, 0x00, 0xC8,
+    0x28, 0x80, 0x40, 0x20, 0x00, 0x00, 0x00, 0xC8, 0xFA, 0xFA, 0xFA, 0xC8, 0x28, 0x28, 0x00, 0x00,
+    0x00, 0x28, 0xC8, 0xC8, 0x28, 0xC8, 0x28, 0x00, 0x00, 0x28, 0xC8, 0x28, 0xC8, 0x28, 0x28, 0xC8,
+    0x0A, 0x14, 0x1E, 0x0A, 0x14, 0x1E, 0x80, 0x89, 0xA8, 0x21, 0x8B, 0x75, 0xDA, 0xDF, 0x90, 0x82,
+    0x29, 0xA1, 0x32, 0x0F, 0x12, 0xC0, 0x00, 0xF1, 0x1A, 0x83, 0x24, 0xB0, 0x85, 0x25, 0xE5, 0x6B,
+    0xDA, 0xCF, 0x50, 0x30, 0xFF, 0x38, 0x89, 0x68, 0x5C, 0x45, 0x34, 0x91, 0xF3, 0xD8, 0xE1, 0xFD,
+    0xF9, 0x9A, 0x1A, 0x82, 0xB5, 0x08, 0x5A, 0x4C, 0xF9, 0xD9, 0xD2, 0x8F, 0xDB, 0x0F, 0x0A, 0xC6,
+    0x3A, 0x7F, 0x20, 0x62, 0x3E, 0x84, 0x79, 0x1D, 0x78, 0xA2, 0x28, 0x82, 0xAF, 0x7D, 0x1E, 0x5A,
+    0xC4, 0xC3, 0x19, 0x8D, 0xE8, 0x2D, 0xF9, 0xD5, 0xBC, 0xA9, 0xE8, 0x8E, 0x0E, 0x52, 0x15, 0xB4,
+    0xF4, 0xD3, 0xF2, 0x94, 0x44, 0xF6, 0x33, 0xB1, 0x4D, 0xA6, 0x87, 0x26, 0xD4, 0xFF, 0x1A, 0xF8,
+    0x8A, 0x88, 0x2A, 0xD6, 0x28, 0x66, 0xD5, 0x23, 0x02, 0x81, 0x18, 0x93, 0x48, 0x30, 0xEB, 0xD0,
+    0x5F, 0x42, 0x28, 0x9E, 0x4C, 0x7B, 0x68, 0xFE, 0x7B, 0x04, 0x2E, 0x59, 0x4A, 0xF6, 0x3B, 0x77,
+    0x81, 0xA3, 0x90, 0xA4, 0x34, 0x9A, 0x30, 0x83, 0xB8, 0xBC, 0x86, 0x50, 0x3B, 0xA5, 0x19, 0x02,
+    0xE2, 0x5F, 0x4C, 0x32, 0xE0, 0x1B, 0x2F, 0x13, 0x0B, 0x19, 0xA6, 0x51, 0x3C, 0x0D, 0x4F, 0x0C,
+    0x41, 0x07, 0x0D, 0xBA, 0x2B, 0x04, 0x2D, 0x2B, 0x75, 0x12, 0x23, 0x2F, 0x82, 0x88, 0x63, 0x0C,
+    0x9E, 0xCF, 0xBF, 0xDC, 0x62, 0xC4, 0xCE, 0x34, 0x44, 0x18, 0xC2, 0x8F, 0x0F, 0x83, 0x0E, 0xDB,
+    0xC1, 0x6D, 0x64, 0x18, 0x4E, 0x0B, 0xC6, 0x55,
+};
+// gzip -9 of the same image as P3 text: dynamic Huffman blocks
+static const uint8_t kSeedGzip[] = {
+    0x1F, 0x8B, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xDD, 0x56, 0xDB, 0x0D, 0x83, 0x30,
+    0x10, 0xFB, 0xF7, 0x14, 0x27, 0x75, 0x81, 0x10, 0x02, 0xEA, 0x18, 0x1D, 0xA2, 0x4C, 0xD0, 0xFD,
+    0x25, 0xA4, 0x42, 0x09, 0x10, 0x73, 0x3C, 0xF2, 0xA8, 0x5A, 0x05, 0xA4, 0xE3, 0x88, 0x82, 0x4D,
+    0x7C, 0xCE, 0x3D, 0x6A, 0xDC, 0xE4, 0xD5, 0x75, 0x4F, 0x58, 0x27, 0x55, 0x0B, 0xDB, 0x34, 0xA8,
+    0x8C, 0x58, 0x23, 0xB5, 0x91, 0x30, 0xB0, 0xC6, 0x88, 0x7B, 0x5F, 0x2C, 0x72, 0xEA, 0x84, 0xCA,
+    0xDE, 0xA5, 0x75, 0x52, 0x5B, 0x3A, 0xC1, 0x36, 0xFB, 0x77, 0x38, 0xFC, 0x9A, 0xEB, 0xE7, 0x6D,
+    0x12, 0x20, 0x6C, 0x3C, 0x9C, 0x0D, 0x36, 0xCA, 0x84, 0x39, 0x42, 0x9E, 0x1D, 0x46, 0x98, 0x39,
+    0x82, 0x3E, 0x4C, 0x79, 0x00, 0x1A, 0x11, 0x2C, 0x72, 0x0C, 0xFE, 0x27, 0x41, 0xE1, 0xFB, 0x28,
+    0x04, 0x3F, 0xBF, 0xD7, 0x14, 0x46, 0x22, 0x04, 0xFE, 0x14, 0x11, 0xFC, 0x53, 0xA0, 0xE0, 0xE4,
+    0x44, 0x10, 0xA3, 0xC8, 0x8D, 0x95, 0x13, 0x29, 0x92, 0x46, 0x17, 0x4B, 0x0B, 0xB9, 0x84, 0xC7,
+    0xF7, 0x92, 0xEC, 0x1F, 0x83, 0x17, 0x51, 0x48, 0xC3, 0xA0, 0xA8, 0xF1, 0x2F, 0xDA, 0xDC, 0x2B,
+    0x32, 0xE8, 0x02, 0x5D, 0xD0, 0xF1, 0x6F, 0x92, 0xAA, 0x6F, 0xFC, 0x81, 0x11, 0x35, 0xA4, 0x4E,
+    0xC0, 0x55, 0x59, 0xEA, 0xE8, 0x4F, 0x7A, 0xE2, 0x2E, 0xE6, 0x78, 0x73, 0x87, 0xA6, 0x3B, 0x26,
+    0xAA, 0x6F, 0x6B, 0x6F, 0x4E, 0x86, 0x6A, 0x4B, 0x21, 0x84, 0xC2, 0xCE, 0xA8, 0x6E, 0x69, 0x84,
+    0x3A, 0x8F, 0x38, 0x3C, 0xAE, 0x9D, 0xCC, 0xFE, 0x53, 0x81, 0xD1, 0x9D, 0xB6, 0xCA, 0x9C, 0xFD,
+    0x05, 0xCE, 0x79, 0x62, 0x48, 0x39, 0xA7, 0x30, 0xD3, 0xB8, 0x3B, 0xF2, 0x9C, 0xC8, 0xB9, 0x85,
+    0x47, 0x0A, 0x88, 0x6E, 0x04, 0xA3, 0x79, 0x84, 0xD2, 0x4F, 0x76, 0xBC, 0xD0, 0xBB, 0xB8, 0x54,
+    0xC2, 0xE3, 0xED, 0x51, 0x91, 0xD6, 0x62, 0x30, 0xD8, 0xE2, 0x07, 0x75, 0xE1, 0x66, 0x17, 0x3D,
+    0xF6, 0x22, 0x77, 0xB6, 0x77, 0x0E, 0x00, 0x00,
+};
+
+std::string MakeCompressedFuzzInput(std::mt19937_64& rng, const std::vector<std::string>& seeds) {
+    static const std::string kBuiltIn[] = {
+        std::string(reinterpret_cast<const char*>(kSeedZstd), sizeof(kSeedZstd)),
+        std::string(reinterpret_cast<const char*>(kSeedZstdFast), sizeof(kSeedZstdFast)),
+        std::string(reinterpret_cast<const char*>(kSeedGzip), sizeof(kSeedGzip)),
+    };
+    const size_t choices = std::size(kBuiltIn) + seeds.size() + 1;
+    const size_t pick = static_cast<size_t>(Pick(rng, 0, static_cast<int64_t>(choices) - 1));
+    std::string data;
+    if (pick < std::size(kBuiltIn)) data = kBuiltIn[pick];
+    else if (pick < std::size(kBuiltIn) + seeds.size()) data = seeds[pick - std::size(kBuiltIn)];
+    else data = FixedGzip(MakeFuzzInput(rng), static_cast<size_t>(Pick(rng, 1, 4096)));
+
+    // Damage past the magic number mostly, so that it is still taken for compressed
+    if (Chance(rng, 0.9)) {
+        const std::string magic = data.substr(0, 4);
+        Mutate(rng, data);
+        if (Chance(rng, 0.9) && data.size() >= magic.size()) data.replace(0, magic.size(), magic);
+    }
+    return data;
+}
+
+#ifdef PPM_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const std::string workDir = PathUtf8(fs::temp_directory_path() / "ppm-fuzz");
+    const std::string failure = CheckDecoders(std::string(reinterpret_cast<const char*>(data), size), workDir);
+    if (!failure.empty()) {
+        std::cerr << "Decoder mismatch: " << failure << std::endl;
+        std::abort();
+    }
+    return 0;
+}
+#endif
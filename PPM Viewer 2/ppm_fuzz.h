@@ -0,0 +1,34 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Differential fuzzing of the decoders. Every fast path that turns a file into an
+// Image (the buffered tokenizer at several buffer sizes, banded statistics, the
+// file reader with its UTF-16 transcoding, the decode cache on a miss and on a
+// hit, gzip and zstd decompression, incremental reload, multi-image streams with
+// decoded and skipped frames, and thumbnails at full size) must agree with DecodePnmReference: same success
+// or failure and, on success, the same header fields and samples. Images the
+// reference decodes must also survive a round trip through a tiled container,
+// whole and as a region.
+//
+// Run by `ppmconv --fuzz N`, or by libFuzzer when built with PPM_LIBFUZZER, e.g.
+//   clang++ -std=c++20 -fsanitize=fuzzer,address -DPPM_LIBFUZZER ppm_fuzz.cpp ppm_reference.cpp
+//           ppm.cpp decode_cache.cpp image_cache.cpp decompress.cpp tiled.cpp
+// Uses process-wide settings (decode cache directory, statistics), restoring them
+// afterwards, so no decoding may run on other threads meanwhile.
+
+// Run input `data` through every path, using files in `workDir` (created if
+// missing). Empty if all agree, otherwise what differed first. A gzip or zstd
+// input, damaged or not, is checked against what its decompressor gets out of it.
+std::string CheckDecoders(const std::string& data, const std::string& workDir);
+
+// A random input: mostly P3/P6 (other formats too) with BOMs, comments, odd
+// whitespace, UTF-16 text, out-of-range and oversized numbers, truncation and
+// byte-level damage
+std::string MakeFuzzInput(std::mt19937_64& rng);
+// A gzip or zstd input, mostly damaged: one of `seeds`, a built-in member made by
+// the real compressors (dynamic Huffman deflate; Huffman literals and FSE coded
+// sequences in zstd) or a generated input compressed with fixed Huffman codes
+std::string MakeCompressedFuzzInput(std::mt19937_64& rng, const std::vector<std::string>& seeds);
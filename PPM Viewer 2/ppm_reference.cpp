@@ -0,0 +1,271 @@
+#include "ppm_reference.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// 1. TEXT
+// Helper: UTF-16 file (BOM first) -> UTF-8. A trailing odd byte is dropped, and a
+// high surrogate without a low one after it is encoded as it is.
+static std::string Utf16Text(const std::string& data, bool bigEndian) {
+    std::vector<uint32_t> units;
+    for (size_t i = 2; i + 1 < data.size(); i += 2) {
+        const uint32_t b0 = static_cast<unsigned char>(data[i]), b1 = static_cast<unsigned char>(data[i + 1]);
+        units.push_back(bigEndian ? (b0 << 8) | b1 : (b1 << 8) | b0);
+    }
+    std::string out;
+    for (size_t i = 0; i < units.size(); ++i) {
+        uint32_t cp = units[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < units.size() && units[i + 1] >= 0xDC00 && units[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (units[i + 1] - 0xDC00);
+            ++i;
+        }
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+    return out;
+}
+
+// The file being decoded and the position in it
+struct RefInput {
+    const std::string& data;
+    size_t pos = 0;
+
+    // Byte `offset` past the position, or EOF
+    int At(size_t offset = 0) const {
+        return pos + offset < data.size() ? static_cast<unsigned char>(data[pos + offset]) : EOF;
+    }
+};
+
+// Helper: length of the whitespace at the position: one byte up to 0x20 (controls
+// included), a UTF-8 no-break space (C2 A0) or a UTF-8 BOM (EF BB BF); 0 if none
+static size_t SpaceAt(const RefInput& in) {
+    const int c = in.At();
+    if (c == EOF) return 0;
+    if (c <= 0x20) return 1;
+    if (c == 0xC2 && in.At(1) == 0xA0) return 2;
+    if (c == 0xEF && in.At(1) == 0xBB && in.At(2) == 0xBF) return 3;
+    return 0;
+}
+
+// Helper: skip whitespace and comments ('#' up to and including the next CR or
+// LF); false at the end of the file
+static bool SkipSpace(RefInput& in) {
+    while (true) {
+        if (in.At() == EOF) return false;
+        if (in.At() == '#') {
+            while (in.At() != EOF && in.At() != '\n' && in.At() != '\r') ++in.pos;
+            if (in.At() != EOF) ++in.pos;
+            continue;
+        }
+        const size_t n = SpaceAt(in);
+        if (n == 0) return true;
+        in.pos += n;
+    }
+}
+
+// Helper: next run of bytes up to whitespace, a comment or the end
+static bool NextToken(RefInput& in, std::string& out) {
+    out.clear();
+    if (!SkipSpace(in)) return false;
+    while (in.At() != EOF && in.At() != '#' && SpaceAt(in) == 0) out += in.data[in.pos++];
+    return !out.empty();
+}
+
+// Helper: next decimal sample, saturating at 2^32 - 1; it must end at whitespace,
+// a comment or the end of the file
+static bool ReadUInt(RefInput& in, uint32_t& value) {
+    if (!SkipSpace(in)) return false;
+    uint64_t v = 0;
+    size_t digits = 0;
+    while (in.At() >= '0' && in.At() <= '9') {
+        v = std::min<uint64_t>(v * 10 + (in.At() - '0'), 0xFFFFFFFFu);
+        ++digits;
+        ++in.pos;
+    }
+    if (digits == 0) return false;
+    if (in.At() != EOF && in.At() != '#' && SpaceAt(in) == 0) return false;
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+// Helper: next P1 bit, a single '0' or '1' (no separator needed after it)
+static bool ReadBit(RefInput& in, uint8_t& value) {
+    if (!SkipSpace(in)) return false;
+    const int c = in.At();
+    ++in.pos;
+    if (c != '0' && c != '1') return false;
+    value = static_cast<uint8_t>(c - '0');
+    return true;
+}
+
+// 2. HEADER
+static bool ReadPamHeader(RefInput& in, PnmHeader& header) {
+    std::string key, value;
+    int depth = 0;
+    bool haveW = false, haveH = false, haveD = false, haveM = false;
+    while (true) {
+        if (!NextToken(in, key)) return false;
+        if (key == "ENDHDR") break;
+        if (!NextToken(in, value)) return false;
+        if (key == "TUPLTYPE") {
+            if (!header.tupleType.empty()) header.tupleType += ' ';
+            header.tupleType += value;
+            continue;
+        }
+        int v = 0;
+        try { v = std::stoi(value); } catch (...) { return false; }
+        if (key == "WIDTH") { header.width = v; haveW = true; }
+        else if (key == "HEIGHT") { header.height = v; haveH = true; }
+        else if (key == "DEPTH") { depth = v; haveD = true; }
+        else if (key == "MAXVAL") { header.maxVal = v; haveM = true; }
+        else return false;
+    }
+    if (!haveW || !haveH || !haveD || !haveM || depth < 1 || depth > 4) return false;
+    header.channels = depth;
+    const std::string suffix = "_ALPHA";
+    const std::string& type = header.tupleType;
+    header.alpha = (depth == 2 || depth == 4)
+        && (type.empty() || (type.size() >= suffix.size() && type.compare(type.size() - suffix.size(), suffix.size(), suffix) == 0));
+    return true;
+}
+
+static bool ReadHeader(RefInput& in, PnmHeader& header) {
+    header = PnmHeader{};
+    if (!NextToken(in, header.magic)) return false;
+    const std::string& magic = header.magic;
+    if (magic.size() != 2 || magic[0] != 'P' || ((magic[1] < '1' || magic[1] > '7') && magic[1] != 'F' && magic[1] != 'f')) return false;
+    const char kind = magic[1];
+    const bool bitmap = (kind == '1' || kind == '4');
+    header.isFloat = (kind == 'F' || kind == 'f');
+    header.channels = (kind == '3' || kind == '6' || kind == 'F') ? 3 : 1;
+
+    if (kind == '7') {
+        if (!ReadPamHeader(in, header)) return false;
+    } else {
+        std::string w, h, m;
+        if (!NextToken(in, w) || !NextToken(in, h) || (!bitmap && !NextToken(in, m))) return false;
+        try {
+            header.width = std::stoi(w);
+            header.height = std::stoi(h);
+            // The PFM scale only gives the byte order; PBM has no maxVal
+            if (header.isFloat) header.littleEndian = std::stof(m) < 0.0f;
+            else if (!bitmap) header.maxVal = std::stoi(m);
+        } catch (...) {
+            return false;
+        }
+    }
+    if (header.width <= 0 || header.height <= 0) return false;
+    if (static_cast<uint64_t>(header.width) * static_cast<uint64_t>(header.height) > 100000000) return false;
+    if (header.maxVal <= 0 || header.maxVal > 65535) return false;
+    // Binary rasters start after one more byte, whatever it is
+    if (!header.IsAscii()) {
+        if (in.At() == EOF) return false;
+        ++in.pos;
+    }
+    return true;
+}
+
+// 3. RASTER
+// Helper: sample i of the image, stored in its native layout
+static void PutSample(Image& img, size_t i, uint32_t v) {
+    if (img.BytesPerSample() == 2) {
+        const uint16_t s = static_cast<uint16_t>(v);
+        std::memcpy(img.samples.data() + 2 * i, &s, 2);
+    } else {
+        img.samples[i] = static_cast<uint8_t>(v);
+    }
+}
+
+static bool ReadRaster(RefInput& in, const PnmHeader& header, Image& img) {
+    const size_t count = img.SampleCount();
+    const char kind = header.magic[1];
+    if (kind == '1') {
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t bit;
+            if (!ReadBit(in, bit)) return false;
+            img.samples[i] = bit ^ 1; // 1 = black
+        }
+        return true;
+    }
+    if (kind == '2' || kind == '3') {
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t v;
+            if (!ReadUInt(in, v)) return false;
+            PutSample(img, i, std::min(v, static_cast<uint32_t>(img.maxVal)));
+        }
+        return true;
+    }
+    if (header.RasterBytes() > in.data.size() - in.pos) return false;
+    const uint8_t* raw = reinterpret_cast<const uint8_t*>(in.data.data()) + in.pos;
+    in.pos += static_cast<size_t>(header.RasterBytes());
+    if (kind == '4') {
+        const size_t rowBytes = (static_cast<size_t>(img.width) + 7) / 8;
+        for (int y = 0; y < img.height; ++y) {
+            for (int x = 0; x < img.width; ++x) {
+                const int bit = (raw[y * rowBytes + x / 8] >> (7 - x % 8)) & 1;
+                img.samples[static_cast<size_t>(y) * img.width + x] = static_cast<uint8_t>(bit ^ 1);
+            }
+        }
+    } else if (img.isFloat) {
+        // Bottom row first; 4 bytes per sample in the byte order the scale gave
+        const size_t rowSamples = static_cast<size_t>(img.width) * img.channels;
+        for (int row = 0; row < img.height; ++row) {
+            const int y = img.height - 1 - row;
+            for (size_t i = 0; i < rowSamples; ++i) {
+                const uint8_t* b = raw + (static_cast<size_t>(row) * rowSamples + i) * 4;
+                const uint32_t bits = header.littleEndian
+                    ? b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24)
+                    : b[3] | (b[2] << 8) | (b[1] << 16) | (static_cast<uint32_t>(b[0]) << 24);
+                float v;
+                std::memcpy(&v, &bits, 4);
+                std::memcpy(img.samples.data() + (static_cast<size_t>(y) * rowSamples + i) * 4, &v, 4);
+            }
+        }
+    } else {
+        // Samples above maxVal are kept as they are; 16-bit ones are big-endian
+        for (size_t i = 0; i < count; ++i) {
+            PutSample(img, i, img.BytesPerSample() == 2 ? (raw[2 * i] << 8) | raw[2 * i + 1] : raw[i]);
+        }
+    }
+    return true;
+}
+
+bool DecodePnmReference(const std::string& data, Image& img, size_t* end) {
+    img = Image{};
+    const bool utf16le = data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0xFF && static_cast<unsigned char>(data[1]) == 0xFE;
+    const bool utf16be = data.size() >= 2 && static_cast<unsigned char>(data[0]) == 0xFE && static_cast<unsigned char>(data[1]) == 0xFF;
+    const std::string text = (utf16le || utf16be) ? Utf16Text(data, utf16be) : std::string();
+    RefInput in{ (utf16le || utf16be) ? text : data };
+
+    PnmHeader header;
+    if (!ReadHeader(in, header)) return false;
+    img.width = header.width;
+    img.height = header.height;
+    img.channels = header.channels;
+    img.maxVal = header.maxVal;
+    img.alpha = header.alpha;
+    img.isFloat = header.isFloat;
+    img.tupleType = header.tupleType;
+    img.samples.assign(img.SampleCount() * img.BytesPerSample(), 0);
+    if (!ReadRaster(in, header, img)) {
+        img = Image{};
+        return false;
+    }
+    if (end) *end = in.pos;
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <string>
+
+// Reference decoder: the first image of a whole Netpbm/PFM file held in memory,
+// decoded one byte at a time with no buffering, SIMD, bands, threads or caches.
+// It accepts exactly what DecodePnm/LoadPPM accept (same whitespace, comment and
+// BOM rules, same limits) and produces the same Image, so any fast path can be
+// checked against it (see ppm_fuzz.h). Slow by design; prints nothing. `end`
+// receives the offset just past the image (into the UTF-8 text for UTF-16 files),
+// where the next image of a multi-image file would start.
+bool DecodePnmReference(const std::string& data, Image& img, size_t* end = nullptr);
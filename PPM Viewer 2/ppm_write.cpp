@@ -0,0 +1,269 @@
+#include "ppm.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "utf8_path.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+// Rows are gathered into chunks of about this many bytes per write
+constexpr size_t kWriteChunkBytes = 4 << 20;
+// P3 row bands are formatted in parallel, each about this many samples
+constexpr size_t kAsciiBandSamples = 1 << 16;
+// Plain Netpbm lines must not exceed 70 characters
+constexpr int kAsciiLineLimit = 70;
+
+// 1. SAMPLE CONVERSION
+// Helper: native sample -> output scale (rounded, clamped), covering the whole storage range
+static std::vector<uint16_t> BuildRescaleLut(const Image& img, uint32_t outMax) {
+    std::vector<uint16_t> lut(img.BytesPerSample() == 2 ? 65536 : 256);
+    const uint32_t inMax = static_cast<uint32_t>(img.maxVal);
+    for (uint32_t v = 0; v < lut.size(); ++v) {
+        const uint32_t c = std::min(v, inMax);
+        lut[v] = static_cast<uint16_t>((c * outMax + inMax / 2) / inMax);
+    }
+    return lut;
+}
+
+// Helper: row y of img as RGB values in the output scale (gray is replicated, alpha dropped)
+static void ImageRowToRGB(const Image& img, int y, uint32_t outMax, const std::vector<uint16_t>& lut, uint16_t* out) {
+    const int ch = img.channels;
+    const int colorCh = (ch >= 3) ? 3 : 1;
+    const size_t first = static_cast<size_t>(y) * img.width * ch;
+    for (int x = 0; x < img.width; ++x) {
+        for (int c = 0; c < 3; ++c) {
+            const size_t i = first + static_cast<size_t>(x) * ch + (colorCh == 3 ? c : 0);
+            uint16_t v;
+            if (img.isFloat) {
+                float f = img.SamplesF()[i];
+                f = (f > 0.0f) ? f : 0.0f; // also maps NaN to 0
+                f = (f < 1.0f) ? f : 1.0f;
+                v = static_cast<uint16_t>(f * outMax + 0.5f);
+            } else if (img.BytesPerSample() == 2) {
+                v = lut[img.Samples16()[i]];
+            } else {
+                v = lut[img.Data()[i]];
+            }
+            out[x * 3 + c] = v;
+        }
+    }
+}
+
+// Helper: BGRX -> packed RGB24
+#ifdef PPM_SSSE3
+PPM_TARGET_SSSE3 static int PackBGRXToRGB24SSSE3(const uint32_t* in, uint8_t* out, int n) {
+    // Each 4-pixel block becomes 12 RGB bytes in the low lanes; four blocks are
+    // then merged into three full 16-byte stores
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    int x = 0;
+    for (; x + 16 <= n; x += 16, out += 48) {
+        const __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x)), shuf);
+        const __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x + 4)), shuf);
+        const __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x + 8)), shuf);
+        const __m128i d = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x + 12)), shuf);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+    return x;
+}
+#endif
+
+static void PackBGRXToRGB24(const uint32_t* in, uint8_t* out, int n) {
+    int x = 0;
+#ifdef PPM_SSSE3
+    if (CpuHasSSSE3()) {
+        x = PackBGRXToRGB24SSSE3(in, out, n);
+        out += static_cast<size_t>(x) * 3;
+    }
+#endif
+    for (; x < n; ++x, out += 3) {
+        out[0] = static_cast<uint8_t>(in[x] >> 16);
+        out[1] = static_cast<uint8_t>(in[x] >> 8);
+        out[2] = static_cast<uint8_t>(in[x]);
+    }
+}
+
+// 2. ENCODERS
+// Produces row y already encoded as P6 bytes
+using EncodedRowFn = std::function<void(int y, uint8_t* out)>;
+// Produces row y as width * 3 values in the output scale (may run concurrently)
+using ValueRowFn = std::function<void(int y, uint16_t* out)>;
+
+static bool WriteHeader(std::ostream& out, const char* magic, int width, int height, uint32_t outMax) {
+    out << magic << "\n" << width << " " << height << "\n" << outMax << "\n";
+    return static_cast<bool>(out);
+}
+
+static bool WriteBinaryRows(std::ostream& out, int width, int height, uint32_t outMax, const EncodedRowFn& encodeRow) {
+    if (!WriteHeader(out, "P6", width, height, outMax)) return false;
+    const size_t rowBytes = static_cast<size_t>(width) * 3 * (outMax > 255 ? 2 : 1);
+    const int rowsPerChunk = static_cast<int>(std::max<size_t>(1, kWriteChunkBytes / rowBytes));
+    std::vector<uint8_t> chunk(rowBytes * std::min(rowsPerChunk, height));
+    for (int y0 = 0; y0 < height; y0 += rowsPerChunk) {
+        const int rows = std::min(rowsPerChunk, height - y0);
+        for (int r = 0; r < rows; ++r) encodeRow(y0 + r, chunk.data() + rowBytes * r);
+        out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(rowBytes * rows));
+        if (!out) return false;
+    }
+    return true;
+}
+
+// Helper: pre-formatted decimal text for every value 0..outMax
+struct DecimalTable {
+    struct Entry { char text[7]; uint8_t len; };
+    std::vector<Entry> entries;
+    explicit DecimalTable(uint32_t outMax) : entries(outMax + 1) {
+        for (uint32_t v = 0; v <= outMax; ++v) {
+            char tmp[8];
+            int n = 0;
+            uint32_t t = v;
+            do { tmp[n++] = static_cast<char>('0' + t % 10); t /= 10; } while (t);
+            for (int i = 0; i < n; ++i) entries[v].text[i] = tmp[n - 1 - i];
+            entries[v].len = static_cast<uint8_t>(n);
+        }
+    }
+};
+
+// Helper: format rows [y0, y1) as P3 text (one row per line, wrapped at 70 characters)
+static void FormatAsciiBand(const ValueRowFn& rowValues, const DecimalTable& table, int width, int y0, int y1, std::string& text) {
+    text.clear();
+    std::vector<uint16_t> values(static_cast<size_t>(width) * 3);
+    for (int y = y0; y < y1; ++y) {
+        rowValues(y, values.data());
+        int lineLen = 0;
+        for (uint16_t v : values) {
+            const DecimalTable::Entry& e = table.entries[v];
+            if (lineLen > 0) {
+                if (lineLen + 1 + e.len > kAsciiLineLimit) { text.push_back('\n'); lineLen = 0; }
+                else { text.push_back(' '); ++lineLen; }
+            }
+            text.append(e.text, e.len);
+            lineLen += e.len;
+        }
+        text.push_back('\n');
+    }
+}
+
+static bool WriteAsciiRows(std::ostream& out, int width, int height, uint32_t outMax, const ValueRowFn& rowValues) {
+    if (!WriteHeader(out, "P3", width, height, outMax)) return false;
+    const DecimalTable table(outMax);
+    const int bandRows = static_cast<int>(std::max<size_t>(1, kAsciiBandSamples / (static_cast<size_t>(width) * 3)));
+    const int bandCount = (height + bandRows - 1) / bandRows;
+    const int threads = ParallelBandCount(bandCount, 0, 1);
+
+    // Batches of `threads` bands: formatted in parallel, then written in order, so
+    // memory stays bounded by one batch of text
+    std::vector<std::string> bands(threads);
+    for (int firstBand = 0; firstBand < bandCount; firstBand += threads) {
+        const int batch = std::min(threads, bandCount - firstBand);
+        ParallelBands(batch, threads, 1, [&](int i, int, int) {
+            const int y0 = (firstBand + i) * bandRows;
+            FormatAsciiBand(rowValues, table, width, y0, std::min(height, y0 + bandRows), bands[i]);
+        });
+        for (int i = 0; i < batch; ++i) {
+            out.write(bands[i].data(), static_cast<std::streamsize>(bands[i].size()));
+        }
+        if (!out) return false;
+    }
+    return true;
+}
+
+// 3. PUBLIC API
+// Helper: "-" writes stdout, anything else a file
+static bool WithOutput(const std::string& filepath, const std::function<bool(std::ostream&)>& write) {
+    bool ok;
+    if (filepath == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ok = write(std::cout);
+        std::cout.flush();
+    } else {
+        std::ofstream file(Utf8Path(filepath), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not create file: " << filepath << std::endl;
+            return false;
+        }
+        ok = write(file);
+        file.close();
+        ok = ok && !file.fail();
+    }
+    if (!ok) std::cerr << "Error: Failed while writing: " << filepath << std::endl;
+    return ok;
+}
+
+bool WritePPM(std::ostream& out, const Image& img, const SaveOptions& options) {
+    if (img.width <= 0 || img.height <= 0 || !img.HasSamples()) {
+        std::cerr << "Error: Nothing to save (empty image)." << std::endl;
+        return false;
+    }
+    const uint32_t outMax = static_cast<uint32_t>(options.maxVal > 0 ? options.maxVal : (img.isFloat ? 255 : img.maxVal));
+    if (outMax > 65535) { std::cerr << "Error: Unsupported output maxVal " << outMax << "." << std::endl; return false; }
+
+    const std::vector<uint16_t> lut = img.isFloat ? std::vector<uint16_t>() : BuildRescaleLut(img, outMax);
+    const ValueRowFn rowValues = [&](int y, uint16_t* values) { ImageRowToRGB(img, y, outMax, lut, values); };
+    if (options.ascii) return WriteAsciiRows(out, img.width, img.height, outMax, rowValues);
+
+    // Already in P6 layout (8-bit RGB at maxVal 255, where no sample can be out of
+    // range): one contiguous write. Below 255 samples above maxVal are stored as
+    // read and must go through the clamping LUT like every other path.
+    if (img.channels == 3 && !img.isFloat && img.maxVal == 255 && outMax == 255) {
+        if (!WriteHeader(out, "P6", img.width, img.height, outMax)) return false;
+        out.write(reinterpret_cast<const char*>(img.Data()), static_cast<std::streamsize>(img.SampleCount()));
+        return static_cast<bool>(out);
+    }
+
+    std::vector<uint16_t> values(static_cast<size_t>(img.width) * 3);
+    const EncodedRowFn encodeRow = [&](int y, uint8_t* dst) {
+        rowValues(y, values.data());
+        if (outMax > 255) {
+            // 16-bit samples are big-endian on disk
+            for (size_t i = 0; i < values.size(); ++i) {
+                dst[2 * i] = static_cast<uint8_t>(values[i] >> 8);
+                dst[2 * i + 1] = static_cast<uint8_t>(values[i]);
+            }
+        } else {
+            for (size_t i = 0; i < values.size(); ++i) dst[i] = static_cast<uint8_t>(values[i]);
+        }
+    };
+    return WriteBinaryRows(out, img.width, img.height, outMax, encodeRow);
+}
+
+bool SavePPM(const Image& img, const std::string& filepath, const SaveOptions& options) {
+    return WithOutput(filepath, [&](std::ostream& out) { return WritePPM(out, img, options); });
+}
+
+bool SavePPMFromBGRX(const std::string& filepath, int width, int height, bool ascii, const BGRXRowFn& getRow) {
+    if (width <= 0 || height <= 0) {
+        std::cerr << "Error: Nothing to save (empty image)." << std::endl;
+        return false;
+    }
+    return WithOutput(filepath, [&](std::ostream& out) {
+        if (ascii) {
+            const ValueRowFn rowValues = [&](int y, uint16_t* values) {
+                std::vector<uint32_t> bgrx(width);
+                getRow(y, bgrx.data());
+                for (int x = 0; x < width; ++x) {
+                    values[x * 3 + 0] = static_cast<uint16_t>((bgrx[x] >> 16) & 0xFF);
+                    values[x * 3 + 1] = static_cast<uint16_t>((bgrx[x] >> 8) & 0xFF);
+                    values[x * 3 + 2] = static_cast<uint16_t>(bgrx[x] & 0xFF);
+                }
+            };
+            return WriteAsciiRows(out, width, height, 255, rowValues);
+        }
+        std::vector<uint32_t> bgrx(width);
+        const EncodedRowFn encodeRow = [&](int y, uint8_t* dst) {
+            getRow(y, bgrx.data());
+            PackBGRXToRGB24(bgrx.data(), dst, width);
+        };
+        return WriteBinaryRows(out, width, height, 255, encodeRow);
+    });
+}
@@ -0,0 +1,291 @@
+#include "sequence.h"
+#include "image_cache.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// 1. DIRECTORY LISTING
+bool NaturalLess(const std::string& a, const std::string& b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        const unsigned char ca = static_cast<unsigned char>(a[i]);
+        const unsigned char cb = static_cast<unsigned char>(b[j]);
+        if (std::isdigit(ca) && std::isdigit(cb)) {
+            // Compare the digit runs by value: skip leading zeros, then longer wins,
+            // then the first differing digit
+            size_t ia = i, jb = j;
+            while (ia < a.size() && a[ia] == '0') ++ia;
+            while (jb < b.size() && b[jb] == '0') ++jb;
+            size_t ea = ia, eb = jb;
+            while (ea < a.size() && std::isdigit(static_cast<unsigned char>(a[ea]))) ++ea;
+            while (eb < b.size() && std::isdigit(static_cast<unsigned char>(b[eb]))) ++eb;
+            if (ea - ia != eb - jb) return (ea - ia) < (eb - jb);
+            const int cmp = a.compare(ia, ea - ia, b, jb, eb - jb);
+            if (cmp != 0) return cmp < 0;
+            // Equal values: fewer leading zeros first ("7" < "007")
+            if (ia - i != jb - j) return (ia - i) < (jb - j);
+            i = ea;
+            j = eb;
+            continue;
+        }
+        const int la = std::tolower(ca), lb = std::tolower(cb);
+        if (la != lb) return la < lb;
+        ++i;
+        ++j;
+    }
+    if ((a.size() - i) != (b.size() - j)) return (a.size() - i) < (b.size() - j);
+    return a < b; // differ only in case: keep the order total
+}
+
+// Helper: extensions treated as frames of a sequence
+static bool IsNetpbmExtension(const fs::path& p) {
+    auto lower = [](std::string ext) {
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ext;
+    };
+    std::string ext = lower(p.extension().string());
+    // frame0001.ppm.gz, frame0001.ppm.zst
+    if (IsCompressedExtension(ext)) ext = lower(p.stem().extension().string());
+    return ext == ".ppm" || ext == ".pgm" || ext == ".pbm" || ext == ".pnm" || ext == ".pam" || ext == ".pfm"
+        || ext == ".ppmt";
+}
+
+std::vector<std::string> ListSequence(const std::string& filepath, size_t& index) {
+    std::vector<std::string> files;
+    index = 0;
+    const fs::path self = Utf8Path(filepath);
+    fs::path dir = self.parent_path();
+    if (dir.empty()) dir = ".";
+
+    const std::string selfName = PathUtf8(self.filename());
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        // The opened file always belongs to the sequence, whatever its extension
+        const std::string name = PathUtf8(entry.path().filename());
+        if (entry.is_regular_file(ec) && (IsNetpbmExtension(entry.path()) || name == selfName)) names.push_back(name);
+    }
+    if (ec) {
+        std::cerr << "Error: Could not list directory: " << PathUtf8(dir) << std::endl;
+        return files;
+    }
+    std::sort(names.begin(), names.end(), NaturalLess);
+
+    for (const std::string& name : names) {
+        if (name == selfName) index = files.size();
+        files.push_back(PathUtf8(dir / Utf8Path(name)));
+    }
+    return files;
+}
+
+void HintReadAhead(const std::string& filepath) {
+#ifdef _WIN32
+    const fs::path p = Utf8Path(filepath);
+    HANDLE file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size = {};
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && static_cast<uint64_t>(size.QuadPart) <= SIZE_MAX) {
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view) {
+                // Queues the reads and returns; the pages land in the file cache and
+                // stay there after the view is gone
+                WIN32_MEMORY_RANGE_ENTRY range = { view, static_cast<SIZE_T>(size.QuadPart) };
+                PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+                UnmapViewOfFile(view);
+            }
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    const int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#endif
+}
+
+// 2. PREFETCHER
+// Helper: decodes go through the shared cache, so files that left the window (or
+// were opened before) come back without decoding again
+static std::shared_ptr<const Image> DecodeFile(const std::string& filepath) {
+    return SharedImageCache().Load(filepath);
+}
+
+FramePrefetcher::FramePrefetcher(unsigned threads, size_t ahead, size_t behind, size_t hinted)
+    : ahead_(ahead), behind_(behind), hintCount_(hinted) {
+    for (unsigned i = 0; i < std::max(1u, threads); ++i) workers_.emplace_back([this] { Worker(); });
+}
+
+FramePrefetcher::~FramePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+void FramePrefetcher::SetFiles(std::vector<std::string> files, size_t index, std::shared_ptr<const Image> current) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_ = std::move(files);
+    slots_.clear();
+    queue_.clear();
+    hints_.clear();
+    hinted_.assign(files_.size(), false);
+    failed_.assign(files_.size(), false);
+    ++generation_;
+    direction_ = 1;
+    center_ = index;
+    if (files_.empty()) return;
+    if (current) slots_[index].image = std::move(current);
+    Schedule(index);
+    wake_.notify_all();
+}
+
+void FramePrefetcher::Replace(size_t index, std::shared_ptr<const Image> image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= files_.size()) return;
+    failed_[index] = false; // the file changed: worth decoding again
+    if (!InWindow(index)) return;
+    Slot& slot = slots_[index];
+    // A worker decoding it right now stores its own result when done
+    if (!slot.decoding) slot.image = std::move(image);
+}
+
+bool FramePrefetcher::InWindow(size_t index) const {
+    return index >= windowLo_ && index <= windowHi_;
+}
+
+void FramePrefetcher::Schedule(size_t center) {
+    if (center != center_) direction_ = (center > center_) ? 1 : -1;
+    center_ = center;
+    const size_t up = (direction_ > 0) ? ahead_ : behind_;   // towards higher indices
+    const size_t down = (direction_ > 0) ? behind_ : ahead_;
+    windowLo_ = (center >= down) ? center - down : 0;
+    windowHi_ = std::min(files_.size() - 1, center + up);
+
+    // Drop decoded frames that fell out of the window (in-flight ones are dropped
+    // when they finish)
+    for (auto it = slots_.begin(); it != slots_.end();) {
+        if (!InWindow(it->first) && !it->second.decoding) it = slots_.erase(it);
+        else ++it;
+    }
+
+    // Helper: frame `d` steps from center, in the direction of travel (sign 1) or against it (-1)
+    const auto step = [&](size_t d, int sign) {
+        return static_cast<long long>(center) + sign * direction_ * static_cast<long long>(d);
+    };
+    const auto valid = [&](long long i) { return i >= 0 && i < static_cast<long long>(files_.size()); };
+
+    // Nearest first, alternating sides, with the direction of travel leading; files
+    // that already failed are left out
+    const auto wanted = [&](long long i) {
+        return valid(i) && !slots_.count(static_cast<size_t>(i)) && !failed_[static_cast<size_t>(i)];
+    };
+    queue_.clear();
+    for (size_t d = 1; d <= std::max(ahead_, behind_); ++d) {
+        if (d <= ahead_ && wanted(step(d, 1))) queue_.push_back(static_cast<size_t>(step(d, 1)));
+        if (d <= behind_ && wanted(step(d, -1))) queue_.push_back(static_cast<size_t>(step(d, -1)));
+    }
+
+    // The files right past the leading edge only get their bytes pulled into the cache
+    for (size_t d = ahead_ + 1; d <= ahead_ + hintCount_; ++d) {
+        const long long i = step(d, 1);
+        if (!valid(i) || hinted_[static_cast<size_t>(i)]) continue;
+        hinted_[static_cast<size_t>(i)] = true;
+        hints_.push_back(files_[static_cast<size_t>(i)]);
+    }
+}
+
+std::shared_ptr<const Image> FramePrefetcher::Get(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (index >= files_.size()) return nullptr;
+    Schedule(index);
+    wake_.notify_all();
+
+    Slot& slot = slots_[index];
+    if (slot.image) {
+        ++hits_;
+        return slot.image;
+    }
+    if (slot.decoding) {
+        ++waits_;
+        const uint64_t generation = generation_;
+        decoded_.wait(lock, [&] {
+            auto it = slots_.find(index);
+            return generation_ != generation || it == slots_.end() || !it->second.decoding;
+        });
+        auto it = slots_.find(index);
+        return (generation_ == generation && it != slots_.end()) ? it->second.image : nullptr;
+    }
+
+    // Not started yet: decode here rather than wait behind other queued frames
+    ++misses_;
+    slot.decoding = true;
+    const std::string file = files_[index];
+    const uint64_t generation = generation_;
+    lock.unlock();
+    std::shared_ptr<const Image> img = DecodeFile(file);
+    lock.lock();
+    if (generation_ == generation) {
+        Slot& done = slots_[index];
+        done.decoding = false;
+        done.image = img;
+        failed_[index] = !img;
+        if (!img) slots_.erase(index); // failed: only a later Get() retries
+    }
+    decoded_.notify_all();
+    return img;
+}
+
+void FramePrefetcher::Worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this] { return stopping_ || !queue_.empty() || !hints_.empty(); });
+        if (stopping_) return;
+
+        if (queue_.empty()) {
+            const std::string file = std::move(hints_.front());
+            hints_.erase(hints_.begin());
+            lock.unlock();
+            HintReadAhead(file);
+            lock.lock();
+            continue;
+        }
+
+        const size_t index = queue_.front();
+        queue_.erase(queue_.begin());
+        if (slots_.count(index) || failed_[index]) continue; // decoded, claimed or failed meanwhile
+        slots_[index].decoding = true;
+        const std::string file = files_[index];
+        const uint64_t generation = generation_;
+        lock.unlock();
+        std::shared_ptr<const Image> img = DecodeFile(file);
+        lock.lock();
+        if (generation_ != generation) continue;
+        Slot& slot = slots_[index];
+        slot.decoding = false;
+        slot.image = std::move(img);
+        // A failure is recorded so that Schedule() doesn't queue the file again
+        if (!slot.image) failed_[index] = true;
+        // Keep it only if it is still wanted
+        if (!InWindow(index) || !slot.image) slots_.erase(index);
+        decoded_.notify_all();
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sequence playback: the Netpbm files of one directory, stepped through in natural
+// order ("frame9" before "frame10") with a background prefetcher so scrubbing hits
+// already decoded frames.
+
+// Natural order: digit runs compare by value, everything else case-insensitively
+bool NaturalLess(const std::string& a, const std::string& b);
+// Netpbm (and tiled .ppmt) files in the directory of `filepath` (UTF-8), naturally sorted; index
+// receives the position of filepath itself. Empty if the directory can't be read.
+std::vector<std::string> ListSequence(const std::string& filepath, size_t& index);
+// Ask the OS to start pulling a file into its cache without waiting for it
+// (posix_fadvise WILLNEED, or PrefetchVirtualMemory over a mapped view on Windows)
+void HintReadAhead(const std::string& filepath);
+
+// Keeps a window of decoded frames around the current position: `ahead` frames in
+// the direction of travel and `behind` the other way, so reversing direction swaps
+// the two. Frames past the window only get a read-ahead hint. Worker threads decode;
+// Get() on a frame that isn't ready decodes it (or waits for the worker that is).
+// A file that fails to decode is not tried again by the workers until the file list
+// is set anew or the file is replaced; only an explicit Get() retries it.
+class FramePrefetcher {
+public:
+    explicit FramePrefetcher(unsigned threads = 2, size_t ahead = 8, size_t behind = 3, size_t hinted = 4);
+    ~FramePrefetcher();
+
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    // Start over with a new file list; `current` (already decoded by the caller,
+    // may be null) seeds the cache at position `index`
+    void SetFiles(std::vector<std::string> files, size_t index, std::shared_ptr<const Image> current);
+    // Frame `index` was decoded again (its file changed); the other frames are kept
+    void Replace(size_t index, std::shared_ptr<const Image> image);
+    // Decoded frame `index` (null if it fails to decode); moves the window there
+    std::shared_ptr<const Image> Get(size_t index);
+
+    size_t Size() const { return files_.size(); }
+    const std::string& File(size_t index) const { return files_[index]; }
+
+    // Get() outcomes: ready in the cache, waited on a worker, decoded on the spot
+    uint64_t Hits() const { return hits_; }
+    uint64_t Waits() const { return waits_; }
+    uint64_t Misses() const { return misses_; }
+
+private:
+    struct Slot {
+        std::shared_ptr<const Image> image;
+        bool decoding = false;
+    };
+
+    // Recompute the window around `center` (lock held): evict, queue decodes and hints
+    void Schedule(size_t center);
+    bool InWindow(size_t index) const;
+    void Worker();
+
+    std::vector<std::string> files_;
+    std::map<size_t, Slot> slots_;
+    std::vector<size_t> queue_;       // decodes wanted, most urgent first
+    std::vector<std::string> hints_;  // read-ahead hints not yet issued
+    std::vector<bool> hinted_;
+    std::vector<bool> failed_;        // decodes that failed, left alone by the workers
+    size_t center_ = 0;
+    size_t windowLo_ = 0, windowHi_ = 0; // inclusive
+    int direction_ = 1;
+    uint64_t generation_ = 0;            // bumped by SetFiles so stale decodes are dropped
+    const size_t ahead_, behind_, hintCount_;
+    uint64_t hits_ = 0, waits_ = 0, misses_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;    // workers: work queued or stopping
+    std::condition_variable decoded_; // Get(): a worker finished a frame
+    std::vector<std::thread> workers_;
+    bool stopping_ = false;
+};
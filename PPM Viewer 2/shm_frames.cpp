@@ -0,0 +1,380 @@
+#include "shm_frames.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <ctime>
+#endif
+#endif
+
+constexpr char kRingMagic[8] = { 'P', 'P', 'M', 'S', 'H', 'M', 'R', 'G' };
+constexpr uint32_t kRingVersion = 1;
+constexpr uint32_t kMaxSlots = 16;
+// Slot offsets are whole pages, so every slot's samples are suitably aligned
+constexpr uint64_t kSlotAlign = 4096;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the ring's counters are shared between processes and must be lock-free");
+
+struct SlotHeader {
+    std::atomic<uint64_t> sequence; // 2 * frame once published, odd while being written
+    std::atomic<uint32_t> readers;  // Images handed out by consumers and not released yet
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t maxVal;
+    uint32_t flags; // 1 = alpha, 2 = float
+};
+
+// Ring layout: RingHeader, then slotCount slots of slotStride bytes from slotOffset
+struct RingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slotCount;
+    uint64_t slotBytes;
+    uint64_t slotStride;
+    uint64_t slotOffset;
+    std::atomic<uint64_t> latest; // (frame << 8) | slot of the newest published frame; 0 before the first
+    std::atomic<uint32_t> closed;
+    std::atomic<uint32_t> signal; // bumped on every publish (and on close); the futex word on Linux
+    SlotHeader slots[kMaxSlots];
+};
+
+// 1. HELPERS
+// Helper: round up to whole pages
+static uint64_t AlignUp(uint64_t v) {
+    return (v + kSlotAlign - 1) / kSlotAlign * kSlotAlign;
+}
+
+// Helper: names end up in a path (POSIX) or the object namespace (Windows)
+static bool ValidName(const std::string& name) {
+    if (name.empty() || name.size() > 200) return false;
+    return std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isalnum(c) || c == '-' || c == '_' || c == '.'; });
+}
+
+#ifdef _WIN32
+static std::wstring MappingName(const std::string& name) {
+    return L"Local\\ppmshm-" + std::wstring(name.begin(), name.end());
+}
+static std::wstring EventName(const std::string& name) {
+    return MappingName(name) + L"-frame";
+}
+#else
+static std::string MappingName(const std::string& name) {
+    return "/ppmshm-" + name;
+}
+#endif
+
+// Helper: wake consumers blocked in ShmFrameReader::Wait()
+static void Signal(RingHeader* ring, void* event) {
+    ring->signal.fetch_add(1);
+#ifdef _WIN32
+    if (event) SetEvent(event);
+#elif defined(__linux__)
+    (void)event;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&ring->signal), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+    (void)event;
+#endif
+}
+
+// 2. PRODUCER
+bool ShmFrameWriter::Create(const std::string& name, size_t slotBytes, unsigned slots) {
+    Close();
+    if (!ValidName(name) || slotBytes == 0) {
+        std::cerr << "Error: Invalid shared memory ring name or size: " << name << std::endl;
+        return false;
+    }
+    slots = std::clamp(slots, 3u, kMaxSlots);
+    const uint64_t stride = AlignUp(slotBytes);
+    const uint64_t offset = AlignUp(sizeof(RingHeader));
+    const uint64_t size = offset + stride * slots;
+
+#ifdef _WIN32
+    mapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                  static_cast<DWORD>(size), MappingName(name).c_str());
+    // A consumer still holding the previous ring keeps it (and its name) alive
+    const bool existed = (mapping_ && GetLastError() == ERROR_ALREADY_EXISTS);
+    void* view = (mapping_ && !existed) ? MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "Error: Could not create shared memory ring " << name << (existed ? " (still in use)" : "") << std::endl;
+        if (mapping_) CloseHandle(mapping_);
+        mapping_ = nullptr;
+        return false;
+    }
+    event_ = CreateEventW(nullptr, FALSE, FALSE, EventName(name).c_str());
+#else
+    // An old ring of the same name goes; consumers that still map it keep their copy
+    const std::string path = MappingName(name);
+    shm_unlink(path.c_str());
+    const int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    void* view = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        view = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (fd >= 0) close(fd);
+    if (view == MAP_FAILED) {
+        std::cerr << "Error: Could not create shared memory ring " << name << std::endl;
+        if (fd >= 0) shm_unlink(path.c_str());
+        return false;
+    }
+#endif
+
+    base_ = static_cast<uint8_t*>(view);
+    size_ = static_cast<size_t>(size);
+    name_ = name;
+    slotBytes_ = slotBytes;
+    frame_ = dropped_ = 0;
+    claimed_ = -1;
+    // The mapping starts zeroed; the header's fields (and atomics) are set up here
+    RingHeader* ring = new (base_) RingHeader();
+    std::memcpy(ring->magic, kRingMagic, sizeof(kRingMagic));
+    ring->version = kRingVersion;
+    ring->slotCount = slots;
+    ring->slotBytes = slotBytes;
+    ring->slotStride = stride;
+    ring->slotOffset = offset;
+    return true;
+}
+
+void ShmFrameWriter::Close() {
+    if (!base_) return;
+    RingHeader* ring = reinterpret_cast<RingHeader*>(base_);
+    ring->closed.store(1);
+#ifdef _WIN32
+    Signal(ring, event_);
+    UnmapViewOfFile(base_);
+    CloseHandle(mapping_);
+    if (event_) CloseHandle(event_);
+    mapping_ = event_ = nullptr;
+#else
+    Signal(ring, nullptr);
+    munmap(base_, size_);
+    shm_unlink(MappingName(name_).c_str());
+#endif
+    base_ = nullptr;
+    size_ = slotBytes_ = 0;
+    claimed_ = -1;
+    name_.clear();
+}
+
+uint8_t* ShmFrameWriter::Begin(int width, int height, int channels, int maxVal, bool isFloat, bool alpha) {
+    if (!base_) return nullptr;
+    ++frame_;
+    claimed_ = -1;
+    const int bytesPerSample = isFloat ? 4 : (maxVal > 255 ? 2 : 1);
+    const uint64_t bytes = static_cast<uint64_t>(std::max(width, 0)) * std::max(height, 0) * std::max(channels, 0) * bytesPerSample;
+    if (bytes == 0 || channels > 4 || bytes > slotBytes_) {
+        std::cerr << "Error: Frame " << width << "x" << height << "x" << channels << " does not fit the ring's "
+                  << slotBytes_ << "-byte slots" << std::endl;
+        ++dropped_;
+        return nullptr;
+    }
+
+    RingHeader* ring = reinterpret_cast<RingHeader*>(base_);
+    const uint64_t latest = ring->latest.load();
+    for (uint32_t s = 0; s < ring->slotCount; ++s) {
+        // The newest frame stays readable until a newer one is published
+        if (latest != 0 && (latest & 0xFF) == s) continue;
+        SlotHeader& slot = ring->slots[s];
+        if (slot.readers.load() != 0) continue;
+        // Mark it as being written, then look for readers again: a consumer either
+        // saw the odd sequence and backs off, or is seen here (both sequentially
+        // consistent, so they can't miss each other)
+        const uint64_t before = slot.sequence.load();
+        slot.sequence.store(2 * frame_ + 1);
+        if (slot.readers.load() != 0) {
+            slot.sequence.store(before);
+            continue;
+        }
+        slot.width = width;
+        slot.height = height;
+        slot.channels = channels;
+        slot.maxVal = maxVal;
+        slot.flags = (alpha ? 1u : 0u) | (isFloat ? 2u : 0u);
+        claimed_ = static_cast<int>(s);
+        return base_ + ring->slotOffset + s * ring->slotStride;
+    }
+    // Every slot is held: the consumer is behind, this frame is never seen
+    ++dropped_;
+    return nullptr;
+}
+
+void ShmFrameWriter::Commit() {
+    if (!base_ || claimed_ < 0) return;
+    RingHeader* ring = reinterpret_cast<RingHeader*>(base_);
+    ring->slots[claimed_].sequence.store(2 * frame_, std::memory_order_release);
+    ring->latest.store((frame_ << 8) | static_cast<uint64_t>(claimed_), std::memory_order_release);
+#ifdef _WIN32
+    Signal(ring, event_);
+#else
+    Signal(ring, nullptr);
+#endif
+    claimed_ = -1;
+}
+
+bool ShmFrameWriter::Write(const Image& img) {
+    uint8_t* dst = Begin(img.width, img.height, img.channels, img.maxVal, img.isFloat, img.alpha);
+    if (!dst) return false;
+    std::memcpy(dst, img.Data(), img.SampleCount() * img.BytesPerSample());
+    Commit();
+    return true;
+}
+
+// 3. CONSUMER
+// One mapped ring; every Image handed out shares it, so it outlives Close()
+struct ShmFrameReader::Mapping {
+    uint8_t* base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE event = nullptr;
+#endif
+
+    RingHeader* Ring() const { return reinterpret_cast<RingHeader*>(base); }
+
+    ~Mapping() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (event) CloseHandle(event);
+#else
+        if (base) munmap(base, size);
+#endif
+    }
+};
+
+bool ShmFrameReader::Open(const std::string& name) {
+    Close();
+    if (!ValidName(name)) {
+        std::cerr << "Error: Invalid shared memory ring name: " << name << std::endl;
+        return false;
+    }
+    auto mapping = std::make_shared<Mapping>();
+#ifdef _WIN32
+    HANDLE file = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, MappingName(name).c_str());
+    if (file) {
+        // The view keeps the mapping alive
+        mapping->base = static_cast<uint8_t*>(MapViewOfFile(file, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+        CloseHandle(file);
+    }
+    MEMORY_BASIC_INFORMATION info = {};
+    if (mapping->base && VirtualQuery(mapping->base, &info, sizeof(info)) == sizeof(info)) mapping->size = info.RegionSize;
+    mapping->event = OpenEventW(SYNCHRONIZE, FALSE, EventName(name).c_str());
+#else
+    const int fd = shm_open(MappingName(name).c_str(), O_RDWR | O_CLOEXEC, 0);
+    struct stat st = {};
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED) {
+            mapping->base = static_cast<uint8_t*>(view);
+            mapping->size = static_cast<size_t>(st.st_size);
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+    if (!mapping->base) {
+        std::cerr << "Error: No shared memory ring named " << name << std::endl;
+        return false;
+    }
+
+    const RingHeader* ring = mapping->Ring();
+    const bool valid = mapping->size >= sizeof(RingHeader) && std::memcmp(ring->magic, kRingMagic, sizeof(kRingMagic)) == 0
+        && ring->version == kRingVersion && ring->slotCount >= 3 && ring->slotCount <= kMaxSlots
+        && ring->slotStride >= ring->slotBytes && ring->slotOffset % kSlotAlign == 0
+        && ring->slotOffset + ring->slotStride * ring->slotCount <= mapping->size;
+    if (!valid) {
+        std::cerr << "Error: " << name << " is not a frame ring this viewer understands" << std::endl;
+        return false;
+    }
+    mapping_ = std::move(mapping);
+    last_ = 0;
+    return true;
+}
+
+void ShmFrameReader::Close() {
+    mapping_.reset();
+    last_ = 0;
+}
+
+std::shared_ptr<const Image> ShmFrameReader::Latest(uint64_t* frame) {
+    if (!mapping_) return nullptr;
+    RingHeader* ring = mapping_->Ring();
+    // A retry only follows a newer frame being published meanwhile
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        const uint64_t latest = ring->latest.load(std::memory_order_acquire);
+        const uint64_t number = latest >> 8;
+        const uint32_t s = static_cast<uint32_t>(latest & 0xFF);
+        if (number == 0 || number <= last_ || s >= ring->slotCount) return nullptr;
+
+        // Hold the slot, then check it still has that frame (see Begin())
+        SlotHeader& slot = ring->slots[s];
+        slot.readers.fetch_add(1);
+        if (slot.sequence.load() != 2 * number) {
+            slot.readers.fetch_sub(1);
+            continue;
+        }
+
+        auto img = std::make_shared<Image>();
+        img->width = slot.width;
+        img->height = slot.height;
+        img->channels = slot.channels;
+        img->maxVal = slot.maxVal;
+        img->alpha = (slot.flags & 1) != 0;
+        img->isFloat = (slot.flags & 2) != 0;
+        if (img->width <= 0 || img->height <= 0 || img->channels < 1 || img->channels > 4 || img->maxVal < 1 || img->maxVal > 65535
+            || static_cast<uint64_t>(img->SampleCount()) * img->BytesPerSample() > ring->slotBytes) {
+            slot.readers.fetch_sub(1);
+            last_ = number;
+            return nullptr;
+        }
+        // The samples are the slot: released (for the producer to reuse) with the last copy
+        SlotHeader* held = &slot;
+        img->mapped = std::shared_ptr<const uint8_t>(mapping_->base + ring->slotOffset + s * ring->slotStride,
+                                                     [mapping = mapping_, held](const uint8_t*) { held->readers.fetch_sub(1); });
+        last_ = number;
+        if (frame) *frame = number;
+        return img;
+    }
+    return nullptr;
+}
+
+bool ShmFrameReader::Wait(int timeoutMs) {
+    if (!mapping_) return false;
+    RingHeader* ring = mapping_->Ring();
+    auto ready = [&] { return (ring->latest.load() >> 8) > last_ || ring->closed.load() != 0; };
+    // Read before checking, so a publish in between makes the wait return at once
+    const uint32_t seen = ring->signal.load();
+    if (ready()) return true;
+#ifdef _WIN32
+    (void)seen;
+    if (mapping_->event) WaitForSingleObject(mapping_->event, static_cast<DWORD>(timeoutMs));
+    else Sleep(1);
+#elif defined(__linux__)
+    timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&ring->signal), FUTEX_WAIT, seen, &timeout, nullptr, 0);
+#else
+    (void)seen;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+    return ready();
+}
+
+bool ShmFrameReader::Closed() const {
+    return mapping_ && mapping_->Ring()->closed.load() != 0;
+}
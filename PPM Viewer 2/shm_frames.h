@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Frame handoff through shared memory (POSIX shm on Linux, a named file mapping
+// on Windows) for producers on the same machine, e.g. a renderer feeding the
+// viewer at display rate. The producer writes each frame straight into a slot of
+// a small ring, in Image's native layout (row-major, interleaved, host byte order);
+// the consumer gets an Image whose samples *are* that slot: nothing is parsed,
+// converted or copied on either side.
+//
+// Slots are claimed and published with per-slot sequence counters (odd while a
+// frame is being written). A slot stays readable for as long as the consumer holds
+// an Image pointing into it: the producer only writes into slots nobody reads and
+// that don't hold the newest frame, and drops a frame if there is no such slot.
+
+// Producer side
+class ShmFrameWriter {
+public:
+    ShmFrameWriter() = default;
+    ~ShmFrameWriter() { Close(); }
+
+    ShmFrameWriter(const ShmFrameWriter&) = delete;
+    ShmFrameWriter& operator=(const ShmFrameWriter&) = delete;
+
+    // Create ring `name` with `slots` frames of up to slotBytes each (at least 3
+    // slots: one being read, the newest, one being written), replacing an old one
+    bool Create(const std::string& name, size_t slotBytes, unsigned slots = 4);
+    // Mark the stream ended and remove the ring; consumers keep what they hold
+    void Close();
+
+    // Claim a slot for the next frame and describe it; returns where its samples
+    // go, or null if every slot is in use (the frame is dropped) or it doesn't fit
+    uint8_t* Begin(int width, int height, int channels, int maxVal, bool isFloat, bool alpha);
+    // Publish the frame claimed by Begin()
+    void Commit();
+    // Begin() + copy + Commit(), for producers that already hold an Image
+    bool Write(const Image& img);
+
+    bool IsOpen() const { return base_ != nullptr; }
+    size_t SlotBytes() const { return slotBytes_; }
+    // Frames offered so far, and those dropped for lack of a free slot
+    uint64_t Frames() const { return frame_; }
+    uint64_t Dropped() const { return dropped_; }
+
+private:
+    std::string name_;
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    size_t slotBytes_ = 0;
+    uint64_t frame_ = 0, dropped_ = 0;
+    int claimed_ = -1; // slot between Begin() and Commit()
+#ifdef _WIN32
+    void* mapping_ = nullptr; // HANDLE
+    void* event_ = nullptr;   // HANDLE, signaled on every Commit()
+#endif
+};
+
+// Consumer side
+class ShmFrameReader {
+public:
+    ShmFrameReader() = default;
+    ~ShmFrameReader() { Close(); }
+
+    ShmFrameReader(const ShmFrameReader&) = delete;
+    ShmFrameReader& operator=(const ShmFrameReader&) = delete;
+
+    // Map ring `name`; false (after printing) if there is none or it isn't one
+    bool Open(const std::string& name);
+    void Close();
+
+    // Newest frame if it is newer than the last one returned, else null. Its
+    // samples are the slot itself (Image::mapped); the slot is held until every
+    // copy is released. frame (optional) receives the producer's frame number.
+    std::shared_ptr<const Image> Latest(uint64_t* frame = nullptr);
+    // Block until a frame newer than the last one returned is published or the
+    // producer closed the ring (true), or timeoutMs passed (false)
+    bool Wait(int timeoutMs);
+    // The producer closed the ring
+    bool Closed() const;
+
+private:
+    struct Mapping;
+    std::shared_ptr<Mapping> mapping_; // also held by every Image handed out
+    uint64_t last_ = 0;
+};
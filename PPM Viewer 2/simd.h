@@ -0,0 +1,36 @@
+#pragma once
+
+// SSE2 is baseline on every x64 target (and on x86 with MSVC's default /arch:SSE2),
+// so kernels use it unconditionally when available and keep a scalar fallback.
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define PPM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// SSSE3 (pshufb) is not baseline: kernels using it are compiled for it explicitly
+// (PPM_TARGET_SSSE3) and only called when CpuHasSSSE3() says so.
+#ifdef PPM_SSE2
+#define PPM_SSSE3 1
+#include <tmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PPM_TARGET_SSSE3
+#else
+#include <cpuid.h>
+#define PPM_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+
+inline bool CpuHasSSSE3() {
+    static const bool has = [] {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int regs[4] = {};
+        __cpuid(regs, 1);
+        return (regs[2] & (1 << 9)) != 0;
+#else
+        unsigned a = 0, b = 0, c = 0, d = 0;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & (1u << 9)) != 0;
+#endif
+    }();
+    return has;
+}
+#endif
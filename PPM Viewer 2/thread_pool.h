@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads draining a FIFO task queue. Tasks may submit further
+// tasks (to this pool or another one); the destructor runs whatever is still queued
+// before joining.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; ++i) workers_.emplace_back([this] { Worker(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(task));
+        }
+        wake_.notify_one();
+    }
+
+    // Block until the queue is empty and no task is running
+    void WaitIdle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return queue_.empty() && running_ == 0; });
+    }
+
+    size_t Size() const { return workers_.size(); }
+
+    // Worker count for CPU-bound work: one per hardware thread
+    static unsigned DefaultThreads() {
+        const unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 4;
+    }
+
+private:
+    void Worker() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return; // stopping, and nothing left to run
+            std::function<void()> task = std::move(queue_.front());
+            queue_.pop_front();
+            ++running_;
+            lock.unlock();
+            task();
+            lock.lock();
+            --running_;
+            if (queue_.empty() && running_ == 0) idle_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> queue_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    size_t running_ = 0;
+    bool stopping_ = false;
+};
+
+// Number of bands ParallelBands cuts `rows` rows into: one per thread (0 =
+// ThreadPool::DefaultThreads()), but none shorter than minRows
+inline int ParallelBandCount(int rows, unsigned threads, int minRows) {
+    if (threads == 0) threads = ThreadPool::DefaultThreads();
+    const int byRows = std::max(1, rows / std::max(1, minRows));
+    return static_cast<int>(std::min(threads, static_cast<unsigned>(byRows)));
+}
+
+// Fork/join over rows [0, rows): fn(band, y0, y1) for ParallelBandCount() bands,
+// band i covering [rows * i / bands, rows * (i + 1) / bands). Band 0 runs on the
+// calling thread, the others on threads of their own; returns when all are done.
+template <typename Fn>
+inline void ParallelBands(int rows, unsigned threads, int minRows, Fn&& fn) {
+    const int bands = ParallelBandCount(rows, threads, minRows);
+    const auto bound = [&](int i) { return static_cast<int>(static_cast<int64_t>(rows) * i / bands); };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < bands; ++i) workers.emplace_back([&fn, &bound, i] { fn(i, bound(i), bound(i + 1)); });
+    fn(0, 0, bound(1));
+    for (auto& t : workers) t.join();
+}
@@ -0,0 +1,272 @@
+#include "thumbnails.h"
+#include "display.h"
+#include "thread_pool.h"
+#include "tiled.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// First comment line of a stored thumbnail: "# ppmthumb <version> <size> <file size> <mtime>"
+constexpr const char* kStoreTag = "# ppmthumb 1";
+
+// 1. GENERATION
+Image MakeThumbnail(const std::string& filepath, int size) {
+    Image thumb;
+    // Tiled containers keep reduced levels: only the smallest one that is big enough is read
+    const Image preview = IsTiledFile(filepath) ? LoadTiledThumbnail(filepath, size) : LoadPPMThumbnail(filepath, size);
+    if (!preview.HasSamples()) return thumb;
+
+    // Same mapping the viewer paints with, so the grid matches the opened image
+    DisplayTransform xf;
+    BuildDisplayTransform(preview, ToneSettings{}, xf);
+    std::vector<uint32_t> bgrx(static_cast<size_t>(preview.width) * preview.height);
+    ConvertToBGRX(preview, xf, 0, 0, preview.width, preview.height, bgrx.data(), preview.width);
+
+    thumb.width = preview.width;
+    thumb.height = preview.height;
+    thumb.channels = 3;
+    thumb.maxVal = 255;
+    thumb.samples.resize(thumb.SampleCount());
+    uint8_t* out = thumb.samples.data();
+    for (uint32_t p : bgrx) {
+        *out++ = static_cast<uint8_t>(p >> 16);
+        *out++ = static_cast<uint8_t>(p >> 8);
+        *out++ = static_cast<uint8_t>(p);
+    }
+    return thumb;
+}
+
+// 2. ON-DISK STORE
+// Helper: entry file of one (source path, size) pair (FNV-1a of the path)
+static fs::path EntryPath(const std::string& dir, const std::string& filepath, int size) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : filepath) h = (h ^ c) * 1099511628211ull;
+    char name[48];
+    std::snprintf(name, sizeof(name), "%016llx-%d.ppm", static_cast<unsigned long long>(h), size);
+    return Utf8Path(dir) / name;
+}
+
+// Helper: the comment lines identifying an entry's source
+static std::string EntryTag(const std::string& filepath, const FileStamp& stamp, int size) {
+    return std::string(kStoreTag) + " " + std::to_string(size) + " " + std::to_string(stamp.size) + " "
+        + std::to_string(stamp.mtime) + "\n# " + filepath + "\n";
+}
+
+ThumbnailStore::ThumbnailStore(std::string directory) : directory_(std::move(directory)) {
+    if (directory_.empty()) return;
+    std::error_code ec;
+    fs::create_directories(Utf8Path(directory_), ec);
+    if (ec) {
+        std::cerr << "Error: Could not create thumbnail directory: " << directory_ << std::endl;
+        directory_.clear();
+    }
+}
+
+bool ThumbnailStore::Lookup(const std::string& filepath, const FileStamp& stamp, int size, Image& thumb) const {
+    if (directory_.empty()) return false;
+    std::ifstream in(EntryPath(directory_, filepath, size), std::ios::binary);
+    if (!in.is_open()) return false;
+
+    // "P6\n" followed by the tag lines exactly as Store() wrote them
+    const std::string expected = "P6\n" + EntryTag(filepath, stamp, size);
+    std::string head(expected.size(), '\0');
+    if (!in.read(head.data(), static_cast<std::streamsize>(head.size())) || head != expected) return false;
+    in.seekg(0, std::ios::beg);
+
+    PnmReader reader(in, 1 << 14);
+    PnmHeader header;
+    Image entry;
+    if (!ReadPnmHeader(reader, header) || header.magic != "P6" || header.maxVal != 255
+        || header.width > size || header.height > size || !ReadPnmRaster(reader, header, entry)) {
+        return false;
+    }
+    thumb = std::move(entry);
+    return true;
+}
+
+bool ThumbnailStore::Store(const std::string& filepath, const FileStamp& stamp, int size, const Image& thumb) const {
+    if (directory_.empty() || thumb.channels != 3 || thumb.maxVal != 255) return false;
+
+    // Written under a temporary name and renamed into place, so a concurrent
+    // Lookup() never reads a half-written entry
+    static std::atomic<uint32_t> counter{0};
+    const fs::path target = EntryPath(directory_, filepath, size);
+    fs::path temp = target;
+    temp += ".tmp" + std::to_string(counter++);
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            std::cerr << "Error: Could not create thumbnail in " << directory_ << std::endl;
+            return false;
+        }
+        out << "P6\n" << EntryTag(filepath, stamp, size) << thumb.width << " " << thumb.height << "\n255\n";
+        out.write(reinterpret_cast<const char*>(thumb.Data()), static_cast<std::streamsize>(thumb.SampleCount()));
+        out.close();
+        if (out.fail()) {
+            std::cerr << "Error: Failed while writing thumbnail for " << filepath << std::endl;
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(temp, target, ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const Image> ThumbnailStore::Get(const std::string& filepath, int size, bool* fromStore) const {
+    if (fromStore) *fromStore = false;
+    FileStamp stamp;
+    const bool stamped = GetFileStamp(filepath, stamp);
+    auto thumb = std::make_shared<Image>();
+    if (stamped && Lookup(filepath, stamp, size, *thumb)) {
+        if (fromStore) *fromStore = true;
+        return thumb;
+    }
+    *thumb = MakeThumbnail(filepath, size);
+    if (!thumb->HasSamples()) return nullptr;
+    // Skipped if the file changed while it was decoded; the next look makes it again
+    FileStamp after;
+    if (stamped && GetFileStamp(filepath, after) && after == stamp) Store(filepath, stamp, size, *thumb);
+    return thumb;
+}
+
+std::string DefaultThumbnailDir() {
+    std::error_code ec;
+    const fs::path temp = fs::temp_directory_path(ec);
+    if (ec) return {};
+    return PathUtf8(temp / "ppmviewer-thumbnails");
+}
+
+// 3. LOADER
+ThumbnailLoader::ThumbnailLoader(int size, std::string storeDir, unsigned threads, size_t margin)
+    : size_(size), store_(std::move(storeDir)), margin_(margin) {
+    if (threads == 0) threads = ThreadPool::DefaultThreads();
+    for (unsigned i = 0; i < threads; ++i) workers_.emplace_back([this] { Worker(); });
+}
+
+ThumbnailLoader::~ThumbnailLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+void ThumbnailLoader::SetOnReady(std::function<void(size_t index)> onReady) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    onReady_ = std::move(onReady);
+}
+
+void ThumbnailLoader::SetFiles(std::vector<std::string> files) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_ = std::move(files);
+    states_.assign(files_.size(), State::Pending);
+    thumbs_.assign(files_.size(), nullptr);
+    first_ = last_ = 0;
+    visible_ = false;
+    ++generation_;
+    idle_.notify_all();
+}
+
+bool ThumbnailLoader::InWindow(size_t index) const {
+    return visible_ && index + margin_ >= first_ && index <= last_ + margin_;
+}
+
+void ThumbnailLoader::SetVisible(size_t first, size_t last) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (files_.empty()) return;
+    last_ = std::min(std::max(first, last), files_.size() - 1);
+    first_ = std::min(first, last_);
+    visible_ = true;
+    // Finished cells that scrolled out of the window give their memory back
+    for (size_t i = 0; i < files_.size(); ++i) {
+        if (!InWindow(i) && states_[i] == State::Done) {
+            states_[i] = State::Pending;
+            thumbs_[i].reset();
+        }
+    }
+    wake_.notify_all();
+}
+
+bool ThumbnailLoader::NextPending(size_t& index) const {
+    if (!visible_) return false;
+    for (size_t i = first_; i <= last_; ++i) {
+        if (states_[i] == State::Pending) { index = i; return true; }
+    }
+    // Then alternately below and above the visible cells, nearest first
+    for (size_t d = 1; d <= margin_; ++d) {
+        const bool below = last_ + d < files_.size(), above = d <= first_;
+        if (!below && !above) break;
+        if (below && states_[last_ + d] == State::Pending) { index = last_ + d; return true; }
+        if (above && states_[first_ - d] == State::Pending) { index = first_ - d; return true; }
+    }
+    return false;
+}
+
+std::shared_ptr<const Image> ThumbnailLoader::Get(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index < thumbs_.size() ? thumbs_[index] : nullptr;
+}
+
+bool ThumbnailLoader::Failed(size_t index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index < states_.size() && states_[index] == State::Failed;
+}
+
+void ThumbnailLoader::WaitIdle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t index = 0;
+    idle_.wait(lock, [&] { return working_ == 0 && !NextPending(index); });
+}
+
+void ThumbnailLoader::Worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        size_t index = 0;
+        wake_.wait(lock, [&] { return stopping_ || NextPending(index); });
+        if (stopping_) return;
+
+        states_[index] = State::Working;
+        ++working_;
+        const std::string file = files_[index];
+        const uint64_t generation = generation_;
+        lock.unlock();
+        bool stored = false;
+        std::shared_ptr<const Image> thumb = store_.Get(file, size_, &stored);
+        lock.lock();
+        if (generation_ == generation) {
+            if (!thumb) ++failures_;
+            else if (stored) ++fromStore_;
+            else ++generated_;
+            // Scrolled out of the window meanwhile: not kept, made again (from the store) if needed
+            if (!thumb) states_[index] = State::Failed;
+            else if (!InWindow(index)) states_[index] = State::Pending;
+            else {
+                states_[index] = State::Done;
+                thumbs_[index] = std::move(thumb);
+            }
+            if (onReady_ && states_[index] != State::Pending) {
+                const std::function<void(size_t)> onReady = onReady_;
+                lock.unlock();
+                onReady(index);
+                lock.lock();
+            }
+        }
+        // Counted until after onReady so WaitIdle() also waits for the callbacks
+        --working_;
+        idle_.notify_all();
+    }
+}
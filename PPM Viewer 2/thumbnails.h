@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ppm.h"
+#include "image_cache.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Thumbnails for the browser grid: small 8-bit RGB previews made with the
+// decimating decoder (ReadPnmThumbnail), or from a reduced level of a tiled
+// container (tiled.h), so a preview never costs a full decode.
+// They are kept in memory around the visible cells and on disk across runs.
+
+// Edge length of the browser's thumbnails
+constexpr int kThumbnailSize = 160;
+
+// Preview of the first image of filepath, fitting in size x size, as 8-bit RGB
+// rendered the way the viewer shows it (default tone mapping for float images,
+// alpha over a checkerboard). Empty on failure.
+Image MakeThumbnail(const std::string& filepath, int size);
+
+// Thumbnails on disk: one P6 file per (source path, size) in one directory, so
+// entries open in any Netpbm viewer. Header comments carry the source path, size
+// and mtime; an entry whose source changed since is a miss and gets replaced.
+class ThumbnailStore {
+public:
+    // An empty directory disables persistence (Get() then always generates)
+    explicit ThumbnailStore(std::string directory = {});
+
+    const std::string& Directory() const { return directory_; }
+    bool Lookup(const std::string& filepath, const FileStamp& stamp, int size, Image& thumb) const;
+    bool Store(const std::string& filepath, const FileStamp& stamp, int size, const Image& thumb) const;
+    // Stored thumbnail if current, otherwise a new one (stored for next time); null
+    // on failure. fromStore (optional) tells which.
+    std::shared_ptr<const Image> Get(const std::string& filepath, int size, bool* fromStore = nullptr) const;
+
+private:
+    std::string directory_;
+};
+
+// A per-user default under the system temp directory
+std::string DefaultThumbnailDir();
+
+// Generates the thumbnails of a file list on worker threads: the visible cells
+// first (in order), then outward from them. Only cells within `margin` of the
+// visible range are generated and kept in memory; scrolling away drops the rest,
+// which come back from the store when they are scrolled to again.
+class ThumbnailLoader {
+public:
+    ThumbnailLoader(int size, std::string storeDir, unsigned threads = 0, size_t margin = 128);
+    ~ThumbnailLoader();
+
+    ThumbnailLoader(const ThumbnailLoader&) = delete;
+    ThumbnailLoader& operator=(const ThumbnailLoader&) = delete;
+
+    // Called on a worker thread whenever a cell finishes (e.g. to post a repaint);
+    // set before SetFiles()
+    void SetOnReady(std::function<void(size_t index)> onReady);
+    // Start over with a new file list; nothing is generated until SetVisible()
+    void SetFiles(std::vector<std::string> files);
+    // Cells first..last (inclusive) are on screen
+    void SetVisible(size_t first, size_t last);
+    // Finished thumbnail of cell `index`; null while pending or if it failed
+    std::shared_ptr<const Image> Get(size_t index);
+    bool Failed(size_t index);
+    // Block until every cell within the window is finished
+    void WaitIdle();
+
+    size_t Size() const { return files_.size(); }
+    const std::string& File(size_t index) const { return files_[index]; }
+    int ThumbSize() const { return size_; }
+
+    // Thumbnails made by decoding, found in the store, and files that failed
+    uint64_t Generated() const { return generated_; }
+    uint64_t FromStore() const { return fromStore_; }
+    uint64_t Failures() const { return failures_; }
+
+private:
+    enum class State : uint8_t { Pending, Working, Done, Failed };
+
+    // Most urgent pending cell within the window (lock held); false if there is none
+    bool NextPending(size_t& index) const;
+    bool InWindow(size_t index) const;
+    void Worker();
+
+    const int size_;
+    const ThumbnailStore store_;
+    const size_t margin_;
+    std::vector<std::string> files_;
+    std::vector<State> states_;
+    std::vector<std::shared_ptr<const Image>> thumbs_;
+    size_t first_ = 0, last_ = 0;  // visible cells, inclusive
+    bool visible_ = false;         // SetVisible() called since SetFiles()
+    size_t working_ = 0;
+    uint64_t generation_ = 0;      // bumped by SetFiles so stale results are dropped
+    uint64_t generated_ = 0, fromStore_ = 0, failures_ = 0;
+    std::function<void(size_t)> onReady_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_; // workers: window moved, files changed or stopping
+    std::condition_variable idle_; // WaitIdle(): a cell finished
+    std::vector<std::thread> workers_;
+    bool stopping_ = false;
+};
@@ -0,0 +1,611 @@
+#include "tiled.h"
+#include "image_cache.h"
+#include "thread_pool.h"
+#include "utf8_path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+namespace fs = std::filesystem;
+
+// Samples are stored as Image holds them, and Image holds them host-endian
+static_assert(std::endian::native == std::endian::little, "the tiled format is little-endian");
+
+constexpr char kTiledMagic[8] = { 'P', 'P', 'M', 'T', 'I', 'L', 'E', 'D' };
+constexpr uint32_t kTiledVersion = 1;
+constexpr int kMinTileSize = 16;
+constexpr int kMaxTileSize = 2048;
+constexpr int kMaxLevels = 32;
+// Same limit the Netpbm decoder puts on a single image
+constexpr uint64_t kMaxPixels = 100000000;
+
+// File layout: TiledHeader, tuple type, tileCount TileEntry records, tile data
+struct TiledHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags; // 1 = alpha, 2 = float, 4 = byte planes
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t maxVal;
+    int32_t tileSize;
+    int32_t levels;
+    uint32_t tupleTypeBytes;
+    uint32_t reserved;
+    uint64_t tileCount;
+};
+
+struct TileEntry {
+    uint64_t offset;
+    uint32_t bytes;
+    uint32_t coding; // 0 = stored, 1 = LZ4 block
+};
+
+// 1. LZ4 BLOCKS
+// The LZ4 block format: sequences of (token, literals, 16-bit match offset, match
+// length) where the last sequence is literals only. Blocks written here decode with
+// any LZ4 block decoder, and the decoder accepts any valid block.
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5; // the block ends with at least this many literals
+constexpr size_t kMatchFindLimit = 12; // no match starts closer than this to the end
+constexpr int kHashBits = 13;
+// Misses in a row before the search starts skipping ahead (incompressible data)
+constexpr unsigned kSkipTrigger = 6;
+
+// Helper: unaligned little-endian loads
+static inline uint32_t Load32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+static inline uint64_t Load64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t Hash4(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+// Helper: LZ4 length continuation bytes (255, 255, ..., rest)
+static inline uint8_t* PutLength(uint8_t* op, size_t length) {
+    for (; length >= 255; length -= 255) *op++ = 255;
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+// Helper: compress n bytes into at most `capacity` bytes of dst (greedy matching over
+// a hash table of 4-byte sequences); 0 if the block doesn't fit
+static size_t Lz4Compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity, std::vector<uint32_t>& table) {
+    table.assign(size_t(1) << kHashBits, 0); // positions + 1, 0 = empty
+    uint8_t* op = dst;
+    const uint8_t* anchor = src;
+
+    // One sequence: the literals from anchor to literalEnd, then a match (none for the last)
+    auto emit = [&](const uint8_t* literalEnd, size_t matchLength, size_t offset) {
+        const size_t literals = static_cast<size_t>(literalEnd - anchor);
+        const size_t worst = 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1;
+        if (worst > capacity - static_cast<size_t>(op - dst)) return false;
+        const size_t extra = matchLength ? matchLength - kMinMatch : 0;
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15) op = PutLength(op, literals - 15);
+        if (literals) std::memcpy(op, anchor, literals);
+        op += literals;
+        if (!matchLength) return true;
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+        if (extra >= 15) op = PutLength(op, extra - 15);
+        return true;
+    };
+
+    if (n > kMatchFindLimit) {
+        const uint8_t* const matchStartLimit = src + n - kMatchFindLimit;
+        const uint8_t* const matchEndLimit = src + n - kLastLiterals;
+        const uint8_t* ip = src;
+        unsigned misses = 1u << kSkipTrigger;
+        while (ip < matchStartLimit) {
+            const uint32_t sequence = Load32(ip);
+            uint32_t& slot = table[Hash4(sequence)];
+            const uint8_t* match = slot ? src + slot - 1 : nullptr;
+            slot = static_cast<uint32_t>(ip - src) + 1;
+            if (!match || ip - match > 65535 || Load32(match) != sequence) {
+                ip += misses++ >> kSkipTrigger;
+                continue;
+            }
+            // Extend backwards over literals not yet emitted, then forwards
+            while (ip > anchor && match > src && ip[-1] == match[-1]) { --ip; --match; }
+            const uint8_t* end = ip + kMinMatch;
+            const uint8_t* ref = match + kMinMatch;
+            bool stopped = false;
+            while (end + 8 <= matchEndLimit) {
+                const uint64_t diff = Load64(end) ^ Load64(ref);
+                if (diff) {
+                    end += std::countr_zero(diff) / 8;
+                    stopped = true;
+                    break;
+                }
+                end += 8;
+                ref += 8;
+            }
+            if (!stopped) while (end < matchEndLimit && *end == *ref) { ++end; ++ref; }
+
+            if (!emit(ip, static_cast<size_t>(end - ip), static_cast<size_t>(ip - match))) return 0;
+            ip = anchor = end;
+            misses = 1u << kSkipTrigger;
+            // The position just behind the match is a good candidate for the next one
+            if (ip < matchStartLimit) table[Hash4(Load32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src) + 1;
+        }
+    }
+    if (!emit(src + n, 0, 0)) return 0;
+    return static_cast<size_t>(op - dst);
+}
+
+// Helper: decode an LZ4 block of n bytes that must produce exactly `size` bytes;
+// false on anything malformed (never reads or writes out of bounds)
+static bool Lz4Decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t size) {
+    const uint8_t* ip = src;
+    const uint8_t* const inEnd = src + n;
+    uint8_t* op = dst;
+    uint8_t* const outEnd = dst + size;
+    auto readLength = [&](size_t& length) {
+        unsigned byte;
+        do {
+            if (ip == inEnd) return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    };
+
+    while (ip < inEnd) {
+        const unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if (literals > static_cast<size_t>(inEnd - ip) || literals > static_cast<size_t>(outEnd - op)) return false;
+        // Short runs (the common case) copy a fixed 16 bytes when both buffers have room
+        if (literals <= 16 && inEnd - ip >= 16 && outEnd - op >= 16) std::memcpy(op, ip, 16);
+        else if (literals) std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == inEnd) break; // the last sequence has no match
+
+        if (inEnd - ip < 2) return false;
+        const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length)) return false;
+        length += kMinMatch;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) || length > static_cast<size_t>(outEnd - op)) return false;
+
+        // Overlapping matches repeat the last `offset` bytes: copy in chunks that never
+        // read what they write, doubling as the repeated part grows
+        const uint8_t* ref = op - offset;
+        if (offset >= 8 && static_cast<size_t>(outEnd - op) >= length + 8) {
+            // 8 bytes at a time, overshooting into output not yet written
+            for (size_t i = 0; i < length; i += 8) std::memcpy(op + i, ref + i, 8);
+        } else if (offset >= length) {
+            std::memcpy(op, ref, length);
+        } else {
+            size_t done = 0, distance = offset;
+            while (done < length) {
+                const size_t chunk = std::min(distance, length - done);
+                std::memcpy(op + done, op + done - distance, chunk);
+                done += chunk;
+                distance *= 2;
+            }
+        }
+        op += length;
+    }
+    return op == outEnd;
+}
+
+// 2. LEVELS
+// Helper: sizes of every level, each half the one before (rounded up); a 1x1 level
+// is never halved
+static std::vector<std::pair<int, int>> LevelSizes(int width, int height, int levels) {
+    std::vector<std::pair<int, int>> sizes{ { width, height } };
+    while (static_cast<int>(sizes.size()) < levels && (width > 1 || height > 1)) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        sizes.push_back({ width, height });
+    }
+    return sizes;
+}
+
+// Helper: box filter rows [ty0, ty1) of dst from src. Source column x lands in output
+// column x * dst.width / src.width (rows alike), so every source pixel counts once.
+template <typename Sample>
+static void BoxFilterBand(const Image& src, Image& dst, int ty0, int ty1) {
+    const int channels = src.channels;
+    std::vector<int> column(src.width);
+    std::vector<uint32_t> columnCount(dst.width, 0);
+    for (int x = 0; x < src.width; ++x) {
+        column[x] = static_cast<int>(static_cast<int64_t>(x) * dst.width / src.width);
+        ++columnCount[column[x]];
+    }
+    // First source row that lands in output row ty
+    auto firstRow = [&](int ty) { return static_cast<int>((static_cast<int64_t>(ty) * src.height + dst.height - 1) / dst.height); };
+
+    const Sample* in = reinterpret_cast<const Sample*>(src.Data());
+    Sample* out = reinterpret_cast<Sample*>(dst.samples.data());
+    std::vector<double> sum(static_cast<size_t>(dst.width) * channels);
+    for (int ty = ty0; ty < ty1; ++ty) {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        const int y0 = firstRow(ty), y1 = firstRow(ty + 1);
+        for (int y = y0; y < y1; ++y) {
+            const Sample* s = in + static_cast<size_t>(y) * src.width * channels;
+            for (int x = 0; x < src.width; ++x, s += channels) {
+                double* a = sum.data() + static_cast<size_t>(column[x]) * channels;
+                for (int c = 0; c < channels; ++c) a[c] += s[c];
+            }
+        }
+        Sample* o = out + static_cast<size_t>(ty) * dst.width * channels;
+        for (int tx = 0; tx < dst.width; ++tx) {
+            const double count = static_cast<double>(columnCount[tx]) * (y1 - y0);
+            for (int c = 0; c < channels; ++c) {
+                const size_t i = static_cast<size_t>(tx) * channels + c;
+                if constexpr (std::is_same_v<Sample, float>) o[i] = static_cast<float>(sum[i] / count);
+                else o[i] = static_cast<Sample>(sum[i] / count + 0.5);
+            }
+        }
+    }
+}
+
+// Helper: src box filtered down to width x height, rows in parallel bands
+static Image BoxFilter(const Image& src, int width, int height, unsigned threads) {
+    Image dst;
+    dst.width = width;
+    dst.height = height;
+    dst.channels = src.channels;
+    dst.maxVal = src.maxVal;
+    dst.alpha = src.alpha;
+    dst.isFloat = src.isFloat;
+    dst.tupleType = src.tupleType;
+    dst.samples.resize(dst.SampleCount() * dst.BytesPerSample());
+
+    // Bands of at least 1M source samples
+    const size_t srcPerRow = std::max<size_t>(1, src.SampleCount() / std::max(1, height));
+    const int minRows = static_cast<int>(((size_t(1) << 20) + srcPerRow - 1) / srcPerRow);
+    ParallelBands(height, threads, minRows, [&](int, int ty0, int ty1) {
+        if (src.isFloat) BoxFilterBand<float>(src, dst, ty0, ty1);
+        else if (src.BytesPerSample() == 2) BoxFilterBand<uint16_t>(src, dst, ty0, ty1);
+        else BoxFilterBand<uint8_t>(src, dst, ty0, ty1);
+    });
+    return dst;
+}
+
+// 3. WRITING
+bool IsTiledData(const uint8_t* head, size_t size) {
+    return size >= sizeof(kTiledMagic) && std::memcmp(head, kTiledMagic, sizeof(kTiledMagic)) == 0;
+}
+
+bool IsTiledFile(const std::string& filepath) {
+    std::ifstream in(Utf8Path(filepath), std::ios::binary);
+    char head[sizeof(kTiledMagic)] = {};
+    in.read(head, sizeof(head));
+    return in.gcount() == sizeof(head) && IsTiledData(reinterpret_cast<const uint8_t*>(head), sizeof(head));
+}
+
+bool EncodeTiled(const Image& img, const TiledOptions& options, std::string& out) {
+    if (img.width <= 0 || img.height <= 0 || !img.HasSamples()) {
+        std::cerr << "Error: Nothing to save (empty image)." << std::endl;
+        return false;
+    }
+    if (options.tileSize < kMinTileSize || options.tileSize > kMaxTileSize || options.levels < 0 || options.levels > kMaxLevels) {
+        std::cerr << "Error: Invalid tile size " << options.tileSize << " or level count " << options.levels << "." << std::endl;
+        return false;
+    }
+    const int tileSize = options.tileSize;
+    const int bytesPerSample = img.BytesPerSample();
+
+    // Level count: as asked, or halving until a single tile holds the level
+    int levels = options.levels;
+    if (levels == 0) {
+        levels = 1;
+        for (int w = img.width, h = img.height; (w > tileSize || h > tileSize) && levels < kMaxLevels; ++levels) {
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+    }
+    const std::vector<std::pair<int, int>> sizes = LevelSizes(img.width, img.height, levels);
+    std::vector<Image> reduced; // levels 1.. (level 0 is img itself)
+    for (size_t l = 1; l < sizes.size(); ++l)
+        reduced.push_back(BoxFilter(l == 1 ? img : reduced.back(), sizes[l].first, sizes[l].second, options.threads));
+
+    struct TileJob {
+        const Image* level;
+        int x, y, w, h;
+        std::vector<uint8_t> payload;
+        uint32_t coding = 0;
+    };
+    std::vector<TileJob> jobs;
+    for (size_t l = 0; l < sizes.size(); ++l) {
+        const Image* level = l == 0 ? &img : &reduced[l - 1];
+        for (int y = 0; y < level->height; y += tileSize)
+            for (int x = 0; x < level->width; x += tileSize)
+                jobs.push_back({ level, x, y, std::min(tileSize, level->width - x), std::min(tileSize, level->height - y), {}, 0 });
+    }
+
+    // Tiles are independent: compress them on every thread, each taking the next one
+    // (one band per thread; the bands only set how many threads there are)
+    std::atomic<size_t> next{ 0 };
+    ParallelBands(static_cast<int>(jobs.size()), options.threads, 1, [&](int, int, int) {
+        std::vector<uint8_t> raw, planes;
+        std::vector<uint32_t> table;
+        for (size_t j; (j = next.fetch_add(1)) < jobs.size();) {
+            TileJob& job = jobs[j];
+            const size_t rowBytes = static_cast<size_t>(job.w) * img.channels * bytesPerSample;
+            const size_t stride = static_cast<size_t>(job.level->width) * img.channels * bytesPerSample;
+            raw.resize(rowBytes * job.h);
+            const uint8_t* src = job.level->Data() + job.y * stride + static_cast<size_t>(job.x) * img.channels * bytesPerSample;
+            for (int r = 0; r < job.h; ++r) std::memcpy(raw.data() + r * rowBytes, src + r * stride, rowBytes);
+            if (bytesPerSample > 1) {
+                const size_t count = raw.size() / bytesPerSample;
+                planes.resize(raw.size());
+                for (size_t i = 0; i < count; ++i)
+                    for (int b = 0; b < bytesPerSample; ++b) planes[b * count + i] = raw[i * bytesPerSample + b];
+                raw.swap(planes);
+            }
+            job.payload.resize(raw.size());
+            const size_t packed = Lz4Compress(raw.data(), raw.size(), job.payload.data(), raw.size() - 1, table);
+            if (packed) {
+                job.payload.resize(packed);
+                job.coding = 1;
+            } else {
+                job.payload = raw; // incompressible: stored
+            }
+        }
+    });
+
+    TiledHeader header = {};
+    std::memcpy(header.magic, kTiledMagic, sizeof(kTiledMagic));
+    header.version = kTiledVersion;
+    header.flags = (img.alpha ? 1u : 0u) | (img.isFloat ? 2u : 0u) | (bytesPerSample > 1 ? 4u : 0u);
+    header.width = img.width;
+    header.height = img.height;
+    header.channels = img.channels;
+    header.maxVal = img.maxVal;
+    header.tileSize = tileSize;
+    header.levels = static_cast<int32_t>(sizes.size());
+    header.tupleTypeBytes = static_cast<uint32_t>(img.tupleType.size());
+    header.tileCount = jobs.size();
+
+    uint64_t offset = sizeof(header) + img.tupleType.size() + jobs.size() * sizeof(TileEntry);
+    size_t total = static_cast<size_t>(offset);
+    for (const TileJob& job : jobs) total += job.payload.size();
+    out.clear();
+    out.reserve(total);
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += img.tupleType;
+    for (const TileJob& job : jobs) {
+        const TileEntry entry = { offset, static_cast<uint32_t>(job.payload.size()), job.coding };
+        out.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        offset += job.payload.size();
+    }
+    for (const TileJob& job : jobs) out.append(reinterpret_cast<const char*>(job.payload.data()), job.payload.size());
+    return true;
+}
+
+bool SaveTiled(const Image& img, const std::string& filepath, const TiledOptions& options) {
+    std::string data;
+    if (!EncodeTiled(img, options, data)) return false;
+    std::ofstream file(Utf8Path(filepath), std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file: " << filepath << std::endl;
+        return false;
+    }
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    file.close();
+    if (file.fail()) {
+        std::cerr << "Error: Failed while writing: " << filepath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 4. READING
+bool TiledReader::Open(const std::string& filepath) {
+    uint64_t size = 0;
+    std::shared_ptr<const uint8_t> data = MapFileReadOnly(filepath, size);
+    if (!data) {
+        *this = TiledReader{};
+        std::cerr << "Error: Could not open file: " << filepath << std::endl;
+        return false;
+    }
+    return Parse(std::move(data), size, filepath);
+}
+
+bool TiledReader::OpenBuffer(std::string data) {
+    auto holder = std::make_shared<std::string>(std::move(data));
+    const uint64_t size = holder->size();
+    // Points into the string and shares its lifetime
+    std::shared_ptr<const uint8_t> bytes(holder, reinterpret_cast<const uint8_t*>(holder->data()));
+    return Parse(std::move(bytes), size, "(buffer)");
+}
+
+bool TiledReader::Parse(std::shared_ptr<const uint8_t> data, uint64_t size, const std::string& name) {
+    *this = TiledReader{};
+    auto invalid = [&](const char* what) {
+        *this = TiledReader{};
+        std::cerr << "Error: Invalid tiled image (" << what << "): " << name << std::endl;
+        return false;
+    };
+    if (size < sizeof(TiledHeader)) return invalid("truncated header");
+    TiledHeader header;
+    std::memcpy(&header, data.get(), sizeof(header));
+    if (std::memcmp(header.magic, kTiledMagic, sizeof(kTiledMagic)) != 0) return invalid("not a tiled image");
+    if (header.version != kTiledVersion) return invalid("unsupported version");
+
+    format_.width = header.width;
+    format_.height = header.height;
+    format_.channels = header.channels;
+    format_.maxVal = header.maxVal;
+    format_.alpha = (header.flags & 1) != 0;
+    format_.isFloat = (header.flags & 2) != 0;
+    if ((header.flags & ~7u) != 0 || format_.width <= 0 || format_.height <= 0
+        || static_cast<uint64_t>(format_.width) * format_.height > kMaxPixels || format_.channels < 1 || format_.channels > 4
+        || (!format_.isFloat && (format_.maxVal < 1 || format_.maxVal > 65535)))
+        return invalid("bad format");
+    if (header.tileSize < kMinTileSize || header.tileSize > kMaxTileSize || header.levels < 1 || header.levels > kMaxLevels)
+        return invalid("bad tiling");
+    const int bytesPerSample = format_.BytesPerSample();
+    planes_ = (header.flags & 4) != 0;
+    if (planes_ != (bytesPerSample > 1)) return invalid("bad format");
+
+    const std::vector<std::pair<int, int>> sizes = LevelSizes(format_.width, format_.height, header.levels);
+    if (static_cast<int>(sizes.size()) != header.levels) return invalid("bad tiling");
+    tileSize_ = header.tileSize;
+    size_t tiles = 0;
+    for (const auto& [w, h] : sizes) {
+        Level level;
+        level.width = w;
+        level.height = h;
+        level.tilesX = (w + tileSize_ - 1) / tileSize_;
+        level.tilesY = (h + tileSize_ - 1) / tileSize_;
+        level.firstTile = tiles;
+        tiles += static_cast<size_t>(level.tilesX) * level.tilesY;
+        levels_.push_back(level);
+    }
+
+    const uint64_t indexOffset = sizeof(TiledHeader) + static_cast<uint64_t>(header.tupleTypeBytes);
+    if (header.tileCount != tiles || indexOffset > size || (size - indexOffset) / sizeof(TileEntry) < tiles)
+        return invalid("truncated index");
+    format_.tupleType.assign(reinterpret_cast<const char*>(data.get()) + sizeof(TiledHeader), header.tupleTypeBytes);
+
+    // Every tile must lie inside the file; stored tiles hold exactly the raw samples
+    tiles_.resize(tiles);
+    for (size_t l = 0; l < levels_.size(); ++l) {
+        const Level& level = levels_[l];
+        for (int ty = 0; ty < level.tilesY; ++ty) {
+            for (int tx = 0; tx < level.tilesX; ++tx) {
+                const size_t i = level.firstTile + static_cast<size_t>(ty) * level.tilesX + tx;
+                TileEntry entry;
+                std::memcpy(&entry, data.get() + indexOffset + i * sizeof(TileEntry), sizeof(entry));
+                const uint64_t rawBytes = static_cast<uint64_t>(std::min(tileSize_, level.width - tx * tileSize_))
+                    * std::min(tileSize_, level.height - ty * tileSize_) * format_.channels * bytesPerSample;
+                if (entry.offset > size || entry.bytes > size - entry.offset || entry.coding > 1
+                    || (entry.coding == 0 && entry.bytes != rawBytes))
+                    return invalid("bad tile index");
+                tiles_[i] = { entry.offset, entry.bytes, entry.coding };
+            }
+        }
+    }
+    data_ = std::move(data);
+    return true;
+}
+
+int TiledReader::LevelFor(int maxSize) const {
+    for (int l = Levels() - 1; l > 0; --l)
+        if (std::max(levels_[l].width, levels_[l].height) >= maxSize) return l;
+    return 0;
+}
+
+bool TiledReader::ReadTile(int level, int tx, int ty, int x, int y, Image& img, std::vector<uint8_t>& scratch) const {
+    const Level& lv = levels_[level];
+    const Tile& tile = tiles_[lv.firstTile + static_cast<size_t>(ty) * lv.tilesX + tx];
+    const int tileX = tx * tileSize_, tileY = ty * tileSize_;
+    const int tileW = std::min(tileSize_, lv.width - tileX), tileH = std::min(tileSize_, lv.height - tileY);
+    const int channels = format_.channels, bytesPerSample = format_.BytesPerSample();
+    const size_t rawBytes = static_cast<size_t>(tileW) * tileH * channels * bytesPerSample;
+
+    const uint8_t* raw = data_.get() + tile.offset;
+    if (tile.coding == 1) {
+        scratch.resize(rawBytes);
+        if (!Lz4Decompress(raw, tile.bytes, scratch.data(), rawBytes)) return false;
+        raw = scratch.data();
+    }
+
+    // The part of the tile inside the rectangle, un-planed as it is copied
+    const int x0 = std::max(x, tileX), x1 = std::min(x + img.width, tileX + tileW);
+    const int y0 = std::max(y, tileY), y1 = std::min(y + img.height, tileY + tileH);
+    const size_t plane = rawBytes / bytesPerSample;
+    const size_t count = static_cast<size_t>(x1 - x0) * channels;
+    for (int row = y0; row < y1; ++row) {
+        const size_t first = (static_cast<size_t>(row - tileY) * tileW + (x0 - tileX)) * channels;
+        uint8_t* out = img.samples.data() + (static_cast<size_t>(row - y) * img.width + (x0 - x)) * channels * bytesPerSample;
+        if (!planes_) {
+            std::memcpy(out, raw + first * bytesPerSample, count * bytesPerSample);
+        } else if (bytesPerSample == 2) {
+            const uint8_t* low = raw + first;
+            const uint8_t* high = raw + plane + first;
+            for (size_t i = 0; i < count; ++i) {
+                out[2 * i] = low[i];
+                out[2 * i + 1] = high[i];
+            }
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                for (int b = 0; b < bytesPerSample; ++b) out[i * bytesPerSample + b] = raw[b * plane + first + i];
+        }
+    }
+    return true;
+}
+
+bool TiledReader::ReadRegion(int level, int x, int y, int w, int h, Image& img, unsigned threads) const {
+    if (!IsOpen() || level < 0 || level >= Levels()) return false;
+    const Level& lv = levels_[level];
+    const int x0 = static_cast<int>(std::clamp<int64_t>(x, 0, lv.width));
+    const int y0 = static_cast<int>(std::clamp<int64_t>(y, 0, lv.height));
+    const int x1 = static_cast<int>(std::clamp<int64_t>(static_cast<int64_t>(x) + w, 0, lv.width));
+    const int y1 = static_cast<int>(std::clamp<int64_t>(static_cast<int64_t>(y) + h, 0, lv.height));
+    if (x1 <= x0 || y1 <= y0) return false;
+
+    img = format_;
+    img.width = x1 - x0;
+    img.height = y1 - y0;
+    img.samples.resize(img.SampleCount() * img.BytesPerSample());
+
+    // Only the tiles the rectangle touches, each decoded by whichever thread takes it
+    // (as in EncodeTiled, the bands only set the thread count)
+    const int tx0 = x0 / tileSize_, tx1 = (x1 - 1) / tileSize_ + 1;
+    const int ty0 = y0 / tileSize_, ty1 = (y1 - 1) / tileSize_ + 1;
+    const size_t across = static_cast<size_t>(tx1 - tx0);
+    const size_t count = across * (ty1 - ty0);
+    std::atomic<size_t> next{ 0 };
+    std::atomic<bool> failed{ false };
+    ParallelBands(static_cast<int>(count), threads, 1, [&](int, int, int) {
+        std::vector<uint8_t> scratch;
+        for (size_t i; !failed && (i = next.fetch_add(1)) < count;) {
+            const int tx = tx0 + static_cast<int>(i % across), ty = ty0 + static_cast<int>(i / across);
+            if (!ReadTile(level, tx, ty, x0, y0, img, scratch)) failed = true;
+        }
+    });
+    if (failed) {
+        std::cerr << "Error: Corrupt tile in tiled image." << std::endl;
+        img = Image{};
+        return false;
+    }
+    return true;
+}
+
+bool TiledReader::ReadLevel(int level, Image& img, unsigned threads) const {
+    if (!IsOpen() || level < 0 || level >= Levels()) return false;
+    return ReadRegion(level, 0, 0, levels_[level].width, levels_[level].height, img, threads);
+}
+
+Image LoadTiled(const std::string& filepath, unsigned threads) {
+    Image img;
+    TiledReader reader;
+    if (!reader.Open(filepath) || !reader.ReadLevel(0, img, threads)) return Image{};
+    std::cout << "Tiled Image Loaded: " << img.width << "x" << img.height << std::endl;
+    return img;
+}
+
+Image LoadTiledThumbnail(const std::string& filepath, int maxSize) {
+    Image level;
+    TiledReader reader;
+    if (maxSize < 1 || !reader.Open(filepath) || !reader.ReadLevel(reader.LevelFor(maxSize), level, 1)) return level;
+    // Sized from the full image, as LoadPPMThumbnail would make it
+    int width = 0, height = 0;
+    ThumbnailSize(reader.Format().width, reader.Format().height, maxSize, width, height);
+    width = std::min(width, level.width);
+    height = std::min(height, level.height);
+    if (width == level.width && height == level.height) return level;
+    return BoxFilter(level, width, height, 1);
+}
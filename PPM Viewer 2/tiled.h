@@ -0,0 +1,96 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Tiled image container (.ppmt), for archiving large frames so that they open and
+// pan without decoding all of them. The raster, in Image's native sample layout, is
+// cut into square tiles that are LZ4-compressed independently; an index at the
+// front gives every tile's offset, so any rectangle is read by decompressing just
+// the tiles it touches. Optional lower resolution levels (each half the size of
+// the one before, 2x2 box filtered) let a thumbnail or an overview come from a
+// small level instead of the full image.
+//
+// Layout (little-endian): a fixed header, the PAM tuple type, the tile index
+// (offset, compressed size and coding of every tile; level 0 first, tile rows top
+// to bottom), then the tiles. Tiles on the right and bottom edges are cut to the
+// image. Samples wider than a byte are split into byte planes before compression
+// (every sample's low byte, then every sample's next byte, ...): the slowly varying
+// high bytes then form long runs that LZ4 finds, which interleaved they do not.
+
+struct TiledOptions {
+    int tileSize = 256;   // tile edge in pixels (16-2048)
+    int levels = 0;       // resolution levels including the full one; 0 = halve until one tile holds a level
+    unsigned threads = 0; // tiles compressed in parallel; 0 = one per hardware thread
+};
+
+// Whether data / the file starts like a tiled container
+bool IsTiledData(const uint8_t* head, size_t size);
+bool IsTiledFile(const std::string& filepath);
+
+// Encode img (any format, stats not kept) as a tiled container
+bool EncodeTiled(const Image& img, const TiledOptions& options, std::string& out);
+// Same, written to filepath; prints and returns false on failure
+bool SaveTiled(const Image& img, const std::string& filepath, const TiledOptions& options = TiledOptions{});
+
+// Random access to a tiled container. Open reads only the header and the index
+// (the file is mapped, not read), so it costs the same for any image size. Reads
+// are const and may run on several threads at once.
+class TiledReader {
+public:
+    // Map a file / take a container already in memory; print and return false when
+    // it isn't a valid container
+    bool Open(const std::string& filepath);
+    bool OpenBuffer(std::string data);
+    bool IsOpen() const { return data_ != nullptr; }
+
+    // Format of the full image (width, height, channels, maxVal, ...); no samples
+    const Image& Format() const { return format_; }
+    int TileSize() const { return tileSize_; }
+    int Levels() const { return static_cast<int>(levels_.size()); }
+    int LevelWidth(int level) const { return levels_[level].width; }
+    int LevelHeight(int level) const { return levels_[level].height; }
+    // Smallest level whose longer side is still at least maxSize (level 0 if none is)
+    int LevelFor(int maxSize) const;
+
+    // The w x h pixels at (x, y) of `level`, clipped to it, into img (same format
+    // as the container). Only the tiles the rectangle touches are decompressed, on
+    // `threads` threads (0 = one per hardware thread). False on a corrupt tile or
+    // an empty rectangle.
+    bool ReadRegion(int level, int x, int y, int w, int h, Image& img, unsigned threads = 0) const;
+    bool ReadLevel(int level, Image& img, unsigned threads = 0) const;
+
+private:
+    struct Level {
+        int width = 0, height = 0;
+        int tilesX = 0, tilesY = 0;
+        size_t firstTile = 0; // index of its first tile in tiles_
+    };
+    struct Tile {
+        uint64_t offset = 0;
+        uint32_t bytes = 0;
+        uint32_t coding = 0; // 0 = stored, 1 = LZ4
+    };
+
+    bool Parse(std::shared_ptr<const uint8_t> data, uint64_t size, const std::string& name);
+    // Decompress tile (tx, ty) of level and copy its part of the rectangle into img
+    bool ReadTile(int level, int tx, int ty, int x, int y, Image& img, std::vector<uint8_t>& scratch) const;
+
+    std::shared_ptr<const uint8_t> data_;
+    Image format_;
+    int tileSize_ = 0;
+    bool planes_ = false; // multi-byte samples stored as byte planes
+    std::vector<Level> levels_;
+    std::vector<Tile> tiles_;
+};
+
+// Full-resolution image of a tiled file, tiles decoded in parallel; empty on failure
+Image LoadTiled(const std::string& filepath, unsigned threads = 0);
+// Thumbnail (see ThumbnailSize) of a tiled file, box filtered from the smallest
+// level that is at least maxSize, so only that level's tiles are read
+Image LoadTiledThumbnail(const std::string& filepath, int maxSize);
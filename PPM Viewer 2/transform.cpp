@@ -0,0 +1,267 @@
+#include "transform.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Edge of the square tiles a transposing copy works through, in pixels: a tile of
+// 16-byte pixels is 16 KB on each side, small enough for L1 to hold both
+constexpr int kOrientTile = 32;
+// Bytes of source rows per thread when materializing, so small images stay on one
+constexpr size_t kOrientBandBytes = 1 << 22;
+
+// Source (x, y) lands at dst (x', y'): swap exchanges the axes first, negX/negY then
+// count x'/y' from the far edge
+struct OrientAxes {
+    bool swap, negX, negY;
+};
+
+static constexpr OrientAxes kOrientAxes[8] = {
+    { false, false, false }, // Identity
+    { true, true, false },   // Rotate90:   x' = H-1-y, y' = x
+    { false, true, true },   // Rotate180
+    { true, false, true },   // Rotate270:  x' = y, y' = W-1-x
+    { false, true, false },  // FlipH
+    { false, false, true },  // FlipV
+    { true, false, false },  // Transpose:  x' = y, y' = x
+    { true, true, true },    // Transverse: x' = H-1-y, y' = W-1-x
+};
+
+// 1. ORIENTATION ALGEBRA
+// Helper: the axes of an orientation applied to a (possibly already oriented) one
+static OrientAxes Apply(const OrientAxes& o, OrientAxes p) {
+    if (o.swap) std::swap(p.negX, p.negY);
+    return { p.swap != o.swap, p.negX != o.negX, p.negY != o.negY };
+}
+
+Orientation Compose(Orientation first, Orientation then) {
+    const OrientAxes axes = Apply(kOrientAxes[static_cast<int>(then)], kOrientAxes[static_cast<int>(first)]);
+    for (int i = 0; i < 8; ++i) {
+        const OrientAxes& a = kOrientAxes[i];
+        if (a.swap == axes.swap && a.negX == axes.negX && a.negY == axes.negY) return static_cast<Orientation>(i);
+    }
+    return Orientation::Identity;
+}
+
+Orientation Inverse(Orientation o) {
+    for (int i = 0; i < 8; ++i) {
+        if (Compose(o, static_cast<Orientation>(i)) == Orientation::Identity) return static_cast<Orientation>(i);
+    }
+    return Orientation::Identity;
+}
+
+bool SwapsAxes(Orientation o) {
+    return kOrientAxes[static_cast<int>(o)].swap;
+}
+
+void OrientRect(Orientation o, int width, int height, int& x, int& y, int& w, int& h) {
+    const OrientAxes& a = kOrientAxes[static_cast<int>(o)];
+    const int outW = a.swap ? height : width, outH = a.swap ? width : height;
+    int nx = a.swap ? y : x, ny = a.swap ? x : y;
+    const int nw = a.swap ? h : w, nh = a.swap ? w : h;
+    if (a.negX) nx = outW - nx - nw;
+    if (a.negY) ny = outH - ny - nh;
+    x = nx;
+    y = ny;
+    w = nw;
+    h = nh;
+}
+
+bool ParseOrientation(const std::string& text, Orientation& o) {
+    for (int i = 0; i < 8; ++i) {
+        if (text == OrientationName(static_cast<Orientation>(i))) {
+            o = static_cast<Orientation>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* OrientationName(Orientation o) {
+    static const char* kNames[8] = { "0", "90", "180", "270", "fliph", "flipv", "transpose", "transverse" };
+    return kNames[static_cast<int>(o)];
+}
+
+// 2. COPY KERNELS
+// Helper: scalar copy of a w x h block, source pixel (x, y) -> dst + x * dx + y * dy
+template <int N>
+static void CopyPixels(const uint8_t* src, size_t srcStride, int w, int h, uint8_t* dst, ptrdiff_t dx, ptrdiff_t dy) {
+    for (int y = 0; y < h; ++y) {
+        const uint8_t* s = src + y * srcStride;
+        uint8_t* d = dst + y * dy;
+        for (int x = 0; x < w; ++x, s += N, d += dx) std::memcpy(d, s, N);
+    }
+}
+
+// Helper: CopyPixels for any of the pixel sizes an Image can have (1-4 channels of 1, 2 or 4 bytes)
+static void CopyPixels(int pixelBytes, const uint8_t* src, size_t srcStride, int w, int h, uint8_t* dst, ptrdiff_t dx, ptrdiff_t dy) {
+    switch (pixelBytes) {
+    case 1: CopyPixels<1>(src, srcStride, w, h, dst, dx, dy); break;
+    case 2: CopyPixels<2>(src, srcStride, w, h, dst, dx, dy); break;
+    case 3: CopyPixels<3>(src, srcStride, w, h, dst, dx, dy); break;
+    case 4: CopyPixels<4>(src, srcStride, w, h, dst, dx, dy); break;
+    case 6: CopyPixels<6>(src, srcStride, w, h, dst, dx, dy); break;
+    case 8: CopyPixels<8>(src, srcStride, w, h, dst, dx, dy); break;
+    case 12: CopyPixels<12>(src, srcStride, w, h, dst, dx, dy); break;
+    case 16: CopyPixels<16>(src, srcStride, w, h, dst, dx, dy); break;
+    default:
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) std::memcpy(dst + x * dx + y * dy, src + y * srcStride + static_cast<size_t>(x) * pixelBytes, pixelBytes);
+        }
+        break;
+    }
+}
+
+#ifdef PPM_SSE2
+// Helper: transpose 8 rows of 8 bytes; row j becomes lane j of each output column,
+// and column i is stored at dst + i * step
+static inline void Transpose8x8(const uint8_t* const rows[8], uint8_t* dst, ptrdiff_t step) {
+    __m128i r[8];
+    for (int j = 0; j < 8; ++j) r[j] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[j]));
+    const __m128i a = _mm_unpacklo_epi8(r[0], r[1]);
+    const __m128i b = _mm_unpacklo_epi8(r[2], r[3]);
+    const __m128i c = _mm_unpacklo_epi8(r[4], r[5]);
+    const __m128i d = _mm_unpacklo_epi8(r[6], r[7]);
+    const __m128i ab0 = _mm_unpacklo_epi16(a, b), ab1 = _mm_unpackhi_epi16(a, b); // columns 0-3, 4-7 of rows 0-3
+    const __m128i cd0 = _mm_unpacklo_epi16(c, d), cd1 = _mm_unpackhi_epi16(c, d); // same for rows 4-7
+    const __m128i cols[4] = { _mm_unpacklo_epi32(ab0, cd0), _mm_unpackhi_epi32(ab0, cd0),
+                              _mm_unpacklo_epi32(ab1, cd1), _mm_unpackhi_epi32(ab1, cd1) };
+    for (int i = 0; i < 4; ++i) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + (2 * i) * step), cols[i]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + (2 * i + 1) * step), _mm_unpackhi_epi64(cols[i], cols[i]));
+    }
+}
+
+// Helper: transpose 4 rows of 4 four-byte pixels, same conventions as Transpose8x8
+static inline void Transpose4x4(const uint8_t* const rows[4], uint8_t* dst, ptrdiff_t step) {
+    const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0]));
+    const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1]));
+    const __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2]));
+    const __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[3]));
+    const __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+    const __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + step), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * step), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * step), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+// Helper: one tile of a transposing copy (source x moves dst by dx = +-dstStride,
+// source y by dy = +-pixelBytes). Whole k x k squares go through the register
+// transpose, feeding the source rows in reverse when dst runs right to left.
+static void TransposeTile(const uint8_t* src, size_t srcStride, int w, int h, int pixelBytes,
+                          uint8_t* dst, ptrdiff_t dx, ptrdiff_t dy) {
+    int k = 0;
+#ifdef PPM_SSE2
+    if (pixelBytes == 1) k = 8;
+    else if (pixelBytes == 4) k = 4;
+#endif
+    int doneW = 0, doneH = 0;
+#ifdef PPM_SSE2
+    if (k > 0) {
+        doneW = w - w % k;
+        doneH = h - h % k;
+        const uint8_t* rows[8];
+        for (int y = 0; y < doneH; y += k) {
+            // Lane j of each dst run holds source row y + j, or y + k-1-j going backwards
+            const bool backwards = dy < 0;
+            for (int x = 0; x < doneW; x += k) {
+                for (int j = 0; j < k; ++j) {
+                    rows[j] = src + static_cast<size_t>(backwards ? y + k - 1 - j : y + j) * srcStride + static_cast<size_t>(x) * pixelBytes;
+                }
+                uint8_t* d = dst + x * dx + (backwards ? y + k - 1 : y) * dy;
+                if (k == 8) Transpose8x8(rows, d, dx);
+                else Transpose4x4(rows, d, dx);
+            }
+        }
+    }
+#endif
+    // Right and bottom edges of the tile
+    if (doneW < w) CopyPixels(pixelBytes, src + static_cast<size_t>(doneW) * pixelBytes, srcStride, w - doneW, doneH, dst + doneW * dx, dx, dy);
+    if (doneH < h) CopyPixels(pixelBytes, src + static_cast<size_t>(doneH) * srcStride, srcStride, w, h - doneH, dst + doneH * dy, dx, dy);
+}
+
+// Helper: one row copied right to left
+static void ReverseRow(const uint8_t* src, int w, int pixelBytes, uint8_t* dstEnd) {
+    int x = 0;
+#ifdef PPM_SSE2
+    if (pixelBytes == 4) {
+        for (; x + 4 <= w; x += 4) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + static_cast<size_t>(x) * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dstEnd - static_cast<ptrdiff_t>(x + 3) * 4), _mm_shuffle_epi32(v, 0x1B));
+        }
+    }
+#endif
+    CopyPixels(pixelBytes, src + static_cast<size_t>(x) * pixelBytes, 0, w - x, 1, dstEnd - static_cast<ptrdiff_t>(x) * pixelBytes, -pixelBytes, 0);
+}
+
+void OrientPixels(const uint8_t* src, size_t srcStride, int w, int h, int pixelBytes, Orientation o,
+                  uint8_t* dst, size_t dstStride) {
+    if (w <= 0 || h <= 0) return;
+    const OrientAxes& a = kOrientAxes[static_cast<int>(o)];
+    const ptrdiff_t pb = pixelBytes, stride = static_cast<ptrdiff_t>(dstStride);
+    // Where source pixel (0, 0) goes, and how far one step along each source axis moves it
+    const int outW = a.swap ? h : w, outH = a.swap ? w : h;
+    uint8_t* origin = dst + (a.negX ? outW - 1 : 0) * pb + (a.negY ? outH - 1 : 0) * stride;
+    const ptrdiff_t stepX = a.negX ? -pb : pb, stepY = a.negY ? -stride : stride;
+
+    if (!a.swap) {
+        // Rows stay rows: plain or reversed row copies
+        for (int y = 0; y < h; ++y) {
+            const uint8_t* s = src + static_cast<size_t>(y) * srcStride;
+            uint8_t* d = origin + y * stepY;
+            if (a.negX) ReverseRow(s, w, pixelBytes, d);
+            else std::memcpy(d, s, static_cast<size_t>(w) * pixelBytes);
+        }
+        return;
+    }
+    // Source rows become dst columns: go tile by tile, so the dst rows written and the
+    // source rows read are both a tile long and stay cached while the tile is done
+    const ptrdiff_t dx = stepY, dy = stepX;
+    for (int ty = 0; ty < h; ty += kOrientTile) {
+        const int th = std::min(kOrientTile, h - ty);
+        for (int tx = 0; tx < w; tx += kOrientTile) {
+            const int tw = std::min(kOrientTile, w - tx);
+            TransposeTile(src + static_cast<size_t>(ty) * srcStride + static_cast<size_t>(tx) * pixelBytes, srcStride, tw, th,
+                          pixelBytes, origin + tx * dx + ty * dy, dx, dy);
+        }
+    }
+}
+
+// 3. IMAGES
+Image OrientImage(const Image& img, Orientation o, unsigned threads) {
+    Image out;
+    out.channels = img.channels;
+    out.maxVal = img.maxVal;
+    out.alpha = img.alpha;
+    out.isFloat = img.isFloat;
+    out.tupleType = img.tupleType;
+    out.stats = img.stats;
+    const bool swap = SwapsAxes(o);
+    out.width = swap ? img.height : img.width;
+    out.height = swap ? img.width : img.height;
+    if (!img.HasSamples() || img.width <= 0 || img.height <= 0) return out;
+    const int pixelBytes = img.channels * img.BytesPerSample();
+    const size_t srcStride = static_cast<size_t>(img.width) * pixelBytes;
+    const size_t dstStride = static_cast<size_t>(out.width) * pixelBytes;
+    out.samples.resize(static_cast<size_t>(out.height) * dstStride);
+
+    // Bands of source rows land in disjoint parts of dst (found with OrientRect), so
+    // they can go in parallel
+    const int tileRows = (img.height + kOrientTile - 1) / kOrientTile;
+    const size_t tileRowBytes = srcStride * kOrientTile;
+    const int minTileRows = static_cast<int>((kOrientBandBytes + tileRowBytes - 1) / tileRowBytes);
+    ParallelBands(tileRows, threads, minTileRows, [&](int, int t0, int t1) {
+        const int y0 = t0 * kOrientTile;
+        const int y1 = std::min(img.height, t1 * kOrientTile);
+        if (y0 >= y1) return;
+        int x = 0, y = y0, w = img.width, h = y1 - y0;
+        OrientRect(o, img.width, img.height, x, y, w, h);
+        OrientPixels(img.Data() + static_cast<size_t>(y0) * srcStride, srcStride, img.width, y1 - y0, pixelBytes, o,
+                     out.samples.data() + static_cast<size_t>(y) * dstStride + static_cast<size_t>(x) * pixelBytes, dstStride);
+    });
+    return out;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ppm.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The eight ways an image can be laid back onto a rectangle: the rotations
+// (clockwise) and their mirror images. Transpose mirrors across the main diagonal
+// (x and y swap), Transverse across the other one.
+enum class Orientation { Identity, Rotate90, Rotate180, Rotate270, FlipH, FlipV, Transpose, Transverse };
+
+// `first`, then `then`
+Orientation Compose(Orientation first, Orientation then);
+// The orientation that undoes o
+Orientation Inverse(Orientation o);
+// Rotations by 90/270 and the two transposes swap width and height
+bool SwapsAxes(Orientation o);
+
+// Where the w x h rectangle at (x, y) of a width x height image ends up after o
+void OrientRect(Orientation o, int width, int height, int& x, int& y, int& w, int& h);
+
+// "0", "90", "180", "270", "fliph", "flipv", "transpose" or "transverse"
+bool ParseOrientation(const std::string& text, Orientation& o);
+const char* OrientationName(Orientation o);
+
+// Copy a w x h block of pixels (pixelBytes each, rows srcStride bytes apart) into
+// dst in orientation o; dst is h x w when o swaps axes. Transposing orientations
+// work through the block in small tiles that stay in cache on both sides, so
+// neither the reads nor the writes walk down columns of the whole image; 1- and
+// 4-byte pixels are transposed in SSE2 registers (8x8 and 4x4 at a time).
+void OrientPixels(const uint8_t* src, size_t srcStride, int w, int h, int pixelBytes, Orientation o,
+                  uint8_t* dst, size_t dstStride);
+
+// img in orientation o, as a new image (stats included, as they don't change).
+// Row bands go to `threads` threads; 0 = one per hardware thread.
+Image OrientImage(const Image& img, Orientation o, unsigned threads = 0);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// The viewer and ppmconv keep file paths as UTF-8 std::strings. These convert them
+// to and from std::filesystem::path without going through the narrow code page
+// (fs::path(std::string) would, and mangles names outside it on Windows).
+
+inline std::filesystem::path Utf8Path(const std::string& s) {
+    return std::filesystem::path(std::u8string(reinterpret_cast<const char8_t*>(s.data()), s.size()));
+}
+
+inline std::string PathUtf8(const std::filesystem::path& p) {
+    const std::u8string s = p.u8string();
+    return std::string(reinterpret_cast<const char*>(s.data()), s.size());
+}
@@ -0,0 +1,1023 @@
+// ppmconv: headless batch converter for directories of Netpbm images.
+//
+//   ppmconv [options] <input file or directory>... -o <output directory>
+//   ppmconv --probe [-r] <input file or directory>...
+//   ppmconv --thumbnails N [--thumb-dir DIR] [-o <output directory>] <input>...
+//   ppmconv --stream [options] <"-", pipe or shm:NAME> -o <output directory, "-" or shm:NAME>
+//   ppmconv --compare [thresholds] [-r] <reference> <test> [-o <heatmap directory>]
+//   ppmconv --fuzz N [--seed S] [-o <failure directory>] [<input file>...]
+//
+// Every input (P1-P7, PFM, also gzip or zstd compressed as .ppm.gz or .ppm.zst,
+// decompressed as it is decoded) is written as a PPM: P6 by default, P3 with --ascii,
+// optionally rescaled with --maxval (e.g. --maxval 255 turns 16-bit frames into
+// 8-bit ones) and turned with --orient (90, 180, 270, fliph, flipv, transpose or
+// transverse; rotations are clockwise). --tiled writes tiled LZ4 containers (.ppmt,
+// see tiled.h) instead: the viewer decodes their tiles in parallel and makes
+// thumbnails from a reduced level; .ppmt inputs are read too. Outputs keep the
+// input's name with the extension replaced, so inputs that differ only in
+// extension (a.ppm, a.pgm, a.ppm.gz) are refused up front rather than written over
+// each other. Files are converted in a pipeline: a small I/O pool reads whole
+// files into memory and writes finished ones, while a CPU pool decodes and encodes
+// in memory, so disk latency overlaps with conversion work.
+//
+// --probe only lists each file's header (format, size, maxVal, raster offset; tile
+// size and levels of tiled files), which reads a few KB per file instead of decoding it.
+//
+// --thumbnails runs the viewer's thumbnail browser headlessly: the same loader
+// and on-disk thumbnail store (by default the viewer's own, so this also warms
+// it), paging through the inputs like a scrolling grid. With -o the thumbnails
+// are also written out as P6 files.
+//
+// --stream reads a continuous stream of concatenated frames (stdin or a named
+// pipe, e.g. from a renderer) through the viewer's live reader and writes each one
+// as it arrives, numbered by its position in the stream; "-o -" passes them on to
+// stdout instead, and "-o shm:NAME" into a shared memory frame ring (which the
+// viewer opens as "shm:NAME"), bridging producers that can only write a pipe.
+// Frames that arrive while one is being written are dropped, all but the newest,
+// so a slow disk or consumer never backs up the producer.
+//
+// --compare diffs a test image against its reference (or every file of a test
+// directory against the file of the same name in a reference directory), printing
+// max/mean error, PSNR and SSIM, and exits with 1 if any pair is over a threshold:
+// --max-error, --min-psnr and --min-ssim, or any difference at all when none is
+// given. With -o, a heatmap of every pair over a threshold is written there; -q
+// lists only those pairs and the ones that failed.
+//
+// --stats adds a line per channel to every converted file: min/max/mean and the
+// share of samples clipped at 0 and at maxVal, gathered by the decoder as the
+// raster streams in rather than by a second pass over the image.
+//
+// --roi X,Y,W,H (repeatable) and --roi-file FILE (one rectangle per line) add the
+// mean and standard deviation of every channel over each rectangle of every
+// converted file, in source pixels (before --orient) and clipped to the image.
+// The rectangles are looked up in summed-area tables built once per file, so
+// thousands of them cost next to nothing.
+//
+// --fuzz generates N damaged inputs (mostly P3/P6 with BOMs, comments, odd
+// whitespace, UTF-16 text, out-of-range numbers and truncation) and decodes each
+// through every fast path, comparing the results with a plain byte-at-a-time
+// reference decoder (see ppm_fuzz.h). Every fourth input is instead a damaged gzip
+// or zstd member, from built-in samples or from the .gz/.zst input files given.
+// Input files are also checked the same way as they are, e.g. to replay the
+// failures that -o saved. Exits with 1 on any mismatch.
+
+#include "ppm.h"
+#include "thread_pool.h"
+#include "thumbnails.h"
+#include "live_stream.h"
+#include "shm_frames.h"
+#include "compare.h"
+#include "transform.h"
+#include "integral.h"
+#include "ppm_fuzz.h"
+#include "tiled.h"
+#include "utf8_path.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// 1. OPTIONS AND INPUT DISCOVERY
+// A --roi rectangle
+struct Roi {
+    int x = 0, y = 0, w = 0, h = 0;
+};
+
+struct ConvOptions {
+    std::vector<fs::path> inputs;
+    fs::path outputDir;
+    SaveOptions save;
+    Orientation orientation = Orientation::Identity;
+    bool tiled = false;     // write tiled containers instead of PPM
+    TiledOptions tiling;
+    unsigned threads = 0;   // CPU workers (0 = one per hardware thread)
+    unsigned ioThreads = 2; // reader/writer workers
+    bool recursive = false;
+    bool quiet = false;     // no per-file lines, only the summary
+    bool probe = false;     // list headers instead of converting
+    int thumbnails = 0;     // thumbnail edge length; 0 = convert
+    bool stream = false;    // write the frames of one live input as they arrive
+    bool compare = false;   // diff a test input against a reference input
+    bool ssim = true;
+    bool stats = false;     // per-channel statistics of every converted file
+    std::vector<Roi> rois;  // region statistics of every converted file
+    int fuzz = 0;           // generated inputs to check against the reference decoder
+    uint64_t seed = 0;      // --fuzz generator seed (0: from the clock)
+    double maxError = -1;   // --compare thresholds (negative / 0: not given)
+    double minPsnr = 0;
+    double minSsim = 0;
+    std::string thumbDir = DefaultThumbnailDir();
+};
+
+static void PrintUsage() {
+    std::cerr <<
+        "Usage: ppmconv [options] <input file or directory>... -o <output directory>\n"
+        "       ppmconv --probe [-r] <input file or directory>...\n"
+        "       ppmconv --thumbnails N [--thumb-dir DIR] [-o DIR] <input file or directory>...\n"
+        "       ppmconv --stream [options] <\"-\", pipe or shm:NAME> -o <output directory, \"-\" or shm:NAME>\n"
+        "       ppmconv --compare [thresholds] [-r] <reference> <test> [-o <heatmap directory>]\n"
+        "       ppmconv --fuzz N [--seed S] [-o <failure directory>] [<input file>...]\n"
+        "  -o, --output DIR   where converted files go (created if missing)\n"
+        "  --ascii            write P3 instead of P6\n"
+        "  --maxval N         output maxVal (1-65535; default keeps the source's)\n"
+        "  --orient O         rotate (90, 180, 270 clockwise) or flip (fliph, flipv,\n"
+        "                     transpose, transverse) every image\n"
+        "  --tiled            write tiled LZ4 containers (.ppmt) instead of PPM\n"
+        "  --tile N           --tiled tile edge in pixels (16-2048, default 256)\n"
+        "  --levels N         --tiled resolution levels, full size included (1-32;\n"
+        "                     default: halve until a level fits in one tile)\n"
+        "  -j, --threads N    decode/encode threads (default: hardware threads)\n"
+        "  --io-threads N     file read/write threads (default: 2)\n"
+        "  -r, --recursive    descend into subdirectories (layout is mirrored)\n"
+        "  -q, --quiet        only print the summary\n"
+        "  --probe            print each file's header instead of converting\n"
+        "  --thumbnails N     make N x N thumbnails (through the thumbnail store) instead\n"
+        "  --thumb-dir DIR    thumbnail store (default: the viewer's; \"\" for none)\n"
+        "  --stream           write the frames of a live input as they arrive, dropping\n"
+        "                     those that come in faster than they can be written\n"
+        "  --compare          diff test against reference (files, or directories of them)\n"
+        "  --max-error E      fail pairs whose largest sample difference exceeds E\n"
+        "  --min-psnr DB      fail pairs below DB dB PSNR\n"
+        "  --min-ssim S       fail pairs below SSIM S (0-1)\n"
+        "  --no-ssim          skip SSIM (which reads the images a second time)\n"
+        "  --stats            print per-channel min/max/mean and clipping of every file\n"
+        "  --roi X,Y,W,H      print per-channel mean and standard deviation of the W x H\n"
+        "                     rectangle at X,Y of every file (repeatable)\n"
+        "  --roi-file FILE    the same for every rectangle of FILE (X,Y,W,H per line, # comments)\n"
+        "  --fuzz N           check N generated inputs (and any input files) against the\n"
+        "                     reference decoder; -o keeps the ones that disagree\n"
+        "  --seed S           --fuzz generator seed (default: from the clock)\n";
+}
+
+// Helper: parse a non-negative number option value; prints and returns false on junk
+static bool ParseNumber(const std::string& text, const char* name, double& value) {
+    try {
+        size_t used = 0;
+        value = std::stod(text, &used);
+        if (used == text.size() && value >= 0) return true;
+    } catch (...) {
+    }
+    std::cerr << "Error: Invalid value for " << name << ": " << text << std::endl;
+    return false;
+}
+
+// Helper: parse a positive integer option value; prints and returns false on junk
+static bool ParseCount(const std::string& text, const char* name, int maxValue, int& value) {
+    try {
+        size_t used = 0;
+        value = std::stoi(text, &used);
+        if (used == text.size() && value >= 1 && value <= maxValue) return true;
+    } catch (...) {
+    }
+    std::cerr << "Error: Invalid value for " << name << ": " << text << std::endl;
+    return false;
+}
+
+// Helper: "X,Y,W,H" (commas or blanks between) -> roi; W and H must be positive
+static bool ParseRoi(const std::string& text, Roi& roi) {
+    std::string spaced = text;
+    std::replace(spaced.begin(), spaced.end(), ',', ' ');
+    std::istringstream in(spaced);
+    std::string rest;
+    return (in >> roi.x >> roi.y >> roi.w >> roi.h) && !(in >> rest) && roi.w > 0 && roi.h > 0;
+}
+
+// Helper: append the rectangles of a --roi-file; prints and returns false on junk
+static bool ReadRoiFile(const fs::path& path, std::vector<Roi>& rois) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file: " << path.string() << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        const size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        Roi roi;
+        if (!ParseRoi(line, roi)) {
+            std::cerr << "Error: Invalid rectangle in " << path.string() << " line " << number << ": " << line << std::endl;
+            return false;
+        }
+        rois.push_back(roi);
+    }
+    return true;
+}
+
+static bool ParseArgs(int argc, char* argv[], ConvOptions& opt) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&](std::string& out) {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " needs a value" << std::endl;
+                return false;
+            }
+            out = argv[++i];
+            return true;
+        };
+        std::string v;
+        int n = 0;
+        if (arg == "-h" || arg == "--help") {
+            PrintUsage();
+            return false;
+        } else if (arg == "-o" || arg == "--output") {
+            if (!value(v)) return false;
+            opt.outputDir = fs::path(v);
+        } else if (arg == "--ascii") {
+            opt.save.ascii = true;
+        } else if (arg == "--maxval") {
+            if (!value(v) || !ParseCount(v, "--maxval", 65535, n)) return false;
+            opt.save.maxVal = n;
+        } else if (arg == "--orient") {
+            if (!value(v)) return false;
+            if (!ParseOrientation(v, opt.orientation)) {
+                std::cerr << "Error: Invalid --orient value: " << v << std::endl;
+                return false;
+            }
+        } else if (arg == "--tiled") {
+            opt.tiled = true;
+        } else if (arg == "--tile") {
+            if (!value(v) || !ParseCount(v, "--tile", 2048, n)) return false;
+            if (n < 16) {
+                std::cerr << "Error: Invalid value for --tile: " << v << std::endl;
+                return false;
+            }
+            opt.tiling.tileSize = n;
+        } else if (arg == "--levels") {
+            if (!value(v) || !ParseCount(v, "--levels", 32, n)) return false;
+            opt.tiling.levels = n;
+        } else if (arg == "-j" || arg == "--threads") {
+            if (!value(v) || !ParseCount(v, "--threads", 1024, n)) return false;
+            opt.threads = static_cast<unsigned>(n);
+        } else if (arg == "--io-threads") {
+            if (!value(v) || !ParseCount(v, "--io-threads", 64, n)) return false;
+            opt.ioThreads = static_cast<unsigned>(n);
+        } else if (arg == "-r" || arg == "--recursive") {
+            opt.recursive = true;
+        } else if (arg == "-q" || arg == "--quiet") {
+            opt.quiet = true;
+        } else if (arg == "--probe") {
+            opt.probe = true;
+        } else if (arg == "--thumbnails") {
+            if (!value(v) || !ParseCount(v, "--thumbnails", 4096, n)) return false;
+            opt.thumbnails = n;
+        } else if (arg == "--thumb-dir") {
+            if (!value(v)) return false;
+            opt.thumbDir = PathUtf8(fs::path(v)); // the library takes UTF-8 paths
+        } else if (arg == "--stream") {
+            opt.stream = true;
+        } else if (arg == "--compare") {
+            opt.compare = true;
+        } else if (arg == "--max-error") {
+            if (!value(v) || !ParseNumber(v, "--max-error", opt.maxError)) return false;
+        } else if (arg == "--min-psnr") {
+            if (!value(v) || !ParseNumber(v, "--min-psnr", opt.minPsnr)) return false;
+        } else if (arg == "--min-ssim") {
+            if (!value(v) || !ParseNumber(v, "--min-ssim", opt.minSsim)) return false;
+        } else if (arg == "--no-ssim") {
+            opt.ssim = false;
+        } else if (arg == "--stats") {
+            opt.stats = true;
+        } else if (arg == "--roi") {
+            Roi roi;
+            if (!value(v)) return false;
+            if (!ParseRoi(v, roi)) {
+                std::cerr << "Error: Invalid value for --roi: " << v << std::endl;
+                return false;
+            }
+            opt.rois.push_back(roi);
+        } else if (arg == "--roi-file") {
+            if (!value(v) || !ReadRoiFile(fs::path(v), opt.rois)) return false;
+        } else if (arg == "--fuzz") {
+            if (!value(v) || !ParseCount(v, "--fuzz", 1000000000, n)) return false;
+            opt.fuzz = n;
+        } else if (arg == "--seed") {
+            if (!value(v) || !ParseCount(v, "--seed", 2147483647, n)) return false;
+            opt.seed = static_cast<uint64_t>(n);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Error: Unknown option: " << arg << std::endl;
+            PrintUsage();
+            return false;
+        } else {
+            opt.inputs.push_back(fs::path(arg));
+        }
+    }
+    if (!opt.fuzz && (opt.inputs.empty() || (opt.outputDir.empty() && !opt.probe && !opt.thumbnails && !opt.compare))) {
+        PrintUsage();
+        return false;
+    }
+    if (opt.stream && opt.inputs.size() != 1) {
+        std::cerr << "Error: --stream reads exactly one input" << std::endl;
+        return false;
+    }
+    if (opt.compare && opt.inputs.size() != 2) {
+        std::cerr << "Error: --compare takes a reference and a test input" << std::endl;
+        return false;
+    }
+    if (opt.tiled && (opt.save.ascii || opt.save.maxVal)) {
+        std::cerr << "Error: --tiled keeps the source's samples; it takes no --ascii or --maxval" << std::endl;
+        return false;
+    }
+    if (opt.minSsim > 1 || (!opt.ssim && opt.minSsim > 0)) {
+        std::cerr << "Error: --min-ssim needs SSIM, and a value of at most 1" << std::endl;
+        return false;
+    }
+    if (opt.threads == 0) opt.threads = ThreadPool::DefaultThreads();
+    return true;
+}
+
+// Helper: extensions picked up when scanning a directory
+static bool IsNetpbmFile(const fs::path& p) {
+    auto lower = [](std::string ext) {
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ext;
+    };
+    std::string ext = lower(p.extension().string());
+    // Compressed: name.ppm.gz, name.ppm.zst
+    if (IsCompressedExtension(ext)) ext = lower(p.stem().extension().string());
+    return ext == ".ppm" || ext == ".pgm" || ext == ".pbm" || ext == ".pnm" || ext == ".pam" || ext == ".pfm"
+        || ext == ".ppmt";
+}
+
+struct Job {
+    fs::path input;
+    fs::path output;
+    std::string data;    // file contents, then the encoded output
+    std::string format;  // e.g. "P3 1920x1080 maxval 255"
+    std::string stats;   // --stats lines, one per channel, then --roi lines, one per rectangle
+    double readMs = 0, decodeMs = 0, encodeMs = 0, writeMs = 0;
+    uint64_t inBytes = 0, outBytes = 0;
+    bool ok = false;
+};
+
+// Helper: expand the command line inputs into (input, output) pairs, sorted by input path
+static std::vector<std::shared_ptr<Job>> CollectJobs(const ConvOptions& opt) {
+    std::vector<std::shared_ptr<Job>> jobs;
+    auto add = [&](const fs::path& in, const fs::path& relative) {
+        auto job = std::make_shared<Job>();
+        job->input = in;
+        job->output = opt.outputDir / relative;
+        if (IsCompressedExtension(job->output.extension().string())) job->output.replace_extension();
+        job->output.replace_extension(opt.tiled ? ".ppmt" : ".ppm");
+        jobs.push_back(std::move(job));
+    };
+    for (const fs::path& in : opt.inputs) {
+        std::error_code ec;
+        if (fs::is_directory(in, ec)) {
+            if (opt.recursive) {
+                for (const auto& entry : fs::recursive_directory_iterator(in, ec)) {
+                    if (entry.is_regular_file(ec) && IsNetpbmFile(entry.path())) add(entry.path(), entry.path().lexically_relative(in));
+                }
+            } else {
+                for (const auto& entry : fs::directory_iterator(in, ec)) {
+                    if (entry.is_regular_file(ec) && IsNetpbmFile(entry.path())) add(entry.path(), entry.path().filename());
+                }
+            }
+            if (ec) std::cerr << "Error: Could not scan directory: " << in.string() << std::endl;
+        } else if (fs::is_regular_file(in, ec)) {
+            add(in, in.filename());
+        } else {
+            std::cerr << "Error: No such file or directory: " << in.string() << std::endl;
+        }
+    }
+    std::sort(jobs.begin(), jobs.end(), [](const auto& a, const auto& b) { return a->input < b->input; });
+    return jobs;
+}
+
+// Helper: outputs are named after their inputs minus the extension, so a.ppm and
+// a.pgm (or a.ppm.gz) would write the same file; prints every such pair
+static bool UniqueOutputs(const std::vector<std::shared_ptr<Job>>& jobs) {
+    std::map<std::string, const Job*> seen;
+    bool unique = true;
+    for (const auto& job : jobs) {
+        std::string key = job->output.lexically_normal().generic_string();
+#ifdef _WIN32
+        // Windows file names are case-insensitive
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+        const auto [it, inserted] = seen.emplace(key, job.get());
+        if (inserted) continue;
+        std::cerr << "Error: " << it->second->input.string() << " and " << job->input.string()
+                  << " would both be written to " << job->output.string() << std::endl;
+        unique = false;
+    }
+    return unique;
+}
+
+// 2. PIPELINE STAGES
+static double MsSince(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Helper: whole file into memory
+static bool ReadWhole(const fs::path& path, std::string& data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not open file: " << path.string() << std::endl;
+        return false;
+    }
+    const std::streamoff size = file.tellg();
+    data.resize(static_cast<size_t>(std::max<std::streamoff>(0, size)));
+    file.seekg(0, std::ios::beg);
+    file.read(data.data(), static_cast<std::streamsize>(data.size()));
+    data.resize(static_cast<size_t>(file.gcount()));
+    return true;
+}
+
+// Helper: decode the first image of a file read by ReadWhole (the buffer is consumed);
+// the tiles of a tiled file are decoded on tileThreads threads
+static bool DecodeWhole(std::string& data, PnmHeader& header, Image& img, unsigned tileThreads = 1) {
+    if (IsTiledData(reinterpret_cast<const uint8_t*>(data.data()), data.size())) {
+        TiledReader tiled;
+        const bool opened = tiled.OpenBuffer(std::move(data));
+        data = std::string();
+        if (!opened || !tiled.ReadLevel(0, img, tileThreads)) return false;
+        header.magic = "PPMT";
+        // Tiles carry no statistics: a pass over the samples makes them
+        if (CollectStats()) img.stats = ComputeImageStats(img);
+        return true;
+    }
+    std::unique_ptr<std::istream> in = OpenPnmBuffer(std::move(data));
+    data = std::string();
+    PnmReader reader(*in);
+    return ReadPnmHeader(reader, header) && ReadPnmRaster(reader, header, img);
+}
+
+// I/O: whole file into memory
+static bool ReadStage(Job& job) {
+    const auto t0 = Clock::now();
+    if (!ReadWhole(job.input, job.data)) return false;
+    job.inBytes = job.data.size();
+    job.readMs = MsSince(t0);
+    return true;
+}
+
+// Helper: --stats lines for a decoded image
+static std::string FormatStats(const ImageStats& stats, const Image& img) {
+    static const char* kNames[] = { "R", "G", "B", "A" };
+    const double pixels = std::max(1.0, static_cast<double>(img.width) * img.height);
+    std::string out;
+    for (int c = 0; c < stats.channels; ++c) {
+        const ImageStats::Channel& ch = stats.channel[c];
+        const char* name = stats.channels >= 3 ? kNames[std::min(c, 3)] : (c == 0 ? "Y" : "A");
+        char line[200];
+        std::snprintf(line, sizeof(line), "    %s  min %g  max %g  mean %.6g  clipped %.2f%% low, %.2f%% high",
+                      name, ch.min, ch.max, ch.mean, 100.0 * ch.clippedLow / pixels, 100.0 * ch.clippedHigh / pixels);
+        out += line;
+        if (ch.nan) out += ", " + std::to_string(ch.nan) + " NaN";
+        out += '\n';
+    }
+    return out;
+}
+
+// Helper: a line per rectangle, each channel's mean and standard deviation
+static std::string FormatRois(const std::vector<Roi>& rois, const Image& img) {
+    static const char* kNames[] = { "R", "G", "B", "A" };
+    // One thread: files are already converted in parallel
+    IntegralImage integral;
+    if (!integral.Build(img, 1)) return {};
+    std::string out;
+    for (const Roi& roi : rois) {
+        char line[96];
+        std::snprintf(line, sizeof(line), "    roi %d,%d %dx%d", roi.x, roi.y, roi.w, roi.h);
+        out += line;
+        RegionStats stats;
+        if (!integral.Query(roi.x, roi.y, roi.w, roi.h, stats)) {
+            out += "  outside the image\n";
+            continue;
+        }
+        for (int c = 0; c < stats.channels; ++c) {
+            const char* name = stats.channels >= 3 ? kNames[std::min(c, 3)] : (c == 0 ? "Y" : "A");
+            std::snprintf(line, sizeof(line), "  %s mean %.6g sd %.4g", name, stats.mean[c], std::sqrt(stats.variance[c]));
+            out += line;
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+// CPU: decode the buffer and replace it with the encoded PPM
+static bool ConvertStage(Job& job, const ConvOptions& opt) {
+    auto t0 = Clock::now();
+    Image img;
+    PnmHeader header;
+    if (!DecodeWhole(job.data, header, img, opt.tiling.threads)) return false;
+    job.format = header.magic + " " + std::to_string(img.width) + "x" + std::to_string(img.height);
+    if (!img.isFloat) job.format += " maxval " + std::to_string(img.maxVal);
+    if (img.stats) job.stats = FormatStats(*img.stats, img);
+    if (!opt.rois.empty()) job.stats += FormatRois(opt.rois, img);
+    job.decodeMs = MsSince(t0);
+
+    t0 = Clock::now();
+    // One thread: the pool already keeps every core busy with other files
+    if (opt.orientation != Orientation::Identity) img = OrientImage(img, opt.orientation, 1);
+    if (opt.tiled) {
+        if (!EncodeTiled(img, opt.tiling, job.data)) return false;
+    } else {
+        std::ostringstream out(std::ios::binary);
+        if (!WritePPM(out, img, opt.save)) return false;
+        job.data = std::move(out).str();
+    }
+    job.outBytes = job.data.size();
+    job.encodeMs = MsSince(t0);
+    return true;
+}
+
+// I/O: write the encoded file, creating its directory as needed
+static bool WriteStage(Job& job) {
+    const auto t0 = Clock::now();
+    std::error_code ec;
+    fs::create_directories(job.output.parent_path(), ec);
+    std::ofstream file(job.output, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error: Could not create file: " << job.output.string() << std::endl;
+        return false;
+    }
+    file.write(job.data.data(), static_cast<std::streamsize>(job.data.size()));
+    file.close();
+    job.data = std::string();
+    job.writeMs = MsSince(t0);
+    if (file.fail()) {
+        std::cerr << "Error: Failed while writing: " << job.output.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 3. DRIVER
+// Helper: --probe; headers only, in input order
+static int ProbeAll(const std::vector<std::shared_ptr<Job>>& jobs, bool quiet) {
+    size_t failed = 0;
+    const auto start = Clock::now();
+    for (const auto& job : jobs) {
+        if (IsTiledFile(PathUtf8(job->input))) {
+            // Header and tile index only; the file is mapped, no tile is read
+            TiledReader tiled;
+            if (!tiled.Open(PathUtf8(job->input))) {
+                ++failed;
+                continue;
+            }
+            if (quiet) continue;
+            const Image& f = tiled.Format();
+            std::error_code ec;
+            const uintmax_t size = fs::file_size(job->input, ec);
+            char line[256];
+            std::snprintf(line, sizeof(line), "PPMT %dx%d depth %d maxval %d%s%s  %d px tiles, %d level(s), %llu bytes",
+                          f.width, f.height, f.channels, f.isFloat ? 0 : f.maxVal, f.tupleType.empty() ? "" : " ",
+                          f.tupleType.c_str(), tiled.TileSize(), tiled.Levels(), static_cast<unsigned long long>(ec ? 0 : size));
+            std::cout << line << "  " << job->input.string() << std::endl;
+            continue;
+        }
+        PnmProbe probe;
+        if (!ProbePPM(PathUtf8(job->input), probe)) {
+            ++failed;
+            continue;
+        }
+        if (quiet) continue;
+        const PnmHeader& h = probe.header;
+        char line[256];
+        std::snprintf(line, sizeof(line), "%s %dx%d depth %d maxval %d%s%s  raster at %llu%s of %llu bytes%s%s",
+                      h.magic.c_str(), h.width, h.height, h.channels, h.isFloat ? 0 : h.maxVal,
+                      h.tupleType.empty() ? "" : " ", h.tupleType.c_str(),
+                      static_cast<unsigned long long>(probe.rasterOffset),
+                      probe.compression == Compression::None ? "" : " (decompressed)",
+                      static_cast<unsigned long long>(probe.fileSize),
+                      probe.compression == Compression::None ? "" : ", ", probe.compression == Compression::None ? "" : CompressionName(probe.compression));
+        std::cout << line << "  " << job->input.string() << std::endl;
+    }
+    const double ms = MsSince(start);
+    char line[256];
+    std::snprintf(line, sizeof(line), "Probed %zu file(s) in %.1f ms (%.2f ms per 1000)", jobs.size(), ms, ms * 1000.0 / jobs.size());
+    std::cout << line << std::endl;
+    if (failed) std::cerr << failed << " file(s) failed." << std::endl;
+    return failed ? 1 : 0;
+}
+
+// Helper: --thumbnails; pages of cells are made visible in turn, as when scrolling
+// through the browser grid, and each page is written out once it is complete
+static int ThumbnailAll(const std::vector<std::shared_ptr<Job>>& jobs, const ConvOptions& opt) {
+    // No margin: only the current page is generated and kept
+    ThumbnailLoader loader(opt.thumbnails, opt.thumbDir, opt.threads, 0);
+    std::vector<std::string> files;
+    for (const auto& job : jobs) {
+        files.push_back(PathUtf8(job->input));
+    }
+    loader.SetFiles(std::move(files));
+
+    size_t failed = 0;
+    const size_t page = 4 * static_cast<size_t>(opt.threads);
+    const auto start = Clock::now();
+    for (size_t first = 0; first < jobs.size(); first += page) {
+        const size_t last = std::min(jobs.size(), first + page) - 1;
+        loader.SetVisible(first, last);
+        loader.WaitIdle();
+        for (size_t i = first; i <= last; ++i) {
+            const Job& job = *jobs[i];
+            std::shared_ptr<const Image> thumb = loader.Get(i);
+            bool ok = (thumb != nullptr);
+            if (ok && !opt.outputDir.empty()) {
+                std::error_code ec;
+                fs::create_directories(job.output.parent_path(), ec);
+                ok = SavePPM(*thumb, PathUtf8(job.output));
+            }
+            if (!ok) ++failed;
+            if (!opt.quiet) {
+                char line[64];
+                if (ok) std::snprintf(line, sizeof(line), "[%zu/%zu] %dx%d", i + 1, jobs.size(), thumb->width, thumb->height);
+                else std::snprintf(line, sizeof(line), "[%zu/%zu] FAILED", i + 1, jobs.size());
+                std::cout << line << "  " << job.input.string() << std::endl;
+            }
+        }
+    }
+    const double ms = MsSince(start);
+    char line[256];
+    std::snprintf(line, sizeof(line), "Made %zu thumbnail(s) in %.2f s (%.1f per s): %llu generated, %llu from the store%s%s",
+                  jobs.size() - failed, ms / 1e3, jobs.size() / (ms / 1e3),
+                  static_cast<unsigned long long>(loader.Generated()), static_cast<unsigned long long>(loader.FromStore()),
+                  opt.thumbDir.empty() ? "" : " in ", opt.thumbDir.c_str());
+    std::cout << line << std::endl;
+    if (failed) std::cerr << failed << " file(s) failed." << std::endl;
+    return failed ? 1 : 0;
+}
+
+// Helper: --stream; the newest waiting frame is written, then the next newest, and
+// so on until the producer closes the stream
+static int StreamFrames(const ConvOptions& opt) {
+    const std::string source = PathUtf8(opt.inputs[0]);
+    const bool toStdout = (opt.outputDir == "-");
+    const std::string outName = opt.outputDir.string();
+    const bool toShm = (outName.rfind("shm:", 0) == 0);
+    // With the frames going to stdout, the progress lines must not
+    std::ostream& log = toStdout ? std::cerr : std::cout;
+    // Sized by the first frame, once it is known
+    ShmFrameWriter ring;
+    if (!toStdout && !toShm) {
+        std::error_code ec;
+        fs::create_directories(opt.outputDir, ec);
+    }
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+    bool signaled = false;
+    LiveStream live;
+    const bool started = live.Start(source, [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            signaled = true;
+        }
+        arrived.notify_one();
+    });
+    if (!started) return 1;
+
+    size_t written = 0, failed = 0;
+    const auto start = Clock::now();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            signaled = false;
+        }
+        // Checked first: every frame is ready before the end is flagged
+        const bool ended = live.Ended();
+        uint64_t frame = 0;
+        std::shared_ptr<const Image> img = live.Take(&frame);
+        if (!img) {
+            if (ended) break;
+            std::unique_lock<std::mutex> lock(mutex);
+            arrived.wait(lock, [&] { return signaled; });
+            continue;
+        }
+        if (opt.orientation != Orientation::Identity) img = std::make_shared<Image>(OrientImage(*img, opt.orientation));
+        std::string output = toShm ? outName : "-";
+        if (!toStdout && !toShm) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame%06llu.ppm", static_cast<unsigned long long>(frame));
+            output = PathUtf8(opt.outputDir / name);
+        }
+        bool ok = true, dropped = false;
+        if (toShm) {
+            // Native layout, as decoded: --ascii/--maxval don't apply
+            if (!ring.IsOpen() && !ring.Create(outName.substr(4), img->SampleCount() * img->BytesPerSample())) return 1;
+            // Every slot still held by the consumer: dropped, like frames of the stream
+            dropped = !ring.Write(*img);
+        } else {
+            ok = SavePPM(*img, output, opt.save);
+        }
+        if (!ok) ++failed;
+        else if (!dropped) ++written;
+        if (!opt.quiet) {
+            char line[96];
+            std::snprintf(line, sizeof(line), "[frame %llu] %dx%d%s", static_cast<unsigned long long>(frame), img->width, img->height,
+                          ok ? (dropped ? " dropped" : "") : " FAILED");
+            log << line << "  " << output << std::endl;
+        }
+    }
+    const double ms = MsSince(start);
+    char line[256];
+    std::snprintf(line, sizeof(line), "Streamed %llu frame(s) in %.2f s: %zu written (%.1f per s), %llu dropped",
+                  static_cast<unsigned long long>(live.Received()), ms / 1e3, written, written / (ms / 1e3),
+                  static_cast<unsigned long long>(live.Dropped() + ring.Dropped()));
+    log << line << std::endl;
+    if (failed) std::cerr << failed << " frame(s) failed." << std::endl;
+    return failed ? 1 : 0;
+}
+
+// Aggregate counters and in-flight accounting shared by all stages
+struct Progress {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t inFlight = 0;
+    size_t finished = 0;
+    size_t failed = 0;
+    uint64_t inBytes = 0, outBytes = 0;
+    double readMs = 0, decodeMs = 0, encodeMs = 0, writeMs = 0;
+};
+
+static void FinishJob(Job& job, size_t total, bool quiet, Progress& progress) {
+    std::lock_guard<std::mutex> lock(progress.mutex);
+    ++progress.finished;
+    if (job.ok) {
+        progress.inBytes += job.inBytes;
+        progress.outBytes += job.outBytes;
+        progress.readMs += job.readMs;
+        progress.decodeMs += job.decodeMs;
+        progress.encodeMs += job.encodeMs;
+        progress.writeMs += job.writeMs;
+    } else {
+        ++progress.failed;
+    }
+    if (!quiet) {
+        char line[256];
+        if (job.ok) {
+            const double ms = job.readMs + job.decodeMs + job.encodeMs + job.writeMs;
+            std::snprintf(line, sizeof(line), "[%zu/%zu] %s  read %.1f  decode %.1f  encode %.1f  write %.1f ms  (%.1f MB/s)",
+                          progress.finished, total, job.format.c_str(), job.readMs, job.decodeMs, job.encodeMs, job.writeMs,
+                          ms > 0 ? job.inBytes / 1e3 / ms : 0.0);
+        } else {
+            std::snprintf(line, sizeof(line), "[%zu/%zu] FAILED", progress.finished, total);
+        }
+        std::cout << line << "  " << job.input.string() << std::endl;
+        if (job.ok) std::cout << job.stats << std::flush;
+    }
+    job.data = std::string();
+    --progress.inFlight;
+    progress.done.notify_all();
+}
+
+// One --compare pair: the test file is job.input, its data job.data
+struct ComparePair {
+    Job job;
+    fs::path reference;
+    fs::path heatmap; // empty: no heatmaps
+    std::string referenceData;
+    CompareStats stats;
+};
+
+// Helper: --compare verdict; without thresholds, any difference fails
+static bool WithinThresholds(const CompareStats& s, const ConvOptions& opt) {
+    if (opt.maxError < 0 && opt.minPsnr <= 0 && opt.minSsim <= 0) return s.maxError == 0;
+    return (opt.maxError < 0 || s.maxError <= opt.maxError) && (opt.minPsnr <= 0 || s.psnr >= opt.minPsnr)
+        && (opt.minSsim <= 0 || s.ssim >= opt.minSsim);
+}
+
+// Helper: --compare; both files of a pair are read on the I/O pool, then decoded and
+// diffed on the CPU pool, a pair per task. A single pair is split into row bands.
+static int CompareAll(const ConvOptions& opt) {
+    const fs::path& referenceInput = opt.inputs[0];
+    std::error_code ec;
+    const bool directories = fs::is_directory(opt.inputs[1], ec);
+    if (directories != fs::is_directory(referenceInput, ec)) {
+        std::cerr << "Error: --compare needs two files or two directories" << std::endl;
+        return 1;
+    }
+    // The test side is scanned as if for converting; heatmaps take the outputs' places
+    ConvOptions scan = opt;
+    scan.inputs = { opt.inputs[1] };
+    const std::vector<std::shared_ptr<Job>> scanned = CollectJobs(scan);
+    if (!opt.outputDir.empty() && !UniqueOutputs(scanned)) return 1;
+    std::vector<std::shared_ptr<ComparePair>> pairs;
+    for (const auto& job : scanned) {
+        auto pair = std::make_shared<ComparePair>();
+        pair->job.input = job->input;
+        pair->reference = directories ? referenceInput / job->input.lexically_relative(opt.inputs[1]) : referenceInput;
+        if (!opt.outputDir.empty()) pair->heatmap = fs::path(job->output).replace_extension(".diff.ppm");
+        pairs.push_back(std::move(pair));
+    }
+    if (pairs.empty()) {
+        std::cerr << "Error: No Netpbm files to compare." << std::endl;
+        return 1;
+    }
+
+    const size_t total = pairs.size();
+    CompareOptions compare;
+    compare.ssim = opt.ssim;
+    compare.threads = total == 1 ? opt.threads : 1;
+    Progress progress;
+    size_t over = 0;
+    auto finish = [&](ComparePair& pair, bool within) {
+        std::lock_guard<std::mutex> lock(progress.mutex);
+        ++progress.finished;
+        if (!pair.job.ok) ++progress.failed;
+        else if (!within) ++over;
+        progress.inBytes += pair.job.inBytes;
+        if (!opt.quiet || !within) {
+            char line[256];
+            const CompareStats& s = pair.stats;
+            if (pair.job.ok) {
+                std::snprintf(line, sizeof(line), "[%zu/%zu] %s  max %g  mean %.4g  PSNR %.2f dB  SSIM %.6f  %llu px differ",
+                              progress.finished, total, within ? "ok  " : "OVER", s.maxError, s.meanError, s.psnr, s.ssim,
+                              static_cast<unsigned long long>(s.differing));
+            } else {
+                std::snprintf(line, sizeof(line), "[%zu/%zu] FAILED", progress.finished, total);
+            }
+            std::cout << line << "  " << pair.job.input.string() << std::endl;
+        }
+        pair.job.data = pair.referenceData = std::string();
+        --progress.inFlight;
+        progress.done.notify_all();
+    };
+
+    const size_t maxInFlight = 2 * static_cast<size_t>(opt.threads) + opt.ioThreads;
+    const auto start = Clock::now();
+    {
+        ThreadPool io(opt.ioThreads);
+        ThreadPool cpu(opt.threads);
+        for (const auto& pair : pairs) {
+            {
+                std::unique_lock<std::mutex> lock(progress.mutex);
+                progress.done.wait(lock, [&] { return progress.inFlight < maxInFlight; });
+                ++progress.inFlight;
+            }
+            io.Submit([&, pair] {
+                if (!ReadWhole(pair->reference, pair->referenceData) || !ReadWhole(pair->job.input, pair->job.data)) {
+                    return finish(*pair, false);
+                }
+                pair->job.inBytes = pair->referenceData.size() + pair->job.data.size();
+                cpu.Submit([&, pair] {
+                    Image reference, test;
+                    PnmHeader header;
+                    pair->job.ok = DecodeWhole(pair->referenceData, header, reference) && DecodeWhole(pair->job.data, header, test)
+                                   && CompareImages(reference, test, pair->stats, compare);
+                    const bool within = pair->job.ok && WithinThresholds(pair->stats, opt);
+                    if (pair->job.ok && !within && !pair->heatmap.empty()) {
+                        // Task-local: tasks run concurrently. A heatmap that can't be
+                        // written fails the pair (SavePPM says why)
+                        std::error_code dirEc;
+                        fs::create_directories(pair->heatmap.parent_path(), dirEc);
+                        pair->job.ok = SavePPM(DiffHeatmap(reference, test, pair->stats.maxError, compare.threads), PathUtf8(pair->heatmap));
+                    }
+                    finish(*pair, within);
+                });
+            });
+        }
+        std::unique_lock<std::mutex> lock(progress.mutex);
+        progress.done.wait(lock, [&] { return progress.inFlight == 0; });
+    }
+    const double ms = MsSince(start);
+    char line[256];
+    std::snprintf(line, sizeof(line), "Compared %zu pair(s) in %.2f s (%.1f per s, %.1f MB/s): %zu within thresholds, %zu over, %zu failed",
+                  total, ms / 1e3, total / (ms / 1e3), progress.inBytes / 1e3 / ms, total - over - progress.failed, over, progress.failed);
+    std::cout << line << std::endl;
+    return (over || progress.failed) ? 1 : 0;
+}
+
+// Helper: --fuzz; every generated input, then every input file, goes through all
+// decoder paths and is compared with the reference decoder
+static int FuzzDecoders(const ConvOptions& opt) {
+    std::error_code ec;
+    const fs::path temp = fs::temp_directory_path(ec);
+    if (ec) {
+        std::cerr << "Error: No temporary directory for --fuzz" << std::endl;
+        return 1;
+    }
+    const std::string workDir = PathUtf8(temp / "ppmconv-fuzz");
+    if (!opt.outputDir.empty() && !fs::create_directories(opt.outputDir, ec) && ec) {
+        std::cerr << "Error: Could not create output directory: " << opt.outputDir.string() << std::endl;
+        return 1;
+    }
+    const uint64_t seed = opt.seed ? opt.seed : static_cast<uint64_t>(Clock::now().time_since_epoch().count());
+    std::mt19937_64 rng(seed);
+
+    size_t checked = 0, mismatches = 0;
+    auto check = [&](const std::string& data, const std::string& name, const std::string& saveAs) {
+        ++checked;
+        const std::string failure = CheckDecoders(data, workDir);
+        if (failure.empty()) return;
+        ++mismatches;
+        std::cout << "MISMATCH " << name << ": " << failure << std::endl;
+        if (!opt.outputDir.empty() && !saveAs.empty()) {
+            std::ofstream out(opt.outputDir / saveAs, std::ios::binary);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        }
+    };
+
+    std::vector<std::pair<fs::path, std::string>> files;
+    std::vector<std::string> seeds;
+    for (const fs::path& input : opt.inputs) {
+        std::string data;
+        if (!ReadWhole(input, data)) {
+            ++mismatches;
+            continue;
+        }
+        // Compressed input files also seed the damaged compressed members
+        if (DetectCompression(reinterpret_cast<const uint8_t*>(data.data()), data.size()) != Compression::None) seeds.push_back(data);
+        files.emplace_back(input, std::move(data));
+    }
+
+    const auto start = Clock::now();
+    for (int i = 0; i < opt.fuzz; ++i) {
+        const std::string data = i % 4 == 3 ? MakeCompressedFuzzInput(rng, seeds) : MakeFuzzInput(rng);
+        check(data, "input " + std::to_string(i), "fuzz-" + std::to_string(seed) + "-" + std::to_string(i) + ".pnm");
+        if (!opt.quiet && (i + 1) % 1000 == 0) std::cout << "  " << i + 1 << " of " << opt.fuzz << std::endl;
+    }
+    for (const auto& [input, data] : files) check(data, input.string(), {});
+    fs::remove_all(temp / "ppmconv-fuzz", ec);
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "Fuzzed %zu input(s) (seed %llu) in %.2f s: %zu mismatch(es)",
+                  checked, static_cast<unsigned long long>(seed), MsSince(start) / 1e3, mismatches);
+    std::cout << line << std::endl;
+    return mismatches ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    ConvOptions opt;
+    if (!ParseArgs(argc, argv, opt)) return 2;
+    if (opt.fuzz) return FuzzDecoders(opt);
+    if (opt.stream) return StreamFrames(opt);
+    if (opt.compare) return CompareAll(opt);
+
+    std::vector<std::shared_ptr<Job>> jobs = CollectJobs(opt);
+    if (jobs.empty()) {
+        std::cerr << "Error: No Netpbm files to convert." << std::endl;
+        return 1;
+    }
+    if (opt.probe) return ProbeAll(jobs, opt.quiet);
+    // Two inputs that map to one output would race to write it, and one would be lost
+    if (!opt.outputDir.empty() && !UniqueOutputs(jobs)) return 1;
+    if (opt.thumbnails) return ThumbnailAll(jobs, opt);
+    const size_t total = jobs.size();
+    // Gathered by the decoder itself, so the statistics cost no extra pass
+    if (opt.stats) SetCollectStats(true);
+    // Independent frames of a compressed file only go to their own threads when
+    // there is a single file: otherwise the files already keep every core busy
+    SetDecompressThreads(total == 1 ? opt.threads : 1);
+    opt.tiling.threads = total == 1 ? opt.threads : 1;
+    std::cout << "Converting " << total << " file(s) with " << opt.threads << " CPU + " << opt.ioThreads << " I/O threads" << std::endl;
+
+    Progress progress;
+    // Bounds memory: enough files in flight to keep every stage busy, no more
+    const size_t maxInFlight = 2 * static_cast<size_t>(opt.threads) + opt.ioThreads;
+    const auto start = Clock::now();
+    {
+        ThreadPool io(opt.ioThreads);
+        ThreadPool cpu(opt.threads);
+        for (const auto& job : jobs) {
+            {
+                std::unique_lock<std::mutex> lock(progress.mutex);
+                progress.done.wait(lock, [&] { return progress.inFlight < maxInFlight; });
+                ++progress.inFlight;
+            }
+            io.Submit([&, job] {
+                if (!ReadStage(*job)) return FinishJob(*job, total, opt.quiet, progress);
+                cpu.Submit([&, job] {
+                    if (!ConvertStage(*job, opt)) return FinishJob(*job, total, opt.quiet, progress);
+                    io.Submit([&, job] {
+                        job->ok = WriteStage(*job);
+                        FinishJob(*job, total, opt.quiet, progress);
+                    });
+                });
+            });
+        }
+        std::unique_lock<std::mutex> lock(progress.mutex);
+        progress.done.wait(lock, [&] { return progress.inFlight == 0; });
+    }
+    const double wallMs = MsSince(start);
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "Converted %zu of %zu file(s) in %.2f s: %.1f files/s, %.1f MB in (%.1f MB/s), %.1f MB out (%.1f MB/s)\n"
+                  "Stage time summed over threads: read %.2f s, decode %.2f s, encode %.2f s, write %.2f s",
+                  total - progress.failed, total, wallMs / 1e3, total / (wallMs / 1e3),
+                  progress.inBytes / 1e6, progress.inBytes / 1e3 / wallMs,
+                  progress.outBytes / 1e6, progress.outBytes / 1e3 / wallMs,
+                  progress.readMs / 1e3, progress.decodeMs / 1e3, progress.encodeMs / 1e3, progress.writeMs / 1e3);
+    std::cout << line << std::endl;
+    if (progress.failed) std::cerr << progress.failed << " file(s) failed." << std::endl;
+    return progress.failed ? 1 : 0;
+}